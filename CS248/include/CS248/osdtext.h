@@ -1,6 +1,8 @@
 #ifndef CS248_TEXTOSD_H
 #define CS248_TEXTOSD_H
 
+#include <map>
+#include <stdint.h>
 #include <string>
 #include <vector>
 
@@ -41,11 +43,25 @@ struct OSDLine {
 
 };
 
+struct OSDGlyph {
+
+  // position and size of the bitmap in the glyph atlas, in pixels
+  size_t x, y, w, h;
+
+  // bitmap offset from the pen position, in pixels
+  int left, top;
+
+  // pen advance, in pixels
+  float advance_x, advance_y;
+
+};
+
 /**
  * Provides an interface for text on-screen display.
- * Note that this requires GL_BLEND enabled to work. Do note this is a very
- * basic implementation and the cost of all operations increases linearly with
- * respect to the number of lines and the length of the lines.
+ * Note that this requires GL_BLEND enabled to work. Glyphs are rasterized
+ * once per font size, the first time they are drawn, and packed into a single
+ * atlas texture; all lines are then drawn with one vertex buffer upload and
+ * one draw call per render().
  */
 class OSDText {
  public:
@@ -147,8 +163,15 @@ class OSDText {
 
  private:
 
-  // draw a single line
-  void draw_line(OSDLine line);
+  // append the quads of a single line to vertices
+  void append_line(const OSDLine& line);
+
+  // the atlas entry of a glyph, rasterized on first use; NULL if the font
+  // has no such glyph
+  const OSDGlyph* find_glyph(size_t size, uint32_t codepoint);
+
+  // reserve a w x h rectangle in the atlas, growing it if needed
+  bool pack_glyph(size_t w, size_t h, size_t& x, size_t& y);
 
   // HDPI displays
   bool use_hdpi;
@@ -162,6 +185,17 @@ class OSDText {
   // freetype
   char* font; size_t font_size;
   FT_Library* ft; FT_Face* face;
+  size_t face_pixel_size;  // size the face is currently set to
+
+  // glyph atlas, packed in rows of glyphs ("shelves")
+  GLuint atlas;
+  size_t atlas_w, atlas_h;
+  std::vector<unsigned char> atlas_pixels;
+  size_t shelf_x, shelf_y, shelf_h;
+  std::map<uint64_t, OSDGlyph> glyphs;  // by (size << 32 | codepoint)
+
+  // quads of all lines, rebuilt every render()
+  std::vector<GLfloat> vertices;
 
   // lines to draw
   std::vector<OSDLine> lines;
@@ -170,8 +204,8 @@ class OSDText {
   GLuint vbo;
   GLuint program;
   GLint attribute_coord;
+  GLint attribute_color;
   GLint uniform_tex;
-  GLint uniform_color;
 
   // GL helpers
   GLuint compile_shaders();
@@ -16,14 +16,14 @@ class Timer {
    * Starts the timer
    */
   inline void start() {
-    //t0 = std::chrono::steady_clock::now();
+    t0 = std::chrono::steady_clock::now();
   }
 
   /**
    * Stops the timer
    */
   inline void stop() {
-    //t1 = std::chrono::steady_clock::now();
+    t1 = std::chrono::steady_clock::now();
   }
 
   /**
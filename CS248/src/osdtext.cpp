@@ -1,5 +1,7 @@
 #include "osdtext.h"
 
+#include <algorithm>
+#include <cstring>
 #include <iostream>
 
 #include "ft2build.h"
@@ -19,12 +21,24 @@ struct point {
     GLfloat t;
 };
 
+// floats per vertex: a point followed by an RGBA color
+static const size_t vertex_size = 8;
+
+// initial and largest size of the glyph atlas
+static const size_t atlas_initial_size = 256;
+static const size_t atlas_max_size = 4096;
+
 OSDText::OSDText() {
 
   use_hdpi = false;
 
   ft   = new FT_Library;
   face = new FT_Face;
+  face_pixel_size = 0;
+
+  atlas = 0; atlas_w = atlas_h = 0;
+  shelf_x = shelf_y = shelf_h = 0;
+  vbo = 0; program = 0;
 
   lines = vector<OSDLine>(); next_id = 0;
 }
@@ -37,6 +51,8 @@ OSDText::~OSDText() {
 
   lines.clear();
 
+  glDeleteTextures(1, &atlas);
+  glDeleteBuffers(1, &vbo);
   glDeleteProgram(program);
 }
 
@@ -69,9 +85,9 @@ int OSDText::init(bool use_hdpi) {
   program = compile_shaders();
   if(program) {
       attribute_coord = get_attribu ( program, "coord" );
+      attribute_color = get_attribu ( program, "color" );
       uniform_tex     = get_uniform ( program, "tex"   );
-      uniform_color   = get_uniform ( program, "color" );
-      if (attribute_coord == -1 || uniform_tex == -1 || uniform_color == -1) {
+      if (attribute_coord == -1 || attribute_color == -1 || uniform_tex == -1) {
           return -1;
       }
   } else return -1;
@@ -79,22 +95,71 @@ int OSDText::init(bool use_hdpi) {
   // create the vbo
   glGenBuffers(1, &vbo);
 
+  // create the (empty) glyph atlas
+  atlas_w = atlas_h = atlas_initial_size;
+  atlas_pixels.assign(atlas_w * atlas_h, 0);
+  glGenTextures(1, &atlas);
+  glBindTexture(GL_TEXTURE_2D, atlas);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_ALPHA, atlas_w, atlas_h, 0,
+               GL_ALPHA, GL_UNSIGNED_BYTE, &atlas_pixels[0]);
+
+  // clamping to edges is important to prevent artifacts when scaling
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+  // linear filtering usually looks best for text
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glBindTexture(GL_TEXTURE_2D, 0);
+
   return 0;
 }
 
 void OSDText::render() {
 
+  // build the quads of all lines; this rasterizes glyphs not seen before
+  vertices.clear();
+  vector<OSDLine>::iterator it = lines.begin();
+  while(it != lines.end()) {
+    append_line(*it);
+    ++it;
+  }
+  if (vertices.empty()) return;
+
+  // atlas pixel coordinates to texture coordinates, now that the atlas
+  // has its final size for this frame
+  for (size_t i = 0; i < vertices.size(); i += vertex_size) {
+    vertices[i + 2] /= atlas_w;
+    vertices[i + 3] /= atlas_h;
+  }
+
   glUseProgram(program);
 
   glEnable( GL_BLEND );
   glBlendFunc( GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA );
 
-  vector<OSDLine>::iterator it = lines.begin();
-  while(it != lines.end()) {
-    draw_line(*it);
-    ++it;
-  }
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, atlas);
+  glUniform1i(uniform_tex, 0);
+
+  // all lines in one upload and one draw call
+  glBindBuffer(GL_ARRAY_BUFFER, vbo);
+  glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(GLfloat),
+               &vertices[0], GL_STREAM_DRAW);
+  glEnableVertexAttribArray(attribute_coord);
+  glEnableVertexAttribArray(attribute_color);
+  glVertexAttribPointer(attribute_coord, 4, GL_FLOAT, GL_FALSE,
+                        vertex_size * sizeof(GLfloat), 0);
+  glVertexAttribPointer(attribute_color, 4, GL_FLOAT, GL_FALSE,
+                        vertex_size * sizeof(GLfloat),
+                        (const GLvoid*) (4 * sizeof(GLfloat)));
+  glDrawArrays(GL_TRIANGLES, 0, vertices.size() / vertex_size);
+  glDisableVertexAttribArray(attribute_coord);
+  glDisableVertexAttribArray(attribute_color);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
 
+  glBindTexture(GL_TEXTURE_2D, 0);
   glUseProgram(0);
 }
 
@@ -187,78 +252,118 @@ void OSDText::set_color(int line_id, Color color) {
   }
 }
 
-void OSDText::draw_line(OSDLine line) {
+void OSDText::append_line(const OSDLine& line) {
 
-  // set font size
-  FT_Set_Pixel_Sizes(*face, 0, line.size);
+  const GLfloat* color = (const GLfloat*) &line.color;
 
-  // set font color
-  glUniform4fv(uniform_color, 1, (GLfloat*) &line.color);
+  float x = line.x, y = line.y;
+  for (const char* p = line.text.c_str(); *p; p++) {
 
-  // get glyph
-  const char *p;
-  FT_GlyphSlot g = (*face)->glyph;
+    const OSDGlyph* g = find_glyph(line.size, (unsigned char) *p);
 
-  // gen texture
-  GLuint tex;
-  glActiveTexture(GL_TEXTURE0);
-  glGenTextures(1, &tex);
-  glBindTexture(GL_TEXTURE_2D, tex);
-  glUniform1i(uniform_tex, 0);
+    if (g->w && g->h) {
 
-  // require 1 byte alignment when uploading texture data
-  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+      // calculate the vertex and (atlas pixel) texture coordinates
+      float x0 = x + g->left * sx, x1 = x0 + g->w * sx;
+      float y0 = y + g->top  * sy, y1 = y0 - g->h * sy;
+      float s0 = g->x, s1 = (float) (g->x + g->w);
+      float t0 = g->y, t1 = (float) (g->y + g->h);
 
-  // clamping to edges is important to prevent artifacts when scaling
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+      point box[6] = {
+        {x0, y0, s0, t0}, {x1, y0, s1, t0}, {x0, y1, s0, t1},
+        {x1, y0, s1, t0}, {x1, y1, s1, t1}, {x0, y1, s0, t1},
+      };
+      for (int i = 0; i < 6; i++) {
+        vertices.insert(vertices.end(), (GLfloat*) &box[i],
+                        (GLfloat*) &box[i] + 4);
+        vertices.insert(vertices.end(), color, color + 4);
+      }
+    }
 
-  // linear filtering usually looks best for text
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    // Advance the cursor to the start of the next character
+    x += g->advance_x * sx;
+    y += g->advance_y * sy;
+  }
+}
 
-  // set up the VBO for our vertex data
-  glEnableVertexAttribArray(attribute_coord);
-  glBindBuffer(GL_ARRAY_BUFFER, vbo);
-  glVertexAttribPointer(attribute_coord, 4, GL_FLOAT, GL_FALSE, 0, 0);
+const OSDGlyph* OSDText::find_glyph(size_t size, uint32_t codepoint) {
 
-  // loop through all characters
-  const char* text = line.text.c_str();
-  for (p = text; *p; p++) {
+  uint64_t key = (uint64_t) size << 32 | codepoint;
+  map<uint64_t, OSDGlyph>::iterator it = glyphs.find(key);
+  if (it != glyphs.end()) return &it->second;
 
-    // Try to load and render the character
-    if (FT_Load_Char(*face, *p, FT_LOAD_RENDER)) continue;
+  // glyphs the font doesn't have are cached as empty glyphs
+  OSDGlyph glyph = OSDGlyph();
 
-    // Upload the glyph bitmap as an alpha texture
-    glTexImage2D(GL_TEXTURE_2D,
-                 0, GL_ALPHA, g->bitmap.width, g->bitmap.rows,
-                 0, GL_ALPHA, GL_UNSIGNED_BYTE, g->bitmap.buffer);
+  if (face_pixel_size != size) {
+    FT_Set_Pixel_Sizes(*face, 0, size);
+    face_pixel_size = size;
+  }
+
+  FT_GlyphSlot g = (*face)->glyph;
+  if (!FT_Load_Char(*face, codepoint, FT_LOAD_RENDER)) {
+    glyph.left = g->bitmap_left;
+    glyph.top  = g->bitmap_top;
+    glyph.advance_x = g->advance.x >> 6;
+    glyph.advance_y = g->advance.y >> 6;
+
+    size_t w = g->bitmap.width, h = g->bitmap.rows;
+    if (w && h && pack_glyph(w, h, glyph.x, glyph.y)) {
+      glyph.w = w;
+      glyph.h = h;
+
+      // copy the bitmap into the atlas, then upload just that rectangle
+      for (size_t row = 0; row < h; row++) {
+        memcpy(&atlas_pixels[(glyph.y + row) * atlas_w + glyph.x],
+               g->bitmap.buffer + row * g->bitmap.pitch, w);
+      }
+      glBindTexture(GL_TEXTURE_2D, atlas);
+      glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+      glPixelStorei(GL_UNPACK_ROW_LENGTH, atlas_w);
+      glTexSubImage2D(GL_TEXTURE_2D, 0, glyph.x, glyph.y, w, h,
+                      GL_ALPHA, GL_UNSIGNED_BYTE,
+                      &atlas_pixels[glyph.y * atlas_w + glyph.x]);
+      glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    }
+  }
 
-    // calculate the vertex and texture coordinates
-    float x2 =  line.x + g->bitmap_left * sx;
-    float y2 = -line.y - g->bitmap_top  * sy;
-    float w = g->bitmap.width * sx;
-    float h = g->bitmap.rows  * sy;
+  return &(glyphs[key] = glyph);
+}
 
-    point box[4] = {
-      {x2, -y2, 0, 0},
-      {x2 + w, -y2, 1, 0},
-      {x2, -y2 - h, 0, 1},
-      {x2 + w, -y2 - h, 1, 1},
-    };
+bool OSDText::pack_glyph(size_t w, size_t h, size_t& x, size_t& y) {
 
-    // draw the character to screen
-    glBufferData(GL_ARRAY_BUFFER, sizeof box, box, GL_DYNAMIC_DRAW);
-    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+  // leave a pixel between glyphs so that linear filtering doesn't bleed
+  w += 1; h += 1;
+  if (w > atlas_w) return false;
 
-    // Advance the cursor to the start of the next character
-    line.x += (g->advance.x >> 6) * sx;
-    line.y += (g->advance.y >> 6) * sy;
+  // start a new shelf when the current one is full
+  if (shelf_x + w > atlas_w) {
+    shelf_y += shelf_h;
+    shelf_x = 0;
+    shelf_h = 0;
   }
 
-  glDisableVertexAttribArray(attribute_coord);
-  glDeleteTextures(1, &tex);
+  // grow the atlas downwards; existing glyphs keep their pixel positions
+  if (shelf_y + h > atlas_h) {
+    size_t new_h = atlas_h;
+    while (shelf_y + h > new_h) new_h *= 2;
+    if (new_h > atlas_max_size) {
+      out_err("OSD glyph atlas is full");
+      return false;
+    }
+    atlas_h = new_h;
+    atlas_pixels.resize(atlas_w * atlas_h, 0);
+    glBindTexture(GL_TEXTURE_2D, atlas);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_ALPHA, atlas_w, atlas_h, 0,
+                 GL_ALPHA, GL_UNSIGNED_BYTE, &atlas_pixels[0]);
+  }
 
+  x = shelf_x;
+  y = shelf_y;
+  shelf_x += w;
+  shelf_h = max(shelf_h, h);
+  return true;
 }
 
 GLuint OSDText::compile_shaders() {
@@ -269,18 +374,21 @@ GLuint OSDText::compile_shaders() {
 
   const char *vert_shader_src = "#version 120"
   "\nattribute vec4 coord;"
+  "\nattribute vec4 color;"
   "\nvarying vec2 texpos;"
+  "\nvarying vec4 texcolor;"
   "\nvoid main(void) {"
   "\n  gl_Position = vec4(coord.xy, 0, 1);"
   "\n  texpos = coord.zw;"
+  "\n  texcolor = color;"
   "\n}";
 
   const char *frag_shader_src = "#version 120"
   "\nvarying vec2 texpos;"
+  "\nvarying vec4 texcolor;"
   "\nuniform sampler2D tex;"
-  "\nuniform vec4 color;"
   "\nvoid main(void) {"
-  "\n  gl_FragColor = vec4(1, 1, 1, texture2D(tex, texpos).a) * color;"
+  "\n  gl_FragColor = vec4(1, 1, 1, texture2D(tex, texpos).a) * texcolor;"
   "\n}";
 
 // with drop shadow
@@ -1,3 +1,64 @@
+#define MAX_NUM_LIGHTS 64              // kMaxLights in src/uniform_blocks.h
+
+#ifdef USE_UNIFORM_BLOCKS
+
+// Data shared by every mesh drawn in a frame, uploaded once per frame. The
+// blocks must be declared the same way in the vertex and fragment shader.
+layout(std140) uniform FrameData {
+    vec3 camera_position;               // world space camera position
+    int num_directional_lights;
+    int num_point_lights;
+    vec3 directional_light_vectors[MAX_NUM_LIGHTS];
+    vec3 point_light_positions[MAX_NUM_LIGHTS];
+    mat4 view_projection;               // world to clip space
+};
+
+#ifdef USE_MULTI_DRAW
+
+#define MAX_DRAWS 64                    // kMaxDrawsPerCall in src/uniform_blocks.h
+
+struct ObjectData {
+    mat4 obj2world;
+    mat3 obj2worldNorm;
+    bool useTextureMapping;
+    bool useNormalMapping;
+    bool useEnvironmentMapping;
+    bool useBlending;
+    bool useDisneyBRDF;
+};
+
+// Data of every mesh drawn by one multi-draw call
+layout(std140) uniform ObjectDataArray {
+    ObjectData objects[MAX_DRAWS];
+};
+
+varying float draw_id;                  // which draw of the call this is
+
+#define obj2world objects[int(draw_id + 0.5)].obj2world
+#define obj2worldNorm objects[int(draw_id + 0.5)].obj2worldNorm
+#define useTextureMapping objects[int(draw_id + 0.5)].useTextureMapping
+#define useNormalMapping objects[int(draw_id + 0.5)].useNormalMapping
+#define useEnvironmentMapping objects[int(draw_id + 0.5)].useEnvironmentMapping
+#define useBlending objects[int(draw_id + 0.5)].useBlending
+#define useDisneyBRDF objects[int(draw_id + 0.5)].useDisneyBRDF
+
+#else
+
+// Data of the mesh being drawn
+layout(std140) uniform ObjectData {
+    mat4 obj2world;                     // stored position to world transform
+    mat3 obj2worldNorm;                 // object to world transform for normals
+    bool useTextureMapping;
+    bool useNormalMapping;
+    bool useEnvironmentMapping;
+    bool useBlending;
+    bool useDisneyBRDF;
+};
+
+#endif
+
+#else
+
 //
 // Parameters that control fragment shader behavior. Different scene materials
 // will set these flags to true/false for different looks
@@ -9,6 +70,8 @@ uniform bool useEnvironmentMapping; // true if environment mapping should be use
 uniform bool useBlending;           // true if blending via texture mapping should be used
 uniform bool useDisneyBRDF;         // true if disney brdf should be used (default: phong)
 
+#endif
+
 //
 // texture maps
 //
@@ -23,11 +86,12 @@ uniform sampler2D blendTextureSampler;
 // and point light sources, as well as an environment map
 //
 
-#define MAX_NUM_LIGHTS 10
+#ifndef USE_UNIFORM_BLOCKS
 uniform int num_directional_lights;
 uniform vec3 directional_light_vectors[MAX_NUM_LIGHTS];
 uniform int num_point_lights;
 uniform vec3 point_light_positions[MAX_NUM_LIGHTS];
+#endif
 
 //
 // material-specific uniforms
@@ -228,6 +292,16 @@ vec3 SampleEnvironmentMap(vec3 D)
      
 }
 
+//
+// Tangent space normal from the normal map. The map may be stored with only
+// its x and y channels (BC5), so z is rebuilt from them.
+//
+vec3 sampleNormalMap(vec2 uv)
+{
+    vec2 xy = texture2D(normalTextureSampler, uv).rg * 2.0 - 1.0;
+    return vec3(xy, sqrt(max(0.0, 1.0 - dot(xy, xy))));
+}
+
 //
 // Fragment shader main entry point
 //
@@ -274,6 +348,9 @@ void main(void)
        // lie in the range (0-1), to the range (-1,1).
        //
        // In other words:   tangent_space_normal = texture_value * 2.0 - 1.0;
+       //
+       // Normal maps are block-compressed with only their x and y channels,
+       // so use sampleNormalMap(), which does the above and rebuilds z.
 
        // replace this line with your implementation
        N = normalize(normal);
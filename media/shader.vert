@@ -1,13 +1,80 @@
-uniform mat4 obj2world;                 // object to world transform
+#define MAX_NUM_LIGHTS 64              // kMaxLights in src/uniform_blocks.h
+
+#ifdef USE_UNIFORM_BLOCKS
+
+// Data shared by every mesh drawn in a frame, uploaded once per frame. The
+// blocks must be declared the same way in the vertex and fragment shader.
+layout(std140) uniform FrameData {
+    vec3 camera_position;               // world space camera position
+    int num_directional_lights;
+    int num_point_lights;
+    vec3 directional_light_vectors[MAX_NUM_LIGHTS];
+    vec3 point_light_positions[MAX_NUM_LIGHTS];
+    mat4 view_projection;               // world to clip space
+};
+
+#ifdef USE_MULTI_DRAW
+
+#define MAX_DRAWS 64                    // kMaxDrawsPerCall in src/uniform_blocks.h
+
+struct ObjectData {
+    mat4 obj2world;
+    mat3 obj2worldNorm;
+    bool useTextureMapping;
+    bool useNormalMapping;
+    bool useEnvironmentMapping;
+    bool useBlending;
+    bool useDisneyBRDF;
+};
+
+// Data of every mesh drawn by one multi-draw call
+layout(std140) uniform ObjectDataArray {
+    ObjectData objects[MAX_DRAWS];
+};
+
+attribute float vtx_draw_id;            // which draw of the call this is
+varying float draw_id;
+
+#define obj2world objects[int(vtx_draw_id)].obj2world
+#define obj2worldNorm objects[int(vtx_draw_id)].obj2worldNorm
+#define useTextureMapping objects[int(vtx_draw_id)].useTextureMapping
+#define useNormalMapping objects[int(vtx_draw_id)].useNormalMapping
+#define useEnvironmentMapping objects[int(vtx_draw_id)].useEnvironmentMapping
+#define useBlending objects[int(vtx_draw_id)].useBlending
+#define useDisneyBRDF objects[int(vtx_draw_id)].useDisneyBRDF
+
+#else
+
+// Data of the mesh being drawn
+layout(std140) uniform ObjectData {
+    mat4 obj2world;                     // stored position to world transform
+    mat3 obj2worldNorm;                 // object to world transform for normals
+    bool useTextureMapping;
+    bool useNormalMapping;
+    bool useEnvironmentMapping;
+    bool useBlending;
+    bool useDisneyBRDF;
+};
+
+#endif
+
+#else
+
+uniform mat4 obj2world;                 // stored position to world transform
 uniform mat3 obj2worldNorm;             // object to world transform for normals
 uniform vec3 camera_position;           // world space camera position           
+uniform mat4 view_projection;           // world to clip space
 
 uniform bool useNormalMapping;         // true if normal mapping should be used
 
-// per vertex input attributes 
-attribute vec3 vtx_position;            // object space position
-attribute vec3 vtx_tangent;
-attribute vec3 vtx_normal;              // object space normal
+#endif
+
+// per vertex input attributes, packed as in src/dynamic_scene/vertex_format.h
+attribute vec4 vtx_position;            // xyz: position, which obj2world moves to
+                                        // world space; w: 1 if the bitangent is
+                                        // cross(normal, tangent), 0 if it is the opposite
+attribute vec2 vtx_tangent;             // octahedral object space tangent
+attribute vec2 vtx_normal;              // octahedral object space normal
 attribute vec2 vtx_texcoord;
 attribute vec3 vtx_diffuse_color; 
 
@@ -20,9 +87,24 @@ varying vec2 texcoord;
 varying vec3 dir2camera;                // world space vector from surface point to camera
 varying mat3 tan2world;                 // tangent space rotation matrix multiplied by obj2WorldNorm
 
+// Unit vector from its octahedral encoding: the upper half of the sphere
+// maps to the inner square, the lower half is folded over the corners.
+vec3 decode_octahedral(vec2 e)
+{
+    vec3 v = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (v.z < 0.0) {
+        v.xy = (1.0 - abs(v.yx)) * vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+    }
+    return normalize(v);
+}
+
 void main(void)
 {
-    position = vec3(obj2world * vec4(vtx_position, 1));
+    position = vec3(obj2world * vec4(vtx_position.xyz, 1));
+
+    vec3 vertex_normal = decode_octahedral(vtx_normal);
+    vec3 vertex_tangent = decode_octahedral(vtx_tangent);
+    float bitangent_sign = vtx_position.w * 2.0 - 1.0;
 
     if (useNormalMapping) {
 
@@ -40,18 +122,25 @@ void main(void)
 
        // (3) obj2worldNorm is a 3x3 matrix transforming object space normals to world space normals
 
+       // (4) vertex_tangent and vertex_normal are the object space tangent and normal; the
+       // bitangent is bitangent_sign * cross(vertex_normal, vertex_tangent)
+
        
        // pass through object-space normal unmodified to fragment shader
-       normal = vtx_normal;
+       normal = vertex_normal;
        
     } else {
 
        // just transform normal into world space 
-       normal = obj2worldNorm * vtx_normal; 
+       normal = obj2worldNorm * vertex_normal; 
     }
 
     vertex_diffuse_color = vtx_diffuse_color;
     texcoord = vtx_texcoord;
     dir2camera = camera_position - position;
-    gl_Position = gl_ModelViewProjectionMatrix * vec4(vtx_position, 1);
+#ifdef USE_MULTI_DRAW
+    draw_id = vtx_draw_id;
+#endif
+
+    gl_Position = view_projection * vec4(position, 1);
 }
@@ -6,12 +6,17 @@
 #include "dynamic_scene/spot_light.h"
 #include "dynamic_scene/sphere.h"
 #include "dynamic_scene/mesh.h"
+#include "dynamic_scene/mesh_batch.h"
+#include "dynamic_scene/mesh_store.h"
+#include "texture_registry.h"
+#include "uniform_blocks.h"
 
 #include "CS248/lodepng.h"
 
 #include "GLFW/glfw3.h"
 
 #include <sstream>
+#include <iomanip>
 #include <chrono>
 #include <thread>
 
@@ -26,6 +31,11 @@ using Collada::PolymeshInfo;
 using Collada::SceneInfo;
 using Collada::SphereInfo;
 
+// Decoded texture bytes uploaded per frame. Textures are decoded in the
+// background; a frame uploads at most this much (but at least one texture) so
+// that loading never stalls drawing for long.
+static const size_t texture_upload_budget = 16 * 1024 * 1024;
+
 Application::Application() {
   scene = nullptr;
 }
@@ -54,6 +64,8 @@ void Application::init() {
 
   show_coordinates = false;
   show_hud = true;
+  frame_time = 0;
+  frame_timer.start();
 
   // Lighting needs to be explicitly enabled.
   glEnable(GL_LIGHTING);
@@ -113,6 +125,10 @@ void Application::exit_2D_GL_draw_mode() {
 }
 
 void Application::render() {
+  frame_timer.stop();
+  double elapsed = frame_timer.duration();
+  frame_timer.start();
+  frame_time = frame_time > 0 ? 0.95 * frame_time + 0.05 * elapsed : elapsed;
 
   // Update the hovered element using the pick buffer once very n iterations.
   // We do this here rather than on mouse move, because some platforms generate
@@ -123,6 +139,29 @@ void Application::render() {
     pickDrawCountdown--;
   }
 
+  TextureRegistry &textures = TextureRegistry::shared();
+  if (textures.upload_pending(texture_upload_budget) &&
+      textures.stats().pending == 0) {
+    TextureRegistry::Stats stats = textures.stats();
+    cerr << "Textures: " << stats.decodes << " decoded, " << stats.misses
+         << " uploaded, " << stats.hits << " shared ("
+         << stats.bytes_saved / 1024 << " KB not decoded or uploaded again), "
+         << stats.cache_loads << " read from the texture cache" << endl;
+    cerr << "Texture memory: " << stats.vram_bytes / 1024 << " KB ("
+         << stats.rgba8_bytes / 1024 << " KB as RGBA8)" << endl;
+    if (stats.mip_seconds > 0) {
+      cerr << "Texture mipmaps: " << stats.mip_pixels / 1e6
+           << " Mpixels at " << stats.mip_pixels / stats.mip_seconds / 1e6
+           << " Mpixels/s" << endl;
+    }
+    if (stats.encode_seconds > 0) {
+      cerr << "Texture encoding: " << stats.encoded_pixels / 1e6
+           << " Mpixels at "
+           << stats.encoded_pixels / stats.encode_seconds / 1e6
+           << " Mpixels/s" << endl;
+    }
+  }
+
   glClearColor(0., 0., 0., 0.);
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
   update_gl_camera();
@@ -146,15 +185,13 @@ void Application::update_gl_camera() {
     resize(view[2], view[3]);
   }
 
-  // Control the camera to look at the mesh.
+  // Meshes take the camera from the FrameData block; the fixed-function
+  // matrices are only left for immediate-mode helpers like
+  // draw_coordinates().
+  float world_to_camera[16];
+  camera.view_matrix(world_to_camera);
   glMatrixMode(GL_MODELVIEW);
-  glLoadIdentity();
-
-  const Vector3D &c = camera.position();
-  const Vector3D &r = camera.view_point();
-  const Vector3D &u = camera.up_dir();
-
-  gluLookAt(c.x, c.y, c.z, r.x, r.y, r.z, u.x, u.y, u.z);
+  glLoadMatrixf(world_to_camera);
 
   scene->camera = &camera;
 }
@@ -168,10 +205,10 @@ void Application::resize(size_t w, size_t h) {
 }
 
 void Application::set_projection_matrix() {
+  float projection[16];
+  camera.projection_matrix(projection);
   glMatrixMode(GL_PROJECTION);
-  glLoadIdentity();
-  gluPerspective(camera.v_fov(), camera.aspect_ratio(), camera.near_clip(),
-                 camera.far_clip());
+  glLoadMatrixf(projection);
 }
 
 string Application::name() { return "Render"; }
@@ -211,7 +248,11 @@ void Application::load(SceneInfo *sceneInfo) {
   Vector3D c_dir = Vector3D();
 
   vector<DynamicScene::PatternObject> patterns;
+  vector<PolymeshInfo *> polymeshes;
+  vector<const Matrix4x4 *> polymesh_transforms;
   std::string shader_prefix = "";
+  if (uniform_blocks_supported()) shader_prefix = kUniformBlocksShaderPrefix;
+  if (multi_draw_supported()) shader_prefix += kMultiDrawShaderPrefix;
 
   int len = nodes.size();
   for (int i = 0; i < len; i++) {
@@ -245,12 +286,63 @@ void Application::load(SceneInfo *sceneInfo) {
             init_sphere(static_cast<SphereInfo &>(*instance), transform));
         break;
       case Collada::Instance::POLYMESH:
-        objects.push_back(
-            init_polymesh(static_cast<PolymeshInfo &>(*instance), transform, shader_prefix));
+        polymeshes.push_back(static_cast<PolymeshInfo *>(instance));
+        polymesh_transforms.push_back(&transform);
         break;
     }
   }
 
+  // Copies of the same mesh are loaded once and drawn as instances.
+  DynamicScene::MeshStore &store = DynamicScene::MeshStore::shared();
+  size_t num_instanced = 0, num_geometries = 0, instanced_bytes_saved = 0;
+  vector<PolymeshInfo *> unique_polymeshes;
+  vector<const Matrix4x4 *> unique_transforms;
+  for (const vector<size_t> &group :
+       DynamicScene::MeshInstances::group(polymeshes, store)) {
+    if (group.size() == 1) {
+      unique_polymeshes.push_back(polymeshes[group[0]]);
+      unique_transforms.push_back(polymesh_transforms[group[0]]);
+      continue;
+    }
+    vector<PolymeshInfo *> members;
+    for (size_t i : group) members.push_back(polymeshes[i]);
+    instanced_bytes_saved +=
+        (group.size() - 1) * store.get(*members[0]).size_bytes();
+    DynamicScene::MeshInstances::create(members, store, shader_prefix,
+                                        objects);
+    num_geometries++;
+    num_instanced += group.size();
+  }
+  if (num_geometries > 0) {
+    cerr << "Instancing: " << num_instanced << " meshes drawn as "
+         << num_geometries << " instanced meshes, " << fixed << setprecision(1)
+         << instanced_bytes_saved / 1048576.0 << " MB of vertices and "
+         << num_instanced - num_geometries << " draw calls saved" << endl;
+  }
+
+  // Other meshes that draw the same way are merged into static batches.
+  size_t num_batches = 0, num_batched = 0;
+  for (const vector<size_t> &group :
+       DynamicScene::MeshBatch::group(unique_polymeshes)) {
+    if (group.size() == 1) {
+      objects.push_back(init_polymesh(*unique_polymeshes[group[0]],
+                                      *unique_transforms[group[0]],
+                                      shader_prefix));
+      continue;
+    }
+    vector<PolymeshInfo *> members;
+    for (size_t i : group) members.push_back(unique_polymeshes[i]);
+    DynamicScene::MeshBatch::create(members, store, shader_prefix, objects);
+    num_batches++;
+    num_batched += group.size();
+  }
+  if (num_batches > 0) {
+    cerr << "Static batching: " << num_batched << " meshes merged into "
+         << num_batches << " batches" << endl;
+  }
+  // the meshes hold on to their streams
+  store.clear();
+
   if (lights.size() == 0) {  // no lights, default use ambient_light
     LightInfo default_light = LightInfo();
     lights.push_back(new DynamicScene::AmbientLight(default_light));
@@ -365,7 +457,9 @@ DynamicScene::SceneObject *Application::init_sphere(
 
 DynamicScene::SceneObject *Application::init_polymesh(
   PolymeshInfo &polymesh, const Matrix4x4 &transform, const std::string shader_prefix) {
-  return new DynamicScene::Mesh(polymesh, transform, shader_prefix);
+  return new DynamicScene::Mesh(
+      polymesh, DynamicScene::MeshStore::shared().get(polymesh), transform,
+      shader_prefix);
 }
 
 void Application::set_scroll_rate() {
@@ -521,7 +615,8 @@ void Application::loadScene(const char *filename) {
   Camera originalCanonicalCamera = canonicalCamera;
 
   Collada::SceneInfo *sceneInfo = new Collada::SceneInfo();
-  if (Collada::ColladaParser::load(filename, sceneInfo) < 0) {
+  if (Collada::ColladaParser::load(filename, sceneInfo,
+                                   &DynamicScene::MeshStore::shared()) < 0) {
     cerr << "Warning: scene file failed to load." << endl;
     delete sceneInfo;
     return;
@@ -702,6 +797,86 @@ void Application::draw_hud() {
   const int inc = use_hdpi ? 48 : 24;
   float y = y0 + inc - size;
 
+  ostringstream frame_line;
+  frame_line << "Frame: " << fixed << setprecision(2) << frame_time * 1e3
+             << " ms";
+  draw_string(x0, y, frame_line.str(), size, text_color);
+  y += inc;
+
+  TextureRegistry::Stats textures = TextureRegistry::shared().stats();
+  ostringstream texture_line;
+  texture_line << "Textures: " << textures.misses - textures.pending
+               << " loaded, " << textures.pending << " pending, "
+               << textures.hits << " shared ("
+               << fixed << setprecision(1) << textures.bytes_saved / 1048576.0
+               << " MB saved)";
+  draw_string(x0, y, texture_line.str(), size, text_color);
+  y += inc;
+
+  ostringstream memory_line;
+  memory_line << "Texture memory: " << fixed << setprecision(1)
+              << textures.vram_bytes / 1048576.0 << " MB ("
+              << textures.rgba8_bytes / 1048576.0 << " MB as RGBA8)";
+  draw_string(x0, y, memory_line.str(), size, text_color);
+  y += inc;
+
+  DynamicScene::GeometryArena &arena = DynamicScene::GeometryArena::shared();
+  ostringstream vertex_memory_line;
+  vertex_memory_line << "Vertex memory: " << fixed << setprecision(1)
+                     << arena.vertex_bytes() / 1048576.0 << " MB ("
+                     << arena.float_vertex_bytes() / 1048576.0
+                     << " MB as floats)";
+  draw_string(x0, y, vertex_memory_line.str(), size, text_color);
+  y += inc;
+
+  if (scene) {
+    DynamicScene::RenderQueue::Stats draws = scene->render_queue.stats();
+    size_t requested = draws.binds + draws.binds_skipped;
+    ostringstream draw_line;
+    draw_line << "Draws: " << draws.packets << " in " << draws.draw_calls
+              << " calls, " << draws.triangles << " triangles, binds: "
+              << draws.binds
+              << " (" << fixed << setprecision(0)
+              << (requested ? 100.0 * draws.binds_skipped / requested : 0.0)
+              << "% skipped), " << setprecision(2)
+              << draws.cpu_seconds * 1e3 << " ms";
+    draw_string(x0, y, draw_line.str(), size, text_color);
+    y += inc;
+
+    ostringstream culling_line;
+    culling_line << "Culled: " << scene->culling.culled << " / "
+                 << scene->culling.tested << " objects";
+    draw_string(x0, y, culling_line.str(), size, text_color);
+    y += inc;
+
+    ostringstream occlusion_line;
+    occlusion_line << "Occluded: " << scene->culling.occluded
+                   << " objects behind " << scene->culling.occluder_triangles
+                   << " triangles, " << fixed << setprecision(0)
+                   << scene->culling.occlusion_seconds * 1e6 << " us";
+    draw_string(x0, y, occlusion_line.str(), size, text_color);
+    y += inc;
+
+    const DynamicScene::MeshClusters::Stats &clusters = scene->culling.clusters;
+    double tested = max<size_t>(clusters.triangles, 1);
+    ostringstream cluster_line;
+    cluster_line << "Clusters: " << fixed << setprecision(0)
+                 << 100.0 * clusters.rejected() / tested << "% of "
+                 << clusters.triangles << " triangles culled (frustum "
+                 << 100.0 * clusters.outside / tested << "%, back-facing "
+                 << 100.0 * clusters.backfacing / tested << "%, small "
+                 << 100.0 * clusters.small / tested << "%), "
+                 << scene->culling.cluster_seconds * 1e6 << " us";
+    draw_string(x0, y, cluster_line.str(), size, text_color);
+    y += inc;
+
+    ostringstream vertex_line;
+    vertex_line << "Vertex arrays: " << draws.setup_calls_saved
+                << " GL calls saved";
+    draw_string(x0, y, vertex_line.str(), size, text_color);
+    y += inc;
+  }
+
   glEnable(GL_LIGHTING);
   glEnable(GL_DEPTH_TEST);
 
@@ -13,6 +13,7 @@
 #include "CS248/CS248.h"
 #include "CS248/renderer.h"
 #include "CS248/osdtext.h"
+#include "CS248/timer.h"
 
 // COLLADA
 #include "collada/collada.h"
@@ -158,6 +159,8 @@ class Application : public Renderer {
 
   // HUD //
   bool show_hud;
+  Timer frame_timer;  ///< restarted at the beginning of every frame
+  double frame_time;  ///< seconds per frame, smoothed over recent frames
   void draw_hud();
   inline void draw_string(float x, float y, string str, size_t size,
                           const Color& c);
@@ -0,0 +1,211 @@
+#include "benchmark.h"
+
+#include "CS248/timer.h"
+
+#include "CS248/lodepng.h"
+
+#include "block_compressor.h"
+#include "collada/obj_parser.h"
+#include "dynamic_scene/mesh_buffers.h"
+#include "dynamic_scene/mesh_optimizer.h"
+#include "thread_pool.h"
+
+#include <cmath>
+#include <cstdio>
+#include <algorithm>
+
+using namespace std;
+
+namespace CS248 {
+namespace Benchmark {
+
+// Number of timed runs per file; the fastest one is reported.
+static const int kRuns = 5;
+
+int obj_load(const vector<string>& filenames) {
+  // serial first, then doubling up to the full pool
+  vector<size_t> thread_counts(1, 1);
+  size_t pool_size = ThreadPool::shared().size();
+  for (size_t n = 2; n < pool_size; n *= 2) thread_counts.push_back(n);
+  if (pool_size > 1) thread_counts.push_back(pool_size);
+
+  printf("%-48s %7s %9s %9s %10s %9s %10s\n", "file", "threads", "MB", "faces",
+         "time (ms)", "MB/s", "Mfaces/s");
+
+  double total_bytes = 0, total_faces = 0;
+  vector<double> total_time(thread_counts.size(), 0);
+  for (const string& filename : filenames) {
+    string data;
+    if (!Collada::ObjParser::read_file(filename, data)) {
+      fprintf(stderr, "Warning: could not open file %s\n", filename.c_str());
+      continue;
+    }
+    double mb = data.size() / (1024.0 * 1024.0);
+
+    size_t faces = 0;
+    for (size_t t = 0; t < thread_counts.size(); ++t) {
+      double best = INF_D;
+      for (int run = 0; run < kRuns; ++run) {
+        Collada::PolymeshInfo polymesh;
+        Timer timer;
+        timer.start();
+        bool ok = Collada::ObjParser::parse(
+            data.data(), data.data() + data.size(), polymesh, thread_counts[t]);
+        timer.stop();
+        if (!ok) {
+          fprintf(stderr, "Error: bad obj format in %s\n", filename.c_str());
+          return 1;
+        }
+        best = min(best, timer.duration());
+        faces = polymesh.polygons.size();
+      }
+
+      printf("%-48s %7zu %9.2f %9zu %10.2f %9.1f %10.2f\n", filename.c_str(),
+             thread_counts[t], mb, faces, best * 1e3, mb / best,
+             faces / best * 1e-6);
+      total_time[t] += best;
+    }
+
+    total_bytes += mb;
+    total_faces += faces;
+  }
+
+  for (size_t t = 0; t < thread_counts.size(); ++t) {
+    if (total_time[t] <= 0) continue;
+    printf("%-48s %7zu %9.2f %9.0f %10.2f %9.1f %10.2f\n", "total",
+           thread_counts[t], total_bytes, total_faces, total_time[t] * 1e3,
+           total_bytes / total_time[t], total_faces / total_time[t] * 1e-6);
+  }
+  return 0;
+}
+
+int texture_encode(const vector<string>& filenames) {
+  const TextureFormat formats[] = {TEXTURE_BC1, TEXTURE_BC3, TEXTURE_BC5};
+  const char* format_names[] = {"BC1", "BC3", "BC5"};
+  const int format_channels[] = {3, 4, 2};  // channels each format stores
+
+  vector<size_t> thread_counts(1, 1);
+  size_t pool_size = ThreadPool::shared().size();
+  if (pool_size > 1) thread_counts.push_back(pool_size);
+
+  printf("%-48s %6s %7s %9s %10s %10s %6s %9s\n", "file", "format",
+         "threads", "Mpixels", "time (ms)", "Mpixels/s", "ratio", "PSNR (dB)");
+
+  for (const string& filename : filenames) {
+    vector<unsigned char> rgba;
+    unsigned width, height;
+    if (lodepng::decode(rgba, width, height, filename)) {
+      fprintf(stderr, "Warning: could not decode %s\n", filename.c_str());
+      continue;
+    }
+    double mpixels = (double)width * height * 1e-6;
+
+    for (int f = 0; f < 3; ++f) {
+      vector<unsigned char> blocks(
+          BlockCompressor::encoded_size(formats[f], width, height));
+      for (size_t t = 0; t < thread_counts.size(); ++t) {
+        double best = INF_D;
+        for (int run = 0; run < kRuns; ++run) {
+          Timer timer;
+          timer.start();
+          BlockCompressor::encode(formats[f], rgba.data(), width, height,
+                                  blocks.data(), thread_counts[t]);
+          timer.stop();
+          best = min(best, timer.duration());
+        }
+
+        vector<unsigned char> decoded(rgba.size());
+        BlockCompressor::decode(formats[f], blocks.data(), width, height,
+                                decoded.data());
+        double squared_error = 0;
+        for (size_t i = 0; i < (size_t)width * height; ++i) {
+          for (int c = 0; c < format_channels[f]; ++c) {
+            double d = (double)decoded[4 * i + c] - rgba[4 * i + c];
+            squared_error += d * d;
+          }
+        }
+        double mse = squared_error / ((double)width * height * format_channels[f]);
+        double psnr = mse > 0 ? 10 * log10(255.0 * 255.0 / mse) : INF_D;
+
+        printf("%-48s %6s %7zu %9.2f %10.2f %10.1f %5.0f:1 %9.2f\n",
+               filename.c_str(), format_names[f], thread_counts[t], mpixels,
+               best * 1e3, mpixels / best, (double)rgba.size() / blocks.size(),
+               psnr);
+      }
+    }
+  }
+  return 0;
+}
+
+int mesh_optimize(const vector<string>& filenames) {
+  using DynamicScene::MeshBuffers;
+  using DynamicScene::MeshOptimizer;
+
+  printf("%-48s %9s %9s %13s %13s %10s\n", "file", "triangles", "vertices",
+         "ACMR", "ATVR", "time (ms)");
+
+  // Weld without optimizing, then time the passes on the file order.
+  bool enabled = MeshOptimizer::enabled;
+  MeshOptimizer::enabled = false;
+  double total_triangles = 0, total_before = 0, total_after = 0;
+  for (const string& filename : filenames) {
+    string data;
+    Collada::PolymeshInfo polymesh;
+    if (!Collada::ObjParser::read_file(filename, data)) {
+      fprintf(stderr, "Warning: could not open file %s\n", filename.c_str());
+      continue;
+    }
+    if (!Collada::ObjParser::parse(data.data(), data.data() + data.size(),
+                                   polymesh)) {
+      fprintf(stderr, "Error: bad obj format in %s\n", filename.c_str());
+      MeshOptimizer::enabled = enabled;
+      return 1;
+    }
+    MeshBuffers buffers;
+    MeshBuffers::build(polymesh, buffers);
+    if (buffers.num_indices == 0) continue;
+
+    const uint32_t* file_order = buffers.indices;
+    size_t n = buffers.num_indices;
+    MeshOptimizer::CacheStats before =
+        MeshOptimizer::analyze(file_order, n, buffers.num_vertices);
+
+    vector<uint32_t> indices;
+    double best = INF_D;
+    for (int run = 0; run < kRuns; ++run) {
+      indices.assign(file_order, file_order + n);
+      vector<uint32_t> remap;
+      Timer timer;
+      timer.start();
+      MeshOptimizer::optimize_vertex_cache(indices.data(), n,
+                                           buffers.num_vertices);
+      MeshOptimizer::optimize_overdraw(indices.data(), n,
+                                       &buffers.positions[0].x,
+                                       buffers.num_vertices,
+                                       sizeof(buffers.positions[0]));
+      MeshOptimizer::optimize_vertex_fetch(indices.data(), n,
+                                           buffers.num_vertices, remap);
+      timer.stop();
+      best = min(best, timer.duration());
+    }
+    MeshOptimizer::CacheStats after =
+        MeshOptimizer::analyze(indices.data(), n, buffers.num_vertices);
+
+    printf("%-48s %9zu %9zu %5.3f->%5.3f %5.3f->%5.3f %10.2f\n",
+           filename.c_str(), n / 3, buffers.num_vertices, before.acmr,
+           after.acmr, before.atvr, after.atvr, best * 1e3);
+    total_triangles += n / 3;
+    total_before += before.acmr * (n / 3);
+    total_after += after.acmr * (n / 3);
+  }
+  MeshOptimizer::enabled = enabled;
+
+  if (total_triangles > 0) {
+    printf("%-48s %9.0f %9s %5.3f->%5.3f\n", "total", total_triangles, "",
+           total_before / total_triangles, total_after / total_triangles);
+  }
+  return 0;
+}
+
+}  // namespace Benchmark
+}  // namespace CS248
@@ -0,0 +1,30 @@
+#ifndef CS248_BENCHMARK_H
+#define CS248_BENCHMARK_H
+
+#include <string>
+#include <vector>
+
+namespace CS248 {
+
+/*
+  Offline benchmarks that run without opening a window.
+  Each entry point prints a report to stdout and returns a process exit code.
+*/
+namespace Benchmark {
+
+// Measures OBJ parsing throughput (MB/s and faces/s) over the given files,
+// serially and with increasing thread counts.
+int obj_load(const std::vector<std::string>& filenames);
+
+// Measures block compression throughput (Mpixels/s) and error (PSNR) of each
+// BCn format over the given PNG files, serially and on the full pool.
+int texture_encode(const std::vector<std::string>& filenames);
+
+// Reports the simulated vertex cache efficiency (ACMR and ATVR) of the given
+// OBJ files in file order and after MeshOptimizer, and how long it took.
+int mesh_optimize(const std::vector<std::string>& filenames);
+
+}  // namespace Benchmark
+}  // namespace CS248
+
+#endif  // CS248_BENCHMARK_H
@@ -0,0 +1,364 @@
+#include "block_compressor.h"
+
+#include "thread_pool.h"
+
+#include <stdint.h>
+#include <algorithm>
+#include <cstring>
+
+#if (defined(__SSE2__) || defined(_M_X64)) && !defined(CS248_NO_SIMD)
+#define CS248_BLOCK_COMPRESSOR_SSE2
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+namespace CS248 {
+
+namespace {
+
+// The endpoints are pulled in from the block's bounding box by its extent
+// shifted right by these amounts, which lowers the average error.
+const int kColorInsetShift = 4;
+const int kAlphaInsetShift = 5;
+
+// Index to store for each step along the endpoint axis, counting from the
+// low endpoint (step 0) to the high one.
+const uint8_t kColorCodes[4] = {1, 3, 2, 0};
+const uint8_t kAlphaCodes[8] = {1, 7, 6, 5, 4, 3, 2, 0};
+
+size_t block_bytes(TextureFormat format) {
+  return format == TEXTURE_BC1 ? 8 : 16;
+}
+
+// Copies the 4x4 block at (bx, by), repeating the last row and column past
+// the edges of the image.
+void fetch_block(const unsigned char* rgba, unsigned width, unsigned height,
+                 unsigned bx, unsigned by, uint8_t block[64]) {
+  for (unsigned y = 0; y < 4; ++y) {
+    unsigned sy = min(by * 4 + y, height - 1);
+    for (unsigned x = 0; x < 4; ++x) {
+      unsigned sx = min(bx * 4 + x, width - 1);
+      memcpy(block + (y * 4 + x) * 4, rgba + ((size_t)sy * width + sx) * 4, 4);
+    }
+  }
+}
+
+inline uint16_t to_565(const int c[3]) {
+  int r = (c[0] * 31 + 127) / 255;
+  int g = (c[1] * 63 + 127) / 255;
+  int b = (c[2] * 31 + 127) / 255;
+  return (uint16_t)((r << 11) | (g << 5) | b);
+}
+
+inline void from_565(uint16_t c, int out[3]) {
+  int r = (c >> 11) & 31, g = (c >> 5) & 63, b = c & 31;
+  out[0] = (r << 3) | (r >> 2);
+  out[1] = (g << 2) | (g >> 4);
+  out[2] = (b << 3) | (b >> 2);
+}
+
+inline void store16(uint8_t* out, uint16_t v) {
+  out[0] = (uint8_t)v;
+  out[1] = (uint8_t)(v >> 8);
+}
+
+inline uint16_t load16(const uint8_t* in) {
+  return (uint16_t)(in[0] | (in[1] << 8));
+}
+
+// Per-channel minimum and maximum of the 16 pixels.
+void block_bounds(const uint8_t block[64], uint8_t lo[4], uint8_t hi[4]) {
+#ifdef CS248_BLOCK_COMPRESSOR_SSE2
+  __m128i p0 = _mm_loadu_si128((const __m128i*)(block + 0));
+  __m128i p1 = _mm_loadu_si128((const __m128i*)(block + 16));
+  __m128i p2 = _mm_loadu_si128((const __m128i*)(block + 32));
+  __m128i p3 = _mm_loadu_si128((const __m128i*)(block + 48));
+  __m128i mn = _mm_min_epu8(_mm_min_epu8(p0, p1), _mm_min_epu8(p2, p3));
+  __m128i mx = _mm_max_epu8(_mm_max_epu8(p0, p1), _mm_max_epu8(p2, p3));
+  mn = _mm_min_epu8(mn, _mm_shuffle_epi32(mn, _MM_SHUFFLE(1, 0, 3, 2)));
+  mx = _mm_max_epu8(mx, _mm_shuffle_epi32(mx, _MM_SHUFFLE(1, 0, 3, 2)));
+  mn = _mm_min_epu8(mn, _mm_shuffle_epi32(mn, _MM_SHUFFLE(2, 3, 0, 1)));
+  mx = _mm_max_epu8(mx, _mm_shuffle_epi32(mx, _MM_SHUFFLE(2, 3, 0, 1)));
+  int32_t l = _mm_cvtsi128_si32(mn), h = _mm_cvtsi128_si32(mx);
+  memcpy(lo, &l, 4);
+  memcpy(hi, &h, 4);
+#else
+  for (int c = 0; c < 4; ++c) {
+    lo[c] = 255;
+    hi[c] = 0;
+  }
+  for (int i = 0; i < 16; ++i) {
+    for (int c = 0; c < 4; ++c) {
+      lo[c] = min(lo[c], block[i * 4 + c]);
+      hi[c] = max(hi[c], block[i * 4 + c]);
+    }
+  }
+#endif
+}
+
+// Step (0-3) of each pixel along the axis from low to low + axis, found by
+// projecting onto the axis and rounding. len2 is the squared axis length.
+void color_steps(const uint8_t block[64], const int low[3], const int axis[3],
+                 int len2, int32_t steps[16]) {
+#ifdef CS248_BLOCK_COMPRESSOR_SSE2
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i lowv = _mm_set_epi16(0, low[2], low[1], low[0],
+                                     0, low[2], low[1], low[0]);
+  const __m128i axisv = _mm_set_epi16(0, axis[2], axis[1], axis[0],
+                                      0, axis[2], axis[1], axis[0]);
+  const __m128i t1 = _mm_set1_epi32(len2 - 1);
+  const __m128i t2 = _mm_set1_epi32(3 * len2 - 1);
+  const __m128i t3 = _mm_set1_epi32(5 * len2 - 1);
+  for (int r = 0; r < 4; ++r) {
+    __m128i p = _mm_loadu_si128((const __m128i*)(block + 16 * r));
+    __m128i lo = _mm_sub_epi16(_mm_unpacklo_epi8(p, zero), lowv);
+    __m128i hi = _mm_sub_epi16(_mm_unpackhi_epi8(p, zero), lowv);
+    // (r*ar + g*ag, b*ab) per pixel, then summed
+    __m128i mlo = _mm_madd_epi16(lo, axisv);
+    __m128i mhi = _mm_madd_epi16(hi, axisv);
+    mlo = _mm_add_epi32(mlo, _mm_shuffle_epi32(mlo, _MM_SHUFFLE(2, 3, 0, 1)));
+    mhi = _mm_add_epi32(mhi, _mm_shuffle_epi32(mhi, _MM_SHUFFLE(2, 3, 0, 1)));
+    __m128i d = _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(mlo),
+                                                _mm_castsi128_ps(mhi),
+                                                _MM_SHUFFLE(2, 0, 2, 0)));
+    __m128i d6 = _mm_add_epi32(_mm_slli_epi32(d, 2), _mm_slli_epi32(d, 1));
+    __m128i t = _mm_sub_epi32(zero, _mm_cmpgt_epi32(d6, t1));
+    t = _mm_sub_epi32(t, _mm_cmpgt_epi32(d6, t2));
+    t = _mm_sub_epi32(t, _mm_cmpgt_epi32(d6, t3));
+    _mm_storeu_si128((__m128i*)(steps + 4 * r), t);
+  }
+#else
+  for (int i = 0; i < 16; ++i) {
+    const uint8_t* p = block + 4 * i;
+    int d = (p[0] - low[0]) * axis[0] + (p[1] - low[1]) * axis[1] +
+            (p[2] - low[2]) * axis[2];
+    int d6 = 6 * d;
+    steps[i] = (d6 >= len2) + (d6 >= 3 * len2) + (d6 >= 5 * len2);
+  }
+#endif
+}
+
+// Step (0-7) of one channel of each pixel between low and low + range.
+void alpha_steps(const uint8_t block[64], int channel, int low, int range,
+                 int32_t steps[16]) {
+#ifdef CS248_BLOCK_COMPRESSOR_SSE2
+  const __m128i mask = _mm_set1_epi32(0xff);
+  __m128i v[4];
+  for (int r = 0; r < 4; ++r) {
+    __m128i p = _mm_loadu_si128((const __m128i*)(block + 16 * r));
+    v[r] = _mm_and_si128(_mm_srl_epi32(p, _mm_cvtsi32_si128(8 * channel)),
+                         mask);
+  }
+  const __m128i lowv = _mm_set1_epi16((short)low);
+  const __m128i fourteen = _mm_set1_epi16(14);
+  for (int half = 0; half < 2; ++half) {
+    __m128i a = _mm_packs_epi32(v[2 * half], v[2 * half + 1]);
+    __m128i d14 = _mm_mullo_epi16(_mm_sub_epi16(a, lowv), fourteen);
+    __m128i t = _mm_setzero_si128();
+    for (int k = 1; k < 8; ++k) {
+      __m128i threshold = _mm_set1_epi16((short)((2 * k - 1) * range - 1));
+      t = _mm_sub_epi16(t, _mm_cmpgt_epi16(d14, threshold));
+    }
+    _mm_storeu_si128((__m128i*)(steps + 8 * half),
+                     _mm_srai_epi32(_mm_unpacklo_epi16(t, t), 16));
+    _mm_storeu_si128((__m128i*)(steps + 8 * half + 4),
+                     _mm_srai_epi32(_mm_unpackhi_epi16(t, t), 16));
+  }
+#else
+  for (int i = 0; i < 16; ++i) {
+    int d14 = 14 * (block[4 * i + channel] - low);
+    int t = 0;
+    for (int k = 1; k < 8; ++k) t += d14 >= (2 * k - 1) * range;
+    steps[i] = t;
+  }
+#endif
+}
+
+void encode_color_block(const uint8_t block[64], const uint8_t lo[4],
+                        const uint8_t hi[4], uint8_t out[8]) {
+  int high[3], low[3];
+  for (int c = 0; c < 3; ++c) {
+    int inset = (hi[c] - lo[c]) >> kColorInsetShift;
+    high[c] = hi[c] - inset;
+    low[c] = lo[c] + inset;
+  }
+
+  // to_565 is monotonic, so c0 >= c1 and the block is in four-color mode
+  // unless the endpoints are equal, in which case every index is 0.
+  uint16_t c0 = to_565(high), c1 = to_565(low);
+  store16(out, c0);
+  store16(out + 2, c1);
+
+  uint32_t bits = 0;
+  if (c0 != c1) {
+    int e0[3], e1[3], axis[3];
+    from_565(c0, e0);
+    from_565(c1, e1);
+    int len2 = 0;
+    for (int c = 0; c < 3; ++c) {
+      axis[c] = e0[c] - e1[c];
+      len2 += axis[c] * axis[c];
+    }
+    int32_t steps[16];
+    color_steps(block, e1, axis, len2, steps);
+    for (int i = 0; i < 16; ++i) bits |= (uint32_t)kColorCodes[steps[i]] << (2 * i);
+  }
+  for (int j = 0; j < 4; ++j) out[4 + j] = (uint8_t)(bits >> (8 * j));
+}
+
+void encode_alpha_block(const uint8_t block[64], int channel, uint8_t lo,
+                        uint8_t hi, uint8_t out[8]) {
+  int inset = (hi - lo) >> kAlphaInsetShift;
+  int a0 = hi - inset, a1 = lo + inset;
+  out[0] = (uint8_t)a0;
+  out[1] = (uint8_t)a1;
+
+  uint64_t bits = 0;
+  if (a0 > a1) {
+    int32_t steps[16];
+    alpha_steps(block, channel, a1, a0 - a1, steps);
+    for (int i = 0; i < 16; ++i) bits |= (uint64_t)kAlphaCodes[steps[i]] << (3 * i);
+  }
+  for (int j = 0; j < 6; ++j) out[2 + j] = (uint8_t)(bits >> (8 * j));
+}
+
+void encode_block(TextureFormat format, const uint8_t block[64], uint8_t* out) {
+  uint8_t lo[4], hi[4];
+  block_bounds(block, lo, hi);
+  switch (format) {
+    case TEXTURE_BC1:
+      encode_color_block(block, lo, hi, out);
+      break;
+    case TEXTURE_BC3:
+      encode_alpha_block(block, 3, lo[3], hi[3], out);
+      encode_color_block(block, lo, hi, out + 8);
+      break;
+    case TEXTURE_BC5:
+      encode_alpha_block(block, 0, lo[0], hi[0], out);
+      encode_alpha_block(block, 1, lo[1], hi[1], out + 8);
+      break;
+    default:
+      break;
+  }
+}
+
+// Decodes a color block into the RGB channels of 16 RGBA pixels; alpha is
+// set to 255, or 0 for the transparent entry of a three-color BC1 block.
+void decode_color_block(const uint8_t in[8], bool four_color,
+                        uint8_t block[64]) {
+  uint16_t c0 = load16(in), c1 = load16(in + 2);
+  int palette[4][4];
+  from_565(c0, palette[0]);
+  from_565(c1, palette[1]);
+  palette[0][3] = palette[1][3] = palette[2][3] = palette[3][3] = 255;
+  for (int c = 0; c < 3; ++c) {
+    if (four_color || c0 > c1) {
+      palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+      palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+    } else {
+      palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+      palette[3][c] = 0;
+    }
+  }
+  if (!four_color && c0 <= c1) palette[3][3] = 0;
+
+  uint32_t bits = in[4] | (in[5] << 8) | (in[6] << 16) | ((uint32_t)in[7] << 24);
+  for (int i = 0; i < 16; ++i) {
+    const int* color = palette[(bits >> (2 * i)) & 3];
+    for (int c = 0; c < 4; ++c) block[4 * i + c] = (uint8_t)color[c];
+  }
+}
+
+void decode_alpha_block(const uint8_t in[8], int channel, uint8_t block[64]) {
+  int a0 = in[0], a1 = in[1];
+  int palette[8] = {a0, a1};
+  for (int k = 2; k < 8; ++k) {
+    if (a0 > a1) {
+      palette[k] = ((8 - k) * a0 + (k - 1) * a1) / 7;
+    } else if (k < 6) {
+      palette[k] = ((6 - k) * a0 + (k - 1) * a1) / 5;
+    } else {
+      palette[k] = k == 6 ? 0 : 255;
+    }
+  }
+  uint64_t bits = 0;
+  for (int j = 0; j < 6; ++j) bits |= (uint64_t)in[2 + j] << (8 * j);
+  for (int i = 0; i < 16; ++i) {
+    block[4 * i + channel] = (uint8_t)palette[(bits >> (3 * i)) & 7];
+  }
+}
+
+}  // namespace
+
+size_t BlockCompressor::encoded_size(TextureFormat format, unsigned width,
+                                     unsigned height) {
+  if (format == TEXTURE_RGBA8) return (size_t)width * height * 4;
+  return (size_t)((width + 3) / 4) * ((height + 3) / 4) * block_bytes(format);
+}
+
+void BlockCompressor::encode(TextureFormat format, const unsigned char* rgba,
+                             unsigned width, unsigned height,
+                             unsigned char* out, size_t max_threads) {
+  if (format == TEXTURE_RGBA8) {
+    memcpy(out, rgba, encoded_size(format, width, height));
+    return;
+  }
+
+  unsigned blocks_x = (width + 3) / 4, blocks_y = (height + 3) / 4;
+  size_t bytes = block_bytes(format);
+  ThreadPool::shared().parallel_for(blocks_y, [&](size_t by) {
+    uint8_t block[64];
+    unsigned char* dst = out + by * blocks_x * bytes;
+    for (unsigned bx = 0; bx < blocks_x; ++bx, dst += bytes) {
+      fetch_block(rgba, width, height, bx, (unsigned)by, block);
+      encode_block(format, block, dst);
+    }
+  }, max_threads);
+}
+
+void BlockCompressor::decode(TextureFormat format, const unsigned char* blocks,
+                             unsigned width, unsigned height,
+                             unsigned char* rgba) {
+  if (format == TEXTURE_RGBA8) {
+    memcpy(rgba, blocks, encoded_size(format, width, height));
+    return;
+  }
+
+  unsigned blocks_x = (width + 3) / 4, blocks_y = (height + 3) / 4;
+  size_t bytes = block_bytes(format);
+  for (unsigned by = 0; by < blocks_y; ++by) {
+    for (unsigned bx = 0; bx < blocks_x; ++bx) {
+      const uint8_t* in = blocks + ((size_t)by * blocks_x + bx) * bytes;
+      uint8_t block[64];
+      switch (format) {
+        case TEXTURE_BC1:
+          decode_color_block(in, false, block);
+          break;
+        case TEXTURE_BC3:
+          decode_color_block(in + 8, true, block);
+          decode_alpha_block(in, 3, block);
+          break;
+        case TEXTURE_BC5:
+          for (int i = 0; i < 16; ++i) {
+            block[4 * i + 2] = 0;
+            block[4 * i + 3] = 255;
+          }
+          decode_alpha_block(in, 0, block);
+          decode_alpha_block(in + 8, 1, block);
+          break;
+        default:
+          break;
+      }
+
+      for (unsigned y = 0; y < 4 && by * 4 + y < height; ++y) {
+        for (unsigned x = 0; x < 4 && bx * 4 + x < width; ++x) {
+          memcpy(rgba + ((size_t)(by * 4 + y) * width + bx * 4 + x) * 4,
+                 block + (y * 4 + x) * 4, 4);
+        }
+      }
+    }
+  }
+}
+
+}  // namespace CS248
@@ -0,0 +1,55 @@
+#ifndef CS248_BLOCK_COMPRESSOR_H
+#define CS248_BLOCK_COMPRESSOR_H
+
+#include <stddef.h>
+
+namespace CS248 {
+
+/**
+ * Pixel formats a texture can be stored and uploaded in.
+ */
+enum TextureFormat {
+  TEXTURE_RGBA8,  ///< uncompressed, 4 bytes per pixel
+  TEXTURE_BC1,    ///< RGB, 8 bytes per 4x4 block (DXT1)
+  TEXTURE_BC3,    ///< RGBA, 16 bytes per 4x4 block (DXT5)
+  TEXTURE_BC5     ///< red and green, 16 bytes per 4x4 block (RGTC2)
+};
+
+/**
+ * CPU encoder for the BC1, BC3 and BC5 block-compressed formats.
+ *
+ * Endpoints are the inset bounding box of each block and indices are found by
+ * projecting onto the endpoint axis, which is fast and good enough for
+ * photographic textures. Block rows are spread over the shared ThreadPool and
+ * the per-block math uses SSE2 where available; both paths give the same
+ * output.
+ */
+class BlockCompressor {
+ public:
+  /**
+   * Bytes needed to store an image of the given size in a format.
+   */
+  static size_t encoded_size(TextureFormat format, unsigned width,
+                             unsigned height);
+
+  /**
+   * Encodes RGBA8 pixels into out, which must hold encoded_size() bytes.
+   * Images whose size isn't a multiple of 4 are padded by repeating their
+   * last row and column. At most max_threads threads are used; zero means
+   * the whole pool.
+   */
+  static void encode(TextureFormat format, const unsigned char* rgba,
+                     unsigned width, unsigned height, unsigned char* out,
+                     size_t max_threads = 0);
+
+  /**
+   * Decodes blocks back to RGBA8. Channels a format doesn't store are set to
+   * 0 (blue of BC5) or 255 (alpha of BC1 and BC5).
+   */
+  static void decode(TextureFormat format, const unsigned char* blocks,
+                     unsigned width, unsigned height, unsigned char* rgba);
+};
+
+}  // namespace CS248
+
+#endif  // CS248_BLOCK_COMPRESSOR_H
@@ -0,0 +1,83 @@
+#include "cache_file.h"
+
+#include <sys/stat.h>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <thread>
+
+using namespace std;
+
+namespace CS248 {
+
+namespace {
+
+inline uint64_t mix(uint64_t h) {
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+}  // namespace
+
+bool CacheFile::make_source(const string& filename, const void* contents,
+                            size_t size, Source& source) {
+  struct stat st;
+  if (stat(filename.c_str(), &st) != 0) return false;
+  source.size = size;
+  source.mtime = (int64_t)st.st_mtime;
+  source.hash = hash(contents, size);
+  return true;
+}
+
+uint64_t CacheFile::hash(const void* data, size_t size, uint64_t seed) {
+  const unsigned char* p = (const unsigned char*)data;
+  uint64_t h = mix(seed ^ (size * 0x9e3779b97f4a7c15ULL));
+
+  // four independent lanes keep the multiplies pipelined
+  uint64_t lanes[4] = {h, h + 1, h + 2, h + 3};
+  size_t i = 0;
+  for (; i + 32 <= size; i += 32) {
+    for (int l = 0; l < 4; ++l) {
+      uint64_t w;
+      memcpy(&w, p + i + 8 * l, 8);
+      lanes[l] = (lanes[l] ^ w) * 0x100000001b3ULL;
+      lanes[l] ^= lanes[l] >> 29;
+    }
+  }
+  for (int l = 0; l < 4; ++l) h = mix(h ^ lanes[l]);
+  for (; i < size; ++i) h = (h ^ p[i]) * 0x100000001b3ULL;
+  return mix(h);
+}
+
+bool CacheFile::write(const string& filename,
+                      const function<void(ostream&)>& write) {
+  // The temporary is private to this thread, so concurrent writers of one
+  // file don't interleave; the last rename wins.
+  string temp = filename + ".tmp" +
+                to_string(std::hash<thread::id>()(this_thread::get_id()));
+  {
+    ofstream out(temp, ios::out | ios::binary | ios::trunc);
+    if (!out.is_open()) return false;
+    write(out);
+    if (!out) {
+      out.close();
+      remove(temp.c_str());
+      return false;
+    }
+  }
+
+#ifdef _WIN32
+  remove(filename.c_str());
+#endif
+  if (rename(temp.c_str(), filename.c_str()) != 0) {
+    remove(temp.c_str());
+    return false;
+  }
+  return true;
+}
+
+}  // namespace CS248
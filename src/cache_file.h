@@ -0,0 +1,57 @@
+#ifndef CS248_CACHE_FILE_H
+#define CS248_CACHE_FILE_H
+
+#include <stdint.h>
+#include <functional>
+#include <ostream>
+#include <string>
+
+namespace CS248 {
+
+/**
+ * What the on-disk caches (MeshCache, TextureCache) have in common: a fast
+ * content hash, the key fields that tie a cache file to its source, and
+ * writes that replace a cache file atomically.
+ */
+class CacheFile {
+ public:
+  /**
+   * The source a cache file was built from. Stored in cache file headers,
+   * so the layout must not change without bumping their versions.
+   */
+  struct Source {
+    uint64_t size;
+    int64_t mtime;
+    uint64_t hash;  ///< hash of the file's contents
+
+    bool operator==(const Source& other) const {
+      return size == other.size && mtime == other.mtime &&
+             hash == other.hash;
+    }
+  };
+
+  /**
+   * Fills in source for a file whose contents have already been read.
+   * Fails if the file can't be stat'ed.
+   */
+  static bool make_source(const std::string& filename, const void* contents,
+                          size_t size, Source& source);
+
+  /**
+   * 64-bit non-cryptographic hash, fast enough to run over whole source
+   * files.
+   */
+  static uint64_t hash(const void* data, size_t size, uint64_t seed = 0);
+
+  /**
+   * Calls write with a stream to a private temporary file, then renames it
+   * over filename, so that a reader never sees a partial file. Fails, and
+   * leaves filename alone, if the stream fails.
+   */
+  static bool write(const std::string& filename,
+                    const std::function<void(std::ostream&)>& write);
+};
+
+}  // namespace CS248
+
+#endif  // CS248_CACHE_FILE_H
@@ -86,6 +86,46 @@ void Camera::rotate_by(const double dPhi, const double dTheta) {
   compute_position();
 }
 
+void Camera::view_matrix(float m[16]) const {
+  Vector3D f = (targetPos - pos).unit();
+  Vector3D s = cross(f, up_dir()).unit();
+  Vector3D u = cross(s, f);
+  for (int i = 0; i < 3; i++) {
+    m[i * 4] = s[i];
+    m[i * 4 + 1] = u[i];
+    m[i * 4 + 2] = -f[i];
+    m[i * 4 + 3] = 0;
+  }
+  m[12] = -dot(s, pos);
+  m[13] = -dot(u, pos);
+  m[14] = dot(f, pos);
+  m[15] = 1;
+}
+
+void Camera::projection_matrix(float m[16]) const {
+  double f = 1.0 / tan(vFov * M_PI / 360.0);
+  for (int i = 0; i < 16; i++) m[i] = 0;
+  m[0] = f / ar;
+  m[5] = f;
+  m[10] = (fClip + nClip) / (nClip - fClip);
+  m[11] = -1;
+  m[14] = 2 * fClip * nClip / (nClip - fClip);
+}
+
+void Camera::view_projection_matrix(float m[16]) const {
+  float view[16], projection[16];
+  view_matrix(view);
+  projection_matrix(projection);
+  for (int c = 0; c < 4; c++) {
+    for (int r = 0; r < 4; r++) {
+      m[c * 4 + r] = projection[r] * view[c * 4] +
+                     projection[4 + r] * view[c * 4 + 1] +
+                     projection[8 + r] * view[c * 4 + 2] +
+                     projection[12 + r] * view[c * 4 + 3];
+    }
+  }
+}
+
 void Camera::compute_position() {
   double sinPhi = sin(phi);
   if (sinPhi == 0) {
@@ -66,6 +66,23 @@ class Camera {
   double aspect_ratio() const { return ar; }
   double near_clip() const { return nClip; }
   double far_clip() const { return fClip; }
+  size_t screen_width() const { return screenW; }
+  size_t screen_height() const { return screenH; }
+
+  /*
+    The world-to-camera matrix gluLookAt would make, column-major.
+  */
+  void view_matrix(float m[16]) const;
+
+  /*
+    The perspective projection gluPerspective would make, column-major.
+  */
+  void projection_matrix(float m[16]) const;
+
+  /*
+    projection_matrix() times view_matrix().
+  */
+  void view_projection_matrix(float m[16]) const;
 
  private:
   // Computes pos, screenXDir, screenYDir from target, r, phi, theta.
@@ -1,6 +1,10 @@
 #include "collada.h"
+#include "obj_parser.h"
 #include "math.h"
 #include "CS248/JSON.h"
+#include "../thread_pool.h"
+#include "../texture_registry.h"
+#include "../cache_file.h"
 
 #include <assert.h>
 #include <map>
@@ -10,6 +14,7 @@
 #include <sstream>
 #include <iostream>
 #include <algorithm>
+#include <future>
 
 // For more verbose output, uncomment the line below.
 #define stat(s)  // cerr << "[COLLADA Parser] " << s << endl;
@@ -130,7 +135,8 @@ string wstring_to_string(const wstring& str)
     return ret;
 }
 
-int ColladaParser::load(const char* filename, SceneInfo* sceneInfo) {
+int ColladaParser::load(const char* filename, SceneInfo* sceneInfo,
+                        MeshStreams* streams) {
   ifstream in(filename);
   if (!in.is_open()) {
     cerr << "Warning: could not open file " << filename << endl;
@@ -354,11 +360,18 @@ int ColladaParser::load(const char* filename, SceneInfo* sceneInfo) {
 
     if (root.find(L"meshes") != root.end() && root[L"meshes"]->IsArray()) {
         JSONArray mesh_json_array = root[L"meshes"]->AsArray();
+		// The JSON is read here; file parsing and image decoding for each mesh
+		// run as independent tasks on the thread pool (see load_mesh).
+		vector<future<int> > mesh_tasks;
+		vector<string> mesh_logs(mesh_json_array.size());
 		for(int i = 0; i < mesh_json_array.size(); ++i) {
 			if(!mesh_json_array[i]->IsObject()) continue;
 			JSONObject mesh_json_object = mesh_json_array[i]->AsObject();
 			Node node = Node();
 			PolymeshInfo* polymesh = new PolymeshInfo();
+			MeshLoadTask task;
+			task.polymesh = polymesh;
+			task.streams = streams;
             polymesh->position = Vector3D(0,0,0);
             polymesh->rotation = Vector3D(1,1,1);
             polymesh->scale = Vector3D(1,1,1);
@@ -382,20 +395,7 @@ int ColladaParser::load(const char* filename, SceneInfo* sceneInfo) {
 					material_filename = material_filename.substr(0, pos);
 					if(material_filename.substr(material_filename.find_last_of(".") + 1) == "mtl"
 						|| material_filename.substr(material_filename.find_last_of(".") + 1) == "MTL") {
-						ifstream in(material_filename);
-						if (!in.is_open()) {
-							cerr << "Warning: could not open file " << material_filename << endl;
-							return -1;
-						}
-
-						if(!parse_mtl(in, *polymesh)) {
-							cerr << "Error: bad obj format" << endl;
-							in.close();
-							return -1;
-						}
-
-						polymesh->is_mtl_file = true;
-						in.close();
+						task.material_filename = material_filename;
 					}
 				}
 			}
@@ -411,18 +411,7 @@ int ColladaParser::load(const char* filename, SceneInfo* sceneInfo) {
 					mesh_filename = mesh_filename.substr(0, pos);
 					if(mesh_filename.substr(mesh_filename.find_last_of(".") + 1) == "obj"
 							|| mesh_filename.substr(mesh_filename.find_last_of(".") + 1) == "OBJ") {
-						ifstream in(mesh_filename);
-						if (!in.is_open()) {
-							cerr << "Warning: could not open file " << mesh_filename << endl;
-							return -1;
-						}
- 
-						if(!parse_objmesh(in, *polymesh)) {
-							cerr << "Error: bad obj format" << endl;
-							in.close();
-							return -1;
-						}
-						in.close();
+						task.mesh_filename = mesh_filename;
 					}
 				}
 				pos = string::npos;
@@ -585,45 +574,22 @@ int ColladaParser::load(const char* filename, SceneInfo* sceneInfo) {
 				}
 			}
 			if (mesh_json_object.find(L"texcoord_u_scale") != mesh_json_object.end() && mesh_json_object[L"texcoord_u_scale"]->IsNumber()) {
-				double scale = mesh_json_object[L"texcoord_u_scale"]->AsNumber();
-				for(int i = 0; i < polymesh->texcoords.size(); ++i) {
-					polymesh->texcoords[i].x = polymesh->texcoords[i].x * scale;
-				}
+				task.has_u_scale = true;
+				task.u_scale = mesh_json_object[L"texcoord_u_scale"]->AsNumber();
 			}
 			if (mesh_json_object.find(L"texcoord_v_wrap") != mesh_json_object.end() && mesh_json_object[L"texcoord_v_wrap"]->IsString()) {
-				if(L"true" == mesh_json_object[L"texcoord_v_wrap"]->AsString()) {
-					for(int i = 0; i < polymesh->texcoords.size(); ++i) {
-						polymesh->texcoords[i].y = 1.0 - polymesh->texcoords[i].y;
-					}
-				}
+				task.v_wrap = L"true" == mesh_json_object[L"texcoord_v_wrap"]->AsString();
 			}
 			if (mesh_json_object.find(L"texcoord_u_flip") != mesh_json_object.end() && mesh_json_object[L"texcoord_u_flip"]->IsString()) {
-				if(L"true" == mesh_json_object[L"texcoord_u_flip"]->AsString()) {
-                    for(int i = 0; i < polymesh->texcoords.size(); ++i) {
-                        polymesh->texcoords[i].x = 1.0 - polymesh->texcoords[i].x;
-                    }
-                }
+				task.u_flip = L"true" == mesh_json_object[L"texcoord_u_flip"]->AsString();
 			}
 			if (mesh_json_object.find(L"texcoord_v_scale") != mesh_json_object.end() && mesh_json_object[L"texcoord_v_scale"]->IsNumber()) {
-				double scale = mesh_json_object[L"texcoord_v_scale"]->AsNumber();
-				for(int i = 0; i < polymesh->texcoords.size(); ++i) {
-					polymesh->texcoords[i].y = polymesh->texcoords[i].y * scale;
-				}
-			}
-			if (mesh_json_object.find(L"texcoord_v_wrap") != mesh_json_object.end() && mesh_json_object[L"texcoord_v_wrap"]->IsString()) {
-				if(L"true" == mesh_json_object[L"texcoord_v_wrap"]->AsString()) {
-					for(int i = 0; i < polymesh->texcoords.size(); ++i) {
-						polymesh->texcoords[i].y = 1.0 - polymesh->texcoords[i].y;
-					}
-				}
+				task.has_v_scale = true;
+				task.v_scale = mesh_json_object[L"texcoord_v_scale"]->AsNumber();
 			}
 			if (mesh_json_object.find(L"texcoord_v_flip") != mesh_json_object.end() && mesh_json_object[L"texcoord_v_flip"]->IsString()) {
-				if(L"true" == mesh_json_object[L"texcoord_v_flip"]->AsString()) {
-                    for(int i = 0; i < polymesh->texcoords.size(); ++i) {
-                        polymesh->texcoords[i].y = 1.0 - polymesh->texcoords[i].y;
-                    }
-                }
-            }
+				task.v_flip = L"true" == mesh_json_object[L"texcoord_v_flip"]->AsString();
+			}
 			if (mesh_json_object.find(L"parameters") != mesh_json_object.end() && mesh_json_object[L"parameters"]->IsArray()) {
 				JSONArray parameters_json_array = mesh_json_object[L"parameters"]->AsArray();
 				for(int i = 0; i < parameters_json_array.size(); ++i) {
@@ -646,7 +612,26 @@ int ColladaParser::load(const char* filename, SceneInfo* sceneInfo) {
 			node.instance = polymesh;
 			node.transform = Matrix4x4::identity();
 			scene->nodes.push_back(node);
+
+			string* log = &mesh_logs[i];
+			mesh_tasks.push_back(ThreadPool::shared().enqueue([task, log]() {
+				return load_mesh(task, *log);
+			}));
 		}
+
+		// Collect results in scene order so that messages and the reported
+		// error don't depend on which task finished first. Every task is
+		// waited for, since they write into the scene.
+		int status = 0;
+		for(size_t i = 0, t = 0; i < mesh_json_array.size(); ++i) {
+			if(!mesh_json_array[i]->IsObject()) continue;
+			int result = mesh_tasks[t++].get();
+			if(status == 0) {
+				cerr << mesh_logs[i];
+				status = result;
+			}
+		}
+		if(status < 0) return -1;
     }
 
       return 0;
@@ -1441,108 +1426,128 @@ void ColladaParser::parse_polymesh(XMLElement* xml, PolymeshInfo& polymesh) {
   stat("  |- " << polymesh);
 }
 
-bool ColladaParser::parse_objmesh(ifstream &in, PolymeshInfo& polymesh) {
-  polymesh.is_obj_file = true;
-  string line;
-  
-  while(getline(in, line)) {
-    if(line[0] == 'v') {
-      if(line[1] == ' ') {
-	    const char *cp = &line[2];
-        while(*cp == ' ') cp++;
-        Vector3D vertex;
-        if(sscanf(cp, "%lf %lf %lf", &vertex.x, &vertex.y, &vertex.z) == 3) {
-          polymesh.vertices.push_back(vertex);
-        }
-      } else if(line[1] == 'n') {
-	    const char *cp = &line[2];
-        while(*cp == ' ') cp++;
-        Vector3D normal;
-        if(sscanf(cp, "%lf %lf %lf", &normal.x, &normal.y, &normal.z) == 3) {
-          polymesh.normals.push_back(normal);
-        }
-      } else if(line[1] == 't') {
-	    const char *cp = &line[2];
-        while(*cp == ' ') cp++;
-        Vector2D texture_coordinate;
-        if(sscanf(cp, "%lf %lf", &texture_coordinate.x, &texture_coordinate.y) == 2) {
-          polymesh.texcoords.push_back(texture_coordinate);
-        }
-      }
-    }
+int ColladaParser::load_mesh(const MeshLoadTask& task, string& log) {
+  PolymeshInfo* polymesh = task.polymesh;
+  ostringstream out;
+
+  // Start decoding textures in the background right away; meshes with an MTL
+  // use its colors instead. Decode errors are reported when the textures are
+  // uploaded.
+  if (task.material_filename.empty()) {
+    request_texture(polymesh->diffuse_filename, TEXTURE_COLOR);
+    request_texture(polymesh->normal_filename, TEXTURE_NORMAL);
+    request_texture(polymesh->environment_filename, TEXTURE_COLOR);
+    request_texture(polymesh->alpha_filename, TEXTURE_ALPHA);
+    request_texture(polymesh->stub1_filename, TEXTURE_DATA);
+    request_texture(polymesh->stub2_filename, TEXTURE_DATA);
+    request_texture(polymesh->stub3_filename, TEXTURE_DATA);
   }
-  
-  in.clear();
-  in.seekg(0);
-  
-  while(getline(in, line)) {
-    if(line[0] == 'f' && line[1] == ' ') {
-      int vertex_index = 0;
-      int normal_index = 0;
-      int texture_coordinate_index = 0;
-      polymesh.polygons.push_back(Polygon());
-      Polygon &poly = polymesh.polygons[polymesh.polygons.size() - 1];
-	  const char *cp = &line[2];
-      while(*cp == ' ') cp++;
-      while(sscanf(cp, "%d//%d", &vertex_index, &normal_index) == 2) {
-        poly.vertex_indices.push_back(vertex_index - 1);
-		poly.normal_indices.push_back(normal_index - 1);
-        while(*cp && *cp != ' ') cp++;
-        while(*cp == ' ') cp++;
-      }
-      while(sscanf(cp, "%d/%d/%d", &vertex_index, &texture_coordinate_index, &normal_index) == 3) {
-        poly.vertex_indices.push_back(vertex_index - 1);
-        poly.texcoord_indices.push_back(texture_coordinate_index - 1);
-        poly.normal_indices.push_back(normal_index - 1);
-        while(*cp && *cp != ' ') cp++;
-        while(*cp == ' ') cp++;
-      }
-      while(sscanf(cp, "%d/%d", &vertex_index, &texture_coordinate_index) == 2) {
-        poly.vertex_indices.push_back(vertex_index - 1);
-        poly.texcoord_indices.push_back(texture_coordinate_index - 1);
-        while(*cp && *cp != ' ') cp++;
-        while(*cp == ' ') cp++;
-      }
-      while(sscanf(cp, "%d/", &vertex_index) == 1) {
-        poly.vertex_indices.push_back(vertex_index - 1);
-        while(*cp && *cp != ' ') cp++;
-        while(*cp == ' ') cp++;
-      }
-	  if(*cp) return false;
-      int size = polymesh.polygons[polymesh.polygons.size() - 1].vertex_indices.size();
-	  if(size != 3) stat("Non triangle detected");
+
+  string mtl_data, obj_data;
+  if (!task.material_filename.empty() &&
+      !ObjParser::read_file(task.material_filename, mtl_data)) {
+    out << "Warning: could not open file " << task.material_filename << endl;
+    log = out.str();
+    return -1;
+  }
+  if (!task.mesh_filename.empty() &&
+      !ObjParser::read_file(task.mesh_filename, obj_data)) {
+    out << "Warning: could not open file " << task.mesh_filename << endl;
+    log = out.str();
+    return -1;
+  }
+
+  auto parse = [&]() -> bool {
+    if (!task.material_filename.empty()) {
+      istringstream in(mtl_data);
+      if (!parse_mtl(in, *polymesh)) return false;
+      polymesh->is_mtl_file = true;
+    }
+    if (!task.mesh_filename.empty() &&
+        !ObjParser::parse(obj_data.data(), obj_data.data() + obj_data.size(),
+                          *polymesh)) {
+      return false;
     }
+    apply_texcoord_options(task, polymesh->texcoords);
+    return true;
+  };
+
+  bool parsed;
+  if (task.streams && !task.mesh_filename.empty()) {
+    // Besides the OBJ itself, the MTL (diffuse colors) and the texcoord
+    // options end up in the streams.
+    double options[] = {(double)task.has_u_scale, task.u_scale,
+                        (double)task.has_v_scale, task.v_scale,
+                        (double)task.v_wrap, (double)task.u_flip,
+                        (double)task.v_flip};
+    uint64_t inputs_hash = CacheFile::hash(task.mesh_filename.data(),
+                                           task.mesh_filename.size());
+    inputs_hash = CacheFile::hash(mtl_data.data(), mtl_data.size(),
+                                  inputs_hash);
+    inputs_hash = CacheFile::hash(options, sizeof(options), inputs_hash);
+    parsed = task.streams->load(*polymesh, task.mesh_filename, obj_data,
+                                inputs_hash, parse, out);
+    // the flags parse would have set, in case it was skipped
+    polymesh->is_obj_file = true;
+    polymesh->is_mtl_file = !task.material_filename.empty();
+  } else {
+    parsed = parse();
+  }
+  if (!parsed) {
+    out << "Error: bad obj format" << endl;
+    log = out.str();
+    return -1;
   }
 
-  in.clear();
-  in.seekg(0);
-
-  polymesh.material_diffuse_parameters.resize(polymesh.polygons.size());
-
-  Vector3D diffuse_value = Vector3D();
-  int face_id = 0;
-  while(getline(in, line)) {
-	if(line[0] == 'u' && line[1] == 's' && line[2] == 'e' && line[3] == 'm' && line[4] == 't' && line[5] == 'l' && line[6] == ' ') {
-		const char *cp = &line[7];
-		while(*cp == ' ') cp++;
-		char material_name[255];
-		if(sscanf(cp, "%s", material_name) == 1) {
-			for(int i = 0; i < polymesh.material_names.size(); ++i) {
-				if(polymesh.material_names[i] == string(material_name)) {
-					diffuse_value = polymesh.material_diffuse_values[i];
-					break;
-				}
-			}
-		}
-	} else if(line[0] == 'f' && line[1] == ' ') {
-		polymesh.material_diffuse_parameters[face_id++] = diffuse_value;
-	}
+  log = out.str();
+  return 0;
+}
+
+void ColladaParser::apply_texcoord_options(const MeshLoadTask& task,
+                                           vector<Vector2D>& texcoords) {
+  // same order as the JSON keys were always applied in; v_wrap runs twice
+  if (task.has_u_scale) {
+    for (size_t i = 0; i < texcoords.size(); ++i) texcoords[i].x *= task.u_scale;
+  }
+  if (task.v_wrap) {
+    for (size_t i = 0; i < texcoords.size(); ++i) texcoords[i].y = 1.0 - texcoords[i].y;
+  }
+  if (task.u_flip) {
+    for (size_t i = 0; i < texcoords.size(); ++i) texcoords[i].x = 1.0 - texcoords[i].x;
+  }
+  if (task.has_v_scale) {
+    for (size_t i = 0; i < texcoords.size(); ++i) texcoords[i].y *= task.v_scale;
   }
+  if (task.v_wrap) {
+    for (size_t i = 0; i < texcoords.size(); ++i) texcoords[i].y = 1.0 - texcoords[i].y;
+  }
+  if (task.v_flip) {
+    for (size_t i = 0; i < texcoords.size(); ++i) texcoords[i].y = 1.0 - texcoords[i].y;
+  }
+}
 
-  return true;
+void ColladaParser::request_texture(const string& filename,
+                                    TextureUsage usage) {
+  if (filename.empty()) return;
+  TextureRegistry::shared().request(filename, usage);
+}
+
+bool ColladaParser::parse_objmesh(ifstream &in, PolymeshInfo& polymesh) {
+  // slurp the whole file and parse it in a single pass
+  in.seekg(0, ios::end);
+  streamoff size = in.tellg();
+  in.seekg(0, ios::beg);
+
+  string data(size > 0 ? (size_t)size : 0, '\0');
+  if (!data.empty()) {
+    in.read(&data[0], data.size());
+    data.resize((size_t)in.gcount());
+  }
+
+  return ObjParser::parse(data.data(), data.data() + data.size(), polymesh);
 }
 
-bool ColladaParser::parse_mtl(ifstream &in, PolymeshInfo& polymesh) {
+bool ColladaParser::parse_mtl(istream &in, PolymeshInfo& polymesh) {
 	string line;
 	while(getline(in, line)) {
 		if(line[0] == 'n' && line[1] == 'e' && line[2] == 'w' && line[3] == 'm' && line[4] == 't' && line[5] == 'l' && line[6] == ' ') {
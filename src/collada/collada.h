@@ -15,8 +15,10 @@
 #include "light_info.h"
 #include "sphere_info.h"
 #include "polymesh_info.h"
+#include "mesh_streams.h"
 #include "../dynamic_scene/scene.h"
 #include "../dynamic_scene/mesh.h"
+#include "../texture_registry.h"
 
 using namespace tinyxml2;
 
@@ -30,7 +32,10 @@ namespace Collada {
 */
 class ColladaParser {
  public:
-  static int load(const char* filename, SceneInfo* sceneInfo);
+  // The vertex streams of OBJ meshes in JSON scenes are made by streams, if
+  // given, as the meshes are loaded.
+  static int load(const char* filename, SceneInfo* sceneInfo,
+                  MeshStreams* streams = nullptr);
   static int save(const char* filename, const SceneInfo* sceneInfo);
 
  private:
@@ -71,7 +76,35 @@ class ColladaParser {
   static void parse_sphere(XMLElement* xml, SphereInfo& sphere);
   static void parse_polymesh(XMLElement* xml, PolymeshInfo& polymesh);
   static bool parse_objmesh(std::ifstream& in, PolymeshInfo& polymesh);
-  static bool parse_mtl(std::ifstream& in, PolymeshInfo& polymesh);
+  static bool parse_mtl(std::istream& in, PolymeshInfo& polymesh);
+
+  // File work for one entry of a JSON scene's "meshes" array, gathered on
+  // the main thread so that it can run on a worker without touching the JSON
+  struct MeshLoadTask {
+    PolymeshInfo* polymesh;
+    MeshStreams* streams;           ///< makes the OBJ's streams, if given
+    std::string material_filename;  ///< MTL to parse, if any
+    std::string mesh_filename;      ///< OBJ to parse, if any
+
+    bool has_u_scale, has_v_scale;  ///< texcoord_{u,v}_scale
+    double u_scale, v_scale;
+    bool v_wrap, u_flip, v_flip;    ///< texcoord_v_wrap, _u_flip, _v_flip
+
+    MeshLoadTask()
+        : polymesh(nullptr), streams(nullptr), has_u_scale(false),
+          has_v_scale(false), u_scale(1), v_scale(1), v_wrap(false),
+          u_flip(false), v_flip(false) {}
+  };
+
+  // Parses the MTL and OBJ files of a mesh and applies its texcoord options,
+  // through the task's MeshStreams if it has any, and starts decoding its
+  // textures. Messages go to log rather than cerr so that the
+  // caller can print them in scene order. Returns -1 on failure.
+  static int load_mesh(const MeshLoadTask& task, std::string& log);
+  static void apply_texcoord_options(const MeshLoadTask& task,
+                                     std::vector<Vector2D>& texcoords);
+  static void request_texture(const std::string& filename,
+                              TextureUsage usage);
 
 };  // class ColladaParser
 
@@ -0,0 +1,37 @@
+#ifndef CS248_COLLADA_MESHSTREAMS_H
+#define CS248_COLLADA_MESHSTREAMS_H
+
+#include <stdint.h>
+#include <functional>
+#include <ostream>
+#include <string>
+
+#include "polymesh_info.h"
+
+namespace CS248 {
+namespace Collada {
+
+/*
+  Receives the OBJ meshes of a JSON scene as they are loaded, so that the
+  caller can build (or look up) their vertex streams and keep them itself.
+  ColladaParser::load calls it from its worker threads, once per mesh, after
+  the mesh's files have been read.
+*/
+class MeshStreams {
+ public:
+  virtual ~MeshStreams() {}
+
+  // Makes the streams of polymesh. parse fills in polymesh from the mesh's
+  // files and returns false if they are malformed; it may be skipped if the
+  // streams can be had without it. inputs_hash covers everything besides the
+  // OBJ contents that the parsed mesh depends on. Messages go to log.
+  // Returns false if parse failed.
+  virtual bool load(PolymeshInfo& polymesh, const std::string& obj_filename,
+                    const std::string& obj_data, uint64_t inputs_hash,
+                    const std::function<bool()>& parse, std::ostream& log) = 0;
+};
+
+}  // namespace Collada
+}  // namespace CS248
+
+#endif  // CS248_COLLADA_MESHSTREAMS_H
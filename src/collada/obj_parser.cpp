@@ -0,0 +1,477 @@
+#include "obj_parser.h"
+
+#include "../thread_pool.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+
+using namespace std;
+
+namespace CS248 {
+namespace Collada {
+
+// Scanner Helpers //
+
+namespace {
+
+// Powers of ten that are exactly representable as doubles.
+const double kPow10[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+                         1e8,  1e9,  1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+                         1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+inline bool is_blank(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+inline bool is_digit(char c) { return (unsigned char)(c - '0') < 10; }
+
+inline const char* skip_blanks(const char* p, const char* end) {
+  while (p < end && is_blank(*p)) ++p;
+  return p;
+}
+
+inline const char* skip_token(const char* p, const char* end) {
+  while (p < end && !is_blank(*p) && *p != '\n') ++p;
+  return p;
+}
+
+inline const char* next_line(const char* p, const char* end) {
+  const char* nl = (const char*)memchr(p, '\n', end - p);
+  return nl ? nl + 1 : end;
+}
+
+/*
+  Scans a decimal floating point number. Numbers that fit Clinger's fast path
+  (at most 19 significant digits, a mantissa below 2^53 and a power of ten
+  within 1e22) are converted exactly with a single multiply or divide; anything
+  else falls back to strtod, so the result always matches what sscanf("%lf")
+  produced in the old loader.
+*/
+inline bool scan_double(const char*& p, const char* end, double& value) {
+  const char* s = p;
+  bool negative = false;
+  if (s < end && (*s == '-' || *s == '+')) {
+    negative = *s == '-';
+    ++s;
+  }
+
+  uint64_t mantissa = 0;
+  int significant = 0;
+  int exponent = 0;
+  bool any_digits = false;
+
+  while (s < end && is_digit(*s)) {
+    any_digits = true;
+    if (mantissa || *s != '0') {
+      if (++significant > 19) goto slow;
+      mantissa = mantissa * 10 + (*s - '0');
+    }
+    ++s;
+  }
+  if (s < end && *s == '.') {
+    ++s;
+    while (s < end && is_digit(*s)) {
+      any_digits = true;
+      if (mantissa || *s != '0') {
+        if (++significant > 19) goto slow;
+        mantissa = mantissa * 10 + (*s - '0');
+      }
+      --exponent;
+      ++s;
+    }
+  }
+  if (!any_digits) goto slow;  // inf, nan, hex floats, or not a number at all
+
+  if (s < end && (*s == 'e' || *s == 'E')) {
+    const char* e = s + 1;
+    bool negative_exponent = false;
+    if (e < end && (*e == '-' || *e == '+')) {
+      negative_exponent = *e == '-';
+      ++e;
+    }
+    if (e >= end || !is_digit(*e)) goto slow;
+    int exp10 = 0;
+    while (e < end && is_digit(*e)) {
+      if (exp10 < 10000) exp10 = exp10 * 10 + (*e - '0');
+      ++e;
+    }
+    exponent += negative_exponent ? -exp10 : exp10;
+    s = e;
+  }
+
+  if (mantissa == 0) {
+    value = negative ? -0.0 : 0.0;
+    p = s;
+    return true;
+  }
+  if (mantissa > (uint64_t(1) << 53) || exponent < -22 || exponent > 22)
+    goto slow;
+
+  value = (double)mantissa;
+  value = exponent < 0 ? value / kPow10[-exponent] : value * kPow10[exponent];
+  if (negative) value = -value;
+  p = s;
+  return true;
+
+slow:
+  // strtod would skip whitespace, including the newline ending this line
+  if (p >= end || is_blank(*p) || *p == '\n') return false;
+  char* stop;
+  value = strtod(p, &stop);
+  if (stop == p) return false;
+  p = stop;
+  return true;
+}
+
+inline bool scan_int(const char*& p, const char* end, long& value) {
+  const char* s = p;
+  bool negative = false;
+  if (s < end && (*s == '-' || *s == '+')) {
+    negative = *s == '-';
+    ++s;
+  }
+  if (s >= end || !is_digit(*s)) return false;
+  long v = 0;
+  while (s < end && is_digit(*s)) {
+    v = v * 10 + (*s - '0');
+    ++s;
+  }
+  value = negative ? -v : v;
+  p = s;
+  return true;
+}
+
+inline bool keyword_is(const char* p, const char* q, const char* keyword) {
+  size_t len = strlen(keyword);
+  return (size_t)(q - p) == len && memcmp(p, keyword, len) == 0;
+}
+
+// Chunked Parsing //
+
+// Chunks are at least this large, and each thread gets a few of them so that
+// uneven lines (faces vs. vertices) still balance out.
+const size_t kMinChunkBytes = 1 << 20;
+const size_t kChunksPerThread = 4;
+
+// A relative (negative) index seen in a chunk. It can only be resolved once
+// the number of elements in all previous chunks is known.
+struct IndexFixup {
+  enum Kind { VERTEX, TEXCOORD, NORMAL };
+
+  size_t face;       // face index within the chunk
+  size_t corner;     // position within that face's index list
+  Kind kind;
+  size_t available;  // elements of this kind parsed earlier in the chunk
+  size_t offset;     // the index, negated
+};
+
+// Output of parsing one line-aligned slice of the file.
+struct ObjChunk {
+  // Global offsets of a chunk, from the prefix sums over earlier chunks.
+  struct Bases {
+    size_t vertices, normals, texcoords, faces;
+    Vector3D diffuse;  // material in effect when the chunk starts
+  };
+
+  vector<Vector3D> vertices;
+  vector<Vector3D> normals;
+  vector<Vector2D> texcoords;
+  vector<Polygon> polygons;
+  vector<Vector3D> diffuse;  // per face
+  vector<IndexFixup> fixups;
+
+  size_t leading_faces;  // faces before the first usemtl that took effect
+  bool has_material;     // whether any usemtl took effect
+  Vector3D last_diffuse; // material in effect at the end of the chunk
+  bool ok;
+
+  ObjChunk() : leading_faces(0), has_material(false), ok(false) {}
+};
+
+bool parse_index(long index, size_t available, IndexFixup::Kind kind,
+                 size_t corner, ObjChunk& chunk, vector<size_t>& indices) {
+  if (index > 0) {
+    indices.push_back((size_t)(index - 1));
+    return true;
+  }
+  if (index == 0) return false;
+
+  IndexFixup fixup;
+  fixup.face = chunk.polygons.size();
+  fixup.corner = corner;
+  fixup.kind = kind;
+  fixup.available = available;
+  fixup.offset = (size_t)(-index);
+  chunk.fixups.push_back(fixup);
+  indices.push_back(0);
+  return true;
+}
+
+bool resolve_fixups(ObjChunk& chunk, const ObjChunk::Bases& base) {
+  for (const IndexFixup& fixup : chunk.fixups) {
+    Polygon& poly = chunk.polygons[fixup.face];
+    size_t count = fixup.available;
+    vector<size_t>* indices;
+    switch (fixup.kind) {
+      case IndexFixup::VERTEX:
+        count += base.vertices;
+        indices = &poly.vertex_indices;
+        break;
+      case IndexFixup::TEXCOORD:
+        count += base.texcoords;
+        indices = &poly.texcoord_indices;
+        break;
+      default:
+        count += base.normals;
+        indices = &poly.normal_indices;
+        break;
+    }
+    if (fixup.offset > count) return false;
+    (*indices)[fixup.corner] = count - fixup.offset;
+  }
+  return true;
+}
+
+// Parses the lines in [begin, end). Materials are looked up in
+// materials.material_names.
+bool parse_chunk(const char* begin, const char* end,
+                 const PolymeshInfo& materials, ObjChunk& chunk) {
+  // per-face scratch space, reused so steady-state parsing doesn't allocate
+  vector<size_t> vertex_indices, texcoord_indices, normal_indices;
+
+  Vector3D diffuse_value = Vector3D();
+
+  const char* line = begin;
+  while (line < end) {
+    const char* eol = next_line(line, end);
+    const char* p = skip_blanks(line, eol);
+    const char* q = skip_token(p, eol);
+
+    if (q - p == 1 && *p == 'v') {
+      Vector3D vertex;
+      const char* c = skip_blanks(q, eol);
+      if (scan_double(c, eol, vertex.x) &&
+          scan_double(c = skip_blanks(c, eol), eol, vertex.y) &&
+          scan_double(c = skip_blanks(c, eol), eol, vertex.z)) {
+        chunk.vertices.push_back(vertex);
+      }
+    } else if (q - p == 2 && p[0] == 'v' && p[1] == 'n') {
+      Vector3D normal;
+      const char* c = skip_blanks(q, eol);
+      if (scan_double(c, eol, normal.x) &&
+          scan_double(c = skip_blanks(c, eol), eol, normal.y) &&
+          scan_double(c = skip_blanks(c, eol), eol, normal.z)) {
+        chunk.normals.push_back(normal);
+      }
+    } else if (q - p == 2 && p[0] == 'v' && p[1] == 't') {
+      Vector2D texcoord;
+      const char* c = skip_blanks(q, eol);
+      if (scan_double(c, eol, texcoord.x) &&
+          scan_double(c = skip_blanks(c, eol), eol, texcoord.y)) {
+        chunk.texcoords.push_back(texcoord);
+      }
+    } else if (q - p == 1 && *p == 'f') {
+      vertex_indices.clear();
+      texcoord_indices.clear();
+      normal_indices.clear();
+
+      // each corner is one of v, v/t, v//n or v/t/n
+      const char* c = skip_blanks(q, eol);
+      while (c < eol && *c != '\n') {
+        long v, t, n;
+        if (!scan_int(c, eol, v) ||
+            !parse_index(v, chunk.vertices.size(), IndexFixup::VERTEX,
+                         vertex_indices.size(), chunk, vertex_indices)) {
+          return false;
+        }
+        if (c < eol && *c == '/') {
+          ++c;
+          if (c < eol && *c == '/') {
+            ++c;
+            if (!scan_int(c, eol, n) ||
+                !parse_index(n, chunk.normals.size(), IndexFixup::NORMAL,
+                             normal_indices.size(), chunk, normal_indices)) {
+              return false;
+            }
+          } else {
+            if (!scan_int(c, eol, t) ||
+                !parse_index(t, chunk.texcoords.size(), IndexFixup::TEXCOORD,
+                             texcoord_indices.size(), chunk,
+                             texcoord_indices)) {
+              return false;
+            }
+            if (c < eol && *c == '/') {
+              ++c;
+              if (scan_int(c, eol, n) &&
+                  !parse_index(n, chunk.normals.size(), IndexFixup::NORMAL,
+                               normal_indices.size(), chunk, normal_indices)) {
+                return false;
+              }
+            }
+          }
+        }
+        c = skip_blanks(skip_token(c, eol), eol);
+      }
+
+      chunk.polygons.push_back(Polygon());
+      Polygon& poly = chunk.polygons.back();
+      poly.vertex_indices.assign(vertex_indices.begin(), vertex_indices.end());
+      poly.texcoord_indices.assign(texcoord_indices.begin(),
+                                   texcoord_indices.end());
+      poly.normal_indices.assign(normal_indices.begin(), normal_indices.end());
+      chunk.diffuse.push_back(diffuse_value);
+      if (!chunk.has_material) chunk.leading_faces++;
+    } else if (keyword_is(p, q, "usemtl")) {
+      const char* name = skip_blanks(q, eol);
+      const char* name_end = skip_token(name, eol);
+      if (name < name_end) {
+        size_t len = name_end - name;
+        for (size_t i = 0; i < materials.material_names.size(); ++i) {
+          const string& material_name = materials.material_names[i];
+          if (material_name.size() == len &&
+              memcmp(material_name.data(), name, len) == 0) {
+            diffuse_value = materials.material_diffuse_values[i];
+            chunk.has_material = true;
+            chunk.last_diffuse = diffuse_value;
+            break;
+          }
+        }
+      }
+    }
+
+    line = eol;
+  }
+
+  return true;
+}
+
+}  // namespace
+
+bool ObjParser::parse(const char* begin, const char* end,
+                      PolymeshInfo& polymesh, size_t max_threads) {
+  polymesh.is_obj_file = true;
+
+  ThreadPool* pool = NULL;
+  size_t num_chunks = 1;
+  if (max_threads != 1 && (size_t)(end - begin) >= 2 * kMinChunkBytes) {
+    pool = &ThreadPool::shared();
+    size_t threads = max_threads ? max_threads : pool->size();
+    num_chunks = min(threads * kChunksPerThread,
+                     (size_t)(end - begin) / kMinChunkBytes);
+  }
+
+  // split at line boundaries
+  vector<const char*> bounds(num_chunks + 1, end);
+  bounds[0] = begin;
+  for (size_t i = 1; i < num_chunks; ++i) {
+    const char* p = begin + (end - begin) / num_chunks * i;
+    if (p <= bounds[i - 1]) p = bounds[i - 1];
+    else if (p[-1] != '\n') p = next_line(p, end);
+    bounds[i] = p;
+  }
+
+  vector<ObjChunk> chunks(num_chunks);
+  auto parse_one = [&](size_t i) {
+    chunks[i].ok = parse_chunk(bounds[i], bounds[i + 1], polymesh, chunks[i]);
+  };
+  if (pool) {
+    pool->parallel_for(num_chunks, parse_one, max_threads);
+  } else {
+    parse_one(0);
+  }
+
+  // Prefix sums over the chunk sizes give each chunk's offset into the global
+  // arrays; relative indices and inherited materials follow from them.
+  vector<ObjChunk::Bases> bases(num_chunks);
+  ObjChunk::Bases total;
+  total.vertices = polymesh.vertices.size();
+  total.normals = polymesh.normals.size();
+  total.texcoords = polymesh.texcoords.size();
+  total.faces = polymesh.polygons.size();
+  Vector3D diffuse_value = Vector3D();
+  for (size_t i = 0; i < num_chunks; ++i) {
+    if (!chunks[i].ok) return false;
+    bases[i] = total;
+    bases[i].diffuse = diffuse_value;
+    total.vertices += chunks[i].vertices.size();
+    total.normals += chunks[i].normals.size();
+    total.texcoords += chunks[i].texcoords.size();
+    total.faces += chunks[i].polygons.size();
+    if (chunks[i].has_material) diffuse_value = chunks[i].last_diffuse;
+  }
+
+  // A single chunk parsed into an empty mesh is handed over without copying.
+  bool in_place = num_chunks == 1 && polymesh.vertices.empty() &&
+                  polymesh.normals.empty() && polymesh.texcoords.empty() &&
+                  polymesh.polygons.empty() &&
+                  polymesh.material_diffuse_parameters.empty();
+  if (!in_place) {
+    polymesh.vertices.resize(total.vertices);
+    polymesh.normals.resize(total.normals);
+    polymesh.texcoords.resize(total.texcoords);
+    polymesh.polygons.resize(total.faces);
+    polymesh.material_diffuse_parameters.resize(total.faces);
+  }
+
+  auto merge_one = [&](size_t i) {
+    ObjChunk& chunk = chunks[i];
+    const ObjChunk::Bases& base = bases[i];
+    if (!resolve_fixups(chunk, base)) {
+      chunk.ok = false;
+      return;
+    }
+    fill(chunk.diffuse.begin(), chunk.diffuse.begin() + chunk.leading_faces,
+         base.diffuse);
+    if (in_place) return;
+
+    copy(chunk.vertices.begin(), chunk.vertices.end(),
+         polymesh.vertices.begin() + base.vertices);
+    copy(chunk.normals.begin(), chunk.normals.end(),
+         polymesh.normals.begin() + base.normals);
+    copy(chunk.texcoords.begin(), chunk.texcoords.end(),
+         polymesh.texcoords.begin() + base.texcoords);
+    move(chunk.polygons.begin(), chunk.polygons.end(),
+         polymesh.polygons.begin() + base.faces);
+    copy(chunk.diffuse.begin(), chunk.diffuse.end(),
+         polymesh.material_diffuse_parameters.begin() + base.faces);
+  };
+  if (pool) {
+    pool->parallel_for(num_chunks, merge_one, max_threads);
+  } else {
+    merge_one(0);
+  }
+
+  for (size_t i = 0; i < num_chunks; ++i) {
+    if (!chunks[i].ok) return false;
+  }
+
+  if (in_place) {
+    ObjChunk& chunk = chunks[0];
+    polymesh.vertices.swap(chunk.vertices);
+    polymesh.normals.swap(chunk.normals);
+    polymesh.texcoords.swap(chunk.texcoords);
+    polymesh.polygons.swap(chunk.polygons);
+    polymesh.material_diffuse_parameters.swap(chunk.diffuse);
+  }
+
+  return true;
+}
+
+bool ObjParser::read_file(const string& filename, string& data) {
+  ifstream in(filename, ios::in | ios::binary);
+  if (!in.is_open()) return false;
+
+  in.seekg(0, ios::end);
+  streamoff size = in.tellg();
+  in.seekg(0, ios::beg);
+
+  data.resize(size > 0 ? (size_t)size : 0);
+  if (!data.empty()) {
+    in.read(&data[0], data.size());
+    data.resize((size_t)in.gcount());
+  }
+  return true;
+}
+
+}  // namespace Collada
+}  // namespace CS248
@@ -0,0 +1,39 @@
+#ifndef CS248_COLLADA_OBJPARSER_H
+#define CS248_COLLADA_OBJPARSER_H
+
+#include <string>
+#include <vector>
+
+#include "polymesh_info.h"
+
+namespace CS248 {
+namespace Collada {
+
+/*
+  Single-pass Wavefront OBJ parser.
+  Positions, normals, texcoords, faces and material switches (usemtl) are all
+  handled in one sweep over an in-memory copy of the file, using a hand-written
+  number scanner instead of getline/sscanf. Materials referenced by usemtl are
+  looked up in polymesh.material_names, so any MTL file must be parsed first.
+
+  Large files are split at line boundaries and the pieces are parsed on the
+  shared thread pool; a prefix sum over the per-piece counts then rebases
+  relative indices and carries materials across piece boundaries, so the
+  result is identical to a serial parse.
+*/
+class ObjParser {
+ public:
+  // Parses the OBJ text in [begin, end) into polymesh. The buffer must be
+  // followed by a NUL byte (std::string storage satisfies this). At most
+  // max_threads threads are used; zero means the whole pool, one is serial.
+  static bool parse(const char* begin, const char* end, PolymeshInfo& polymesh,
+                    size_t max_threads = 0);
+
+  // Reads a whole file into data. Returns false if the file can't be opened.
+  static bool read_file(const std::string& filename, std::string& data);
+};
+
+}  // namespace Collada
+}  // namespace CS248
+
+#endif  // CS248_COLLADA_OBJPARSER_H
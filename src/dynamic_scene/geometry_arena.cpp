@@ -0,0 +1,237 @@
+#include "geometry_arena.h"
+
+#include "../uniform_blocks.h"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace CS248 {
+namespace DynamicScene {
+
+namespace {
+
+// Vertices and indices the arena starts with; each doubles whenever it runs
+// out.
+const size_t kInitialCapacity = 1 << 16;
+const size_t kInitialIndexCapacity = 3 << 16;
+
+// Replaces a buffer with a larger one holding the same data at the start.
+void resize(GLuint* buffer, size_t old_size, size_t new_size) {
+  GLuint resized;
+  glGenBuffers(1, &resized);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, resized);
+  glBufferData(GL_COPY_WRITE_BUFFER, new_size, nullptr, GL_STATIC_DRAW);
+  if (*buffer) {
+    glBindBuffer(GL_COPY_READ_BUFFER, *buffer);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0,
+                        old_size);
+    glDeleteBuffers(1, buffer);
+  }
+  *buffer = resized;
+}
+
+}  // namespace
+
+long RangeAllocator::allocate(size_t count) {
+  for (size_t i = 0; i < free_ranges.size(); ++i) {
+    pair<size_t, size_t>& range = free_ranges[i];
+    if (range.second < count) continue;
+    size_t first = range.first;
+    range.first += count;
+    range.second -= count;
+    if (range.second == 0) free_ranges.erase(free_ranges.begin() + i);
+    return (long)first;
+  }
+  return -1;
+}
+
+void RangeAllocator::release(size_t first, size_t count) {
+  if (count == 0) return;
+  auto next = lower_bound(free_ranges.begin(), free_ranges.end(),
+                          make_pair(first, (size_t)0));
+  next = free_ranges.insert(next, make_pair(first, count));
+
+  // merge with the following range, then with the preceding one
+  auto after = next + 1;
+  if (after != free_ranges.end() && next->first + next->second == after->first) {
+    next->second += after->second;
+    free_ranges.erase(after);
+  }
+  if (next != free_ranges.begin()) {
+    auto before = next - 1;
+    if (before->first + before->second == next->first) {
+      before->second += next->second;
+      free_ranges.erase(next);
+    }
+  }
+}
+
+void RangeAllocator::grow(size_t new_capacity) {
+  if (new_capacity <= capacity) return;
+  size_t old_capacity = capacity;
+  capacity = new_capacity;
+  release(old_capacity, new_capacity - old_capacity);
+}
+
+GeometryArena& GeometryArena::shared() {
+  static GeometryArena arena;
+  return arena;
+}
+
+GeometryArena::GeometryArena()
+    : vertices(0), indices(0), layout(VertexFormat::layout()),
+      used_vertices(0), draw_ids(0) {}
+
+GeometryArena::Allocation GeometryArena::allocate(const MeshBuffers& buffers) {
+  Allocation allocation = {0, 0};
+  size_t count = buffers.num_vertices;
+  if (count == 0) return allocation;
+
+  // Indices go through the copy target: binding them as element array
+  // would change whatever vertex array is bound. The levels of detail
+  // follow the full mesh's indices.
+  size_t num_indices = buffers.num_indices + buffers.num_lod_indices;
+  long first_index = index_ranges.allocate(num_indices);
+  if (first_index < 0) {
+    grow_indices(max(index_ranges.size() * 2,
+                     index_ranges.size() + num_indices));
+    first_index = index_ranges.allocate(num_indices);
+  }
+  glBindBuffer(GL_COPY_WRITE_BUFFER, indices);
+  glBufferSubData(GL_COPY_WRITE_BUFFER, first_index * sizeof(uint32_t),
+                  buffers.num_indices * sizeof(uint32_t), buffers.indices);
+  if (buffers.num_lod_indices) {
+    glBufferSubData(GL_COPY_WRITE_BUFFER,
+                    (first_index + buffers.num_indices) * sizeof(uint32_t),
+                    buffers.num_lod_indices * sizeof(uint32_t),
+                    buffers.lod_indices);
+  }
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  allocation.first_index = (GLint)first_index;
+
+  long first = ranges.allocate(count);
+  if (first < 0) {
+    grow(max(ranges.size() * 2, ranges.size() + count));
+    first = ranges.allocate(count);
+  }
+
+  vector<uint8_t> packed(count * layout.stride);
+  VertexFormat::pack(buffers, packed.data());
+  glBindBuffer(GL_ARRAY_BUFFER, vertices);
+  glBufferSubData(GL_ARRAY_BUFFER, first * layout.stride, packed.size(),
+                  packed.data());
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  used_vertices += count;
+  allocation.first_vertex = (GLint)first;
+  return allocation;
+}
+
+void GeometryArena::release(const Allocation& allocation,
+                            const MeshBuffers& buffers) {
+  if (buffers.num_vertices == 0) return;
+  ranges.release(allocation.first_vertex, buffers.num_vertices);
+  used_vertices -= buffers.num_vertices;
+  index_ranges.release(allocation.first_index,
+                       buffers.num_indices + buffers.num_lod_indices);
+}
+
+void GeometryArena::grow(size_t min_capacity) {
+  size_t old_capacity = ranges.size();
+  size_t new_capacity = max(min_capacity, kInitialCapacity);
+
+  // Copy the vertices into a larger buffer on the GPU.
+  resize(&vertices, old_capacity * layout.stride,
+         new_capacity * layout.stride);
+  glBindBuffer(GL_COPY_READ_BUFFER, 0);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+  if (!draw_ids) {
+    vector<float> ids(kMaxDrawsPerCall);
+    for (int i = 0; i < kMaxDrawsPerCall; ++i) ids[i] = i;
+    glGenBuffers(1, &draw_ids);
+    glBindBuffer(GL_ARRAY_BUFFER, draw_ids);
+    glBufferData(GL_ARRAY_BUFFER, ids.size() * sizeof(float), ids.data(),
+                 GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+  }
+
+  clear_vertex_arrays();
+  ranges.grow(new_capacity);
+}
+
+void GeometryArena::grow_indices(size_t min_capacity) {
+  size_t old_capacity = index_ranges.size();
+  size_t new_capacity = max(min_capacity, kInitialIndexCapacity);
+  resize(&indices, old_capacity * sizeof(uint32_t),
+         new_capacity * sizeof(uint32_t));
+  glBindBuffer(GL_COPY_READ_BUFFER, 0);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+  clear_vertex_arrays();
+  index_ranges.grow(new_capacity);
+}
+
+void GeometryArena::clear_vertex_arrays() {
+  for (auto& entry : vertex_arrays) glDeleteVertexArrays(1, &entry.second.vao);
+  vertex_arrays.clear();
+}
+
+GLuint GeometryArena::vertex_array(const Shader& shader, int* setup_calls) {
+  auto found = vertex_arrays.find(shader._programID);
+  if (found == vertex_arrays.end()) {
+    // Record which streams feed which of the program's attributes once; a
+    // draw then only has to bind the vertex array.
+    VertexArray& vertex_array = vertex_arrays[shader._programID];
+    vertex_array.setup_calls = 0;
+    glGenVertexArrays(1, &vertex_array.vao);
+    glBindVertexArray(vertex_array.vao);
+
+    // Positions are quantized or float depending on the layout; w is the
+    // bitangent sign either way.
+    GLenum position_type =
+        layout.quantized_positions ? GL_UNSIGNED_SHORT : GL_FLOAT;
+    struct {
+      ShaderAttribute attribute;
+      GLint size;
+      GLenum type;
+      GLboolean normalized;
+      size_t offset;
+    } streams[] = {
+        {ATTRIBUTE_POSITION, 4, position_type, GL_TRUE, layout.position},
+        {ATTRIBUTE_DIFFUSE_COLOR, 4, GL_UNSIGNED_BYTE, GL_TRUE,
+         layout.diffuse_color},
+        {ATTRIBUTE_NORMAL, 2, GL_SHORT, GL_TRUE, layout.normal},
+        {ATTRIBUTE_TEXCOORD, 2, GL_HALF_FLOAT, GL_FALSE, layout.texcoord},
+        {ATTRIBUTE_TANGENT, 2, GL_SHORT, GL_TRUE, layout.tangent},
+    };
+    for (const auto& stream : streams) {
+      GLint loc = shader.attributeLocation(stream.attribute);
+      if (loc < 0) continue;
+      glBindBuffer(GL_ARRAY_BUFFER, vertices);
+      glVertexAttribPointer(loc, stream.size, stream.type, stream.normalized,
+                            layout.stride, (const GLvoid*)stream.offset);
+      glEnableVertexAttribArray(loc);
+      vertex_array.setup_calls += 3;
+    }
+    GLint loc = shader.attributeLocation(ATTRIBUTE_DRAW_ID);
+    if (loc >= 0) {
+      glBindBuffer(GL_ARRAY_BUFFER, draw_ids);
+      glVertexAttribPointer(loc, 1, GL_FLOAT, GL_FALSE, 0, 0);
+      glEnableVertexAttribArray(loc);
+      glVertexAttribDivisor(loc, 1);
+      vertex_array.setup_calls += 3;
+    }
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices);
+    vertex_array.setup_calls++;
+
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    found = vertex_arrays.find(shader._programID);
+  }
+  if (setup_calls) *setup_calls = found->second.setup_calls;
+  return found->second.vao;
+}
+
+}  // namespace DynamicScene
+}  // namespace CS248
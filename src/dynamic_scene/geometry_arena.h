@@ -0,0 +1,122 @@
+#ifndef CS248_DYNAMICSCENE_GEOMETRY_ARENA_H
+#define CS248_DYNAMICSCENE_GEOMETRY_ARENA_H
+
+#include <stddef.h>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "GL/glew.h"
+
+#include "../shader.h"
+#include "mesh_buffers.h"
+#include "vertex_format.h"
+
+namespace CS248 {
+namespace DynamicScene {
+
+/**
+ * First-fit allocator of vertex ranges, with freed ranges merged with their
+ * neighbours. Keeps no GL state, so that it can be tested on its own.
+ */
+class RangeAllocator {
+ public:
+  RangeAllocator() : capacity(0) {}
+
+  /**
+   * Returns the first vertex of count free vertices, or -1 if no free range
+   * is large enough.
+   */
+  long allocate(size_t count);
+
+  void release(size_t first, size_t count);
+
+  /**
+   * Adds vertices at the end.
+   */
+  void grow(size_t new_capacity);
+
+  size_t size() const { return capacity; }
+
+ private:
+  std::vector<std::pair<size_t, size_t>> free_ranges;  ///< (first, count),
+                                                       ///< by first
+  size_t capacity;
+};
+
+/**
+ * One vertex buffer, with the streams interleaved in VertexFormat, plus one
+ * index buffer, that all meshes sub-allocate their vertices and indices
+ * from, so that they all draw from the same vertex array and many of them
+ * can go into one multi-draw call. Indices are 32-bit and relative to the
+ * mesh's first vertex, which draws pass as their base vertex. Like the
+ * texture registry, the shared arena lives as long as the program and its
+ * buffers go with the GL context.
+ */
+class GeometryArena {
+ public:
+  /**
+   * Where a mesh's streams start in the arena.
+   */
+  struct Allocation {
+    GLint first_vertex;
+    GLint first_index;
+  };
+
+  static GeometryArena& shared();
+
+  GeometryArena();
+
+  /**
+   * Packs a mesh's streams into VertexFormat and copies them into the arena,
+   * with its levels of detail's indices right after its own.
+   */
+  Allocation allocate(const MeshBuffers& buffers);
+
+  void release(const Allocation& allocation, const MeshBuffers& buffers);
+
+  /**
+   * The vertex array that feeds the arena's streams to a program's
+   * attributes, built the first time it is asked for. setup_calls is set
+   * to the GL calls building it took, which every draw from it saves.
+   */
+  GLuint vertex_array(const Shader& shader, int* setup_calls = nullptr);
+
+  size_t capacity() const { return ranges.size(); }
+  size_t index_capacity() const { return index_ranges.size(); }
+
+  /**
+   * Bytes of the vertices meshes hold, and what they would take as the
+   * float streams of MeshBuffers.
+   */
+  size_t vertex_bytes() const { return used_vertices * layout.stride; }
+  size_t float_vertex_bytes() const {
+    return used_vertices * (4 * sizeof(Vector3Df) + sizeof(Vector2Df));
+  }
+
+ private:
+  struct VertexArray {
+    GLuint vao;
+    int setup_calls;
+  };
+
+  void grow(size_t min_capacity);
+  void grow_indices(size_t min_capacity);
+
+  // Vertex arrays refer to the buffers, which growing replaces.
+  void clear_vertex_arrays();
+
+  RangeAllocator ranges;
+  RangeAllocator index_ranges;
+  GLuint vertices;
+  GLuint indices;
+  VertexFormat::Layout layout;  ///< as of when the arena was created
+  size_t used_vertices;
+  GLuint draw_ids;  ///< 0, 1, 2, ... as floats, read once per instance
+  std::map<GLuint, VertexArray> vertex_arrays;  ///< by program ID
+};
+
+}  // namespace DynamicScene
+}  // namespace CS248
+
+#endif  // CS248_DYNAMICSCENE_GEOMETRY_ARENA_H
@@ -1,7 +1,10 @@
 #include "mesh.h"
-#include "CS248/lodepng.h"
+#include "../texture_registry.h"
+#include "../thread_pool.h"
 
+#include <algorithm>
 #include <cassert>
+#include <cstring>
 #include <sstream>
 
 #include "../static_scene/object.h"
@@ -18,17 +21,48 @@ static const double low_threshold = .1;
 static const double mid_threshold = .2;
 static const double high_threshold = 1.0 - low_threshold;
 
-Mesh::Mesh(Collada::PolymeshInfo &polyMesh, const Matrix4x4 &transform, const std::string shader_prefix) {
-    // Build halfedge mesh from polygon soup
-    for (const Collada::Polygon &p : polyMesh.polygons) {
-        polygons.push_back(p.vertex_indices);
-    }
+// Most a level of detail may move the surface on screen, in pixels, and the
+// fraction of that a coarser level must stay under before it replaces the
+// one drawn.
+static const double kLodErrorPixels = 1.0;
+static const double kLodHysteresis = 0.75;
+
+// Most clusters one task of cull_clusters() tests.
+static const size_t kClustersPerTask = 256;
+
+// Marks a span of cull_clusters() that is a requested range not made of
+// whole clusters; its second is the range.
+static const size_t kUnclustered = ~(size_t)0;
+
+// Gets a texture from the shared registry, so that meshes using the same image
+// share one GL texture. Until the image has been decoded in the background the
+// texture is a placeholder. Returns null if the mesh has no such texture.
+static shared_ptr<Texture> acquire_texture(const string &filename, TextureUsage usage) {
+	if(filename == "") return nullptr;
+	return TextureRegistry::shared().acquire(filename, usage);
+}
+
+static GLuint texture_id(const shared_ptr<Texture> &texture) {
+	return texture ? texture->id : 0;
+}
 
-    vector<Vector3D> vertices = polyMesh.vertices;  // DELIBERATE COPY.
+// The element array offset glDrawElements* take for an arena index.
+static const GLvoid *index_offset(GLint index) {
+	return (const GLvoid *)(index * sizeof(GLuint));
+}
+
+Mesh::Mesh(Collada::PolymeshInfo &polyMesh, const MeshBuffers &streams, const Matrix4x4 &transform, const std::string shader_prefix) {
     simple_renderable = polyMesh.is_obj_file;
     simple_colors = polyMesh.is_mtl_file;
+    objectDataBuffer = 0;
+    allocation.first_vertex = 0;
+    allocation.first_index = 0;
+    transformVersion = ~0u;
+    lod = 0;
+    clustersCulled = false;
+    patternScene = nullptr;
+    memset(&objectData, 0, sizeof(objectData));
     if (!simple_renderable) return;
-	polygons_carbon_copy = polyMesh.polygons;
 	position = polyMesh.position;
 	rotation = polyMesh.rotation;
 	scale = polyMesh.scale;
@@ -38,128 +72,22 @@ Mesh::Mesh(Collada::PolymeshInfo &polyMesh, const Matrix4x4 &transform, const st
 	do_blending = false;
 	do_disney_brdf = false;
 
-	this->vertices.reserve(polyMesh.vertices.size());
-	this->normals.reserve(polyMesh.normals.size());
-	this->texture_coordinates.reserve(polyMesh.texcoords.size());
-	for(int i = 0; i < polyMesh.vertices.size(); ++i) {
-		Vector3D &u = polyMesh.vertices[i];
-		Vector3Df v;
-		v.x = u.x;
-		v.y = u.y;
-		v.z = u.z;
-		this->vertices.push_back(v);
-	}
-	for(int i = 0; i < polyMesh.normals.size(); ++i) {
-		Vector3D &u = polyMesh.normals[i];
-		Vector3Df v;
-		v.x = u.x;
-		v.y = u.y;
-		v.z = u.z;
-		this->normals.push_back(v);
-	}
-	for(int i = 0; i < polyMesh.texcoords.size(); ++i) {
-		Vector2D &u = polyMesh.texcoords[i];
-		Vector2Df v;
-		v.x = u.x;
-		v.y = u.y;
-		this->texture_coordinates.push_back(v);
-	}
-	diffuse_colors.reserve(polygons.size());
-	for(int i = 0; i < polygons.size(); ++i) {
-		Vector3D &u = polyMesh.material_diffuse_parameters[i];
-		Vector3Df v;
-		v.x = u.x;
-		v.y = u.y;
-		v.z = u.z;
-		diffuse_colors.push_back(v);
-	}
-
-	vertexData.reserve(polygons.size() * 3);
-	diffuse_colorData.reserve(polygons.size() * 3);
-	normalData.reserve(polygons.size() * 3);
-	texcoordData.reserve(polygons.size() * 3);
-	tangentData.reserve(polygons.size() * 3);
-
-	for(int i = 0; i < polygons.size(); ++i) {
-		for(int j = 0; j < 3; ++j) {
-  			vertexData.push_back(this->vertices[polyMesh.polygons[i].vertex_indices[j]]);
-			diffuse_colorData.push_back(this->diffuse_colors[i]);
-  			normalData.push_back(this->normals[polyMesh.polygons[i].normal_indices[j]]);
-		}
-		if(this->texture_coordinates.size() > 0) {
-			for(int j = 0; j < 3; ++j) {
-				texcoordData.push_back(this->texture_coordinates[polyMesh.polygons[i].texcoord_indices[j]]);
-			}
-		}
-	}
-
-	for(int i = 0; i < vertexData.size(); i+=3) {
-		Vector3Df v0 = vertexData[i+0];
-		Vector3Df v1 = vertexData[i+1];
-		Vector3Df v2 = vertexData[i+2];
-
-		Vector2Df uv0 = texcoordData[i+0];
-		Vector2Df uv1 = texcoordData[i+1];
-		Vector2Df uv2 = texcoordData[i+2];
-
-		Vector3Df deltaPos1;
-		deltaPos1.x = v1.x-v0.x;
-		deltaPos1.y = v1.y-v0.y;
-		deltaPos1.z = v1.z-v0.z;
-
-		Vector3Df deltaPos2;
-		deltaPos2.x = v2.x-v0.x;
-		deltaPos2.y = v2.y-v0.y;
-		deltaPos2.z = v2.z-v0.z;    
-
-		Vector2Df deltaUV1;
-		deltaUV1.x = uv1.x - uv0.x;
-		deltaUV1.y = uv1.y - uv0.y;
-
-		Vector2Df deltaUV2;
-		deltaUV2.x = uv2.x - uv0.x;
-		deltaUV2.y = uv2.y - uv0.y;
-
-		float r = 1.0f / (deltaUV1.x * deltaUV2.y - deltaUV1.y * deltaUV2.x);
-
-		Vector3Df tangent;
-		tangent.x = (deltaPos1.x * deltaUV2.y - deltaPos2.x * deltaUV1.y)*r;
-		tangent.y = (deltaPos1.y * deltaUV2.y - deltaPos2.y * deltaUV1.y)*r;
-		tangent.z = (deltaPos1.z * deltaUV2.y - deltaPos2.z * deltaUV1.y)*r;
+	buffers = streams;
+	allocation = GeometryArena::shared().allocate(buffers);
+	clusterBatch.assign(buffers.clusters, buffers.num_clusters);
 
-		this->tangentData.push_back(tangent);
-		this->tangentData.push_back(tangent);
-		this->tangentData.push_back(tangent);
+	if(uniform_blocks_supported() && !multi_draw_supported()) {
+		glGenBuffers(1, &objectDataBuffer);
+		glBindBuffer(GL_UNIFORM_BUFFER, objectDataBuffer);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(objectData), &objectData, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
 	}
 
-	glGenVertexArrays(1, &vao);
-	glBindVertexArray(vao);
-	glGenBuffers(1, &vertexBuffer);
-	glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(Vector3Df) * vertexData.size(), (void*)&vertexData[0], GL_STATIC_DRAW);
-
-	glGenBuffers(1, &normalBuffer);
-	glBindBuffer(GL_ARRAY_BUFFER, normalBuffer);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(Vector3Df) * normalData.size(), (void*)&normalData[0], GL_STATIC_DRAW);
-	  
-	glGenBuffers(1, &texcoordBuffer);
-	glBindBuffer(GL_ARRAY_BUFFER, texcoordBuffer);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(Vector2Df) * texcoordData.size(), (void*)&texcoordData[0], GL_STATIC_DRAW);
-
-	glGenBuffers(1, &tangentBuffer);
-	glBindBuffer(GL_ARRAY_BUFFER, tangentBuffer);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(Vector3Df) * tangentData.size(), (void*)&tangentData[0], GL_STATIC_DRAW);
-
-	if(diffuse_colorData.size() > 0) {
-		glGenBuffers(1, &diffuse_colorBuffer);
-		glBindBuffer(GL_ARRAY_BUFFER, diffuse_colorBuffer);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(Vector3Df) * diffuse_colorData.size(), (void*)&diffuse_colorData[0], GL_STATIC_DRAW);
-	}
-
-	glBindVertexArray(0);
-
 	if(polyMesh.vert_filename != "" && polyMesh.frag_filename != "")
-		shaders.push_back(Shader(polyMesh.vert_filename, polyMesh.frag_filename, shader_prefix, shader_prefix));
+		shaders.push_back(Shader::shared(polyMesh.vert_filename, polyMesh.frag_filename, shader_prefix, shader_prefix));
+
+	// Set up the vertex arrays now rather than on the first frame.
+	for(const Shader &shader : shaders) GeometryArena::shared().vertex_array(shader);
 
 	uniform_strings = polyMesh.uniform_strings;
 	uniform_values = polyMesh.uniform_values;
@@ -196,111 +124,39 @@ Mesh::Mesh(Collada::PolymeshInfo &polyMesh, const Matrix4x4 &transform, const st
         uniform_values.push_back(0);
     }
 
+	for(const Shader &shader : shaders) {
+		uniform_locations.push_back(vector<GLint>());
+		for(const string &name : uniform_strings)
+			uniform_locations.back().push_back(shader.uniformLocation(name));
+	}
+
 	if(simple_colors) return;
 	
     do_disney_brdf = polyMesh.is_disney;
 
-	if(polyMesh.diffuse_filename != "") {
-		unsigned int error = lodepng::decode(diffuse_texture, diffuse_texture_width, diffuse_texture_height, polyMesh.diffuse_filename);
-		if(error) cerr << "Texture (diffuse) loading error = " << polyMesh.diffuse_filename << endl;
-		glGenTextures(1, &diffuseId);
-		glBindTexture(GL_TEXTURE_2D, diffuseId);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, diffuse_texture_width, diffuse_texture_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, (void *)&diffuse_texture[0]);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	    do_texture_mapping = true;
-    } else do_texture_mapping = false;
-	if(polyMesh.normal_filename != "") {
-		unsigned int error = lodepng::decode(normal_texture, normal_texture_width, normal_texture_height, polyMesh.normal_filename);
-		if(error) cerr << "Texture (normal) loading error = " << polyMesh.normal_filename << endl;
-		glGenTextures(1, &normalId);
-		glBindTexture(GL_TEXTURE_2D, normalId);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, normal_texture_width, normal_texture_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, (void *)&normal_texture[0]);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	    do_normal_mapping = true;
-    } else do_normal_mapping = false;
-	if(polyMesh.environment_filename != "") {
-		unsigned int error = lodepng::decode(environment_texture, environment_texture_width, environment_texture_height, polyMesh.environment_filename);
-		if(error) cerr << "Texture (environment) loading error = " << polyMesh.environment_filename << endl;
-		glGenTextures(1, &environmentId);
-		glBindTexture(GL_TEXTURE_2D, environmentId);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, environment_texture_width, environment_texture_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, (void *)&environment_texture[0]);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	    do_environment_mapping = true;
-    } else do_environment_mapping = false;
-	if(polyMesh.alpha_filename != "") {
-		unsigned int error = lodepng::decode(alpha_texture, alpha_texture_width, alpha_texture_height, polyMesh.alpha_filename);
-		if(error) cerr << "Texture (alpha) loading error = " << polyMesh.alpha_filename << endl;
-		glGenTextures(1, &alphaId);
-		glBindTexture(GL_TEXTURE_2D, alphaId);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, alpha_texture_width, alpha_texture_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, (void *)&alpha_texture[0]);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	    do_blending = true;
-    } else do_blending = false;
-	if(polyMesh.stub1_filename != "") {
-		unsigned int error = lodepng::decode(stub1_texture, stub1_texture_width, stub1_texture_height, polyMesh.stub1_filename);
-		if(error) cerr << "Texture (stub1) loading error = " << polyMesh.stub1_filename << endl;
-		glGenTextures(1, &stub1Id);
-		glBindTexture(GL_TEXTURE_2D, stub1Id);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, stub1_texture_width, stub1_texture_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, (void *)&stub1_texture[0]);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	}
-	if(polyMesh.stub2_filename != "") {
-		unsigned int error = lodepng::decode(stub2_texture, stub2_texture_width, stub2_texture_height, polyMesh.stub2_filename);
-		if(error) cerr << "Texture (stub2) loading error = " << polyMesh.stub2_filename << endl;
-		glGenTextures(1, &stub2Id);
-		glBindTexture(GL_TEXTURE_2D, stub2Id);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, stub2_texture_width, stub2_texture_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, (void *)&stub2_texture[0]);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	}
-	if(polyMesh.stub3_filename != "") {
-		unsigned int error = lodepng::decode(stub3_texture, stub3_texture_width, stub3_texture_height, polyMesh.stub3_filename);
-		if(error) cerr << "Texture (stub3) loading error = " << polyMesh.stub3_filename << endl;
-		glGenTextures(1, &stub3Id);
-		glBindTexture(GL_TEXTURE_2D, stub3Id);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, stub3_texture_width, stub3_texture_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, (void *)&stub3_texture[0]);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	}
-
-	glBindTexture(GL_TEXTURE_2D, 0);
+	diffuse_texture = acquire_texture(polyMesh.diffuse_filename, TEXTURE_COLOR);
+	normal_texture = acquire_texture(polyMesh.normal_filename, TEXTURE_NORMAL);
+	environment_texture = acquire_texture(polyMesh.environment_filename, TEXTURE_COLOR);
+	alpha_texture = acquire_texture(polyMesh.alpha_filename, TEXTURE_ALPHA);
+	stub1_texture = acquire_texture(polyMesh.stub1_filename, TEXTURE_DATA);
+	stub2_texture = acquire_texture(polyMesh.stub2_filename, TEXTURE_DATA);
+	stub3_texture = acquire_texture(polyMesh.stub3_filename, TEXTURE_DATA);
+
+	do_texture_mapping = diffuse_texture != nullptr;
+	do_normal_mapping = normal_texture != nullptr;
+	do_environment_mapping = environment_texture != nullptr;
+	do_blending = alpha_texture != nullptr;
 }
 
 Mesh::~Mesh() {
-    glDeleteBuffers(1, &vertexBuffer);
-    glDeleteBuffers(1, &normalBuffer);
-    glDeleteBuffers(1, &texcoordBuffer);
-	glDeleteBuffers(1, &tangentBuffer);
-
-    if(diffuse_colorData.size() > 0) glDeleteBuffers(1, &diffuse_colorBuffer);
+    GeometryArena::shared().release(allocation, buffers);
+    if(objectDataBuffer) glDeleteBuffers(1, &objectDataBuffer);
 }
 
 void Mesh::draw_pretty() {
-  glPushMatrix();
-  glTranslatef(position.x, position.y, position.z);
-  glRotatef(rotation.x, 1.0f, 0.0f, 0.0f);
-  glRotatef(rotation.y, 0.0f, 1.0f, 0.0f);
-  glRotatef(rotation.z, 0.0f, 0.0f, 1.0f);
-  glScalef(scale.x, scale.y, scale.z);
+  update_transform();
+  clustersCulled = false;
+  lod = select_lod(glObj2World, lod);
 
   glBindTexture(GL_TEXTURE_2D, 0);
   Spectrum white = Spectrum(1., 1., 1.);
@@ -310,249 +166,499 @@ void Mesh::draw_pretty() {
   glEnable(GL_LIGHTING);
   glDisable(GL_BLEND);
   draw_faces(true);
-
-  glPopMatrix();
 }
 
 void Mesh::draw() {
-  glPushMatrix();
-
-  glTranslatef(position.x, position.y, position.z);
-  glRotatef(rotation.x, 1.0f, 0.0f, 0.0f);
-  glRotatef(rotation.y, 0.0f, 1.0f, 0.0f);
-  glRotatef(rotation.z, 0.0f, 0.0f, 1.0f);
-  glScalef(scale.x, scale.y, scale.z);
-
-  float deg2Rad = M_PI / 180.0;
-  
-  Matrix4x4 T = Matrix4x4::translation(position);
-  Matrix4x4 RX = Matrix4x4::rotation(rotation.x * deg2Rad, Matrix4x4::Axis::X);
-  Matrix4x4 RY = Matrix4x4::rotation(rotation.y * deg2Rad, Matrix4x4::Axis::Y);
-  Matrix4x4 RZ = Matrix4x4::rotation(rotation.z * deg2Rad, Matrix4x4::Axis::Z);
-  Matrix4x4 scaleXform = Matrix4x4::scaling(scale);
-  
-  Matrix4x4 xform = T * RX * RY * RZ * scaleXform;
-
-  // inv transpose for transforming normals
-  Matrix4x4 xformNorm = (RX * RY * RZ * scaleXform).inv().T();    
-
-  // copy to column-major buffers for hand off to OpenGL  
-  int idx = 0;
-  for (int i=0; i<4; i++) {
-      const Vector4D& c = xform.column(i); 
-      glObj2World[idx++] = c[0]; glObj2World[idx++] = c[1]; glObj2World[idx++] = c[2]; glObj2World[idx++] = c[3];
-  }
+  update_transform();
+  clustersCulled = false;
+  lod = select_lod(glObj2World, lod);
 
-  idx = 0;
-  for (int i=0; i<3; i++) {
-      const Vector4D& c = xformNorm.column(i); 
-      glObj2WorldNorm[idx++] = c[0]; glObj2WorldNorm[idx++] = c[1]; glObj2WorldNorm[idx++] = c[2];
-  }  
-  
   glDisable(GL_BLEND);
   glEnable(GL_LIGHTING);
   draw_faces(false);
+}
+
+bool Mesh::enqueue(RenderQueue &queue) {
+  if(!simple_renderable) return true;
+  update_transform();
+
+  // Meshes with the same textures and flags share a material key.
+  uint32_t material = 2166136261u;
+  const std::shared_ptr<Texture>* textures[] = {
+      &diffuse_texture, &normal_texture, &environment_texture,
+      &alpha_texture, &stub1_texture, &stub2_texture, &stub3_texture
+  };
+  for(int i = 0; i < 7; ++i) material = (material ^ texture_id(*textures[i])) * 16777619u;
+  material = (material ^ (do_texture_mapping | do_normal_mapping << 1 |
+                          do_environment_mapping << 2 | do_blending << 3 |
+                          do_disney_brdf << 4)) * 16777619u;
+
+  // view depth of the center of the mesh's bounds
+  const Vector3Df &lo = buffers.bbox_min, &hi = buffers.bbox_max;
+  float center[3] = {(lo.x + hi.x) / 2, (lo.y + hi.y) / 2, (lo.z + hi.z) / 2};
+  Vector3D world;
+  for (int i = 0; i < 3; i++) {
+      world[i] = glObj2World[i] * center[0] + glObj2World[4 + i] * center[1] +
+                 glObj2World[8 + i] * center[2] + glObj2World[12 + i];
+  }
+  const Camera &camera = *scene->camera;
+  Vector3D viewDir = (camera.view_point() - camera.position()).unit();
+  float depth = dot(world - camera.position(), viewDir);
+  lod = select_lod(glObj2World, lod);
+
+  // Static batches add their ranges after this, so the clusters are culled
+  // once everything has been queued.
+  clustersCulled = false;
+  if(clusterBatch.size()) scene->queue_cluster_culling(this);
+
+  for(uint32_t i = 0; i < shaders.size(); ++i) {
+      queue.push(RenderQueue::make_key(RenderQueue::PASS_OPAQUE, shaders[i]._programID, material, depth), this, i);
+  }
+  return true;
+}
+
+void Mesh::update_transform() {
+  sync_transform();
+  uint32_t version = transform.version();
+  if (version == transformVersion) return;
+  transformVersion = version;
+
+  // copy the column-major matrices for hand off to OpenGL
+  const float *world = transform.world();
+  copy(world, world + 16, glObj2World);
+  const float *normal = transform.world_normal();
+  copy(normal, normal + 9, glObj2WorldNorm);
+
+  update_object_data();
+}
+
+ObjectData Mesh::object_data(const float *obj2world, const float *obj2worldNorm) const {
+  ObjectData data;
+  memset(&data, 0, sizeof(data));
+  VertexFormat::position_transform(buffers, obj2world, data.obj2world);
+  for (int i = 0; i < 3; i++) {
+      memcpy(&data.obj2world_norm[4 * i], &obj2worldNorm[3 * i], 3 * sizeof(float));
+  }
+  data.use_texture_mapping = do_texture_mapping;
+  data.use_normal_mapping = do_normal_mapping;
+  data.use_environment_mapping = do_environment_mapping;
+  data.use_blending = do_blending;
+  data.use_disney_brdf = do_disney_brdf;
+  return data;
+}
+
+void Mesh::update_object_data() {
+  if(!uniform_blocks_supported()) return;
+
+  ObjectData data = object_data(glObj2World, glObj2WorldNorm);
+
+  // static meshes upload their block once
+  if(memcmp(&data, &objectData, sizeof(data)) == 0) return;
+  objectData = data;
+  if(!objectDataBuffer) return;
+  glBindBuffer(GL_UNIFORM_BUFFER, objectDataBuffer);
+  glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(data), &data);
+  glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+uint32_t Mesh::select_lod(const float *obj2world, uint32_t current) const {
+  if (buffers.num_lods == 0 || !drawRanges.empty() || !scene || !scene->camera) return 0;
+  const Camera &camera = *scene->camera;
+
+  // bounding sphere of the mesh in world space, scaled by the longest axis
+  const Vector3Df &lo = buffers.bbox_min, &hi = buffers.bbox_max;
+  float center[3] = {(lo.x + hi.x) / 2, (lo.y + hi.y) / 2, (lo.z + hi.z) / 2};
+  Vector3D extent(hi.x - lo.x, hi.y - lo.y, hi.z - lo.z);
+  double scale = 0;
+  Vector3D world;
+  for (int i = 0; i < 3; i++) {
+      world[i] = obj2world[i] * center[0] + obj2world[4 + i] * center[1] +
+                 obj2world[8 + i] * center[2] + obj2world[12 + i];
+      Vector3D axis(obj2world[4 * i], obj2world[4 * i + 1], obj2world[4 * i + 2]);
+      scale = max(scale, axis.norm());
+  }
+  double radius = extent.norm() / 2 * scale;
+
+  // pixels per world unit at the nearest point of the sphere; full detail
+  // once the camera is (nearly) inside it
+  double distance = (world - camera.position()).norm() - radius;
+  if (distance <= camera.near_clip()) return 0;
+  double pixels = camera.screen_height() / (2 * distance * tan(radians(camera.v_fov()) / 2));
+  auto error_pixels = [&](uint32_t level) {
+      return level == 0 ? 0.0 : buffers.lods[level - 1].error * radius * pixels;
+  };
+
+  uint32_t level = min<uint32_t>(current, buffers.num_lods);
+  while (level > 0 && error_pixels(level) > kLodErrorPixels) level--;
+  while (level < buffers.num_lods &&
+         error_pixels(level + 1) <= kLodErrorPixels * kLodHysteresis) level++;
+  return level;
+}
+
+MeshClusters::Stats Mesh::cull_clusters() {
+  MeshClusters::Stats stats;
+  clusterRanges.clear();
+  clustersCulled = false;
+  if (!clusterBatch.size() || !instances.empty() || lod != 0 ||
+      !scene || !scene->camera) return stats;
+  const MeshBuffers::Cluster *clusters = buffers.clusters;
+  size_t num_clusters = buffers.num_clusters;
+
+  // Split the requested ranges into spans of whole clusters, at most
+  // kClustersPerTask long. Clusters follow each other in index order.
+  clusterSpans.clear();
+  auto add_span = [&](size_t begin, size_t end) {
+      for (; begin < end; begin += kClustersPerTask) {
+          clusterSpans.push_back(make_pair(begin, min(end, begin + kClustersPerTask)));
+      }
+  };
+  if (drawRanges.empty()) {
+      add_span(0, num_clusters);
+  }
+  for (size_t i = 0; i < drawRanges.counts.size(); ++i) {
+      uint32_t first = drawRanges.firsts[i] - allocation.first_index;
+      uint32_t end = first + drawRanges.counts[i];
+      const MeshBuffers::Cluster *begin = lower_bound(
+          clusters, clusters + num_clusters, first,
+          [](const MeshBuffers::Cluster &cluster, uint32_t index) {
+              return cluster.first_index < index;
+          });
+      const MeshBuffers::Cluster *last = begin;
+      while (last < clusters + num_clusters && last->first_index < end) last++;
+      if (begin == last || begin->first_index != first ||
+          last[-1].first_index + last[-1].num_indices != end) {
+          clusterSpans.push_back(make_pair(kUnclustered, i));
+      } else {
+          add_span(begin - clusters, last - clusters);
+      }
+  }
+
+  MeshClusters::View view = MeshClusters::make_view(
+      *scene->camera, glObj2World, buffers.bbox_min, buffers.bbox_max, !do_blending);
+  clusterResults.resize(num_clusters);
+  ThreadPool::shared().parallel_for(clusterSpans.size(), [&](size_t s) {
+      const pair<size_t, size_t> &span = clusterSpans[s];
+      if (span.first == kUnclustered) return;
+      MeshClusters::cull(view, clusterBatch, span.first, span.second - span.first,
+                         &clusterResults[span.first]);
+  });
+
+  for (const pair<size_t, size_t> &span : clusterSpans) {
+      if (span.first == kUnclustered) {
+          clusterRanges.add(drawRanges.firsts[span.second], drawRanges.counts[span.second],
+                            allocation.first_vertex);
+          continue;
+      }
+      for (size_t c = span.first; c < span.second; ++c) {
+          size_t triangles = clusters[c].num_indices / 3;
+          stats.triangles += triangles;
+          switch (clusterResults[c]) {
+          case MeshClusters::VISIBLE:
+              clusterRanges.add(allocation.first_index + clusters[c].first_index,
+                                clusters[c].num_indices, allocation.first_vertex);
+              break;
+          case MeshClusters::OUTSIDE: stats.outside += triangles; break;
+          case MeshClusters::BACKFACING: stats.backfacing += triangles; break;
+          case MeshClusters::SMALL: stats.small += triangles; break;
+          }
+      }
+  }
+  clustersCulled = true;
+  return stats;
+}
 
-  glPopMatrix();
+const Mesh::DrawRanges *Mesh::draw_ranges() const {
+  if (clustersCulled) return &clusterRanges;
+  return drawRanges.empty() ? nullptr : &drawRanges;
+}
 
+void Mesh::lod_range(uint32_t level, GLint *first, GLsizei *count) const {
+  if (level == 0 || level > buffers.num_lods) {
+      *first = allocation.first_index;
+      *count = buffers.num_indices;
+      return;
+  }
+  const MeshBuffers::Lod &range = buffers.lods[level - 1];
+  *first = allocation.first_index + buffers.num_indices + range.first_index;
+  *count = range.num_indices;
 }
 
 void Mesh::draw_faces(bool smooth) const {
     if(!simple_renderable) return;
 
-    for(int i = 0; i < shaders.size(); ++i) {
-        GLuint programID = shaders[i]._programID;
-      
-        glUseProgram(programID);
-	    glBindVertexArray(vao);
-
-        for(int j = 0; j < scene->patterns.size(); ++j) {
-            DynamicScene::PatternObject &po = scene->patterns[j];
-            int uniformLocation  = glGetUniformLocation(programID, po.name.c_str());
-            if(uniformLocation >= 0) {
-                if(po.type == 0) {
-                    glUniform3f(uniformLocation, po.v.x, po.v.y, po.v.z);
-                } else if(po.type == 1) {
-                    glUniform1f(uniformLocation, po.s);
-                }
+    RenderState state;
+    for(uint32_t i = 0; i < shaders.size(); ++i) {
+        submit(i, state);
+    }
+    state.reset();
+}
+
+void Mesh::submit(uint32_t shaderIndex, RenderState &state) const {
+    bind_state(shaderIndex, state);
+
+    // Multi-draw programs read their ObjectData from the batch's array.
+    if(multi_draw_supported()) {
+        IndirectBatch &batch = scene->render_queue.indirect_batch();
+        add_draws(batch, state);
+        batch.flush(state);
+        return;
+    }
+
+    const DrawRanges *ranges = draw_ranges();
+    if(!ranges) {
+        GLint first;
+        GLsizei count;
+        lod_range(lod, &first, &count);
+        glDrawElementsBaseVertex(GL_TRIANGLES, count, GL_UNSIGNED_INT,
+                                 index_offset(first), allocation.first_vertex);
+        state.triangles += count / 3;
+    } else if(!ranges->empty()) {
+        glMultiDrawElementsBaseVertex(GL_TRIANGLES, ranges->counts.data(), GL_UNSIGNED_INT,
+                                      ranges->offsets.data(), ranges->counts.size(),
+                                      ranges->base_vertices.data());
+        for(GLsizei count : ranges->counts) state.triangles += count / 3;
+    } else {
+        return;
+    }
+    state.draw_calls++;
+}
+
+void Mesh::add_draws(IndirectBatch &batch, RenderState &state) const {
+    // The batch merges the copies drawn at the same level of detail into
+    // one instanced command, so they go in level by level.
+    GLint first;
+    GLsizei count;
+    if(!instances.empty()) {
+        for(uint32_t level = 0; level <= buffers.num_lods; ++level) {
+            lod_range(level, &first, &count);
+            for(size_t i = 0; i < instances.size(); ++i) {
+                if(instanceLods[i] != level) continue;
+                if(batch.full()) batch.flush(state);
+                batch.add_object(instances[i]);
+                batch.add_range(first, count, allocation.first_vertex);
+            }
+        }
+        return;
+    }
+
+    const DrawRanges *ranges = draw_ranges();
+    if(ranges && ranges->empty()) return;
+    if(batch.full()) batch.flush(state);
+    batch.add_object(objectData);
+    if(!ranges) {
+        lod_range(lod, &first, &count);
+        batch.add_range(first, count, allocation.first_vertex);
+        return;
+    }
+    for(size_t i = 0; i < ranges->counts.size(); ++i) {
+        batch.add_range(ranges->firsts[i], ranges->counts[i], allocation.first_vertex);
+    }
+}
+
+bool Mesh::shares_state(uint32_t shaderIndex, const Mesh &other, uint32_t otherShader) const {
+    // Transforms and flags are per draw; everything else has to match.
+    return shaders[shaderIndex]._programID == other.shaders[otherShader]._programID &&
+           diffuse_texture == other.diffuse_texture &&
+           normal_texture == other.normal_texture &&
+           environment_texture == other.environment_texture &&
+           alpha_texture == other.alpha_texture &&
+           stub1_texture == other.stub1_texture &&
+           stub2_texture == other.stub2_texture &&
+           stub3_texture == other.stub3_texture &&
+           uniform_strings == other.uniform_strings &&
+           uniform_values == other.uniform_values;
+}
+
+void Mesh::bind_state(uint32_t shaderIndex, RenderState &state) const {
+    const Shader &shader = shaders[shaderIndex];
+
+    // All meshes draw from the arena's streams, through one vertex array
+    // per program.
+    int setupCalls = 0;
+    state.use_program(shader._programID);
+    state.bind_vertex_array(GeometryArena::shared().vertex_array(shader, &setupCalls));
+    state.setup_calls_saved += setupCalls;
+
+    // Camera and lights come from the FrameData block the scene binds
+    // once per frame; transforms and flags from this mesh's ObjectData.
+    // Programs without the blocks get plain uniforms below.
+    if(objectDataBuffer)
+        state.bind_uniform_buffer(OBJECT_DATA_BINDING, objectDataBuffer);
+
+    // Locations were looked up when the program was linked, and those of
+    // pattern and material names when the mesh was loaded or first drawn
+    // in this scene.
+    if(patternScene != scene ||
+       pattern_locations[shaderIndex].size() != scene->patterns.size()) {
+        patternScene = scene;
+        pattern_locations.assign(shaders.size(), vector<GLint>());
+        for(uint32_t i = 0; i < shaders.size(); ++i) {
+            for(const DynamicScene::PatternObject &po : scene->patterns)
+                pattern_locations[i].push_back(shaders[i].uniformLocation(po.name));
+        }
+    }
+    const vector<GLint> &patternLocations = pattern_locations[shaderIndex];
+    for(size_t j = 0; j < patternLocations.size(); ++j) {
+        const DynamicScene::PatternObject &po = scene->patterns[j];
+        int uniformLocation = patternLocations[j];
+        if(uniformLocation >= 0) {
+            if(po.type == 0) {
+                glUniform3f(uniformLocation, po.v.x, po.v.y, po.v.z);
+            } else if(po.type == 1) {
+                glUniform1f(uniformLocation, po.s);
             }
         }
+    }
 
-		for(int j = 0; j < uniform_strings.size(); ++j) {
-			int uniformLocation = glGetUniformLocation(programID, uniform_strings[j].c_str());
+		const vector<GLint> &materialLocations = uniform_locations[shaderIndex];
+		for(size_t j = 0; j < materialLocations.size(); ++j) {
+			int uniformLocation = materialLocations[j];
 			if(uniformLocation >= 0) {
 				glUniform1f(uniformLocation, uniform_values[j]);
 			}
 		}
 
-        int uniformLocation = glGetUniformLocation(programID, "useTextureMapping");
-        if(uniformLocation >= 0)
-            glUniform1i(uniformLocation, do_texture_mapping ? 1 : 0);
+    int uniformLocation = shader.uniformLocation(UNIFORM_USE_TEXTURE_MAPPING);
+    if(uniformLocation >= 0)
+        glUniform1i(uniformLocation, do_texture_mapping ? 1 : 0);
 
-        uniformLocation = glGetUniformLocation(programID, "useNormalMapping");
-        if(uniformLocation >= 0)
-            glUniform1i(uniformLocation, do_normal_mapping ? 1 : 0);
+    uniformLocation = shader.uniformLocation(UNIFORM_USE_NORMAL_MAPPING);
+    if(uniformLocation >= 0)
+        glUniform1i(uniformLocation, do_normal_mapping ? 1 : 0);
 
-        uniformLocation = glGetUniformLocation(programID, "useEnvironmentMapping");
-        if(uniformLocation >= 0)
-            glUniform1i(uniformLocation, do_environment_mapping ? 1 : 0);
+    uniformLocation = shader.uniformLocation(UNIFORM_USE_ENVIRONMENT_MAPPING);
+    if(uniformLocation >= 0)
+        glUniform1i(uniformLocation, do_environment_mapping ? 1 : 0);
  
-        uniformLocation = glGetUniformLocation(programID, "useBlending");
-        if(uniformLocation >= 0)
-            glUniform1i(uniformLocation, do_blending ? 1 : 0);
-       
-        uniformLocation = glGetUniformLocation(programID, "useDisneyBRDF");
-        if(uniformLocation >= 0)
-            glUniform1i(uniformLocation, do_disney_brdf ? 1 : 0);
-       
-        uniformLocation = glGetUniformLocation(programID, "obj2world");
-        if(uniformLocation >= 0) {
-            glUniformMatrix4fv(uniformLocation, 1, GL_FALSE, glObj2World);
-        }
-        
-        uniformLocation = glGetUniformLocation(programID, "obj2worldNorm");
-        if(uniformLocation >= 0) {
-            glUniformMatrix3fv(uniformLocation, 1, GL_FALSE, glObj2WorldNorm);
-        }
-        
-        int diffuseTextureID  = glGetUniformLocation(programID, "diffuseTextureSampler");
-        if(diffuseTextureID >= 0) {
-	        glActiveTexture(GL_TEXTURE0);
-	        glBindTexture(GL_TEXTURE_2D, diffuseId);
-            glUniform1i(diffuseTextureID, 0);
-        }
-
-        int normalTextureID  = glGetUniformLocation(programID, "normalTextureSampler");
-        if(normalTextureID >= 0) {
-	        glActiveTexture(GL_TEXTURE1);
-	        glBindTexture(GL_TEXTURE_2D, normalId);
-            glUniform1i(normalTextureID, 1);
-        }
-
-        int environmentTextureID  = glGetUniformLocation(programID, "environmentTextureSampler");
-        if(environmentTextureID >= 0) {
-	        glActiveTexture(GL_TEXTURE2);
-	        glBindTexture(GL_TEXTURE_2D, environmentId);
-            glUniform1i(environmentTextureID, 2);
-        }
+    uniformLocation = shader.uniformLocation(UNIFORM_USE_BLENDING);
+    if(uniformLocation >= 0)
+        glUniform1i(uniformLocation, do_blending ? 1 : 0);
+   
+    uniformLocation = shader.uniformLocation(UNIFORM_USE_DISNEY_BRDF);
+    if(uniformLocation >= 0)
+        glUniform1i(uniformLocation, do_disney_brdf ? 1 : 0);
+   
+    uniformLocation = shader.uniformLocation(UNIFORM_OBJ2WORLD);
+    if(uniformLocation >= 0) {
+        float position2World[16];
+        VertexFormat::position_transform(buffers, glObj2World, position2World);
+        glUniformMatrix4fv(uniformLocation, 1, GL_FALSE, position2World);
+    }
+    
+    uniformLocation = shader.uniformLocation(UNIFORM_OBJ2WORLD_NORM);
+    if(uniformLocation >= 0) {
+        glUniformMatrix3fv(uniformLocation, 1, GL_FALSE, glObj2WorldNorm);
+    }
 
-        int alphaTextureID  = glGetUniformLocation(programID, "blendTextureSampler");
-        if(alphaTextureID >= 0) {
-	        glActiveTexture(GL_TEXTURE3);
-	        glBindTexture(GL_TEXTURE_2D, alphaId);
-            glUniform1i(alphaTextureID, 3);
-        }
+    uniformLocation = shader.uniformLocation(UNIFORM_VIEW_PROJECTION);
+    if(uniformLocation >= 0) {
+        glUniformMatrix4fv(uniformLocation, 1, GL_FALSE, scene->view_projection);
+    }
 
-        int stub1TextureID  = glGetUniformLocation(programID, "stub1TextureSampler");
-        if(stub1TextureID >= 0) {
-	        glActiveTexture(GL_TEXTURE4);
-	        glBindTexture(GL_TEXTURE_2D, stub1Id);
-            glUniform1i(stub1TextureID, 4);
+    // sampler i reads texture unit i, as set up when the program was linked
+    const std::shared_ptr<Texture>* textures[] = {
+        &diffuse_texture, &normal_texture, &environment_texture,
+        &alpha_texture, &stub1_texture, &stub2_texture, &stub3_texture
+    };
+    for(int unit = 0; unit < 7; ++unit) {
+        if(shader.uniformLocation((ShaderUniform)(UNIFORM_DIFFUSE_TEXTURE + unit)) >= 0) {
+            state.bind_texture(unit, texture_id(*textures[unit]));
         }
+    }
 
-        int stub2TextureID  = glGetUniformLocation(programID, "stub2TextureSampler");
-        if(stub2TextureID >= 0) {
-	        glActiveTexture(GL_TEXTURE5);
-	        glBindTexture(GL_TEXTURE_2D, stub2Id);
-            glUniform1i(stub2TextureID, 5);
-        }
+    Vector3D camPosition = scene->camera->position();
+    float v1 = camPosition.x;
+    float v2 = camPosition.y;
+    float v3 = camPosition.z;
+    uniformLocation = shader.uniformLocation(UNIFORM_CAMERA_POSITION);
+    if(uniformLocation >=0) glUniform3f( uniformLocation, v1, v2, v3 );
+
+    uniformLocation = shader.uniformLocation(UNIFORM_NUM_DIRECTIONAL_LIGHTS);
+    if(uniformLocation >= 0) glUniform1i( uniformLocation, scene->directional_lights.size() );
+
+    size_t num_directional = min(scene->directional_lights.size(), shader.uniformSize(UNIFORM_DIRECTIONAL_LIGHT_VECTORS));
+    for(int j = 0; j < num_directional; ++j) {
+        StaticScene::DirectionalLight *light = scene->directional_lights[j];
+        float v1 = light->dirToLight.x;
+        float v2 = light->dirToLight.y;
+        float v3 = light->dirToLight.z;		
+        uniformLocation = shader.uniformLocation(UNIFORM_DIRECTIONAL_LIGHT_VECTORS, j);
+        if(uniformLocation >= 0) glUniform3f( uniformLocation, v1, v2, v3 );
+    }
 
-        int stub3TextureID  = glGetUniformLocation(programID, "stub3TextureSampler");
-        if(stub3TextureID >= 0) {
-	        glActiveTexture(GL_TEXTURE6);
-	        glBindTexture(GL_TEXTURE_2D, stub3Id);
-            glUniform1i(stub2TextureID, 6);
-        }
+    uniformLocation = shader.uniformLocation(UNIFORM_NUM_POINT_LIGHTS);
+    if(uniformLocation >= 0) glUniform1i( uniformLocation, scene->point_lights.size() );
+
+    size_t num_point = min(scene->point_lights.size(), shader.uniformSize(UNIFORM_POINT_LIGHT_POSITIONS));
+    for(int j = 0; j < num_point; ++j) {
+        StaticScene::PointLight *light = scene->point_lights[j];
+        float v1 = light->position.x;
+        float v2 = light->position.y;
+        float v3 = light->position.z;
+        uniformLocation = shader.uniformLocation(UNIFORM_POINT_LIGHT_POSITIONS, j);
+        if(uniformLocation >= 0) glUniform3f( uniformLocation, v1, v2, v3 );
+    }
+}
 
-        Vector3D camPosition = scene->camera->position();
-        float v1 = camPosition.x;
-        float v2 = camPosition.y;
-        float v3 = camPosition.z;
-        uniformLocation = glGetUniformLocation( programID, "camera_position" );
-        if(uniformLocation >=0) glUniform3f( uniformLocation, v1, v2, v3 );
-
-        uniformLocation = glGetUniformLocation( programID, "num_directional_lights" );
-        if(uniformLocation >= 0) glUniform1i( uniformLocation, scene->directional_lights.size() );
-
-        for(int j = 0; j < scene->directional_lights.size(); ++j) {
-            StaticScene::DirectionalLight *light = scene->directional_lights[j];
-            float v1 = light->dirToLight.x;
-            float v2 = light->dirToLight.y;
-            float v3 = light->dirToLight.z;		
-            string str = "directional_light_vectors[" + std::to_string(j) + "]";
-            uniformLocation = glGetUniformLocation( programID, str.c_str() );
-            if(uniformLocation >= 0) glUniform3f( uniformLocation, v1, v2, v3 );
-        }
+void Mesh::add_draw_range(GLint first, GLsizei count) {
+    drawRanges.add(allocation.first_index + first, count, allocation.first_vertex);
+}
 
-        uniformLocation = glGetUniformLocation( programID, "num_point_lights" );
-        if(uniformLocation >= 0) glUniform1i( uniformLocation, scene->point_lights.size() );
-
-        for(int j = 0; j < scene->point_lights.size(); ++j) {
-            StaticScene::PointLight *light = scene->point_lights[j];
-            float v1 = light->position.x;
-            float v2 = light->position.y;
-            float v3 = light->position.z;
-            string str = "point_light_positions[" + std::to_string(j) + "]";
-            uniformLocation = glGetUniformLocation( programID, str.c_str() );
-            if(uniformLocation >= 0) glUniform3f( uniformLocation, v1, v2, v3 );
-        }
+void Mesh::clear_draw_ranges() {
+    drawRanges.clear();
+}
 
-	    int vert_loc = glGetAttribLocation(programID, "vtx_position");
-	    if (vert_loc >= 0) {
-            glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
-            glVertexAttribPointer(vert_loc, 3, GL_FLOAT, GL_FALSE, 0, 0);
-            glEnableVertexAttribArray(vert_loc);
-	    }
-
-	    int dclr_loc = glGetAttribLocation(programID, "vtx_diffuse_color");
-	    if (dclr_loc >= 0) {
-            glBindBuffer(GL_ARRAY_BUFFER, diffuse_colorBuffer);
-            glVertexAttribPointer(dclr_loc, 3, GL_FLOAT, GL_FALSE, 0, 0);
-            glEnableVertexAttribArray(dclr_loc);
-	    }
-
-	    int normal_loc = glGetAttribLocation(programID, "vtx_normal");
-        if(normal_loc >= 0) {
-            glBindBuffer(GL_ARRAY_BUFFER, normalBuffer);
-            glVertexAttribPointer(normal_loc, 3, GL_FLOAT, GL_FALSE, 0, 0);
-            glEnableVertexAttribArray(normal_loc);
-        }
+void Mesh::DrawRanges::add(GLint first, GLsizei count, GLint base_vertex) {
+    if(!counts.empty() && firsts.back() + counts.back() == first &&
+       base_vertices.back() == base_vertex) {
+        counts.back() += count;
+        return;
+    }
+    firsts.push_back(first);
+    counts.push_back(count);
+    offsets.push_back(index_offset(first));
+    base_vertices.push_back(base_vertex);
+}
 
-	    int tex_loc = glGetAttribLocation(programID, "vtx_texcoord");
-	    if (tex_loc >= 0) {
-            glBindBuffer(GL_ARRAY_BUFFER, texcoordBuffer);
-            glVertexAttribPointer(tex_loc, 2, GL_FLOAT, GL_FALSE, 0, 0);
-            glEnableVertexAttribArray(tex_loc);
-	    }
-
-        int tan_loc = glGetAttribLocation(programID, "vtx_tangent");
-        if (tan_loc >= 0) {
-            glBindBuffer(GL_ARRAY_BUFFER, tangentBuffer);
-            glVertexAttribPointer(tan_loc, 3, GL_FLOAT, GL_FALSE, 0, 0);
-            glEnableVertexAttribArray(tan_loc);
-        }
+void Mesh::DrawRanges::clear() {
+    firsts.clear();
+    counts.clear();
+    offsets.clear();
+    base_vertices.clear();
+}
 
-	    glDrawArrays(GL_TRIANGLES, 0, polygons.size() * 3);
+void Mesh::add_instance(const float *obj2world, const float *obj2worldNorm,
+                        uint32_t level) {
+    instances.push_back(object_data(obj2world, obj2worldNorm));
+    instanceLods.push_back(min<uint32_t>(level, buffers.num_lods));
+}
 
-	    glBindVertexArray(0);
-        glUseProgram(0);
-	    glBindTexture(GL_TEXTURE_2D, 0);
-    }
+void Mesh::clear_instances() {
+    instances.clear();
+    instanceLods.clear();
 }
 
 BBox Mesh::get_bbox() {
   BBox bbox;
-  if (simple_renderable) {
-	  for(int i = 0; i < vertices.size(); ++i) {
-		Vector3Df &u = vertices[i];
-		Vector3D v(u.x, u.y, u.z);
-		bbox.expand(v);
-	  }
+  if (simple_renderable && buffers.bbox_min.x <= buffers.bbox_max.x) {
+	  const Vector3Df &lo = buffers.bbox_min;
+	  const Vector3Df &hi = buffers.bbox_max;
+	  bbox.expand(Vector3D(lo.x, lo.y, lo.z));
+	  bbox.expand(Vector3D(hi.x, hi.y, hi.z));
 	  return bbox;
   }
   return bbox;
 }
 
+bool Mesh::get_occluder(const float **positions, const uint32_t **indices,
+                        size_t *num_indices) {
+  if (!simple_renderable || do_blending || buffers.num_indices == 0) return false;
+  *positions = &buffers.positions[0].x;
+  *indices = buffers.indices;
+  *num_indices = buffers.num_indices;
+  return true;
+}
+
 StaticScene::SceneObject *Mesh::get_static_object() {
   return nullptr;
 //  return new StaticScene::Mesh(mesh);
@@ -5,8 +5,16 @@
 
 #include "../collada/polymesh_info.h"
 #include "../shader.h"
+#include "../texture_registry.h"
+#include "../uniform_blocks.h"
+#include "geometry_arena.h"
+#include "mesh_buffers.h"
+#include "mesh_clusters.h"
+#include "render_queue.h"
+#include "vertex_format.h"
 
 #include <map>
+#include <memory>
 
 namespace CS248 {
 namespace DynamicScene {
@@ -18,19 +26,10 @@ class LBSInfo {
   double distance;
 };
 
-struct Vector2Df {
-public:
-  float x, y;
-};
-
-struct Vector3Df {
-public:
-	float x, y, z;
-};
-
 class Mesh : public SceneObject {
  public:
-  Mesh(Collada::PolymeshInfo &polyMesh, const Matrix4x4 &transform, const std::string shader_prefix = "");
+  // streams are the vertex streams built from polyMesh (see MeshStore)
+  Mesh(Collada::PolymeshInfo &polyMesh, const MeshBuffers &streams, const Matrix4x4 &transform, const std::string shader_prefix = "");
 
   ~Mesh();
 
@@ -38,78 +37,171 @@ class Mesh : public SceneObject {
 
   void draw_pretty() override;
 
+  bool enqueue(RenderQueue &queue) override;
+
+  /**
+   * Draws the mesh with one of its shaders, binding only what isn't bound
+   * yet. Expects the transform to be up to date.
+   */
+  void submit(uint32_t shaderIndex, RenderState &state) const;
+
+  /**
+   * Binds the program, vertex array, textures and uniforms that drawing
+   * with one of the shaders needs, without drawing.
+   */
+  void bind_state(uint32_t shaderIndex, RenderState &state) const;
+
+  /**
+   * Adds this mesh's ObjectData and index ranges to a multi-draw call,
+   * flushing the batch whenever it fills up.
+   */
+  void add_draws(IndirectBatch &batch, RenderState &state) const;
+
+  /**
+   * Whether drawing with one of the shaders binds exactly what another
+   * mesh's shader does, so that both can go into one multi-draw call.
+   */
+  bool shares_state(uint32_t shaderIndex, const Mesh &other,
+                    uint32_t otherShader) const;
+
+  /**
+   * Restricts drawing to ranges of the mesh's indices, drawn with one
+   * multi-draw call; static batches use this to skip their hidden parts.
+   * Adjacent ranges are joined. After clear_draw_ranges() the whole mesh is
+   * drawn again.
+   */
+  void add_draw_range(GLint first, GLsizei count);
+  void clear_draw_ranges();
+
+  /**
+   * Draws the mesh once per added instance, each with its own transform,
+   * instead of once with its own; a multi-draw call draws them all with
+   * one instanced command. After clear_instances() the mesh draws itself
+   * again. Needs multi-draw support. level is the level of detail the
+   * copy is drawn at, as select_lod() picked it.
+   */
+  void add_instance(const float *obj2world, const float *obj2worldNorm,
+                    uint32_t level = 0);
+  void clear_instances();
+
+  /**
+   * The level of detail (0 for the full mesh) whose error, projected onto
+   * the screen, stays under about a pixel when the mesh is drawn with
+   * obj2world. Levels change only once they are clearly past the threshold,
+   * so that current, the level drawn last, doesn't flicker between two.
+   */
+  uint32_t select_lod(const float *obj2world, uint32_t current) const;
+
+  /**
+   * Tests the clusters of the ranges queued this frame against the camera
+   * and from then on draws only those that may be seen, until the mesh is
+   * queued or drawn again. enqueue() asks the scene for this, which runs it
+   * for all meshes at once after every object has been queued.
+   */
+  MeshClusters::Stats cull_clusters();
+
   StaticScene::SceneObject *get_transformed_static_object(double t) override;
 
   BBox get_bbox() override;
 
+  /**
+   * Meshes with alpha-blended holes occlude nothing.
+   */
+  bool get_occluder(const float **positions, const uint32_t **indices,
+                    size_t *num_indices) override;
+
   StaticScene::SceneObject *get_static_object() override;
 
  private:
   // Helpers for draw().
   void draw_faces(bool smooth = false) const;
+  void update_transform();
+  void update_object_data();
+  ObjectData object_data(const float *obj2world, const float *obj2worldNorm) const;
+
+  // The arena index range of a level of detail.
+  void lod_range(uint32_t level, GLint *first, GLsizei *count) const;
+
+  // Texture maps, null if unused; shared with other meshes
+  std::shared_ptr<Texture> diffuse_texture;
+  std::shared_ptr<Texture> normal_texture;
+  std::shared_ptr<Texture> environment_texture;
+  std::shared_ptr<Texture> alpha_texture;
+  std::shared_ptr<Texture> stub1_texture;
+  std::shared_ptr<Texture> stub2_texture;
+  std::shared_ptr<Texture> stub3_texture;
 
-  // Texture map
-  vector<unsigned char> diffuse_texture;
-  vector<unsigned char> normal_texture;
-  vector<unsigned char> environment_texture;
-  vector<unsigned char> alpha_texture;
-  vector<unsigned char> stub1_texture;
-  vector<unsigned char> stub2_texture;
-  vector<unsigned char> stub3_texture;
-  unsigned int diffuse_texture_width, diffuse_texture_height;
-  unsigned int normal_texture_width, normal_texture_height;
-  unsigned int environment_texture_width, environment_texture_height;
-  unsigned int alpha_texture_width, alpha_texture_height;
-  unsigned int stub1_texture_width, stub1_texture_height;
-  unsigned int stub2_texture_width, stub2_texture_height;
-  unsigned int stub3_texture_width, stub3_texture_height;
-  
   string vertex_shader_program;
   string fragment_shader_program;
 
-  vector<vector<size_t>> polygons;
-  vector<Collada::Polygon> polygons_carbon_copy;
-  
-  // Per v
-  vector<Vector3Df> vertices;
-  vector<Vector3Df> normals;
-  vector<Vector2Df> texture_coordinates;
-  vector<Vector3Df> tangentData;
-  vector<Vector3Df> bitangents;
-  
-  // Per f
-  vector<Vector3Df> diffuse_colors;
-  
-  // Packed
-  vector<Vector3Df> vertexData;
-  vector<Vector3Df> diffuse_colorData;
-  vector<Vector3Df> normalData;
-  vector<Vector2Df> texcoordData;
+  // Vertex streams, kept for their bounds
+  MeshBuffers buffers;
+
+  // where the streams start in the shared geometry arena
+  GeometryArena::Allocation allocation;
+
+  // arena index ranges with their byte offsets and base vertices for
+  // glMultiDrawElementsBaseVertex; adjacent ranges are joined
+  struct DrawRanges {
+    std::vector<GLint> firsts;
+    std::vector<GLsizei> counts;
+    std::vector<const GLvoid *> offsets;
+    std::vector<GLint> base_vertices;
+
+    void add(GLint first, GLsizei count, GLint base_vertex);
+    void clear();
+    bool empty() const { return counts.empty(); }
+  };
+
+  // The ranges to draw: those that survived cluster culling, else the
+  // requested ones, else null for all of the current level of detail.
+  const DrawRanges *draw_ranges() const;
+
+  // ranges to draw instead of all indices, if not empty
+  DrawRanges drawRanges;
+
+  // the clusters of drawRanges (or of the whole mesh) that survived
+  // cull_clusters(), drawn instead while clustersCulled is set
+  DrawRanges clusterRanges;
+  bool clustersCulled;
+
+  // cluster bounds for culling, and scratch for cull_clusters()
+  ClusterBatch clusterBatch;
+  std::vector<uint8_t> clusterResults;
+  std::vector<std::pair<size_t, size_t> > clusterSpans;
+
+  // ObjectData of each instance to draw instead of this mesh, if not empty,
+  // and the level of detail each is drawn at
+  std::vector<ObjectData> instances;
+  std::vector<uint32_t> instanceLods;
+
+  // level of detail the mesh itself is drawn at
+  uint32_t lod;
 
   vector<Shader> shaders;
 
   std::vector<std::string> uniform_strings;
   std::vector<float> uniform_values;
 
+  // the location of each of uniform_strings in each shader, looked up once
+  // the program is linked; -1 where the shader doesn't use it
+  std::vector<std::vector<GLint> > uniform_locations;
+
+  // the location of each of the scene's patterns in each shader, looked up
+  // the first time the mesh binds a shader in patternScene
+  mutable std::vector<std::vector<GLint> > pattern_locations;
+  mutable const Scene *patternScene;
+
+  // copies of the transform node's matrices, as of transformVersion
   float glObj2World[16];
   float glObj2WorldNorm[9];
-    
-  GLuint vao;
-  
-  GLuint vertexBuffer;
-  GLuint diffuse_colorBuffer;
-  GLuint normalBuffer;
-  GLuint texcoordBuffer;
-  GLuint tangentBuffer;
-  
-  GLuint diffuseId;
-  GLuint diffuse_colorId;
-  GLuint normalId;
-  GLuint environmentId;
-  GLuint alphaId;
-  GLuint stub1Id;
-  GLuint stub2Id;
-  GLuint stub3Id;
+  uint32_t transformVersion;
+
+  // the ObjectData uniform block and its last contents; the buffer is 0
+  // without uniform block support, and with multi-draw support, where
+  // multi-draw calls upload the blocks of all their meshes at once
+  ObjectData objectData;
+  GLuint objectDataBuffer;
 
   bool simple_renderable;
   bool simple_colors;
@@ -0,0 +1,327 @@
+#include "mesh_batch.h"
+
+#include <cstring>
+#include <map>
+#include <sstream>
+
+#include "../cache_file.h"
+
+using namespace std;
+
+namespace CS248 {
+namespace DynamicScene {
+
+bool MeshBatch::enabled = true;
+bool MeshInstances::enabled = true;
+
+namespace {
+
+// Everything a Mesh takes from a polymesh besides its geometry and
+// transform; polymeshes with the same key draw the same way.
+string batch_key(const Collada::PolymeshInfo &polymesh) {
+  ostringstream key;
+  key << polymesh.vert_filename << '\n' << polymesh.frag_filename << '\n'
+      << polymesh.diffuse_filename << '\n' << polymesh.normal_filename << '\n'
+      << polymesh.environment_filename << '\n' << polymesh.alpha_filename
+      << '\n' << polymesh.stub1_filename << '\n' << polymesh.stub2_filename
+      << '\n' << polymesh.stub3_filename << '\n' << polymesh.is_mtl_file
+      << polymesh.is_disney << '\n';
+  for (size_t i = 0; i < polymesh.uniform_strings.size(); ++i) {
+    key << polymesh.uniform_strings[i] << '=' << polymesh.uniform_values[i]
+        << '\n';
+  }
+  return key.str();
+}
+
+// Takes everything but the geometry and the transform from a polymesh.
+void copy_material(const Collada::PolymeshInfo &from,
+                   Collada::PolymeshInfo &to) {
+  to.is_obj_file = from.is_obj_file;
+  to.is_mtl_file = from.is_mtl_file;
+  to.is_disney = from.is_disney;
+  to.vert_filename = from.vert_filename;
+  to.frag_filename = from.frag_filename;
+  to.uniform_strings = from.uniform_strings;
+  to.uniform_values = from.uniform_values;
+  to.diffuse_filename = from.diffuse_filename;
+  to.normal_filename = from.normal_filename;
+  to.environment_filename = from.environment_filename;
+  to.alpha_filename = from.alpha_filename;
+  to.stub1_filename = from.stub1_filename;
+  to.stub2_filename = from.stub2_filename;
+  to.stub3_filename = from.stub3_filename;
+}
+
+uint64_t geometry_hash(const MeshBuffers &buffers) {
+  size_t n = buffers.num_vertices;
+  uint64_t hash = CacheFile::hash(&n, sizeof(n));
+  hash = CacheFile::hash(buffers.indices,
+                         buffers.num_indices * sizeof(uint32_t), hash);
+  hash = CacheFile::hash(buffers.positions, n * sizeof(Vector3Df), hash);
+  hash = CacheFile::hash(buffers.normals, n * sizeof(Vector3Df), hash);
+  if (buffers.texcoords) {
+    hash = CacheFile::hash(buffers.texcoords, n * sizeof(Vector2Df), hash);
+  }
+  hash = CacheFile::hash(buffers.tangents, n * sizeof(Vector3Df), hash);
+  return CacheFile::hash(buffers.diffuse_colors, n * sizeof(Vector3Df), hash);
+}
+
+bool same_geometry(const MeshBuffers &a, const MeshBuffers &b) {
+  size_t n = a.num_vertices;
+  if (n != b.num_vertices || a.num_indices != b.num_indices ||
+      !a.texcoords != !b.texcoords) {
+    return false;
+  }
+  return memcmp(a.indices, b.indices, a.num_indices * sizeof(uint32_t)) == 0 &&
+         memcmp(a.positions, b.positions, n * sizeof(Vector3Df)) == 0 &&
+         memcmp(a.normals, b.normals, n * sizeof(Vector3Df)) == 0 &&
+         (!a.texcoords ||
+          memcmp(a.texcoords, b.texcoords, n * sizeof(Vector2Df)) == 0) &&
+         memcmp(a.tangents, b.tangents, n * sizeof(Vector3Df)) == 0 &&
+         memcmp(a.diffuse_colors, b.diffuse_colors, n * sizeof(Vector3Df)) ==
+             0;
+}
+
+}  // namespace
+
+vector<vector<size_t>> MeshBatch::group(
+    const vector<Collada::PolymeshInfo *> &polymeshes) {
+  vector<vector<size_t>> groups;
+  map<string, size_t> group_of_key;
+  for (size_t i = 0; i < polymeshes.size(); ++i) {
+    // Only meshes that are drawn at all are worth merging.
+    if (!enabled || !polymeshes[i]->is_obj_file) {
+      groups.push_back(vector<size_t>(1, i));
+      continue;
+    }
+    auto found = group_of_key.insert(
+        make_pair(batch_key(*polymeshes[i]), groups.size()));
+    if (found.second) groups.push_back(vector<size_t>());
+    groups[found.first->second].push_back(i);
+  }
+  return groups;
+}
+
+void MeshBatch::create(const vector<Collada::PolymeshInfo *> &group,
+                       MeshStore &store, const string &shader_prefix,
+                       vector<SceneObject *> &objects) {
+  shared_ptr<MeshBatch> batch(new MeshBatch());
+
+  // Bake each polymesh's transform into its vertices, the same transform
+  // Mesh would apply when drawing it.
+  vector<const MeshBuffers *> parts;
+  vector<unique_ptr<TransformNode>> transforms;
+  vector<const float *> matrices, normal_matrices;
+  for (Collada::PolymeshInfo *polymesh : group) {
+    parts.push_back(&store.get(*polymesh));
+    transforms.emplace_back(new TransformNode());
+    transforms.back()->set_local(polymesh->position, polymesh->rotation,
+                                 polymesh->scale);
+    matrices.push_back(transforms.back()->world());
+    normal_matrices.push_back(transforms.back()->world_normal());
+  }
+
+  const Collada::PolymeshInfo &first = *group[0];
+  Collada::PolymeshInfo merged;
+  MeshBuffers merged_buffers;
+  MeshBuffers::merge(parts, matrices, normal_matrices, merged_buffers);
+  merged.position = Vector3D(0, 0, 0);
+  merged.rotation = Vector3D(0, 0, 0);
+  merged.scale = Vector3D(1, 1, 1);
+  copy_material(first, merged);
+  batch->mesh.reset(
+      new Mesh(merged, merged_buffers, Matrix4x4::identity(), shader_prefix));
+
+  const Vector3Df *positions = merged_buffers.positions;
+  const uint32_t *indices = merged_buffers.indices;
+  GLint first_index = 0;
+  for (size_t i = 0; i < group.size(); ++i) {
+    Range range;
+    range.first = first_index;
+    range.count = parts[i]->num_indices;
+    for (GLint j = range.first; j < range.first + range.count; ++j) {
+      const Vector3Df &p = positions[indices[j]];
+      range.bounds.expand(Vector3D(p.x, p.y, p.z));
+    }
+    batch->ranges.push_back(range);
+    first_index += range.count;
+
+    objects.push_back(new Part(batch, i));
+  }
+}
+
+void MeshBatch::enqueue_part(size_t index, Scene *scene,
+                             RenderQueue &queue) {
+  if (frame != queue.frame()) {
+    frame = queue.frame();
+    mesh->scene = scene;
+    mesh->clear_draw_ranges();
+    queued.clear();
+    mesh->enqueue(queue);
+  }
+  mesh->add_draw_range(ranges[index].first, ranges[index].count);
+  queued.push_back(index);
+}
+
+void MeshBatch::draw_part(size_t index, Scene *scene, bool pretty) {
+  mesh->scene = scene;
+  mesh->clear_draw_ranges();
+  mesh->add_draw_range(ranges[index].first, ranges[index].count);
+  if (pretty) {
+    mesh->draw_pretty();
+  } else {
+    mesh->draw();
+  }
+
+  // Put back the ranges of the parts queued for this frame.
+  mesh->clear_draw_ranges();
+  for (size_t part : queued) {
+    mesh->add_draw_range(ranges[part].first, ranges[part].count);
+  }
+}
+
+void MeshBatch::Part::draw() { batch->draw_part(index, scene, false); }
+
+void MeshBatch::Part::draw_pretty() { batch->draw_part(index, scene, true); }
+
+bool MeshBatch::Part::enqueue(RenderQueue &queue) {
+  batch->enqueue_part(index, scene, queue);
+  return true;
+}
+
+BBox MeshBatch::Part::get_bbox() { return batch->ranges[index].bounds; }
+
+bool MeshBatch::Part::get_occluder(const float **positions,
+                                   const uint32_t **indices,
+                                   size_t *num_indices) {
+  if (!batch->mesh->get_occluder(positions, indices, num_indices)) {
+    return false;
+  }
+  const Range &range = batch->ranges[index];
+  *indices += range.first;
+  *num_indices = range.count;
+  return true;
+}
+
+vector<vector<size_t>> MeshInstances::group(
+    const vector<Collada::PolymeshInfo *> &polymeshes, MeshStore &store) {
+  vector<vector<size_t>> groups;
+  map<pair<uint64_t, string>, vector<size_t>> groups_of_key;
+  bool instancing = enabled && multi_draw_supported();
+  for (size_t i = 0; i < polymeshes.size(); ++i) {
+    Collada::PolymeshInfo &polymesh = *polymeshes[i];
+    if (!instancing || !polymesh.is_obj_file) {
+      groups.push_back(vector<size_t>(1, i));
+      continue;
+    }
+    const MeshBuffers &buffers = store.get(polymesh);
+
+    // Equal hashes are confirmed by comparing the streams.
+    vector<size_t> &candidates = groups_of_key[make_pair(
+        geometry_hash(buffers), batch_key(polymesh))];
+    size_t found = groups.size();
+    for (size_t candidate : candidates) {
+      const Collada::PolymeshInfo &other = *polymeshes[groups[candidate][0]];
+      if (same_geometry(store.get(other), buffers)) {
+        found = candidate;
+        break;
+      }
+    }
+    if (found == groups.size()) {
+      candidates.push_back(found);
+      groups.push_back(vector<size_t>());
+    }
+    groups[found].push_back(i);
+  }
+  return groups;
+}
+
+void MeshInstances::create(const vector<Collada::PolymeshInfo *> &group,
+                           MeshStore &store, const string &shader_prefix,
+                           vector<SceneObject *> &objects) {
+  shared_ptr<MeshInstances> instances(new MeshInstances());
+
+  const Collada::PolymeshInfo &first = *group[0];
+  Collada::PolymeshInfo shared;
+  shared.position = Vector3D(0, 0, 0);
+  shared.rotation = Vector3D(0, 0, 0);
+  shared.scale = Vector3D(1, 1, 1);
+  copy_material(first, shared);
+  instances->mesh.reset(
+      new Mesh(shared, store.get(first), Matrix4x4::identity(),
+               shader_prefix));
+  instances->bounds = instances->mesh->get_bbox();
+
+  for (Collada::PolymeshInfo *polymesh : group) {
+    objects.push_back(new Instance(instances, *polymesh));
+    if (polymesh != &first) store.release(*polymesh);
+  }
+}
+
+void MeshInstances::add_instance(Instance *instance) {
+  instance->sync_transform();
+  instance->lod = mesh->select_lod(instance->transform.world(), instance->lod);
+  mesh->add_instance(instance->transform.world(),
+                     instance->transform.world_normal(), instance->lod);
+}
+
+void MeshInstances::enqueue_instance(Instance *instance, Scene *scene,
+                                     RenderQueue &queue) {
+  if (frame != queue.frame()) {
+    frame = queue.frame();
+    mesh->scene = scene;
+    mesh->clear_instances();
+    queued.clear();
+    mesh->enqueue(queue);
+  }
+  add_instance(instance);
+  queued.push_back(instance);
+}
+
+void MeshInstances::draw_instance(Instance *instance, Scene *scene,
+                                  bool pretty) {
+  mesh->scene = scene;
+  mesh->clear_instances();
+  add_instance(instance);
+  if (pretty) {
+    mesh->draw_pretty();
+  } else {
+    mesh->draw();
+  }
+
+  // Put back the instances queued for this frame.
+  mesh->clear_instances();
+  for (Instance *queued_instance : queued) add_instance(queued_instance);
+}
+
+MeshInstances::Instance::Instance(shared_ptr<MeshInstances> instances,
+                                  const Collada::PolymeshInfo &polymesh)
+    : lod(0), instances(instances) {
+  position = polymesh.position;
+  rotation = polymesh.rotation;
+  scale = polymesh.scale;
+}
+
+void MeshInstances::Instance::draw() {
+  instances->draw_instance(this, scene, false);
+}
+
+void MeshInstances::Instance::draw_pretty() {
+  instances->draw_instance(this, scene, true);
+}
+
+bool MeshInstances::Instance::enqueue(RenderQueue &queue) {
+  instances->enqueue_instance(this, scene, queue);
+  return true;
+}
+
+BBox MeshInstances::Instance::get_bbox() { return instances->bounds; }
+
+bool MeshInstances::Instance::get_occluder(const float **positions,
+                                           const uint32_t **indices,
+                                           size_t *num_indices) {
+  return instances->mesh->get_occluder(positions, indices, num_indices);
+}
+
+}  // namespace DynamicScene
+}  // namespace CS248
@@ -0,0 +1,176 @@
+#ifndef CS248_DYNAMICSCENE_MESH_BATCH_H
+#define CS248_DYNAMICSCENE_MESH_BATCH_H
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "mesh.h"
+#include "mesh_store.h"
+
+namespace CS248 {
+namespace DynamicScene {
+
+/**
+ * Static batching: meshes that share shaders, textures and material
+ * parameters are merged at load time into a single mesh, with their
+ * transforms baked into the vertices, so that they draw with one call.
+ *
+ * Every merged mesh stays a scene object of its own (a Part) with its own
+ * bounds and visibility. Parts that are visible in a frame add their index
+ * ranges to the merged mesh, which draws them all at once. Parts are static:
+ * changing their transform does not move them.
+ */
+class MeshBatch {
+ public:
+  /**
+   * Whether load merges meshes at all.
+   */
+  static bool enabled;
+
+  /**
+   * One of the merged meshes.
+   */
+  class Part : public SceneObject {
+   public:
+    Part(std::shared_ptr<MeshBatch> batch, size_t index)
+        : batch(batch), index(index) {}
+
+    void draw() override;
+    void draw_pretty() override;
+    bool enqueue(RenderQueue &queue) override;
+
+    /**
+     * In world space, as the vertices are.
+     */
+    BBox get_bbox() override;
+
+    bool get_occluder(const float **positions, const uint32_t **indices,
+                      size_t *num_indices) override;
+
+    StaticScene::SceneObject *get_static_object() override { return nullptr; }
+
+   private:
+    std::shared_ptr<MeshBatch> batch;
+    size_t index;
+  };
+
+  /**
+   * Splits polymeshes into groups that can be merged, as indices into
+   * polymeshes. Polymeshes that can't be merged with any other get a group
+   * of their own.
+   */
+  static std::vector<std::vector<size_t>> group(
+      const std::vector<Collada::PolymeshInfo *> &polymeshes);
+
+  /**
+   * Merges a group of polymeshes, with their streams from store, and appends
+   * a Part for each of them to objects.
+   */
+  static void create(const std::vector<Collada::PolymeshInfo *> &group,
+                     MeshStore &store, const std::string &shader_prefix,
+                     std::vector<SceneObject *> &objects);
+
+ private:
+  // a part's indices in the merged mesh
+  struct Range {
+    GLint first;
+    GLsizei count;
+    BBox bounds;
+  };
+
+  MeshBatch() : frame(0) {}
+
+  // Adds a part to the merged mesh's draw, queueing the mesh for the first
+  // part of a frame.
+  void enqueue_part(size_t index, Scene *scene, RenderQueue &queue);
+  void draw_part(size_t index, Scene *scene, bool pretty);
+
+  std::unique_ptr<Mesh> mesh;
+  std::vector<Range> ranges;
+  std::vector<size_t> queued;  ///< parts added to the draw in frame
+  uint32_t frame;              ///< render queue frame of the draw ranges
+};
+
+/**
+ * Automatic instancing: meshes with the same vertex streams and material
+ * are loaded into one mesh, which draws all of them with one instanced
+ * command, each copy with its own transform in its ObjectData.
+ *
+ * Every copy stays a scene object of its own (an Instance) with its own
+ * transform and visibility; unlike parts of a static batch, instances can
+ * move. Needs multi-draw support.
+ */
+class MeshInstances {
+ public:
+  /**
+   * Whether load instances meshes at all.
+   */
+  static bool enabled;
+
+  /**
+   * One copy of the mesh.
+   */
+  class Instance : public SceneObject {
+   public:
+    Instance(std::shared_ptr<MeshInstances> instances,
+             const Collada::PolymeshInfo &polymesh);
+
+    void draw() override;
+    void draw_pretty() override;
+    bool enqueue(RenderQueue &queue) override;
+
+    /**
+     * In object space, the same for every copy.
+     */
+    BBox get_bbox() override;
+
+    bool get_occluder(const float **positions, const uint32_t **indices,
+                      size_t *num_indices) override;
+
+    StaticScene::SceneObject *get_static_object() override { return nullptr; }
+
+    uint32_t lod;  ///< level of detail the copy was drawn at last
+
+   private:
+    std::shared_ptr<MeshInstances> instances;
+  };
+
+  /**
+   * Splits polymeshes into groups with the same vertex streams, compared by
+   * a hash of their contents, and the same material, as indices into
+   * polymeshes. The streams come from store, which builds them if it doesn't
+   * have them yet. Polymeshes without a copy get a group of their own.
+   */
+  static std::vector<std::vector<size_t>> group(
+      const std::vector<Collada::PolymeshInfo *> &polymeshes,
+      MeshStore &store);
+
+  /**
+   * Loads the streams of a group once and appends an Instance for each of
+   * its polymeshes to objects. The streams of the other polymeshes are
+   * released from store.
+   */
+  static void create(const std::vector<Collada::PolymeshInfo *> &group,
+                     MeshStore &store, const std::string &shader_prefix,
+                     std::vector<SceneObject *> &objects);
+
+ private:
+  MeshInstances() : frame(0) {}
+
+  // Adds an instance to the mesh's draw, queueing the mesh for the first
+  // instance of a frame.
+  void enqueue_instance(Instance *instance, Scene *scene, RenderQueue &queue);
+  void draw_instance(Instance *instance, Scene *scene, bool pretty);
+  void add_instance(Instance *instance);
+
+  std::unique_ptr<Mesh> mesh;
+  BBox bounds;
+  std::vector<Instance *> queued;  ///< instances added to the draw in frame
+  uint32_t frame;                  ///< render queue frame of the instances
+};
+
+}  // namespace DynamicScene
+}  // namespace CS248
+
+#endif  // CS248_DYNAMICSCENE_MESH_BATCH_H
@@ -0,0 +1,392 @@
+#include "mesh_buffers.h"
+
+#include "../cache_file.h"
+#include "../collada/polymesh_info.h"
+#include "mesh_clusters.h"
+#include "mesh_optimizer.h"
+#include "mesh_simplifier.h"
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+using namespace std;
+
+namespace CS248 {
+namespace DynamicScene {
+
+namespace {
+
+struct HeapStreams {
+  vector<Vector3Df> positions;
+  vector<Vector3Df> normals;
+  vector<Vector2Df> texcoords;
+  vector<Vector3Df> tangents;
+  vector<Vector3Df> diffuse_colors;
+  vector<uint32_t> indices;
+  vector<uint32_t> lod_indices;
+  vector<MeshBuffers::Cluster> clusters;
+};
+
+// Everything a triangle corner brings to its vertex; corners that agree on
+// all of it become one vertex. Tangents are summed per vertex afterwards.
+struct Corner {
+  Vector3Df position;
+  Vector3Df normal;
+  Vector2Df texcoord;
+  Vector3Df diffuse_color;
+};
+
+const uint32_t kNoVertex = ~0u;
+
+// Open-addressing hash table from corners to the vertices welded so far.
+class VertexWelder {
+ public:
+  explicit VertexWelder(size_t max_vertices) {
+    size_t size = 16;
+    while (size < max_vertices * 2) size *= 2;
+    slots.assign(size, kNoVertex);
+    vertices.reserve(max_vertices);
+  }
+
+  // Returns the index of the vertex the corner is welded into.
+  uint32_t weld(const Corner& corner) {
+    size_t mask = slots.size() - 1;
+    size_t slot = CacheFile::hash(&corner, sizeof(corner)) & mask;
+    for (; slots[slot] != kNoVertex; slot = (slot + 1) & mask) {
+      if (memcmp(&vertices[slots[slot]], &corner, sizeof(corner)) == 0)
+        return slots[slot];
+    }
+    slots[slot] = vertices.size();
+    vertices.push_back(corner);
+    return slots[slot];
+  }
+
+  vector<Corner> vertices;
+
+ private:
+  vector<uint32_t> slots;  ///< vertex index, or kNoVertex if empty
+};
+
+inline Vector3Df to_float(const Vector3D& u) {
+  Vector3Df v;
+  v.x = u.x;
+  v.y = u.y;
+  v.z = u.z;
+  return v;
+}
+
+inline Vector2Df to_float(const Vector2D& u) {
+  Vector2Df v;
+  v.x = u.x;
+  v.y = u.y;
+  return v;
+}
+
+inline Vector3Df transform_point(const float* m, const Vector3Df& p) {
+  Vector3Df v;
+  v.x = m[0] * p.x + m[4] * p.y + m[8] * p.z + m[12];
+  v.y = m[1] * p.x + m[5] * p.y + m[9] * p.z + m[13];
+  v.z = m[2] * p.x + m[6] * p.y + m[10] * p.z + m[14];
+  return v;
+}
+
+inline Vector3Df transform_vector(const float* m, const Vector3Df& d) {
+  Vector3Df v;
+  v.x = m[0] * d.x + m[3] * d.y + m[6] * d.z;
+  v.y = m[1] * d.x + m[4] * d.y + m[7] * d.z;
+  v.z = m[2] * d.x + m[5] * d.y + m[8] * d.z;
+  return v;
+}
+
+}  // namespace
+
+MeshBuffers::MeshBuffers()
+    : num_vertices(0), num_indices(0), positions(nullptr), normals(nullptr),
+      texcoords(nullptr), tangents(nullptr), diffuse_colors(nullptr),
+      indices(nullptr), num_lods(0), num_lod_indices(0),
+      lod_indices(nullptr), num_clusters(0), clusters(nullptr) {
+  memset(lods, 0, sizeof(lods));
+  float inf = numeric_limits<float>::infinity();
+  bbox_min.x = bbox_min.y = bbox_min.z = inf;
+  bbox_max.x = bbox_max.y = bbox_max.z = -inf;
+}
+
+void MeshBuffers::build(const Collada::PolymeshInfo& polymesh,
+                        MeshBuffers& buffers) {
+  shared_ptr<HeapStreams> streams = make_shared<HeapStreams>();
+
+  // Convert to float first, so that every corner that shares a vertex gets
+  // exactly the same value.
+  vector<Vector3Df> vertices, normals;
+  vector<Vector2Df> texture_coordinates;
+  vertices.reserve(polymesh.vertices.size());
+  normals.reserve(polymesh.normals.size());
+  texture_coordinates.reserve(polymesh.texcoords.size());
+  for (const Vector3D& u : polymesh.vertices) vertices.push_back(to_float(u));
+  for (const Vector3D& u : polymesh.normals) normals.push_back(to_float(u));
+  for (const Vector2D& u : polymesh.texcoords)
+    texture_coordinates.push_back(to_float(u));
+
+  buffers = MeshBuffers();
+  for (const Vector3Df& v : vertices) {
+    buffers.bbox_min.x = min(buffers.bbox_min.x, v.x);
+    buffers.bbox_min.y = min(buffers.bbox_min.y, v.y);
+    buffers.bbox_min.z = min(buffers.bbox_min.z, v.z);
+    buffers.bbox_max.x = max(buffers.bbox_max.x, v.x);
+    buffers.bbox_max.y = max(buffers.bbox_max.y, v.y);
+    buffers.bbox_max.z = max(buffers.bbox_max.z, v.z);
+  }
+
+  size_t num_faces = polymesh.polygons.size();
+  bool has_texcoords = !texture_coordinates.empty();
+  Vector3Df zero = {0, 0, 0};
+
+  VertexWelder welder(num_faces * 3);
+  streams->indices.reserve(num_faces * 3);
+  for (size_t i = 0; i < num_faces; ++i) {
+    const Collada::Polygon& poly = polymesh.polygons[i];
+    Corner corner;
+    corner.diffuse_color = to_float(polymesh.material_diffuse_parameters[i]);
+    for (size_t j = 0; j < 3; ++j) {
+      corner.position = vertices[poly.vertex_indices[j]];
+      corner.normal = j < poly.normal_indices.size()
+                          ? normals[poly.normal_indices[j]]
+                          : zero;
+      corner.texcoord.x = corner.texcoord.y = 0;
+      if (has_texcoords && j < poly.texcoord_indices.size())
+        corner.texcoord = texture_coordinates[poly.texcoord_indices[j]];
+      streams->indices.push_back(welder.weld(corner));
+    }
+  }
+
+  // Put the triangles in GPU-friendly order and split them into clusters,
+  // then the vertices in the order the triangles use them.
+  vector<Corner>& welded = welder.vertices;
+  size_t num_vertices = welded.size();
+  if (MeshOptimizer::enabled && num_vertices > 0) {
+    vector<uint32_t>& indices = streams->indices;
+    MeshOptimizer::optimize_vertex_cache(indices.data(), indices.size(),
+                                         num_vertices);
+    MeshOptimizer::optimize_overdraw(indices.data(), indices.size(),
+                                     &welded[0].position.x, num_vertices,
+                                     sizeof(Corner));
+  }
+  if (MeshClusters::enabled && num_vertices > 0) {
+    vector<uint32_t> cache_order;
+    if (MeshOptimizer::enabled) cache_order = streams->indices;
+    MeshClusters::build(streams->indices.data(), streams->indices.size(),
+                        &welded[0].position.x, num_vertices, sizeof(Corner),
+                        streams->clusters);
+
+    // Clusters gather triangles from all over the cache order; put each
+    // cluster's triangles back in cache order, over its own vertices.
+    if (MeshOptimizer::enabled) {
+      vector<uint32_t>& indices = streams->indices;
+      vector<uint32_t> local(num_vertices, ~0u), global, cluster_indices;
+      for (const Cluster& cluster : streams->clusters) {
+        uint32_t* begin = &indices[cluster.first_index];
+        global.clear();
+        cluster_indices.resize(cluster.num_indices);
+        for (uint32_t i = 0; i < cluster.num_indices; ++i) {
+          uint32_t& v = local[begin[i]];
+          if (v == ~0u) {
+            v = global.size();
+            global.push_back(begin[i]);
+          }
+          cluster_indices[i] = v;
+        }
+        MeshOptimizer::optimize_vertex_cache(
+            cluster_indices.data(), cluster.num_indices, global.size());
+        for (uint32_t i = 0; i < cluster.num_indices; ++i) {
+          begin[i] = global[cluster_indices[i]];
+        }
+        for (uint32_t v : global) local[v] = ~0u;
+      }
+
+      // Where that still misses the cache more than the optimized order,
+      // the clusters are cut from that order instead.
+      if (MeshOptimizer::analyze(indices.data(), indices.size(),
+                                 num_vertices).acmr >
+          MeshOptimizer::analyze(cache_order.data(), cache_order.size(),
+                                 num_vertices).acmr) {
+        indices.swap(cache_order);
+        streams->clusters.clear();
+        MeshClusters::split(indices.data(), indices.size(),
+                            &welded[0].position.x, num_vertices,
+                            sizeof(Corner), streams->clusters);
+      }
+    }
+  }
+  if (MeshOptimizer::enabled && num_vertices > 0) {
+    vector<uint32_t>& indices = streams->indices;
+    vector<uint32_t> remap;
+    MeshOptimizer::optimize_vertex_fetch(indices.data(), indices.size(),
+                                         num_vertices, remap);
+    vector<Corner> reordered(num_vertices);
+    for (size_t v = 0; v < num_vertices; ++v) reordered[remap[v]] = welded[v];
+    welded.swap(reordered);
+  }
+
+  streams->positions.reserve(num_vertices);
+  streams->normals.reserve(num_vertices);
+  streams->diffuse_colors.reserve(num_vertices);
+  if (has_texcoords) streams->texcoords.reserve(num_vertices);
+  for (const Corner& corner : welded) {
+    streams->positions.push_back(corner.position);
+    streams->normals.push_back(corner.normal);
+    streams->diffuse_colors.push_back(corner.diffuse_color);
+    if (has_texcoords) streams->texcoords.push_back(corner.texcoord);
+  }
+
+  // Tangents need texcoords; meshes without them get zero tangents. Each
+  // vertex sums the tangents of its triangles, leaving out triangles whose
+  // texcoords are degenerate.
+  streams->tangents.assign(num_vertices, zero);
+  const vector<uint32_t>& indices = streams->indices;
+  const vector<Vector3Df>& vertexData = streams->positions;
+  const vector<Vector2Df>& texcoordData = streams->texcoords;
+  for (size_t i = 0; has_texcoords && i < indices.size(); i += 3) {
+    Vector3Df v0 = vertexData[indices[i+0]];
+    Vector3Df v1 = vertexData[indices[i+1]];
+    Vector3Df v2 = vertexData[indices[i+2]];
+
+    Vector2Df uv0 = texcoordData[indices[i+0]];
+    Vector2Df uv1 = texcoordData[indices[i+1]];
+    Vector2Df uv2 = texcoordData[indices[i+2]];
+
+    Vector3Df deltaPos1;
+    deltaPos1.x = v1.x-v0.x;
+    deltaPos1.y = v1.y-v0.y;
+    deltaPos1.z = v1.z-v0.z;
+
+    Vector3Df deltaPos2;
+    deltaPos2.x = v2.x-v0.x;
+    deltaPos2.y = v2.y-v0.y;
+    deltaPos2.z = v2.z-v0.z;
+
+    Vector2Df deltaUV1;
+    deltaUV1.x = uv1.x - uv0.x;
+    deltaUV1.y = uv1.y - uv0.y;
+
+    Vector2Df deltaUV2;
+    deltaUV2.x = uv2.x - uv0.x;
+    deltaUV2.y = uv2.y - uv0.y;
+
+    float r = 1.0f / (deltaUV1.x * deltaUV2.y - deltaUV1.y * deltaUV2.x);
+
+    Vector3Df tangent;
+    tangent.x = (deltaPos1.x * deltaUV2.y - deltaPos2.x * deltaUV1.y)*r;
+    tangent.y = (deltaPos1.y * deltaUV2.y - deltaPos2.y * deltaUV1.y)*r;
+    tangent.z = (deltaPos1.z * deltaUV2.y - deltaPos2.z * deltaUV1.y)*r;
+    if (!isfinite(tangent.x) || !isfinite(tangent.y) || !isfinite(tangent.z))
+      continue;
+
+    for (int j = 0; j < 3; ++j) {
+      Vector3Df& sum = streams->tangents[indices[i+j]];
+      sum.x += tangent.x;
+      sum.y += tangent.y;
+      sum.z += tangent.z;
+    }
+  }
+
+  buffers.num_vertices = num_vertices;
+  buffers.num_indices = streams->indices.size();
+  buffers.positions = streams->positions.data();
+  buffers.normals = streams->normals.data();
+  buffers.texcoords = has_texcoords ? streams->texcoords.data() : nullptr;
+  buffers.tangents = streams->tangents.data();
+  buffers.diffuse_colors = streams->diffuse_colors.data();
+  buffers.indices = streams->indices.data();
+  buffers.num_clusters = streams->clusters.size();
+  if (buffers.num_clusters) buffers.clusters = streams->clusters.data();
+  buffers.storage = streams;
+
+  if (MeshSimplifier::enabled) {
+    buffers.num_lods = MeshSimplifier::build_lods(
+        buffers, streams->lod_indices, buffers.lods);
+    buffers.num_lod_indices = streams->lod_indices.size();
+    if (buffers.num_lods) buffers.lod_indices = streams->lod_indices.data();
+  }
+}
+
+void MeshBuffers::merge(const vector<const MeshBuffers*>& parts,
+                        const vector<const float*>& transforms,
+                        const vector<const float*>& normal_transforms,
+                        MeshBuffers& merged) {
+  shared_ptr<HeapStreams> streams = make_shared<HeapStreams>();
+
+  size_t num_vertices = 0, num_indices = 0;
+  bool has_texcoords = false;
+  for (const MeshBuffers* part : parts) {
+    num_vertices += part->num_vertices;
+    num_indices += part->num_indices;
+    has_texcoords = has_texcoords || part->texcoords;
+  }
+  streams->positions.reserve(num_vertices);
+  streams->normals.reserve(num_vertices);
+  streams->tangents.reserve(num_vertices);
+  streams->diffuse_colors.reserve(num_vertices);
+  if (has_texcoords) streams->texcoords.reserve(num_vertices);
+  streams->indices.reserve(num_indices);
+
+  merged = MeshBuffers();
+  Vector2Df zero = {0, 0};
+  for (size_t i = 0; i < parts.size(); ++i) {
+    const MeshBuffers& part = *parts[i];
+    const float* m = transforms[i];
+    const float* n = normal_transforms[i];
+    uint32_t base = streams->positions.size();
+    uint32_t first_index = streams->indices.size();
+    for (size_t v = 0; v < part.num_indices; ++v) {
+      streams->indices.push_back(base + part.indices[v]);
+    }
+    for (size_t v = 0; v < part.num_vertices; ++v) {
+      Vector3Df p = transform_point(m, part.positions[v]);
+      merged.bbox_min.x = min(merged.bbox_min.x, p.x);
+      merged.bbox_min.y = min(merged.bbox_min.y, p.y);
+      merged.bbox_min.z = min(merged.bbox_min.z, p.z);
+      merged.bbox_max.x = max(merged.bbox_max.x, p.x);
+      merged.bbox_max.y = max(merged.bbox_max.y, p.y);
+      merged.bbox_max.z = max(merged.bbox_max.z, p.z);
+      streams->positions.push_back(p);
+      streams->normals.push_back(transform_vector(n, part.normals[v]));
+      streams->tangents.push_back(transform_vector(n, part.tangents[v]));
+      streams->diffuse_colors.push_back(part.diffuse_colors[v]);
+      if (has_texcoords) {
+        streams->texcoords.push_back(part.texcoords ? part.texcoords[v]
+                                                    : zero);
+      }
+    }
+
+    // The clusters keep their triangles; their bounds move with the
+    // vertices. Cones stay off where they were, and where the transform
+    // mirrors the part, turning it inside out.
+    float det = m[0] * (m[5] * m[10] - m[9] * m[6]) -
+                m[4] * (m[1] * m[10] - m[9] * m[2]) +
+                m[8] * (m[1] * m[6] - m[5] * m[2]);
+    for (size_t c = 0; c < part.num_clusters; ++c) {
+      Cluster cluster = part.clusters[c];
+      cluster.first_index += first_index;
+      MeshClusters::compute_bounds(
+          streams->indices.data(), &streams->positions[0].x, sizeof(Vector3Df),
+          det > 0 && cluster.cone_cutoff > 0, cluster);
+      streams->clusters.push_back(cluster);
+    }
+  }
+
+  merged.num_vertices = num_vertices;
+  merged.num_indices = num_indices;
+  merged.positions = streams->positions.data();
+  merged.normals = streams->normals.data();
+  merged.texcoords = has_texcoords ? streams->texcoords.data() : nullptr;
+  merged.tangents = streams->tangents.data();
+  merged.diffuse_colors = streams->diffuse_colors.data();
+  merged.indices = streams->indices.data();
+  merged.num_clusters = streams->clusters.size();
+  if (merged.num_clusters) merged.clusters = streams->clusters.data();
+  merged.storage = streams;
+}
+
+}  // namespace DynamicScene
+}  // namespace CS248
@@ -0,0 +1,126 @@
+#ifndef CS248_DYNAMICSCENE_MESH_BUFFERS_H
+#define CS248_DYNAMICSCENE_MESH_BUFFERS_H
+
+#include <stdint.h>
+#include <memory>
+#include <vector>
+
+namespace CS248 {
+
+namespace Collada {
+struct PolymeshInfo;
+}
+
+namespace DynamicScene {
+
+struct Vector2Df {
+public:
+  float x, y;
+};
+
+struct Vector3Df {
+public:
+	float x, y, z;
+};
+
+/**
+ * The GPU-ready streams of a mesh: one entry per unique vertex, and three
+ * indices into them per triangle, in the layout handed to glBufferData. The
+ * streams either live in memory built by build() or point into a
+ * memory-mapped cache file (see MeshCache); either way, storage keeps them
+ * alive and copies of a MeshBuffers share it.
+ */
+struct MeshBuffers {
+  /**
+   * A coarser level of detail: its own triangles over the same vertices,
+   * and how far its surface may be from the full mesh's, as a fraction of
+   * the radius of the mesh's bounding sphere.
+   */
+  struct Lod {
+    uint32_t first_index;  ///< into lod_indices
+    uint32_t num_indices;
+    float error;
+  };
+
+  static const int kMaxLods = 4;
+
+  /**
+   * A run of nearby triangles of the full mesh (see MeshClusters) with the
+   * bounds to cull it by: a box around its vertices, a sphere around the
+   * box's center, and a cone around its triangles' normals.
+   */
+  struct Cluster {
+    uint32_t first_index;  ///< into indices
+    uint32_t num_indices;
+    Vector3Df bbox_min;
+    Vector3Df bbox_max;
+    float radius;
+    Vector3Df cone_axis;
+    float cone_cutoff;  ///< cosine of the cone's half angle; 0 if the
+                        ///< cluster never faces away as a whole
+  };
+
+  size_t num_vertices;  ///< unique vertices
+  size_t num_indices;   ///< triangle corners, 3 per triangle
+
+  const Vector3Df* positions;
+  const Vector3Df* normals;
+  const Vector2Df* texcoords;  ///< null if the mesh has no texcoords
+  const Vector3Df* tangents;   ///< sum over the triangles using the vertex
+  const Vector3Df* diffuse_colors;
+  const uint32_t* indices;
+
+  size_t num_lods;   ///< levels of detail besides the full mesh
+  Lod lods[kMaxLods];  ///< finest first
+  size_t num_lod_indices;
+  const uint32_t* lod_indices;  ///< of every level, one after another
+
+  size_t num_clusters;  ///< 0 if the mesh isn't split into clusters
+  const Cluster* clusters;  ///< in index order, covering all indices
+
+  Vector3Df bbox_min;  ///< bounds of the mesh's vertex array; min > max if
+  Vector3Df bbox_max;  ///< it has no vertices
+
+  std::shared_ptr<const void> storage;
+
+  MeshBuffers();
+
+  bool empty() const { return !storage; }
+
+  /**
+   * Bytes of all streams together.
+   */
+  size_t size_bytes() const {
+    return num_vertices * (4 * sizeof(Vector3Df) +
+                           (texcoords ? sizeof(Vector2Df) : 0)) +
+           (num_indices + num_lod_indices) * sizeof(uint32_t) +
+           num_clusters * sizeof(Cluster);
+  }
+
+  /**
+   * Welds the corners of a triangle mesh that share position, normal,
+   * texcoord and diffuse color into one vertex each, reorders the triangles
+   * and vertices with MeshOptimizer and splits the triangles into clusters
+   * with MeshClusters if they are enabled, computes per-vertex tangents,
+   * and builds levels of detail with MeshSimplifier if it is enabled.
+   */
+  static void build(const Collada::PolymeshInfo& polymesh, MeshBuffers& buffers);
+
+  /**
+   * Concatenates the streams of several meshes, moving each into world space
+   * on the way: positions by a column-major 4x4 matrix, normals and tangents
+   * by a column-major 3x3 one. Meshes without texcoords get zeros if others
+   * have them. Indices are offset by the vertices of the meshes before.
+   * The merged mesh has no levels of detail; it keeps the clusters of
+   * the meshes, with their bounds moved along.
+   */
+  static void merge(const std::vector<const MeshBuffers*>& parts,
+                    const std::vector<const float*>& transforms,
+                    const std::vector<const float*>& normal_transforms,
+                    MeshBuffers& merged);
+};
+
+}  // namespace DynamicScene
+}  // namespace CS248
+
+#endif  // CS248_DYNAMICSCENE_MESH_BUFFERS_H
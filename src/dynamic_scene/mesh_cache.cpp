@@ -0,0 +1,220 @@
+#include "mesh_cache.h"
+
+#include <sys/stat.h>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace CS248 {
+namespace DynamicScene {
+
+MeshCache::Mode MeshCache::mode = MeshCache::READ_WRITE;
+
+namespace {
+
+// Bump whenever the file layout or MeshBuffers::build changes.
+const uint32_t kVersion = 6;
+const char kMagic[8] = {'C', 'S', '2', '4', '8', 'M', 'S', 'H'};
+
+const size_t kAlignment = 16;
+
+enum Stream { POSITIONS, NORMALS, TEXCOORDS, TANGENTS, DIFFUSE_COLORS,
+              INDICES, LOD_INDICES, CLUSTERS, NUM_STREAMS };
+
+struct FileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t has_texcoords;
+  MeshCache::Key key;
+  uint64_t num_vertices;
+  uint64_t num_indices;
+  uint64_t num_lods;
+  uint64_t num_lod_indices;
+  MeshBuffers::Lod lods[MeshBuffers::kMaxLods];
+  uint64_t num_clusters;
+  Vector3Df bbox_min;
+  Vector3Df bbox_max;
+  uint64_t offsets[NUM_STREAMS];  ///< from the start of the file
+  uint64_t file_size;
+};
+
+size_t stream_size(Stream stream, const FileHeader& header) {
+  if (stream == TEXCOORDS) {
+    return header.has_texcoords ? header.num_vertices * sizeof(Vector2Df) : 0;
+  }
+  if (stream == INDICES) return header.num_indices * sizeof(uint32_t);
+  if (stream == LOD_INDICES) return header.num_lod_indices * sizeof(uint32_t);
+  if (stream == CLUSTERS) {
+    return header.num_clusters * sizeof(MeshBuffers::Cluster);
+  }
+  return header.num_vertices * sizeof(Vector3Df);
+}
+
+size_t align(size_t offset) {
+  return (offset + kAlignment - 1) / kAlignment * kAlignment;
+}
+
+// Lays out the streams after the header.
+void layout(FileHeader& header) {
+  size_t offset = align(sizeof(FileHeader));
+  for (int s = 0; s < NUM_STREAMS; ++s) {
+    header.offsets[s] = offset;
+    offset = align(offset + stream_size((Stream)s, header));
+  }
+  header.file_size = offset;
+}
+
+bool same_key(const MeshCache::Key& a, const MeshCache::Key& b) {
+  return a.source == b.source && a.inputs_hash == b.inputs_hash;
+}
+
+// Read-only view of a whole file, memory-mapped where possible.
+shared_ptr<const void> map_file(const string& filename, size_t& size) {
+#ifdef _WIN32
+  ifstream in(filename, ios::in | ios::binary);
+  if (!in.is_open()) return nullptr;
+  in.seekg(0, ios::end);
+  size = (size_t)in.tellg();
+  in.seekg(0, ios::beg);
+  shared_ptr<vector<char> > data = make_shared<vector<char> >(size);
+  if (size && !in.read(data->data(), size)) return nullptr;
+  return shared_ptr<const void>(data, data->data());
+#else
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) return nullptr;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+    close(fd);
+    return nullptr;
+  }
+  size = (size_t)st.st_size;
+  void* addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) return nullptr;
+  size_t length = size;
+  return shared_ptr<const void>(addr, [length](const void* p) {
+    munmap(const_cast<void*>(p), length);
+  });
+#endif
+}
+
+}  // namespace
+
+bool MeshCache::make_key(const string& source_filename, const string& contents,
+                         Key& key) {
+  key.inputs_hash = 0;
+  return CacheFile::make_source(source_filename, contents.data(),
+                                contents.size(), key.source);
+}
+
+string MeshCache::cache_filename(const string& source_filename,
+                                 const Key& key) {
+  // The inputs hash is part of the name so that meshes sharing an OBJ with
+  // different options don't keep overwriting each other's cache.
+  char suffix[32];
+  snprintf(suffix, sizeof(suffix), ".%016llx.meshcache",
+           (unsigned long long)key.inputs_hash);
+  return source_filename + suffix;
+}
+
+bool MeshCache::load(const string& filename, const Key& key,
+                     MeshBuffers& buffers) {
+  size_t size = 0;
+  shared_ptr<const void> file = map_file(filename, size);
+  if (!file || size < sizeof(FileHeader)) return false;
+
+  FileHeader header;
+  memcpy(&header, file.get(), sizeof(FileHeader));
+  if (memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 ||
+      header.version != kVersion || !same_key(header.key, key) ||
+      header.num_lods > MeshBuffers::kMaxLods) {
+    return false;
+  }
+
+  FileHeader expected = header;
+  layout(expected);
+  if (memcmp(expected.offsets, header.offsets, sizeof(header.offsets)) != 0 ||
+      header.file_size != expected.file_size || size < header.file_size) {
+    return false;
+  }
+
+  const char* base = (const char*)file.get();
+  buffers = MeshBuffers();
+  buffers.num_vertices = header.num_vertices;
+  buffers.num_indices = header.num_indices;
+  buffers.positions = (const Vector3Df*)(base + header.offsets[POSITIONS]);
+  buffers.normals = (const Vector3Df*)(base + header.offsets[NORMALS]);
+  buffers.texcoords = header.has_texcoords
+      ? (const Vector2Df*)(base + header.offsets[TEXCOORDS]) : nullptr;
+  buffers.tangents = (const Vector3Df*)(base + header.offsets[TANGENTS]);
+  buffers.diffuse_colors =
+      (const Vector3Df*)(base + header.offsets[DIFFUSE_COLORS]);
+  buffers.indices = (const uint32_t*)(base + header.offsets[INDICES]);
+  buffers.num_lods = header.num_lods;
+  memcpy(buffers.lods, header.lods, sizeof(header.lods));
+  buffers.num_lod_indices = header.num_lod_indices;
+  buffers.lod_indices = header.num_lod_indices
+      ? (const uint32_t*)(base + header.offsets[LOD_INDICES]) : nullptr;
+  buffers.num_clusters = header.num_clusters;
+  buffers.clusters = header.num_clusters
+      ? (const MeshBuffers::Cluster*)(base + header.offsets[CLUSTERS])
+      : nullptr;
+  buffers.bbox_min = header.bbox_min;
+  buffers.bbox_max = header.bbox_max;
+  buffers.storage = file;
+  return true;
+}
+
+bool MeshCache::store(const string& filename, const Key& key,
+                      const MeshBuffers& buffers) {
+  FileHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.has_texcoords = buffers.texcoords != nullptr;
+  header.key = key;
+  header.num_vertices = buffers.num_vertices;
+  header.num_indices = buffers.num_indices;
+  header.num_lods = buffers.num_lods;
+  header.num_lod_indices = buffers.num_lod_indices;
+  memcpy(header.lods, buffers.lods, sizeof(header.lods));
+  header.num_clusters = buffers.num_clusters;
+  header.bbox_min = buffers.bbox_min;
+  header.bbox_max = buffers.bbox_max;
+  layout(header);
+
+  const void* streams[NUM_STREAMS];
+  streams[POSITIONS] = buffers.positions;
+  streams[NORMALS] = buffers.normals;
+  streams[TEXCOORDS] = buffers.texcoords;
+  streams[TANGENTS] = buffers.tangents;
+  streams[DIFFUSE_COLORS] = buffers.diffuse_colors;
+  streams[INDICES] = buffers.indices;
+  streams[LOD_INDICES] = buffers.lod_indices;
+  streams[CLUSTERS] = buffers.clusters;
+
+  return CacheFile::write(filename, [&](ostream& out) {
+    static const char padding[kAlignment] = {0};
+    out.write((const char*)&header, sizeof(header));
+    size_t offset = sizeof(header);
+    for (int s = 0; s < NUM_STREAMS; ++s) {
+      out.write(padding, header.offsets[s] - offset);
+      size_t bytes = stream_size((Stream)s, header);
+      if (bytes) out.write((const char*)streams[s], bytes);
+      offset = header.offsets[s] + bytes;
+    }
+    out.write(padding, header.file_size - offset);
+  });
+}
+
+}  // namespace DynamicScene
+}  // namespace CS248
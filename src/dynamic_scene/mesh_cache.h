@@ -0,0 +1,71 @@
+#ifndef CS248_DYNAMICSCENE_MESH_CACHE_H
+#define CS248_DYNAMICSCENE_MESH_CACHE_H
+
+#include <stdint.h>
+#include <string>
+
+#include "../cache_file.h"
+#include "mesh_buffers.h"
+
+namespace CS248 {
+namespace DynamicScene {
+
+/**
+ * On-disk cache of built MeshBuffers, so that warm starts can skip OBJ
+ * parsing and vertex welding. A cache file holds a versioned header followed
+ * by the vertex and index streams exactly as they are uploaded; loading
+ * memory-maps the file and points the MeshBuffers straight into the mapping.
+ *
+ * Cache files are written next to their source and are only valid on machines
+ * with the same byte order.
+ */
+class MeshCache {
+ public:
+  enum Mode {
+    READ_WRITE,  ///< use valid cache files, write missing or stale ones
+    BYPASS,      ///< neither read nor write cache files
+    REBUILD      ///< ignore existing cache files and rewrite them
+  };
+
+  static Mode mode;
+
+  /**
+   * Everything a cache file was built from. A file is only used if all
+   * fields match.
+   */
+  struct Key {
+    CacheFile::Source source;
+    uint64_t inputs_hash;  ///< source path plus any other build inputs
+  };
+
+  /**
+   * Fills in the source fields of key for a file whose contents have
+   * already been read. inputs_hash is left to the caller.
+   */
+  static bool make_key(const std::string& source_filename,
+                       const std::string& contents, Key& key);
+
+  /**
+   * Where the cache file for a source and key lives.
+   */
+  static std::string cache_filename(const std::string& source_filename,
+                                    const Key& key);
+
+  /**
+   * Maps a cache file. Fails if it is missing, truncated, from another
+   * version, or was built from different inputs.
+   */
+  static bool load(const std::string& filename, const Key& key,
+                   MeshBuffers& buffers);
+
+  /**
+   * Writes a cache file; the file is replaced atomically.
+   */
+  static bool store(const std::string& filename, const Key& key,
+                    const MeshBuffers& buffers);
+};
+
+}  // namespace DynamicScene
+}  // namespace CS248
+
+#endif  // CS248_DYNAMICSCENE_MESH_CACHE_H
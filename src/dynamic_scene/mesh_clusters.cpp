@@ -0,0 +1,593 @@
+#include "mesh_clusters.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+
+#include "../frustum.h"
+
+#if (defined(__SSE2__) || defined(_M_X64)) && !defined(CS248_NO_SIMD)
+#define CS248_CLUSTERS_SSE2
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+namespace CS248 {
+namespace DynamicScene {
+
+bool MeshClusters::enabled = true;
+
+namespace {
+
+// floats per group of four clusters: four each of the box center's x, y
+// and z, the half extents, the radius, the cone axis, and the cone's
+// cosine and sine
+const size_t kGroupFloats = 48;
+enum Field { CX = 0, CY = 4, CZ = 8, EX = 12, EY = 16, EZ = 20, RADIUS = 24,
+             AX = 28, AY = 32, AZ = 36, COS = 40, SIN = 44 };
+
+// How much facing away from a cluster's normals counts against a triangle,
+// relative to its distance, when growing the cluster.
+const float kConeWeight = 1.0f;
+
+// Pixels by which a projection is widened before looking for pixel centers
+// in it, so that rounding never drops a cluster that covers one.
+const float kPixelSlack = 1.0f / 32;
+
+const uint32_t kNone = ~0u;
+
+const Vector3Df &vertex(const float *positions, size_t stride, uint32_t v) {
+  return *(const Vector3Df *)((const char *)positions + v * stride);
+}
+
+Vector3Df sub(const Vector3Df &a, const Vector3Df &b) {
+  Vector3Df d = {a.x - b.x, a.y - b.y, a.z - b.z};
+  return d;
+}
+
+float dot(const Vector3Df &a, const Vector3Df &b) {
+  return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+Vector3Df cross(const Vector3Df &a, const Vector3Df &b) {
+  Vector3Df c = {a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z,
+                 a.x * b.y - a.y * b.x};
+  return c;
+}
+
+// The unit normal of a triangle, zero if it has no area.
+Vector3Df triangle_normal(const float *positions, size_t stride,
+                          const uint32_t *tri) {
+  const Vector3Df &p0 = vertex(positions, stride, tri[0]);
+  Vector3Df n = cross(sub(vertex(positions, stride, tri[1]), p0),
+                      sub(vertex(positions, stride, tri[2]), p0));
+  float length = sqrt(dot(n, n));
+  if (!(length > 0)) {
+    Vector3Df zero = {0, 0, 0};
+    return zero;
+  }
+  Vector3Df unit = {n.x / length, n.y / length, n.z / length};
+  return unit;
+}
+
+#ifndef CS248_CLUSTERS_SSE2
+// Whether a pixel center, at an integer plus a half, falls within [lo, hi]
+// of a viewport size pixels wide.
+bool covers_center(float lo, float hi, float size) {
+  lo = max(lo - kPixelSlack, -2.0f);
+  hi = min(hi + kPixelSlack, size + 2);
+  return floor(hi - 0.5f) >= lo - 0.5f;
+}
+#endif
+
+}  // namespace
+
+void ClusterBatch::assign(const MeshBuffers::Cluster *clusters,
+                          size_t num_clusters) {
+  data.assign((num_clusters + 3) / 4 * kGroupFloats, 0.0f);
+  count = num_clusters;
+  for (size_t i = 0; i < num_clusters; ++i) {
+    const MeshBuffers::Cluster &cluster = clusters[i];
+    float *group = &data[i / 4 * kGroupFloats] + i % 4;
+    group[CX] = (cluster.bbox_min.x + cluster.bbox_max.x) / 2;
+    group[CY] = (cluster.bbox_min.y + cluster.bbox_max.y) / 2;
+    group[CZ] = (cluster.bbox_min.z + cluster.bbox_max.z) / 2;
+    group[EX] = (cluster.bbox_max.x - cluster.bbox_min.x) / 2;
+    group[EY] = (cluster.bbox_max.y - cluster.bbox_min.y) / 2;
+    group[EZ] = (cluster.bbox_max.z - cluster.bbox_min.z) / 2;
+    group[RADIUS] = cluster.radius;
+    group[AX] = cluster.cone_axis.x;
+    group[AY] = cluster.cone_axis.y;
+    group[AZ] = cluster.cone_axis.z;
+    group[COS] = cluster.cone_cutoff;
+    group[SIN] =
+        sqrt(max(0.0f, 1 - cluster.cone_cutoff * cluster.cone_cutoff));
+  }
+}
+
+void MeshClusters::build(uint32_t *indices, size_t num_indices,
+                         const float *positions, size_t num_vertices,
+                         size_t position_stride,
+                         vector<MeshBuffers::Cluster> &clusters) {
+  size_t num_triangles = num_indices / 3;
+  if (num_triangles == 0) return;
+
+  vector<Vector3Df> centroids(num_triangles), normals(num_triangles);
+  for (size_t t = 0; t < num_triangles; ++t) {
+    const uint32_t *tri = &indices[t * 3];
+    const Vector3Df &p0 = vertex(positions, position_stride, tri[0]);
+    const Vector3Df &p1 = vertex(positions, position_stride, tri[1]);
+    const Vector3Df &p2 = vertex(positions, position_stride, tri[2]);
+    Vector3Df centroid = {(p0.x + p1.x + p2.x) / 3, (p0.y + p1.y + p2.y) / 3,
+                          (p0.z + p1.z + p2.z) / 3};
+    centroids[t] = centroid;
+    normals[t] = triangle_normal(positions, position_stride, tri);
+  }
+
+  // triangles using each vertex
+  vector<uint32_t> offsets(num_vertices + 1, 0), triangles(num_triangles * 3);
+  for (size_t i = 0; i < num_triangles * 3; ++i) offsets[indices[i] + 1]++;
+  for (size_t v = 0; v < num_vertices; ++v) offsets[v + 1] += offsets[v];
+  {
+    vector<uint32_t> filled(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < num_triangles * 3; ++i) {
+      triangles[filled[indices[i]]++] = i / 3;
+    }
+  }
+
+  // Grow each cluster from the first triangle left in the current order,
+  // which keeps clusters in about the order the optimizer chose. Vertices
+  // and candidate triangles are stamped with the cluster that saw them.
+  vector<uint32_t> order;
+  order.reserve(num_triangles);
+  vector<char> taken(num_triangles, 0);
+  vector<uint32_t> vertex_cluster(num_vertices, kNone);
+  vector<uint32_t> candidate_cluster(num_triangles, kNone);
+  vector<uint32_t> members, candidates;
+  vector<pair<uint32_t, uint32_t> > ranges;  ///< (first, count) in order
+  size_t seed = 0;
+  for (uint32_t cluster = 0; order.size() < num_triangles; ++cluster) {
+    while (taken[seed]) seed++;
+    members.clear();
+    candidates.clear();
+    Vector3Df center_sum = {0, 0, 0}, normal_sum = {0, 0, 0};
+    uint32_t next = seed;
+    while (true) {
+      taken[next] = 1;
+      members.push_back(next);
+      center_sum.x += centroids[next].x;
+      center_sum.y += centroids[next].y;
+      center_sum.z += centroids[next].z;
+      normal_sum.x += normals[next].x;
+      normal_sum.y += normals[next].y;
+      normal_sum.z += normals[next].z;
+      for (int j = 0; j < 3; ++j) {
+        uint32_t v = indices[next * 3 + j];
+        vertex_cluster[v] = cluster;
+        for (uint32_t i = offsets[v]; i < offsets[v + 1]; ++i) {
+          uint32_t t = triangles[i];
+          if (taken[t] || candidate_cluster[t] == cluster) continue;
+          candidate_cluster[t] = cluster;
+          candidates.push_back(t);
+        }
+      }
+      if (members.size() == kMaxTriangles) break;
+
+      // The closest triangle that faces the cluster's way, favouring those
+      // that share more vertices with it.
+      float n = members.size();
+      Vector3Df center = {center_sum.x / n, center_sum.y / n,
+                          center_sum.z / n};
+      float axis_length = sqrt(dot(normal_sum, normal_sum));
+      Vector3Df axis = {0, 0, 0};
+      if (axis_length > 0) {
+        axis.x = normal_sum.x / axis_length;
+        axis.y = normal_sum.y / axis_length;
+        axis.z = normal_sum.z / axis_length;
+      }
+      float best = numeric_limits<float>::infinity();
+      next = kNone;
+      for (size_t i = 0; i < candidates.size();) {
+        uint32_t t = candidates[i];
+        if (taken[t]) {
+          candidates[i] = candidates.back();
+          candidates.pop_back();
+          continue;
+        }
+        const uint32_t *tri = &indices[t * 3];
+        int shared = (vertex_cluster[tri[0]] == cluster) +
+                     (vertex_cluster[tri[1]] == cluster) +
+                     (vertex_cluster[tri[2]] == cluster);
+        Vector3Df offset = sub(centroids[t], center);
+        float cost = sqrt(dot(offset, offset)) *
+                     (1 + kConeWeight * (1 - dot(normals[t], axis))) /
+                     max(shared, 1);
+        if (cost < best) {
+          best = cost;
+          next = t;
+        }
+        ++i;
+      }
+      if (next == kNone) break;
+    }
+
+    sort(members.begin(), members.end());
+    ranges.push_back(
+        make_pair((uint32_t)order.size(), (uint32_t)members.size()));
+    order.insert(order.end(), members.begin(), members.end());
+  }
+
+  vector<uint32_t> reordered(num_triangles * 3);
+  for (size_t t = 0; t < num_triangles; ++t) {
+    copy(&indices[order[t] * 3], &indices[order[t] * 3] + 3, &reordered[t * 3]);
+  }
+  copy(reordered.begin(), reordered.end(), indices);
+
+  bool cones = encloses_volume(indices, num_indices, positions, num_vertices,
+                               position_stride);
+  for (const pair<uint32_t, uint32_t> &range : ranges) {
+    MeshBuffers::Cluster cluster;
+    cluster.first_index = range.first * 3;
+    cluster.num_indices = range.second * 3;
+    compute_bounds(indices, positions, position_stride, cones, cluster);
+    clusters.push_back(cluster);
+  }
+}
+
+void MeshClusters::split(const uint32_t *indices, size_t num_indices,
+                         const float *positions, size_t num_vertices,
+                         size_t position_stride,
+                         vector<MeshBuffers::Cluster> &clusters) {
+  num_indices -= num_indices % 3;
+  bool cones = encloses_volume(indices, num_indices, positions, num_vertices,
+                               position_stride);
+  for (size_t first = 0; first < num_indices; first += kMaxTriangles * 3) {
+    MeshBuffers::Cluster cluster;
+    cluster.first_index = first;
+    cluster.num_indices = min(num_indices - first, kMaxTriangles * 3);
+    compute_bounds(indices, positions, position_stride, cones, cluster);
+    clusters.push_back(cluster);
+  }
+}
+
+void MeshClusters::compute_bounds(const uint32_t *indices,
+                                  const float *positions,
+                                  size_t position_stride, bool cone,
+                                  MeshBuffers::Cluster &cluster) {
+  const uint32_t *begin = indices + cluster.first_index;
+  const uint32_t *end = begin + cluster.num_indices;
+  float inf = numeric_limits<float>::infinity();
+  Vector3Df lo = {inf, inf, inf}, hi = {-inf, -inf, -inf};
+  for (const uint32_t *i = begin; i != end; ++i) {
+    const Vector3Df &p = vertex(positions, position_stride, *i);
+    lo.x = min(lo.x, p.x);
+    lo.y = min(lo.y, p.y);
+    lo.z = min(lo.z, p.z);
+    hi.x = max(hi.x, p.x);
+    hi.y = max(hi.y, p.y);
+    hi.z = max(hi.z, p.z);
+  }
+  cluster.bbox_min = lo;
+  cluster.bbox_max = hi;
+
+  Vector3Df center = {(lo.x + hi.x) / 2, (lo.y + hi.y) / 2,
+                      (lo.z + hi.z) / 2};
+  float radius2 = 0;
+  for (const uint32_t *i = begin; i != end; ++i) {
+    Vector3Df offset = sub(vertex(positions, position_stride, *i), center);
+    radius2 = max(radius2, dot(offset, offset));
+  }
+  cluster.radius = sqrt(radius2);
+
+  // The cone's axis is the mean normal and its cosine the least any normal
+  // makes with it; triangles without area face nowhere.
+  Vector3Df axis = {0, 0, 0};
+  for (const uint32_t *tri = begin; cone && tri + 3 <= end; tri += 3) {
+    Vector3Df n = triangle_normal(positions, position_stride, tri);
+    axis.x += n.x;
+    axis.y += n.y;
+    axis.z += n.z;
+  }
+  float length = sqrt(dot(axis, axis));
+  float cutoff = 1;
+  if (length > 0) {
+    axis.x /= length;
+    axis.y /= length;
+    axis.z /= length;
+    for (const uint32_t *tri = begin; tri + 3 <= end; tri += 3) {
+      Vector3Df n = triangle_normal(positions, position_stride, tri);
+      if (n.x != 0 || n.y != 0 || n.z != 0) cutoff = min(cutoff, dot(n, axis));
+    }
+  }
+  if (!(length > 0) || !(cutoff > 0)) {
+    axis.x = axis.y = axis.z = 0;
+    cutoff = 0;
+  }
+  cluster.cone_axis = axis;
+  cluster.cone_cutoff = cutoff;
+}
+
+bool MeshClusters::encloses_volume(const uint32_t *indices,
+                                   size_t num_indices, const float *positions,
+                                   size_t num_vertices,
+                                   size_t position_stride) {
+  if (num_indices < 3) return false;
+
+  // Number vertices by position, so that seams don't count as edges.
+  vector<uint32_t> order(num_vertices), remap(num_vertices);
+  iota(order.begin(), order.end(), 0);
+  auto less_position = [&](uint32_t a, uint32_t b) {
+    const Vector3Df &p = vertex(positions, position_stride, a);
+    const Vector3Df &q = vertex(positions, position_stride, b);
+    if (p.x != q.x) return p.x < q.x;
+    if (p.y != q.y) return p.y < q.y;
+    return p.z < q.z;
+  };
+  sort(order.begin(), order.end(), less_position);
+  for (size_t i = 0; i < num_vertices; ++i) {
+    bool same = i > 0 && !less_position(order[i - 1], order[i]);
+    remap[order[i]] = same ? remap[order[i - 1]] : order[i];
+  }
+
+  // Closed means every edge has a twin running the other way; facing
+  // outwards means the enclosed volume is positive.
+  vector<uint64_t> edges;
+  edges.reserve(num_indices);
+  double volume = 0;
+  for (size_t i = 0; i + 3 <= num_indices; i += 3) {
+    uint32_t r[3] = {remap[indices[i]], remap[indices[i + 1]],
+                     remap[indices[i + 2]]};
+    if (r[0] == r[1] || r[1] == r[2] || r[2] == r[0]) continue;
+    for (int j = 0; j < 3; ++j) {
+      edges.push_back((uint64_t)r[j] << 32 | r[(j + 1) % 3]);
+    }
+    const Vector3Df &p0 = vertex(positions, position_stride, r[0]);
+    const Vector3Df &p1 = vertex(positions, position_stride, r[1]);
+    const Vector3Df &p2 = vertex(positions, position_stride, r[2]);
+    volume += (double)p0.x * ((double)p1.y * p2.z - (double)p1.z * p2.y) +
+              (double)p0.y * ((double)p1.z * p2.x - (double)p1.x * p2.z) +
+              (double)p0.z * ((double)p1.x * p2.y - (double)p1.y * p2.x);
+  }
+  sort(edges.begin(), edges.end());
+  for (uint64_t edge : edges) {
+    uint64_t twin = edge << 32 | edge >> 32;
+    if (!binary_search(edges.begin(), edges.end(), twin)) return false;
+  }
+  return !edges.empty() && volume > 0;
+}
+
+MeshClusters::View MeshClusters::make_view(const Camera &camera,
+                                           const float *obj2world,
+                                           const Vector3Df &bbox_min,
+                                           const Vector3Df &bbox_max,
+                                           bool backfaces) {
+  // obj2world maps p to A p + t; a world plane n.x + d is (A'n).p + n.t + d
+  // in object space.
+  const float *m = obj2world;
+  View view;
+  Frustum frustum = Frustum::from_camera(camera);
+  for (int i = 0; i < 6; ++i) {
+    const float *n = frustum.planes[i];
+    for (int c = 0; c < 3; ++c) {
+      view.planes[i][c] = n[0] * m[4 * c] + n[1] * m[4 * c + 1] +
+                          n[2] * m[4 * c + 2];
+    }
+    view.planes[i][3] = n[0] * m[12] + n[1] * m[13] + n[2] * m[14] + n[3];
+  }
+
+  Vector3D eye = camera.position();
+  Vector3D forward = (camera.view_point() - eye).unit();
+  Vector3D right = cross(forward, camera.up_dir()).unit();
+  Vector3D up = cross(right, forward);
+  const Vector3D *basis[3] = {&right, &up, &forward};
+  Vector3D offset = Vector3D(m[12], m[13], m[14]) - eye;
+  for (int k = 0; k < 3; ++k) {
+    const Vector3D &u = *basis[k];
+    for (int c = 0; c < 3; ++c) {
+      view.axes[k][c] = u.x * m[4 * c] + u.y * m[4 * c + 1] + u.z * m[4 * c + 2];
+    }
+    view.axes[k][3] = dot(u, offset);
+  }
+
+  double tan_y = tan(radians(camera.v_fov()) / 2);
+  view.viewport[0] = camera.screen_width();
+  view.viewport[1] = camera.screen_height();
+  view.focal[0] = view.viewport[0] / (2 * tan_y * camera.aspect_ratio());
+  view.focal[1] = view.viewport[1] / (2 * tan_y);
+
+  view.radius_scale = 0;
+  for (int c = 0; c < 3; ++c) {
+    float length = sqrt(m[4 * c] * m[4 * c] + m[4 * c + 1] * m[4 * c + 1] +
+                        m[4 * c + 2] * m[4 * c + 2]);
+    view.radius_scale = max(view.radius_scale, length);
+  }
+
+  // The eye in object space is A^-1 (eye - t), by the adjugate. Mirroring
+  // turns what faces away into what faces the eye.
+  float a[3][3];
+  for (int r = 0; r < 3; ++r) {
+    for (int c = 0; c < 3; ++c) a[r][c] = m[4 * c + r];
+  }
+  float cofactors[3][3];
+  for (int r = 0; r < 3; ++r) {
+    for (int c = 0; c < 3; ++c) {
+      int r1 = (r + 1) % 3, r2 = (r + 2) % 3, c1 = (c + 1) % 3, c2 = (c + 2) % 3;
+      cofactors[r][c] = a[r1][c1] * a[r2][c2] - a[r1][c2] * a[r2][c1];
+    }
+  }
+  float det = a[0][0] * cofactors[0][0] + a[0][1] * cofactors[0][1] +
+              a[0][2] * cofactors[0][2];
+  float relative[3] = {(float)-offset.x, (float)-offset.y, (float)-offset.z};
+  for (int r = 0; r < 3; ++r) {
+    view.eye[r] = det > 0 ? (cofactors[0][r] * relative[0] +
+                             cofactors[1][r] * relative[1] +
+                             cofactors[2][r] * relative[2]) / det
+                          : 0.0f;
+  }
+  bool inside = view.eye[0] >= bbox_min.x && view.eye[0] <= bbox_max.x &&
+                view.eye[1] >= bbox_min.y && view.eye[1] <= bbox_max.y &&
+                view.eye[2] >= bbox_min.z && view.eye[2] <= bbox_max.z;
+  view.backfaces = backfaces && det > 0 && !inside;
+  return view;
+}
+
+void MeshClusters::cull(const View &view, const ClusterBatch &batch,
+                        size_t first, size_t count, uint8_t *result) {
+  // A cluster is
+  //  - outside if its box is entirely behind a plane, as in Frustum::cull;
+  //  - facing away if every normal n within its cone and every point p
+  //    within its sphere have (p - eye).n > 0: with v the center's offset
+  //    from the eye and phi its angle to the axis, that holds when
+  //    |v| cos(phi + theta) > radius;
+  //  - small if the extent of its sphere projected onto x, or onto y,
+  //    holds no pixel center. A sphere at (x, z) in view space with
+  //    radius r projects to (x z -+ r sqrt(x^2 + z^2 - r^2)) / (z^2 - r^2).
+  size_t end = first + count;
+  for (size_t g = first / 4; g * 4 < end; ++g) {
+    const float *group = &batch.data[g * kGroupFloats];
+    int outside = 0, backfacing = 0, small = 0;  // bit per cluster
+#ifdef CS248_CLUSTERS_SSE2
+    __m128 zero = _mm_setzero_ps();
+    __m128 cx = _mm_loadu_ps(group + CX), cy = _mm_loadu_ps(group + CY),
+           cz = _mm_loadu_ps(group + CZ);
+    __m128 ex = _mm_loadu_ps(group + EX), ey = _mm_loadu_ps(group + EY),
+           ez = _mm_loadu_ps(group + EZ);
+    __m128 radius = _mm_loadu_ps(group + RADIUS);
+
+    __m128 out = zero;
+    for (int i = 0; i < 6; ++i) {
+      const float *p = view.planes[i];
+      __m128 dist = _mm_add_ps(
+          _mm_add_ps(_mm_mul_ps(cx, _mm_set1_ps(p[0])),
+                     _mm_mul_ps(cy, _mm_set1_ps(p[1]))),
+          _mm_add_ps(_mm_mul_ps(cz, _mm_set1_ps(p[2])), _mm_set1_ps(p[3])));
+      __m128 reach = _mm_add_ps(
+          _mm_add_ps(_mm_mul_ps(ex, _mm_set1_ps(fabsf(p[0]))),
+                     _mm_mul_ps(ey, _mm_set1_ps(fabsf(p[1])))),
+          _mm_mul_ps(ez, _mm_set1_ps(fabsf(p[2]))));
+      out = _mm_or_ps(out, _mm_cmplt_ps(_mm_add_ps(dist, reach), zero));
+    }
+    outside = _mm_movemask_ps(out);
+
+    if (view.backfaces) {
+      __m128 vx = _mm_sub_ps(cx, _mm_set1_ps(view.eye[0]));
+      __m128 vy = _mm_sub_ps(cy, _mm_set1_ps(view.eye[1]));
+      __m128 vz = _mm_sub_ps(cz, _mm_set1_ps(view.eye[2]));
+      __m128 along = _mm_add_ps(
+          _mm_add_ps(_mm_mul_ps(vx, _mm_loadu_ps(group + AX)),
+                     _mm_mul_ps(vy, _mm_loadu_ps(group + AY))),
+          _mm_mul_ps(vz, _mm_loadu_ps(group + AZ)));
+      __m128 length2 = _mm_add_ps(
+          _mm_add_ps(_mm_mul_ps(vx, vx), _mm_mul_ps(vy, vy)),
+          _mm_mul_ps(vz, vz));
+      __m128 across = _mm_sqrt_ps(
+          _mm_max_ps(_mm_sub_ps(length2, _mm_mul_ps(along, along)), zero));
+      __m128 nearest = _mm_sub_ps(
+          _mm_mul_ps(along, _mm_loadu_ps(group + COS)),
+          _mm_mul_ps(across, _mm_loadu_ps(group + SIN)));
+      backfacing = _mm_movemask_ps(_mm_cmpgt_ps(nearest, radius));
+    }
+
+    __m128 view_coords[3];
+    for (int k = 0; k < 3; ++k) {
+      const float *axis = view.axes[k];
+      view_coords[k] = _mm_add_ps(
+          _mm_add_ps(_mm_mul_ps(cx, _mm_set1_ps(axis[0])),
+                     _mm_mul_ps(cy, _mm_set1_ps(axis[1]))),
+          _mm_add_ps(_mm_mul_ps(cz, _mm_set1_ps(axis[2])),
+                     _mm_set1_ps(axis[3])));
+    }
+    __m128 r = _mm_mul_ps(radius, _mm_set1_ps(view.radius_scale));
+    __m128 z = view_coords[2];
+    __m128 in_front = _mm_cmpgt_ps(z, r);
+    __m128 denom = _mm_max_ps(_mm_sub_ps(_mm_mul_ps(z, z), _mm_mul_ps(r, r)),
+                              _mm_set1_ps(1e-30f));
+    __m128 covered = _mm_castsi128_ps(_mm_set1_epi32(-1));
+    for (int k = 0; k < 2; ++k) {
+      __m128 c = view_coords[k];
+      __m128 root = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(c, c), denom));
+      __m128 middle = _mm_mul_ps(c, z), spread = _mm_mul_ps(r, root);
+      __m128 scale = _mm_div_ps(_mm_set1_ps(view.focal[k]), denom);
+      __m128 center = _mm_set1_ps(view.viewport[k] / 2);
+      __m128 lo = _mm_add_ps(
+          center, _mm_mul_ps(_mm_sub_ps(middle, spread), scale));
+      __m128 hi = _mm_add_ps(
+          center, _mm_mul_ps(_mm_add_ps(middle, spread), scale));
+
+      // Clamped near the viewport, values stay positive after the bias, so
+      // truncating floors them.
+      lo = _mm_max_ps(_mm_sub_ps(lo, _mm_set1_ps(kPixelSlack)),
+                      _mm_set1_ps(-2.0f));
+      hi = _mm_min_ps(_mm_add_ps(hi, _mm_set1_ps(kPixelSlack)),
+                      _mm_set1_ps(view.viewport[k] + 2));
+      __m128 bias = _mm_set1_ps(4.0f);
+      __m128 floored = _mm_sub_ps(
+          _mm_cvtepi32_ps(_mm_cvttps_epi32(
+              _mm_add_ps(_mm_sub_ps(hi, _mm_set1_ps(0.5f)), bias))),
+          bias);
+      covered = _mm_and_ps(
+          covered, _mm_cmpge_ps(floored, _mm_sub_ps(lo, _mm_set1_ps(0.5f))));
+    }
+    small = _mm_movemask_ps(_mm_andnot_ps(covered, in_front));
+#else
+    for (int lane = 0; lane < 4; ++lane) {
+      const float *c = group + lane;
+      for (int i = 0; i < 6; ++i) {
+        const float *p = view.planes[i];
+        float dist = c[CX] * p[0] + c[CY] * p[1] + c[CZ] * p[2] + p[3];
+        float reach = c[EX] * fabsf(p[0]) + c[EY] * fabsf(p[1]) +
+                      c[EZ] * fabsf(p[2]);
+        if (dist + reach < 0) {
+          outside |= 1 << lane;
+          break;
+        }
+      }
+
+      if (view.backfaces) {
+        float v[3] = {c[CX] - view.eye[0], c[CY] - view.eye[1],
+                      c[CZ] - view.eye[2]};
+        float along = v[0] * c[AX] + v[1] * c[AY] + v[2] * c[AZ];
+        float length2 = v[0] * v[0] + v[1] * v[1] + v[2] * v[2];
+        float across = sqrt(max(length2 - along * along, 0.0f));
+        if (along * c[COS] - across * c[SIN] > c[RADIUS]) {
+          backfacing |= 1 << lane;
+        }
+      }
+
+      float coords[3];
+      for (int k = 0; k < 3; ++k) {
+        const float *axis = view.axes[k];
+        coords[k] = c[CX] * axis[0] + c[CY] * axis[1] + c[CZ] * axis[2] +
+                    axis[3];
+      }
+      float r = c[RADIUS] * view.radius_scale, z = coords[2];
+      if (z > r) {
+        float denom = max(z * z - r * r, 1e-30f);
+        bool covered = true;
+        for (int k = 0; k < 2; ++k) {
+          float root = sqrt(coords[k] * coords[k] + denom);
+          float scale = view.focal[k] / denom, center = view.viewport[k] / 2;
+          float lo = center + (coords[k] * z - r * root) * scale;
+          float hi = center + (coords[k] * z + r * root) * scale;
+          covered = covered && covers_center(lo, hi, view.viewport[k]);
+        }
+        if (!covered) small |= 1 << lane;
+      }
+    }
+#endif
+
+    for (size_t lane = 0; lane < 4; ++lane) {
+      size_t i = g * 4 + lane;
+      if (i < first || i >= end) continue;
+      int bit = 1 << lane;
+      result[i - first] = outside & bit ? OUTSIDE
+                          : backfacing & bit ? BACKFACING
+                          : small & bit ? SMALL : VISIBLE;
+    }
+  }
+}
+
+}  // namespace DynamicScene
+}  // namespace CS248
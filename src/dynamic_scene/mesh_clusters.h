@@ -0,0 +1,156 @@
+#ifndef CS248_DYNAMICSCENE_MESH_CLUSTERS_H
+#define CS248_DYNAMICSCENE_MESH_CLUSTERS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "../camera.h"
+#include "mesh_buffers.h"
+
+namespace CS248 {
+namespace DynamicScene {
+
+/**
+ * The bounds of a mesh's clusters stored four at a time (x, y and z of four
+ * centers, then of four half extents, and so on) so that they can be tested
+ * against a view in one pass, like BoxBatch does for objects.
+ */
+class ClusterBatch {
+ public:
+  ClusterBatch() : count(0) {}
+
+  void assign(const MeshBuffers::Cluster* clusters, size_t num_clusters);
+
+  size_t size() const { return count; }
+
+ private:
+  friend class MeshClusters;
+
+  std::vector<float> data;  ///< 48 floats per group of four clusters
+  size_t count;
+};
+
+/**
+ * Meshlets: the triangles of a mesh split at load into clusters of nearby,
+ * similarly facing triangles, each with a bounding box, a bounding sphere
+ * and a cone holding its normals, so that parts of a mesh can be skipped
+ * where whole-object culling has to draw all of it.
+ *
+ * Clusters are culled in the mesh's object space, with the view moved
+ * there. A cluster is rejected if its box is outside the frustum, if every
+ * one of its triangles faces away from the eye, or if its projection falls
+ * between pixel centers, where it can't produce a fragment. Facing only
+ * counts for meshes that enclose a volume and are seen from outside their
+ * bounds, since nothing else culls back faces.
+ */
+class MeshClusters {
+ public:
+  /**
+   * Whether MeshBuffers::build splits meshes into clusters, and so whether
+   * any are culled.
+   */
+  static bool enabled;
+
+  /**
+   * Most triangles in one cluster.
+   */
+  static const size_t kMaxTriangles = 128;
+
+  /**
+   * Reorders the triangles into clusters of at most kMaxTriangles, grown
+   * from the first triangle not yet taken over shared vertices, preferring
+   * triangles close to the cluster and facing its way. Within a cluster
+   * triangles keep their order. Appends the clusters to clusters, with
+   * their bounds. positions holds three floats per vertex, position_stride
+   * bytes apart.
+   */
+  static void build(uint32_t* indices, size_t num_indices,
+                    const float* positions, size_t num_vertices,
+                    size_t position_stride,
+                    std::vector<MeshBuffers::Cluster>& clusters);
+
+  /**
+   * Cuts the triangles, in their order, into runs of kMaxTriangles and
+   * appends those to clusters as they are, with their bounds. Arguments are
+   * as for build().
+   */
+  static void split(const uint32_t* indices, size_t num_indices,
+                    const float* positions, size_t num_vertices,
+                    size_t position_stride,
+                    std::vector<MeshBuffers::Cluster>& clusters);
+
+  /**
+   * Sets the bounds of a cluster from its range of indices. Without cone,
+   * or if its normals spread over more than a half space, the cluster gets
+   * a cone that never faces away.
+   */
+  static void compute_bounds(const uint32_t* indices, const float* positions,
+                             size_t position_stride, bool cone,
+                             MeshBuffers::Cluster& cluster);
+
+  /**
+   * Whether the triangles form closed surfaces facing outwards, so that
+   * from outside, whatever faces away is hidden behind what doesn't.
+   */
+  static bool encloses_volume(const uint32_t* indices, size_t num_indices,
+                              const float* positions, size_t num_vertices,
+                              size_t position_stride);
+
+  /**
+   * A camera as seen from the object space of a mesh drawn with obj2world.
+   */
+  struct View {
+    float planes[6][4];   ///< the frustum; inside where n.p + d >= 0
+    float eye[3];
+    float axes[3][4];     ///< right, up and forward from the eye: n.p + d
+    float focal[2];       ///< pixels per unit of x / z and of y / z
+    float viewport[2];    ///< width and height in pixels
+    float radius_scale;   ///< longest axis of obj2world
+    bool backfaces;       ///< whether clusters may be rejected for facing
+  };
+
+  /**
+   * backfaces allows rejecting clusters that face away; it is dropped if
+   * obj2world mirrors the mesh or the eye is within bbox.
+   */
+  static View make_view(const Camera& camera, const float* obj2world,
+                        const Vector3Df& bbox_min, const Vector3Df& bbox_max,
+                        bool backfaces);
+
+  enum Result { VISIBLE = 0, OUTSIDE, BACKFACING, SMALL };
+
+  /**
+   * Sets result[i] to what becomes of cluster first + i, for count
+   * clusters of batch.
+   */
+  static void cull(const View& view, const ClusterBatch& batch, size_t first,
+                   size_t count, uint8_t* result);
+
+  /**
+   * Triangles in the clusters tested, and those rejected for each reason.
+   */
+  struct Stats {
+    size_t triangles;
+    size_t outside;
+    size_t backfacing;
+    size_t small;
+
+    Stats() : triangles(0), outside(0), backfacing(0), small(0) {}
+
+    Stats& operator+=(const Stats& other) {
+      triangles += other.triangles;
+      outside += other.outside;
+      backfacing += other.backfacing;
+      small += other.small;
+      return *this;
+    }
+
+    size_t rejected() const { return outside + backfacing + small; }
+  };
+};
+
+}  // namespace DynamicScene
+}  // namespace CS248
+
+#endif  // CS248_DYNAMICSCENE_MESH_CLUSTERS_H
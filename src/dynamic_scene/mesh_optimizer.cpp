@@ -0,0 +1,348 @@
+#include "mesh_optimizer.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+namespace CS248 {
+namespace DynamicScene {
+
+bool MeshOptimizer::enabled = true;
+
+namespace {
+
+// Forsyth's scoring: the LRU cache the vertex cache pass models, and how
+// much each vertex in it and each triangle left on a vertex is worth.
+const int kScoreCacheSize = 32;
+const float kCacheDecayPower = 1.5f;
+const float kLastTriangleScore = 0.75f;
+const float kValenceBoostScale = 2.0f;
+const float kValenceBoostPower = 0.5f;
+
+// valences with a precomputed boost; higher ones are computed
+const uint32_t kMaxTableValence = 64;
+
+class VertexScores {
+ public:
+  VertexScores() {
+    for (int i = 0; i < kScoreCacheSize; ++i) {
+      cache[i] = i < 3 ? kLastTriangleScore
+                       : pow(1.0f - (i - 3) * (1.0f / (kScoreCacheSize - 3)),
+                             kCacheDecayPower);
+    }
+    valence[0] = 0;
+    for (uint32_t i = 1; i < kMaxTableValence; ++i) {
+      valence[i] = kValenceBoostScale * pow((float)i, -kValenceBoostPower);
+    }
+  }
+
+  // The score of a vertex at a cache position (-1 if not in the cache) with
+  // remaining triangles left to draw.
+  float operator()(int cache_position, uint32_t remaining) const {
+    if (remaining == 0) return -1.0f;
+    float score = cache_position >= 0 ? cache[cache_position] : 0.0f;
+    if (remaining < kMaxTableValence) return score + valence[remaining];
+    return score +
+           kValenceBoostScale * pow((float)remaining, -kValenceBoostPower);
+  }
+
+ private:
+  float cache[kScoreCacheSize];
+  float valence[kMaxTableValence];
+};
+
+// A FIFO post-transform cache; only misses advance time, so a vertex is
+// still cached while fewer than size misses have happened since its own.
+class FifoCache {
+ public:
+  FifoCache(size_t num_vertices, int size)
+      : timestamps(num_vertices, 0), time(size + 1), size(size) {}
+
+  // Whether the vertex had to be transformed.
+  bool miss(uint32_t v) {
+    if (time - timestamps[v] <= (uint32_t)size) return false;
+    timestamps[v] = time++;
+    return true;
+  }
+
+  int misses(const uint32_t* triangle) {
+    return miss(triangle[0]) + miss(triangle[1]) + miss(triangle[2]);
+  }
+
+  void clear() { time += size + 1; }
+
+ private:
+  vector<uint32_t> timestamps;
+  uint32_t time;
+  int size;
+};
+
+struct Cluster {
+  Cluster(size_t first, size_t end)
+      : first(first), end(end), center(), normal(), sort_key(0) {}
+
+  size_t first, end;  ///< triangles
+  float center[3];    ///< area-weighted mean of the triangle centers
+  float normal[3];    ///< sum of the triangle normals, weighted by area
+  float sort_key;
+};
+
+}  // namespace
+
+MeshOptimizer::CacheStats MeshOptimizer::analyze(const uint32_t* indices,
+                                                 size_t num_indices,
+                                                 size_t num_vertices,
+                                                 int cache_size) {
+  FifoCache cache(num_vertices, cache_size);
+  size_t misses = 0;
+  for (size_t i = 0; i + 3 <= num_indices; i += 3) {
+    misses += cache.misses(indices + i);
+  }
+  CacheStats stats;
+  stats.acmr = num_indices >= 3 ? (double)misses / (num_indices / 3) : 0;
+  stats.atvr = num_vertices ? (double)misses / num_vertices : 0;
+  return stats;
+}
+
+void MeshOptimizer::optimize_vertex_cache(uint32_t* indices,
+                                          size_t num_indices,
+                                          size_t num_vertices) {
+  size_t num_triangles = num_indices / 3;
+  if (num_triangles < 2) return;
+  static const VertexScores vertex_score;
+
+  // The triangles not yet drawn that use each vertex, packed into one
+  // array: vertex v has remaining[v] of them from offsets[v] on.
+  vector<uint32_t> remaining(num_vertices, 0), offsets(num_vertices + 1, 0);
+  for (size_t i = 0; i < num_triangles * 3; ++i) remaining[indices[i]]++;
+  for (size_t v = 0; v < num_vertices; ++v) {
+    offsets[v + 1] = offsets[v] + remaining[v];
+  }
+  vector<uint32_t> adjacency(num_triangles * 3);
+  {
+    vector<uint32_t> filled(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < num_triangles * 3; ++i) {
+      adjacency[filled[indices[i]]++] = i / 3;
+    }
+  }
+
+  vector<int> cache_position(num_vertices, -1);
+  vector<float> scores(num_vertices);
+  for (size_t v = 0; v < num_vertices; ++v) {
+    scores[v] = vertex_score(-1, remaining[v]);
+  }
+  vector<float> triangle_scores(num_triangles);
+  for (size_t t = 0; t < num_triangles; ++t) {
+    const uint32_t* tri = indices + t * 3;
+    triangle_scores[t] = scores[tri[0]] + scores[tri[1]] + scores[tri[2]];
+  }
+
+  vector<char> emitted(num_triangles, 0);
+  vector<uint32_t> output;
+  output.reserve(num_triangles * 3);
+  uint32_t cache[kScoreCacheSize + 3];
+  int cache_count = 0;
+  size_t next_in_order = 0;  // where dead ends resume, in input order
+  long best = 0;
+  for (size_t n = 0; n < num_triangles; ++n) {
+    if (best < 0) {
+      while (emitted[next_in_order]) next_in_order++;
+      best = next_in_order;
+    }
+    const uint32_t* tri = indices + best * 3;
+    emitted[best] = 1;
+    output.insert(output.end(), tri, tri + 3);
+
+    // Take the triangle off its vertices' lists.
+    for (int j = 0; j < 3; ++j) {
+      uint32_t v = tri[j];
+      uint32_t* list = &adjacency[offsets[v]];
+      for (uint32_t k = 0; k < remaining[v]; ++k) {
+        if (list[k] == (uint32_t)best) {
+          list[k] = list[remaining[v] - 1];
+          break;
+        }
+      }
+      remaining[v]--;
+    }
+
+    // The triangle's vertices move to the front of the cache; the ones
+    // pushed past its end leave it.
+    uint32_t new_cache[kScoreCacheSize + 3];
+    int new_count = 0;
+    for (int j = 0; j < 3; ++j) {
+      if (find(new_cache, new_cache + new_count, tri[j]) ==
+          new_cache + new_count) {
+        new_cache[new_count++] = tri[j];
+      }
+    }
+    for (int i = 0; i < cache_count; ++i) {
+      if (cache[i] != tri[0] && cache[i] != tri[1] && cache[i] != tri[2]) {
+        new_cache[new_count++] = cache[i];
+      }
+    }
+
+    // Rescore the vertices that moved and the triangles that use them.
+    for (int i = 0; i < new_count; ++i) {
+      uint32_t v = new_cache[i];
+      cache_position[v] = i < kScoreCacheSize ? i : -1;
+      float score = vertex_score(cache_position[v], remaining[v]);
+      float delta = score - scores[v];
+      scores[v] = score;
+      const uint32_t* list = &adjacency[offsets[v]];
+      for (uint32_t k = 0; k < remaining[v]; ++k) {
+        triangle_scores[list[k]] += delta;
+      }
+    }
+    cache_count = min(new_count, kScoreCacheSize);
+    for (int i = 0; i < cache_count; ++i) cache[i] = new_cache[i];
+
+    // The next triangle is the best one using a cached vertex.
+    best = -1;
+    float best_score = 0;
+    for (int i = 0; i < cache_count; ++i) {
+      uint32_t v = cache[i];
+      const uint32_t* list = &adjacency[offsets[v]];
+      for (uint32_t k = 0; k < remaining[v]; ++k) {
+        if (triangle_scores[list[k]] > best_score) {
+          best_score = triangle_scores[list[k]];
+          best = list[k];
+        }
+      }
+    }
+  }
+
+  if (analyze(output.data(), output.size(), num_vertices).acmr <=
+      analyze(indices, output.size(), num_vertices).acmr) {
+    copy(output.begin(), output.end(), indices);
+  }
+}
+
+void MeshOptimizer::optimize_overdraw(uint32_t* indices, size_t num_indices,
+                                      const float* positions,
+                                      size_t num_vertices,
+                                      size_t position_stride,
+                                      float threshold) {
+  size_t num_triangles = num_indices / 3;
+  if (num_triangles < 2) return;
+
+  // Hard boundaries, where the cache order starts over with three misses.
+  vector<size_t> hard(1, 0);
+  FifoCache cache(num_vertices, kCacheSize);
+  for (size_t t = 0; t < num_triangles; ++t) {
+    if (cache.misses(indices + t * 3) == 3 && t > 0) hard.push_back(t);
+  }
+  hard.push_back(num_triangles);
+
+  // Within each, cut wherever the cluster so far misses about as rarely as
+  // the whole run; the cache starts cold in every cluster.
+  vector<Cluster> clusters;
+  for (size_t h = 0; h + 1 < hard.size(); ++h) {
+    size_t first = hard[h], end = hard[h + 1];
+    cache.clear();
+    size_t run_misses = 0;
+    for (size_t t = first; t < end; ++t) {
+      run_misses += cache.misses(indices + t * 3);
+    }
+    double limit = threshold * run_misses / (end - first);
+
+    cache.clear();
+    size_t cluster_first = first, misses = 0;
+    for (size_t t = first; t < end; ++t) {
+      misses += cache.misses(indices + t * 3);
+      if (t + 1 < end && misses <= limit * (t + 1 - cluster_first)) {
+        clusters.push_back(Cluster(cluster_first, t + 1));
+        cluster_first = t + 1;
+        misses = 0;
+        cache.clear();
+      }
+    }
+    clusters.push_back(Cluster(cluster_first, end));
+  }
+  if (clusters.size() < 2) return;
+
+  // Clusters facing away from the middle of the mesh are on its outside and
+  // go first: from wherever they are visible, they tend to cover the rest.
+  double mesh_center[3] = {0, 0, 0}, mesh_area = 0;
+  for (Cluster& cluster : clusters) {
+    float* center = cluster.center;
+    float* normal = cluster.normal;
+    float area = 0;
+    for (size_t t = cluster.first; t < cluster.end; ++t) {
+      const float* p[3];
+      for (int j = 0; j < 3; ++j) {
+        p[j] = (const float*)((const char*)positions +
+                              indices[t * 3 + j] * position_stride);
+      }
+      float e1[3] = {p[1][0] - p[0][0], p[1][1] - p[0][1], p[1][2] - p[0][2]};
+      float e2[3] = {p[2][0] - p[0][0], p[2][1] - p[0][1], p[2][2] - p[0][2]};
+      float n[3] = {e1[1] * e2[2] - e1[2] * e2[1],
+                    e1[2] * e2[0] - e1[0] * e2[2],
+                    e1[0] * e2[1] - e1[1] * e2[0]};
+      float a = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+      for (int k = 0; k < 3; ++k) {
+        center[k] += (p[0][k] + p[1][k] + p[2][k]) / 3 * a;
+        normal[k] += n[k];
+      }
+      area += a;
+    }
+    for (int k = 0; k < 3; ++k) mesh_center[k] += center[k];
+    mesh_area += area;
+    if (area > 0) {
+      for (int k = 0; k < 3; ++k) center[k] /= area;
+    }
+  }
+  if (mesh_area <= 0) return;
+  for (int k = 0; k < 3; ++k) mesh_center[k] /= mesh_area;
+
+  for (Cluster& cluster : clusters) {
+    const float* center = cluster.center;
+    const float* normal = cluster.normal;
+    float length = sqrt(normal[0] * normal[0] + normal[1] * normal[1] +
+                        normal[2] * normal[2]);
+    float key = 0;
+    for (int k = 0; k < 3; ++k) {
+      key += (center[k] - (float)mesh_center[k]) * normal[k];
+    }
+    cluster.sort_key = length > 0 ? key / length : 0;
+  }
+  stable_sort(clusters.begin(), clusters.end(),
+              [](const Cluster& a, const Cluster& b) {
+                return a.sort_key > b.sort_key;
+              });
+
+  vector<uint32_t> sorted;
+  sorted.reserve(num_triangles * 3);
+  for (const Cluster& cluster : clusters) {
+    sorted.insert(sorted.end(), indices + cluster.first * 3,
+                  indices + cluster.end * 3);
+  }
+
+  // Each cluster starts with a cold cache; where that costs more than the
+  // sorting is worth, the cache order stays.
+  if (analyze(sorted.data(), sorted.size(), num_vertices).acmr <=
+      analyze(indices, sorted.size(), num_vertices).acmr) {
+    copy(sorted.begin(), sorted.end(), indices);
+  }
+}
+
+void MeshOptimizer::optimize_vertex_fetch(uint32_t* indices,
+                                          size_t num_indices,
+                                          size_t num_vertices,
+                                          vector<uint32_t>& remap) {
+  const uint32_t kUnused = ~0u;
+  remap.assign(num_vertices, kUnused);
+  uint32_t next = 0;
+  for (size_t i = 0; i < num_indices; ++i) {
+    uint32_t& v = remap[indices[i]];
+    if (v == kUnused) v = next++;
+    indices[i] = v;
+  }
+  for (size_t v = 0; v < num_vertices; ++v) {
+    if (remap[v] == kUnused) remap[v] = next++;
+  }
+}
+
+}  // namespace DynamicScene
+}  // namespace CS248
@@ -0,0 +1,78 @@
+#ifndef CS248_DYNAMICSCENE_MESH_OPTIMIZER_H
+#define CS248_DYNAMICSCENE_MESH_OPTIMIZER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace CS248 {
+namespace DynamicScene {
+
+/**
+ * Load-time reordering of indexed triangle meshes for the GPU. Triangles are
+ * first put in an order that reuses the post-transform vertex cache
+ * (Forsyth's linear-speed algorithm), then split into clusters, which are
+ * sorted so that triangles likely to hide others from any view draw first.
+ * Last, vertices are renumbered in the order the triangles first use them,
+ * so that vertex fetches walk memory forwards.
+ *
+ * The passes only change the order in which triangles and vertices are
+ * stored, never what is drawn.
+ */
+class MeshOptimizer {
+ public:
+  /**
+   * Whether MeshBuffers::build optimizes meshes at all.
+   */
+  static bool enabled;
+
+  /**
+   * Entries of the FIFO cache analyze() simulates by default, about what
+   * current GPUs reuse.
+   */
+  static const int kCacheSize = 16;
+
+  struct CacheStats {
+    double acmr;  ///< vertices transformed per triangle; 0.5 to 3
+    double atvr;  ///< vertices transformed per vertex; 1 at best
+  };
+
+  /**
+   * Simulates a FIFO vertex cache of cache_size entries over the triangles.
+   */
+  static CacheStats analyze(const uint32_t* indices, size_t num_indices,
+                            size_t num_vertices, int cache_size = kCacheSize);
+
+  /**
+   * Reorders triangles for vertex cache reuse. Keeps the given order if it
+   * already misses the cache no more often.
+   */
+  static void optimize_vertex_cache(uint32_t* indices, size_t num_indices,
+                                    size_t num_vertices);
+
+  /**
+   * Reorders triangles that are already in vertex cache order into clusters
+   * sorted to reduce overdraw. Clusters are cut wherever the cache misses so
+   * far are within threshold times the average. The sorted order is kept
+   * only if it misses the cache no more often than the given one, so the
+   * cache miss ratio never grows. positions holds three floats per vertex,
+   * position_stride bytes apart.
+   */
+  static void optimize_overdraw(uint32_t* indices, size_t num_indices,
+                                const float* positions, size_t num_vertices,
+                                size_t position_stride,
+                                float threshold = 1.05f);
+
+  /**
+   * Renumbers vertices in the order the indices first use them, unused
+   * vertices last. remap is set to the new number of each old vertex.
+   */
+  static void optimize_vertex_fetch(uint32_t* indices, size_t num_indices,
+                                    size_t num_vertices,
+                                    std::vector<uint32_t>& remap);
+};
+
+}  // namespace DynamicScene
+}  // namespace CS248
+
+#endif  // CS248_DYNAMICSCENE_MESH_OPTIMIZER_H
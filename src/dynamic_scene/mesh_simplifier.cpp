@@ -0,0 +1,473 @@
+#include "mesh_simplifier.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+#include "mesh_optimizer.h"
+
+using namespace std;
+
+namespace CS248 {
+namespace DynamicScene {
+
+bool MeshSimplifier::enabled = true;
+
+namespace {
+
+// How much more moving an open border or a seam costs than moving the
+// surface by the same distance.
+const double kBorderWeight = 10.0;
+
+// Collapses that turn a remaining triangle by more than about 75 degrees
+// are rejected, which also keeps triangles from flipping over.
+const double kMinNormalCosine = 0.25;
+
+// Largest error of a level of detail, as a fraction of the radius of the
+// mesh's bounding sphere.
+const float kMaxLodError = 0.1f;
+
+// Levels that keep more than this fraction of the triangles of the level
+// before are not worth drawing.
+const float kMinReduction = 0.75f;
+
+const uint32_t kNone = ~0u;
+
+enum VertexKind { MANIFOLD, BORDER, SEAM, LOCKED };
+
+// Weighted sum of squared distances to planes: p'Ap + 2b'p + c, with A
+// symmetric. Value-initialized quadrics are zero.
+struct Quadric {
+  double a00, a11, a22, a01, a02, a12;
+  double b0, b1, b2;
+  double c;
+  double weight;
+
+  // The plane n.p + d = 0, with n unit length.
+  void add_plane(const double n[3], double d, double w) {
+    a00 += w * n[0] * n[0];
+    a11 += w * n[1] * n[1];
+    a22 += w * n[2] * n[2];
+    a01 += w * n[0] * n[1];
+    a02 += w * n[0] * n[2];
+    a12 += w * n[1] * n[2];
+    b0 += w * n[0] * d;
+    b1 += w * n[1] * d;
+    b2 += w * n[2] * d;
+    c += w * d * d;
+    weight += w;
+  }
+
+  void add(const Quadric& q) {
+    a00 += q.a00;
+    a11 += q.a11;
+    a22 += q.a22;
+    a01 += q.a01;
+    a02 += q.a02;
+    a12 += q.a12;
+    b0 += q.b0;
+    b1 += q.b1;
+    b2 += q.b2;
+    c += q.c;
+    weight += q.weight;
+  }
+
+  // Mean squared distance from p to the planes.
+  double error(const double p[3]) const {
+    double x = p[0], y = p[1], z = p[2];
+    double e = a00 * x * x + a11 * y * y + a22 * z * z +
+               2 * (a01 * x * y + a02 * x * z + a12 * y * z) +
+               2 * (b0 * x + b1 * y + b2 * z) + c;
+    return weight > 0 ? fabs(e) / weight : 0;
+  }
+};
+
+// Outgoing half-edges of each vertex, packed into one array.
+class EdgeAdjacency {
+ public:
+  void build(const vector<uint32_t>& indices, size_t num_vertices) {
+    offsets.assign(num_vertices + 1, 0);
+    for (uint32_t v : indices) offsets[v + 1]++;
+    for (size_t v = 0; v < num_vertices; ++v) offsets[v + 1] += offsets[v];
+    targets.resize(indices.size());
+    vector<uint32_t> filled(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i + 3 <= indices.size(); i += 3) {
+      for (int e = 0; e < 3; ++e) {
+        uint32_t a = indices[i + e], b = indices[i + (e + 1) % 3];
+        targets[filled[a]++] = b;
+      }
+    }
+  }
+
+  bool has_edge(uint32_t a, uint32_t b) const {
+    for (uint32_t i = offsets[a]; i < offsets[a + 1]; ++i) {
+      if (targets[i] == b) return true;
+    }
+    return false;
+  }
+
+  vector<uint32_t> offsets;
+  vector<uint32_t> targets;
+};
+
+struct Collapse {
+  uint32_t from, to;
+  double error;  ///< squared distance
+  bool operator<(const Collapse& other) const { return error < other.error; }
+};
+
+class Simplifier {
+ public:
+  Simplifier(const float* positions, size_t num_vertices, size_t stride)
+      : num_vertices(num_vertices),
+        points(num_vertices * 3),
+        remap(num_vertices),
+        wedge(num_vertices),
+        kind(num_vertices, LOCKED),
+        quadrics(num_vertices) {
+    for (size_t v = 0; v < num_vertices; ++v) {
+      const float* p = (const float*)((const char*)positions + v * stride);
+      for (int k = 0; k < 3; ++k) points[v * 3 + k] = p[k];
+    }
+    find_wedges();
+  }
+
+  size_t run(vector<uint32_t>& indices, size_t target_indices,
+             double max_error, float* error);
+
+ private:
+  const double* point(uint32_t v) const { return &points[v * 3]; }
+
+  void find_wedges();
+  void classify();
+  void add_quadrics(const vector<uint32_t>& indices);
+  void add_candidate(uint32_t from, uint32_t to, bool open);
+  bool turns_triangles(uint32_t from, uint32_t to,
+                       const vector<uint32_t>& indices) const;
+
+  size_t num_vertices;
+  vector<double> points;
+  vector<uint32_t> remap;  ///< the first vertex at the same position
+  vector<uint32_t> wedge;  ///< the next vertex at the same position
+  vector<VertexKind> kind;
+  vector<Quadric> quadrics;  ///< by remapped vertex
+  EdgeAdjacency adjacency;
+  vector<Collapse> candidates;
+
+  // triangles using each remapped vertex, rebuilt every pass
+  vector<uint32_t> triangle_offsets, triangles;
+};
+
+void Simplifier::find_wedges() {
+  // Sort the vertices by position; runs of equal ones are wedges.
+  vector<uint32_t> order(num_vertices);
+  iota(order.begin(), order.end(), 0);
+  sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) {
+    const double *p = point(a), *q = point(b);
+    if (p[0] != q[0]) return p[0] < q[0];
+    if (p[1] != q[1]) return p[1] < q[1];
+    if (p[2] != q[2]) return p[2] < q[2];
+    return a < b;
+  });
+  for (size_t first = 0, end; first < order.size(); first = end) {
+    const double* p = point(order[first]);
+    for (end = first + 1; end < order.size(); ++end) {
+      const double* q = point(order[end]);
+      if (p[0] != q[0] || p[1] != q[1] || p[2] != q[2]) break;
+    }
+    for (size_t i = first; i < end; ++i) {
+      remap[order[i]] = order[first];
+      wedge[order[i]] = order[i + 1 < end ? i + 1 : first];
+    }
+  }
+}
+
+void Simplifier::classify() {
+  // An open half-edge has no twin going the other way. Each vertex keeps
+  // the other end of its one open incoming and outgoing half-edge, or
+  // itself if it has several.
+  vector<uint32_t> open_in(num_vertices, kNone), open_out(num_vertices, kNone);
+  for (size_t a = 0; a < num_vertices; ++a) {
+    for (uint32_t i = adjacency.offsets[a]; i < adjacency.offsets[a + 1]; ++i) {
+      uint32_t b = adjacency.targets[i];
+      if (adjacency.has_edge(b, a)) continue;
+      open_in[b] = open_in[b] == kNone ? a : b;
+      open_out[a] = open_out[a] == kNone ? b : (uint32_t)a;
+    }
+  }
+
+  auto single = [](uint32_t open, uint32_t v) {
+    return open != kNone && open != v;
+  };
+  for (uint32_t v = 0; v < num_vertices; ++v) {
+    if (remap[v] != v) continue;
+    if (wedge[v] == v) {
+      if (open_in[v] == kNone && open_out[v] == kNone) {
+        kind[v] = MANIFOLD;
+      } else if (single(open_in[v], v) && single(open_out[v], v)) {
+        kind[v] = BORDER;
+      } else {
+        kind[v] = LOCKED;
+      }
+    } else if (wedge[wedge[v]] == v) {
+      // Two vertices at one position: a seam if each has one open edge in
+      // and out, and the two sides run along the same positions.
+      uint32_t w = wedge[v];
+      if (single(open_in[v], v) && single(open_out[v], v) &&
+          single(open_in[w], w) && single(open_out[w], w) &&
+          remap[open_in[v]] == remap[open_out[w]] &&
+          remap[open_out[v]] == remap[open_in[w]] &&
+          remap[open_in[v]] != remap[open_out[v]]) {
+        kind[v] = SEAM;
+      } else {
+        kind[v] = LOCKED;
+      }
+    } else {
+      kind[v] = LOCKED;
+    }
+  }
+  for (uint32_t v = 0; v < num_vertices; ++v) kind[v] = kind[remap[v]];
+}
+
+void Simplifier::add_quadrics(const vector<uint32_t>& indices) {
+  for (size_t i = 0; i + 3 <= indices.size(); i += 3) {
+    const double* p[3] = {point(indices[i]), point(indices[i + 1]),
+                          point(indices[i + 2])};
+    double e1[3], e2[3], n[3];
+    for (int k = 0; k < 3; ++k) {
+      e1[k] = p[1][k] - p[0][k];
+      e2[k] = p[2][k] - p[0][k];
+    }
+    n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+    n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+    n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+    double length = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+    if (length == 0) continue;
+    for (int k = 0; k < 3; ++k) n[k] /= length;
+    double d = -(n[0] * p[0][0] + n[1] * p[0][1] + n[2] * p[0][2]);
+    for (int j = 0; j < 3; ++j) {
+      quadrics[remap[indices[i + j]]].add_plane(n, d, length / 2);
+    }
+
+    // Open edges also keep to the plane through them at a right angle to
+    // the triangle, so that borders and seams don't shrink or wander.
+    for (int j = 0; j < 3; ++j) {
+      uint32_t a = indices[i + j], b = indices[i + (j + 1) % 3];
+      if (adjacency.has_edge(b, a)) continue;
+      const double *pa = point(a), *pb = point(b);
+      double edge[3] = {pb[0] - pa[0], pb[1] - pa[1], pb[2] - pa[2]};
+      double m[3] = {edge[1] * n[2] - edge[2] * n[1],
+                     edge[2] * n[0] - edge[0] * n[2],
+                     edge[0] * n[1] - edge[1] * n[0]};
+      double m_length = sqrt(m[0] * m[0] + m[1] * m[1] + m[2] * m[2]);
+      if (m_length == 0) continue;
+      for (int k = 0; k < 3; ++k) m[k] /= m_length;
+      double md = -(m[0] * pa[0] + m[1] * pa[1] + m[2] * pa[2]);
+      double w = kBorderWeight *
+                 (edge[0] * edge[0] + edge[1] * edge[1] + edge[2] * edge[2]);
+      quadrics[remap[a]].add_plane(m, md, w);
+      quadrics[remap[b]].add_plane(m, md, w);
+    }
+  }
+}
+
+void Simplifier::add_candidate(uint32_t from, uint32_t to, bool open) {
+  VertexKind k = kind[from];
+  if (k == LOCKED || remap[from] == remap[to]) return;
+
+  // Borders and seams only collapse along themselves.
+  if ((k == BORDER || k == SEAM) && (!open || kind[to] != k)) return;
+
+  Quadric q = quadrics[remap[from]];
+  q.add(quadrics[remap[to]]);
+  Collapse collapse = {from, to, q.error(point(to))};
+  candidates.push_back(collapse);
+}
+
+bool Simplifier::turns_triangles(uint32_t from, uint32_t to,
+                                 const vector<uint32_t>& indices) const {
+  uint32_t r_from = remap[from], r_to = remap[to];
+  for (uint32_t i = triangle_offsets[r_from];
+       i < triangle_offsets[r_from + 1]; ++i) {
+    const uint32_t* tri = &indices[triangles[i] * 3];
+    uint32_t r[3] = {remap[tri[0]], remap[tri[1]], remap[tri[2]]};
+
+    // triangles along the collapsed edge disappear
+    if (r[0] == r_to || r[1] == r_to || r[2] == r_to) continue;
+
+    const double* p[3];
+    const double* q[3];
+    for (int j = 0; j < 3; ++j) {
+      p[j] = point(r[j]);
+      q[j] = r[j] == r_from ? point(r_to) : p[j];
+    }
+    double before[3], after[3];
+    for (int pass = 0; pass < 2; ++pass) {
+      const double* const* v = pass ? q : p;
+      double e1[3], e2[3];
+      for (int k = 0; k < 3; ++k) {
+        e1[k] = v[1][k] - v[0][k];
+        e2[k] = v[2][k] - v[0][k];
+      }
+      double* n = pass ? after : before;
+      n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+      n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+      n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+    }
+    double dot = before[0] * after[0] + before[1] * after[1] +
+                 before[2] * after[2];
+    double lengths = sqrt((before[0] * before[0] + before[1] * before[1] +
+                           before[2] * before[2]) *
+                          (after[0] * after[0] + after[1] * after[1] +
+                           after[2] * after[2]));
+    if (dot <= kMinNormalCosine * lengths) return true;
+  }
+  return false;
+}
+
+size_t Simplifier::run(vector<uint32_t>& indices, size_t target_indices,
+                       double max_error, float* error) {
+  adjacency.build(indices, num_vertices);
+  classify();
+  add_quadrics(indices);
+
+  double worst = 0;
+  vector<char> locked(num_vertices);
+  vector<uint32_t> collapse_remap(num_vertices);
+  while (indices.size() > target_indices) {
+    // Every edge can collapse either way; interior edges are seen from both
+    // of their triangles, so only one of them adds them.
+    candidates.clear();
+    for (size_t i = 0; i + 3 <= indices.size(); i += 3) {
+      for (int e = 0; e < 3; ++e) {
+        uint32_t a = indices[i + e], b = indices[i + (e + 1) % 3];
+        bool open = !adjacency.has_edge(b, a);
+        if (!open && remap[a] > remap[b]) continue;
+        add_candidate(a, b, open);
+        add_candidate(b, a, open);
+      }
+    }
+    if (candidates.empty()) break;
+    sort(candidates.begin(), candidates.end());
+
+    triangle_offsets.assign(num_vertices + 1, 0);
+    for (uint32_t v : indices) triangle_offsets[remap[v] + 1]++;
+    for (size_t v = 0; v < num_vertices; ++v) {
+      triangle_offsets[v + 1] += triangle_offsets[v];
+    }
+    triangles.resize(indices.size());
+    {
+      vector<uint32_t> filled(triangle_offsets.begin(),
+                              triangle_offsets.end() - 1);
+      for (size_t i = 0; i < indices.size(); ++i) {
+        triangles[filled[remap[indices[i]]]++] = i / 3;
+      }
+    }
+
+    // Take the cheapest collapses, at most one per vertex so that the
+    // checks above stay valid, until enough triangles would go. A collapse
+    // removes two triangles, or one on a border.
+    size_t excess = (indices.size() - target_indices + 2) / 3, removed = 0;
+    fill(locked.begin(), locked.end(), 0);
+    iota(collapse_remap.begin(), collapse_remap.end(), 0);
+    for (const Collapse& collapse : candidates) {
+      if (removed >= excess || collapse.error > max_error * max_error) break;
+      uint32_t r_from = remap[collapse.from], r_to = remap[collapse.to];
+      if (locked[r_from] || locked[r_to]) continue;
+      if (turns_triangles(collapse.from, collapse.to, indices)) continue;
+
+      collapse_remap[collapse.from] = collapse.to;
+      if (kind[collapse.from] == SEAM) {
+        collapse_remap[wedge[collapse.from]] = wedge[collapse.to];
+      }
+      quadrics[r_to].add(quadrics[r_from]);
+      locked[r_from] = locked[r_to] = 1;
+      worst = max(worst, collapse.error);
+      removed += kind[collapse.from] == BORDER ? 1 : 2;
+    }
+    if (removed == 0) break;
+
+    // Drop the triangles that lost an edge.
+    size_t kept = 0;
+    for (size_t i = 0; i + 3 <= indices.size(); i += 3) {
+      uint32_t a = collapse_remap[indices[i]];
+      uint32_t b = collapse_remap[indices[i + 1]];
+      uint32_t c = collapse_remap[indices[i + 2]];
+      if (remap[a] == remap[b] || remap[b] == remap[c] ||
+          remap[c] == remap[a]) {
+        continue;
+      }
+      indices[kept++] = a;
+      indices[kept++] = b;
+      indices[kept++] = c;
+    }
+    indices.resize(kept);
+    adjacency.build(indices, num_vertices);
+  }
+
+  *error = (float)sqrt(worst);
+  return indices.size();
+}
+
+}  // namespace
+
+size_t MeshSimplifier::simplify(const uint32_t* indices, size_t num_indices,
+                                const float* positions, size_t num_vertices,
+                                size_t position_stride, size_t target_indices,
+                                float max_error, uint32_t* out, float* error) {
+  *error = 0;
+  vector<uint32_t> result(indices, indices + num_indices);
+  if (num_indices > target_indices && num_vertices > 0) {
+    Simplifier simplifier(positions, num_vertices, position_stride);
+    simplifier.run(result, target_indices, max_error, error);
+  }
+  copy(result.begin(), result.end(), out);
+  return result.size();
+}
+
+size_t MeshSimplifier::build_lods(const MeshBuffers& buffers,
+                                  vector<uint32_t>& lod_indices,
+                                  MeshBuffers::Lod* lods) {
+  const Vector3Df &lo = buffers.bbox_min, &hi = buffers.bbox_max;
+  float dx = hi.x - lo.x, dy = hi.y - lo.y, dz = hi.z - lo.z;
+  float radius = sqrt(dx * dx + dy * dy + dz * dz) / 2;
+  if (!(radius > 0) || buffers.num_vertices == 0) return 0;
+
+  // Each level simplifies the one before, so its error is at most the sum
+  // of theirs.
+  vector<uint32_t> previous(buffers.indices,
+                            buffers.indices + buffers.num_indices);
+  vector<uint32_t> level;
+  float error = 0;
+  size_t num_lods = 0;
+  while (num_lods < MeshBuffers::kMaxLods) {
+    size_t target = previous.size() / 6 * 3;
+    if (target < kMinTriangles * 3) break;
+
+    level.resize(previous.size());
+    float level_error;
+    size_t count = simplify(previous.data(), previous.size(),
+                            &buffers.positions[0].x, buffers.num_vertices,
+                            sizeof(Vector3Df), target,
+                            kMaxLodError * radius - error, level.data(),
+                            &level_error);
+    if (count > previous.size() * kMinReduction) break;
+    level.resize(count);
+    error += level_error;
+    if (MeshOptimizer::enabled) {
+      MeshOptimizer::optimize_vertex_cache(level.data(), count,
+                                           buffers.num_vertices);
+    }
+
+    MeshBuffers::Lod& lod = lods[num_lods++];
+    lod.first_index = lod_indices.size();
+    lod.num_indices = count;
+    lod.error = error / radius;
+    lod_indices.insert(lod_indices.end(), level.begin(), level.end());
+    previous.swap(level);
+  }
+  return num_lods;
+}
+
+}  // namespace DynamicScene
+}  // namespace CS248
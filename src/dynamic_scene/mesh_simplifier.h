@@ -0,0 +1,62 @@
+#ifndef CS248_DYNAMICSCENE_MESH_SIMPLIFIER_H
+#define CS248_DYNAMICSCENE_MESH_SIMPLIFIER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "mesh_buffers.h"
+
+namespace CS248 {
+namespace DynamicScene {
+
+/**
+ * Quadric error metric simplification (Garland and Heckbert) by edge
+ * collapses that move a vertex onto one of its neighbours, never anywhere
+ * new, so that a coarser level of detail is only a new index buffer into the
+ * mesh's vertices, which keep their own normals and texcoords.
+ *
+ * Vertices on an open border only collapse along the border. Several
+ * vertices at one position make a seam (of texcoords, normals or colors);
+ * they collapse along the seam, both sides at once, so that the seam stays
+ * closed. Vertices where neither can be guaranteed are never removed.
+ */
+class MeshSimplifier {
+ public:
+  /**
+   * Whether MeshBuffers::build generates levels of detail at all.
+   */
+  static bool enabled;
+
+  /**
+   * Fewest triangles a level of detail is built with.
+   */
+  static const size_t kMinTriangles = 16;
+
+  /**
+   * Simplifies triangles until at most target_indices indices are left, or
+   * until going further would move the surface by more than max_error, in
+   * the units of the positions. positions holds three floats per vertex,
+   * position_stride bytes apart. Writes the remaining indices to out, which
+   * needs room for num_indices, and returns how many there are. error is set
+   * to how far the surface moved.
+   */
+  static size_t simplify(const uint32_t* indices, size_t num_indices,
+                         const float* positions, size_t num_vertices,
+                         size_t position_stride, size_t target_indices,
+                         float max_error, uint32_t* out, float* error);
+
+  /**
+   * Builds up to MeshBuffers::kMaxLods levels of detail of a mesh, each with
+   * about half the triangles of the one before, appending their indices to
+   * lod_indices. Returns how many levels there are.
+   */
+  static size_t build_lods(const MeshBuffers& buffers,
+                           std::vector<uint32_t>& lod_indices,
+                           MeshBuffers::Lod* lods);
+};
+
+}  // namespace DynamicScene
+}  // namespace CS248
+
+#endif  // CS248_DYNAMICSCENE_MESH_SIMPLIFIER_H
@@ -0,0 +1,80 @@
+#include "mesh_store.h"
+
+#include <iomanip>
+
+#include "mesh_cache.h"
+#include "mesh_clusters.h"
+#include "mesh_optimizer.h"
+#include "mesh_simplifier.h"
+
+using namespace std;
+
+namespace CS248 {
+namespace DynamicScene {
+
+MeshStore& MeshStore::shared() {
+  static MeshStore store;
+  return store;
+}
+
+bool MeshStore::load(Collada::PolymeshInfo& polymesh,
+                     const string& obj_filename, const string& obj_data,
+                     uint64_t inputs_hash, const function<bool()>& parse,
+                     ostream& log) {
+  // Whether the mesh is optimized ends up in the streams as well.
+  MeshCache::Key key;
+  string cache_filename;
+  bool use_cache = MeshCache::mode != MeshCache::BYPASS &&
+                   MeshCache::make_key(obj_filename, obj_data, key);
+  if (use_cache) {
+    double options[] = {(double)MeshOptimizer::enabled,
+                        (double)MeshSimplifier::enabled,
+                        (double)MeshClusters::enabled};
+    key.inputs_hash = CacheFile::hash(options, sizeof(options), inputs_hash);
+    cache_filename = MeshCache::cache_filename(obj_filename, key);
+  }
+
+  MeshBuffers buffers;
+  if (!use_cache || MeshCache::mode != MeshCache::READ_WRITE ||
+      !MeshCache::load(cache_filename, key, buffers)) {
+    if (!parse()) return false;
+    MeshBuffers::build(polymesh, buffers);
+    if (use_cache && !MeshCache::store(cache_filename, key, buffers)) {
+      log << "Warning: could not write mesh cache " << cache_filename << endl;
+    }
+  }
+
+  if (buffers.num_vertices > 0) {
+    log << "Mesh " << obj_filename << ": " << buffers.num_indices
+        << " triangle corners welded into " << buffers.num_vertices
+        << " vertices (" << fixed << setprecision(1)
+        << (double)buffers.num_indices / buffers.num_vertices << "x fewer)"
+        << endl;
+  }
+
+  lock_guard<std::mutex> lock(mutex);
+  streams[&polymesh] = buffers;
+  return true;
+}
+
+const MeshBuffers& MeshStore::get(const Collada::PolymeshInfo& polymesh) {
+  lock_guard<std::mutex> lock(mutex);
+  MeshBuffers& buffers = streams[&polymesh];
+  if (buffers.empty() && polymesh.is_obj_file) {
+    MeshBuffers::build(polymesh, buffers);
+  }
+  return buffers;
+}
+
+void MeshStore::release(const Collada::PolymeshInfo& polymesh) {
+  lock_guard<std::mutex> lock(mutex);
+  streams.erase(&polymesh);
+}
+
+void MeshStore::clear() {
+  lock_guard<std::mutex> lock(mutex);
+  streams.clear();
+}
+
+}  // namespace DynamicScene
+}  // namespace CS248
@@ -0,0 +1,52 @@
+#ifndef CS248_DYNAMICSCENE_MESH_STORE_H
+#define CS248_DYNAMICSCENE_MESH_STORE_H
+
+#include <map>
+#include <mutex>
+
+#include "../collada/mesh_streams.h"
+#include "mesh_buffers.h"
+
+namespace CS248 {
+namespace DynamicScene {
+
+/**
+ * The vertex streams of a scene's meshes between loading the scene and
+ * setting up its objects, kept by polymesh. The scene loader fills the store
+ * from its worker threads, mapping streams from the MeshCache where it can;
+ * the application then hands each mesh its streams and clears the store.
+ */
+class MeshStore : public Collada::MeshStreams {
+ public:
+  static MeshStore& shared();
+
+  /**
+   * Maps the streams of polymesh from its cache file, or parses it, builds
+   * them and writes the cache file. May be called from any thread.
+   */
+  bool load(Collada::PolymeshInfo& polymesh, const std::string& obj_filename,
+            const std::string& obj_data, uint64_t inputs_hash,
+            const std::function<bool()>& parse, std::ostream& log) override;
+
+  /**
+   * The streams of polymesh, built now if the loader didn't make them (scenes
+   * from a single OBJ file). Empty unless polymesh is from an OBJ.
+   */
+  const MeshBuffers& get(const Collada::PolymeshInfo& polymesh);
+
+  /**
+   * Drops the streams of polymesh; others that share them keep them.
+   */
+  void release(const Collada::PolymeshInfo& polymesh);
+
+  void clear();
+
+ private:
+  std::mutex mutex;
+  std::map<const Collada::PolymeshInfo*, MeshBuffers> streams;
+};
+
+}  // namespace DynamicScene
+}  // namespace CS248
+
+#endif  // CS248_DYNAMICSCENE_MESH_STORE_H
@@ -0,0 +1,258 @@
+#include "render_queue.h"
+
+#include "mesh.h"
+
+#include <cstring>
+
+using namespace std;
+
+namespace CS248 {
+namespace DynamicScene {
+
+namespace {
+
+// never a GL name, so that the first bind of each kind is always issued
+const GLuint kUnknown = ~0u;
+
+const int kPassBits = 2, kProgramBits = 16, kMaterialBits = 22,
+          kDepthBits = 24;
+
+}  // namespace
+
+RenderState::RenderState()
+    : binds(0), skipped(0), setup_calls_saved(0), draw_calls(0),
+      triangles(0) {
+  forget();
+}
+
+void RenderState::forget() {
+  program = vao = kUnknown;
+  for (int i = 0; i < kTextureUnits; ++i) textures[i] = kUnknown;
+  for (int i = 0; i < kUniformBufferBindings; ++i) {
+    uniform_buffers[i] = kUnknown;
+  }
+  active_unit = -1;
+}
+
+void RenderState::use_program(GLuint program) {
+  if (this->program == program) {
+    skipped++;
+    return;
+  }
+  glUseProgram(program);
+  this->program = program;
+  binds++;
+}
+
+void RenderState::bind_vertex_array(GLuint vao) {
+  if (this->vao == vao) {
+    skipped++;
+    return;
+  }
+  glBindVertexArray(vao);
+  this->vao = vao;
+  binds++;
+}
+
+void RenderState::bind_texture(int unit, GLuint texture) {
+  if (textures[unit] == texture) {
+    skipped++;
+    return;
+  }
+  if (active_unit != unit) {
+    glActiveTexture(GL_TEXTURE0 + unit);
+    active_unit = unit;
+  }
+  glBindTexture(GL_TEXTURE_2D, texture);
+  textures[unit] = texture;
+  binds++;
+}
+
+void RenderState::bind_uniform_buffer(GLuint binding, GLuint buffer) {
+  if (uniform_buffers[binding] == buffer) {
+    skipped++;
+    return;
+  }
+  glBindBufferBase(GL_UNIFORM_BUFFER, binding, buffer);
+  uniform_buffers[binding] = buffer;
+  binds++;
+}
+
+void RenderState::reset() {
+  for (int i = kTextureUnits - 1; i >= 0; --i) {
+    if (textures[i] != kUnknown && textures[i] != 0) {
+      glActiveTexture(GL_TEXTURE0 + i);
+      glBindTexture(GL_TEXTURE_2D, 0);
+      active_unit = i;
+    }
+  }
+  if (active_unit != 0) glActiveTexture(GL_TEXTURE0);
+  if (vao != kUnknown && vao != 0) glBindVertexArray(0);
+  if (program != kUnknown && program != 0) glUseProgram(0);
+  forget();
+}
+
+IndirectBatch::~IndirectBatch() {
+  if (command_buffer) glDeleteBuffers(1, &command_buffer);
+  if (object_buffer) glDeleteBuffers(1, &object_buffer);
+}
+
+void IndirectBatch::add_object(const ObjectData &object) {
+  objects.push_back(object);
+}
+
+void IndirectBatch::add_range(GLint first_index, GLsizei count,
+                              GLint base_vertex) {
+  // Consecutive objects drawing the same triangles are instances of one
+  // command.
+  GLuint object = objects.size() - 1;
+  if (!commands.empty()) {
+    Command &last = commands.back();
+    if (last.first_index == (GLuint)first_index &&
+        last.count == (GLuint)count && last.base_vertex == base_vertex &&
+        last.base_instance + last.instance_count == object) {
+      last.instance_count++;
+      return;
+    }
+  }
+
+  Command command = {(GLuint)count, 1, (GLuint)first_index, base_vertex,
+                     object};
+  commands.push_back(command);
+}
+
+void IndirectBatch::flush(RenderState &state) {
+  if (commands.empty()) {
+    objects.clear();
+    return;
+  }
+  if (!command_buffer) {
+    glGenBuffers(1, &command_buffer);
+    glGenBuffers(1, &object_buffer);
+  }
+
+  // Orphan both buffers, so that the driver need not wait for the last
+  // call that read them.
+  glBindBuffer(GL_UNIFORM_BUFFER, object_buffer);
+  glBufferData(GL_UNIFORM_BUFFER, sizeof(ObjectData) * kMaxDrawsPerCall,
+               nullptr, GL_STREAM_DRAW);
+  glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(ObjectData) * objects.size(),
+                  objects.data());
+  glBindBuffer(GL_UNIFORM_BUFFER, 0);
+  state.bind_uniform_buffer(OBJECT_DATA_BINDING, object_buffer);
+
+  // A single command needs no command buffer.
+  if (commands.size() == 1) {
+    const Command &command = commands[0];
+    glDrawElementsInstancedBaseVertexBaseInstance(
+        GL_TRIANGLES, command.count, GL_UNSIGNED_INT,
+        (const GLvoid *)(command.first_index * sizeof(GLuint)),
+        command.instance_count, command.base_vertex, command.base_instance);
+  } else {
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, command_buffer);
+    glBufferData(GL_DRAW_INDIRECT_BUFFER, sizeof(Command) * commands.size(),
+                 commands.data(), GL_STREAM_DRAW);
+    glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, nullptr,
+                                commands.size(), 0);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+  }
+  state.draw_calls++;
+  for (const Command &command : commands) {
+    state.triangles += command.count / 3 * command.instance_count;
+  }
+
+  commands.clear();
+  objects.clear();
+}
+
+uint64_t RenderQueue::make_key(Pass pass, GLuint program, uint32_t material,
+                               float depth) {
+  // Non-negative floats order like their bit patterns; keep the top bits.
+  uint32_t depth_bits = 0;
+  if (depth > 0) {
+    memcpy(&depth_bits, &depth, sizeof(depth_bits));
+    depth_bits >>= 32 - kDepthBits;
+  }
+
+  uint64_t key = (uint64_t)pass & ((1u << kPassBits) - 1);
+  key = key << kProgramBits | (program & ((1u << kProgramBits) - 1));
+  key = key << kMaterialBits | (material & ((1u << kMaterialBits) - 1));
+  key = key << kDepthBits | depth_bits;
+  return key;
+}
+
+void RenderQueue::begin_frame() {
+  timer.start();
+  packets.clear();
+  frame_number++;
+}
+
+void RenderQueue::push(uint64_t key, const Mesh* mesh, uint32_t shader) {
+  Packet packet = {key, mesh, shader};
+  packets.push_back(packet);
+}
+
+void RenderQueue::sort() {
+  // LSD radix sort on bytes, skipping bytes that are the same in every key
+  scratch.resize(packets.size());
+  for (int shift = 0; shift < 64 && packets.size() > 1; shift += 8) {
+    size_t offsets[256] = {0};
+    for (const Packet& packet : packets) {
+      offsets[(packet.key >> shift) & 0xff]++;
+    }
+    if (offsets[(packets[0].key >> shift) & 0xff] == packets.size()) continue;
+
+    size_t sum = 0;
+    for (int digit = 0; digit < 256; ++digit) {
+      size_t count = offsets[digit];
+      offsets[digit] = sum;
+      sum += count;
+    }
+    for (const Packet& packet : packets) {
+      scratch[offsets[(packet.key >> shift) & 0xff]++] = packet;
+    }
+    packets.swap(scratch);
+  }
+}
+
+void RenderQueue::submit() {
+  sort();
+
+  RenderState state;
+  bool multi_draw = multi_draw_supported();
+  for (size_t i = 0; i < packets.size();) {
+    const Packet& packet = packets[i];
+    if (!multi_draw) {
+      packet.mesh->submit(packet.shader, state);
+      i++;
+      continue;
+    }
+
+    // Bind for the first packet of a run, then draw the whole run; the key
+    // without depth groups candidates, the mesh has the final say.
+    packet.mesh->bind_state(packet.shader, state);
+    size_t end = i;
+    do {
+      packets[end].mesh->add_draws(batch, state);
+      end++;
+    } while (end < packets.size() &&
+             packets[end].key >> kDepthBits == packet.key >> kDepthBits &&
+             packet.mesh->shares_state(packet.shader, *packets[end].mesh,
+                                       packets[end].shader));
+    batch.flush(state);
+    i = end;
+  }
+  state.reset();
+
+  timer.stop();
+  last_frame.packets = packets.size();
+  last_frame.binds = state.binds;
+  last_frame.binds_skipped = state.skipped;
+  last_frame.setup_calls_saved = state.setup_calls_saved;
+  last_frame.draw_calls = state.draw_calls;
+  last_frame.triangles = state.triangles;
+  last_frame.cpu_seconds = timer.duration();
+}
+
+}  // namespace DynamicScene
+}  // namespace CS248
@@ -0,0 +1,197 @@
+#ifndef CS248_DYNAMICSCENE_RENDER_QUEUE_H
+#define CS248_DYNAMICSCENE_RENDER_QUEUE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "GL/glew.h"
+
+#include "CS248/timer.h"
+
+#include "../uniform_blocks.h"
+
+namespace CS248 {
+namespace DynamicScene {
+
+class Mesh;
+
+/**
+ * The GL bindings made by the draws of a render queue, so that binds that
+ * wouldn't change anything can be skipped. Nothing is assumed about the
+ * state before the first bind of each kind.
+ */
+class RenderState {
+ public:
+  static const int kTextureUnits = 8;
+  static const int kUniformBufferBindings = 2;
+
+  RenderState();
+
+  void use_program(GLuint program);
+  void bind_vertex_array(GLuint vao);
+  void bind_texture(int unit, GLuint texture);
+  void bind_uniform_buffer(GLuint binding, GLuint buffer);
+
+  /**
+   * Unbinds the program, vertex array and textures, leaves texture unit 0
+   * active, and forgets the state.
+   */
+  void reset();
+
+  size_t binds;    ///< binds issued
+  size_t skipped;  ///< binds skipped because they were already in place
+  size_t setup_calls_saved;  ///< vertex setup calls replaced by vertex arrays
+  size_t draw_calls;         ///< draw calls issued
+  size_t triangles;          ///< triangles those calls drew
+
+ private:
+  // Marks every binding unknown, keeping the counters.
+  void forget();
+
+  GLuint program;
+  GLuint vao;
+  GLuint textures[kTextureUnits];
+  GLuint uniform_buffers[kUniformBufferBindings];
+  int active_unit;
+};
+
+/**
+ * Draws that share a program, vertex array and textures, gathered into one
+ * glMultiDrawElementsIndirect. Each mesh adds its ObjectData and then its
+ * index ranges, which become commands whose base instance selects that
+ * ObjectData through the draw ID attribute. Copies of one mesh added one
+ * after the other share a command, as its instances.
+ */
+class IndirectBatch {
+ public:
+  IndirectBatch() : command_buffer(0), object_buffer(0) {}
+  ~IndirectBatch();
+
+  /**
+   * Whether another ObjectData would not fit; flush first.
+   */
+  bool full() const { return objects.size() == (size_t)kMaxDrawsPerCall; }
+
+  void add_object(const ObjectData &object);
+
+  /**
+   * Adds a range of arena indices, relative to base_vertex, drawn with the
+   * last added ObjectData. The range is a further instance of the last
+   * command if that draws the same triangles with the previous ObjectData.
+   */
+  void add_range(GLint first_index, GLsizei count, GLint base_vertex);
+
+  /**
+   * Uploads the commands and objects, draws them with one call and empties
+   * the batch. Expects the program and vertex array to be bound.
+   */
+  void flush(RenderState &state);
+
+ private:
+  // laid out as GL's DrawElementsIndirectCommand
+  struct Command {
+    GLuint count;
+    GLuint instance_count;
+    GLuint first_index;
+    GLint base_vertex;
+    GLuint base_instance;
+  };
+
+  IndirectBatch(const IndirectBatch &) = delete;
+  IndirectBatch &operator=(const IndirectBatch &) = delete;
+
+  std::vector<Command> commands;
+  std::vector<ObjectData> objects;
+  GLuint command_buffer;  ///< 0 until the first flush
+  GLuint object_buffer;
+};
+
+/**
+ * Collects the draws of a frame as compact packets, sorts them by a 64-bit
+ * key and submits them with redundant state changes filtered out.
+ *
+ * From the most significant bit, a key holds the pass (2 bits), the program
+ * (16 bits), the material, a hash of the textures and flags a draw uses
+ * (22 bits), and the view depth (24 bits). Draws of one program and material
+ * end up next to each other, and within them opaque geometry is drawn front
+ * to back.
+ */
+class RenderQueue {
+ public:
+  enum Pass {
+    PASS_OPAQUE = 0  ///< later passes draw after all opaque geometry
+  };
+
+  struct Stats {
+    size_t packets;        ///< draws submitted
+    size_t binds;          ///< program, vertex array, texture and buffer binds
+    size_t binds_skipped;  ///< binds filtered out as redundant
+    size_t setup_calls_saved;  ///< buffer and attribute calls that prebuilt
+                               ///< vertex arrays made unnecessary
+    size_t draw_calls;     ///< GL draw calls the packets took
+    size_t triangles;      ///< at the levels of detail drawn
+    double cpu_seconds;    ///< from begin_frame() to the end of submit()
+  };
+
+  static uint64_t make_key(Pass pass, GLuint program, uint32_t material,
+                           float depth);
+
+  /**
+   * Empties the queue and starts timing a frame.
+   */
+  void begin_frame();
+
+  /**
+   * Counts the frames begun, so that objects can tell a new frame.
+   */
+  uint32_t frame() const { return frame_number; }
+
+  /**
+   * Queues shader number shader of a mesh.
+   */
+  void push(uint64_t key, const Mesh* mesh, uint32_t shader);
+
+  /**
+   * Sorts the queued packets by key; stable, so equal keys keep their
+   * order.
+   */
+  void sort();
+
+  /**
+   * Sorts and draws the queued packets, then resets the GL bindings. With
+   * multi-draw support, runs of packets that share all their state are
+   * drawn with one call.
+   */
+  void submit();
+
+  /**
+   * The batch that multi-draw calls are gathered in; meshes drawn outside
+   * the queue use it too.
+   */
+  IndirectBatch &indirect_batch() { return batch; }
+
+  /**
+   * Counters of the last submitted frame.
+   */
+  Stats stats() const { return last_frame; }
+
+ private:
+  struct Packet {
+    uint64_t key;
+    const Mesh* mesh;
+    uint32_t shader;
+  };
+
+  std::vector<Packet> packets;
+  std::vector<Packet> scratch;  ///< radix sort buffer
+  IndirectBatch batch;
+  Timer timer;
+  uint32_t frame_number = 0;
+  Stats last_frame = Stats();
+};
+
+}  // namespace DynamicScene
+}  // namespace CS248
+
+#endif  // CS248_DYNAMICSCENE_RENDER_QUEUE_H
@@ -1,6 +1,10 @@
 #include "scene.h"
 #include "mesh.h"
+#include "../thread_pool.h"
+#include <algorithm>
+#include <cstring>
 #include <fstream>
+#include <functional>
 
 using namespace std;
 using std::cout;
@@ -9,6 +13,13 @@ using std::endl;
 namespace CS248 {
 namespace DynamicScene {
 
+namespace {
+
+// most objects rasterized into the occlusion buffer per frame
+const size_t kMaxOccluders = 16;
+
+}  // namespace
+
 Scene::Scene(std::vector<SceneObject *> _objects,
              std::vector<SceneLight *> _lights) {
   for (int i = 0; i < _objects.size(); i++) {
@@ -44,9 +55,13 @@ Scene::Scene(std::vector<SceneObject *> _objects,
   current_pattern_id = 0;
   current_pattern_subid = 0;
   scaling_factor = .05f;
+  frame_data_buffer = 0;
+  camera = nullptr;
+  culling = CullingStats();
 }
 
 Scene::~Scene() {
+  if (frame_data_buffer) glDeleteBuffers(1, &frame_data_buffer);
 }
 
 BBox Scene::get_bbox() {
@@ -78,13 +93,82 @@ bool Scene::removeObject(SceneObject *o) {
   return true;
 }
 
+void Scene::upload_frame_data() {
+  camera->view_projection_matrix(view_projection);
+  if (!uniform_blocks_supported()) return;
+
+  FrameData data;
+  memset(&data, 0, sizeof(data));
+  memcpy(data.view_projection, view_projection, sizeof(view_projection));
+
+  Vector3D camPosition = camera->position();
+  data.camera_position[0] = camPosition.x;
+  data.camera_position[1] = camPosition.y;
+  data.camera_position[2] = camPosition.z;
+
+  data.num_directional_lights = min((int)directional_lights.size(), kMaxLights);
+  for (int i = 0; i < data.num_directional_lights; ++i) {
+    const Vector3D &v = directional_lights[i]->dirToLight;
+    data.directional_light_vectors[i][0] = v.x;
+    data.directional_light_vectors[i][1] = v.y;
+    data.directional_light_vectors[i][2] = v.z;
+  }
+
+  data.num_point_lights = min((int)point_lights.size(), kMaxLights);
+  for (int i = 0; i < data.num_point_lights; ++i) {
+    const Vector3D &p = point_lights[i]->position;
+    data.point_light_positions[i][0] = p.x;
+    data.point_light_positions[i][1] = p.y;
+    data.point_light_positions[i][2] = p.z;
+  }
+
+  if (!frame_data_buffer) glGenBuffers(1, &frame_data_buffer);
+  glBindBuffer(GL_UNIFORM_BUFFER, frame_data_buffer);
+  glBufferData(GL_UNIFORM_BUFFER, sizeof(data), &data, GL_STREAM_DRAW);
+  glBindBuffer(GL_UNIFORM_BUFFER, 0);
+  glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_DATA_BINDING, frame_data_buffer);
+}
+
 void Scene::render_in_opengl() {
+  upload_frame_data();
+
   // Renderpass 1
+  render_queue.begin_frame();
+
+  // Test the bounds of all visible objects against the frustum in one go;
+  // objects without bounds are always drawn.
+  cull_objects.clear();
+  cull_boxes.clear();
   for (SceneObject *obj : objects) {
-    if (obj->isVisible) {
+    if (!obj->isVisible) continue;
+    const BBox &bbox = obj->world_bbox();
+    if (bbox.min.x <= bbox.max.x) {
+      cull_objects.push_back(obj);
+      cull_boxes.push(bbox);
+    } else if (!obj->enqueue(render_queue)) {
       obj->draw();
     }
   }
+  cull_visible.resize(cull_objects.size());
+  if (camera && !cull_objects.empty()) {
+    Frustum::from_camera(*camera).cull(cull_boxes, cull_visible.data());
+  } else {
+    fill(cull_visible.begin(), cull_visible.end(), 1);
+  }
+
+  culling.tested = cull_objects.size();
+  culling.culled = 0;
+  for (uint8_t visible : cull_visible) culling.culled += !visible;
+  cull_occluded();
+
+  for (size_t i = 0; i < cull_objects.size(); ++i) {
+    if (cull_visible[i] && !cull_objects[i]->enqueue(render_queue)) {
+      cull_objects[i]->draw();
+    }
+  }
+  cull_clusters();
+  glDisable(GL_BLEND);
+  render_queue.submit();
 
   // Renderpass 2
 }
@@ -151,6 +235,104 @@ StaticScene::Scene *Scene::get_transformed_static_scene(double t) {
   return new StaticScene::Scene(staticObjects, staticLights);
 }
 
+void Scene::cull_occluded() {
+  culling.occluded = 0;
+  culling.occluder_triangles = 0;
+  culling.occlusion_seconds = 0;
+  if (!OcclusionBuffer::enabled || !camera) return;
+  Timer timer;
+  timer.start();
+
+  // Objects that cover the most of the view occlude the most: rank them by
+  // the size of their bounds over their distance.
+  Vector3D eye = camera->position();
+  occluder_ranks.clear();
+  for (size_t i = 0; i < cull_objects.size(); ++i) {
+    if (!cull_visible[i]) continue;
+    const BBox &bbox = cull_objects[i]->world_bbox();
+    double distance2 = max((bbox.centroid() - eye).norm2(), 1e-6);
+    occluder_ranks.push_back(
+        make_pair(bbox.extent.norm2() / distance2, i));
+  }
+  sort(occluder_ranks.begin(), occluder_ranks.end(),
+       greater<pair<double, size_t> >());
+
+  occlusion.begin(*camera);
+  size_t num_occluders = 0;
+  for (const pair<double, size_t> &rank : occluder_ranks) {
+    if (num_occluders == kMaxOccluders) break;
+    SceneObject *obj = cull_objects[rank.second];
+    const float *positions;
+    const uint32_t *indices;
+    size_t num_indices;
+    if (obj->get_occluder(&positions, &indices, &num_indices) &&
+        occlusion.add_occluder(positions, indices, num_indices,
+                               obj->transform.world())) {
+      num_occluders++;
+    }
+  }
+  occlusion.rasterize();
+
+  for (size_t i = 0; i < cull_objects.size(); ++i) {
+    if (cull_visible[i] && !occlusion.visible(cull_objects[i]->world_bbox())) {
+      cull_visible[i] = 0;
+      culling.occluded++;
+    }
+  }
+
+  timer.stop();
+  culling.occluder_triangles = occlusion.triangles();
+  culling.occlusion_seconds = timer.duration();
+}
+
+void Scene::queue_cluster_culling(Mesh *mesh) {
+  cluster_meshes.push_back(mesh);
+}
+
+void Scene::cull_clusters() {
+  Timer timer;
+  timer.start();
+  cluster_stats.assign(cluster_meshes.size(), MeshClusters::Stats());
+  ThreadPool::shared().parallel_for(cluster_meshes.size(), [&](size_t i) {
+    cluster_stats[i] = cluster_meshes[i]->cull_clusters();
+  });
+  culling.clusters = MeshClusters::Stats();
+  for (const MeshClusters::Stats &stats : cluster_stats) {
+    culling.clusters += stats;
+  }
+  cluster_meshes.clear();
+  timer.stop();
+  culling.cluster_seconds = timer.duration();
+}
+
+const BBox &SceneObject::world_bbox() {
+  sync_transform();
+  uint32_t version = transform.version();
+  if (hasBounds && version == boundsVersion) return worldBounds;
+  if (!hasBounds) objectBounds = get_bbox();
+  hasBounds = true;
+  boundsVersion = version;
+
+  worldBounds = BBox();
+  if (objectBounds.min.x > objectBounds.max.x) return worldBounds;
+
+  // The box around the transformed box: its center moves with the
+  // transform, and each axis spans the absolute transformed half extents.
+  const float *m = transform.world();
+  Vector3D center = (objectBounds.min + objectBounds.max) * 0.5;
+  Vector3D half = (objectBounds.max - objectBounds.min) * 0.5;
+  Vector3D worldCenter, worldHalf;
+  for (int i = 0; i < 3; i++) {
+    worldCenter[i] = m[12 + i];
+    for (int j = 0; j < 3; j++) {
+      worldCenter[i] += m[j * 4 + i] * center[j];
+      worldHalf[i] += fabs(m[j * 4 + i]) * half[j];
+    }
+  }
+  worldBounds = BBox(worldCenter - worldHalf, worldCenter + worldHalf);
+  return worldBounds;
+}
+
 Matrix4x4 SceneObject::getTransformation() {
   Vector3D rot = rotation * M_PI / 180;
   return Matrix4x4::translation(position) *
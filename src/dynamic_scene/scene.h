@@ -12,6 +12,12 @@
 #include "GL/glew.h"
 
 #include "../camera.h"
+#include "../frustum.h"
+#include "../occlusion_buffer.h"
+#include "../uniform_blocks.h"
+#include "mesh_clusters.h"
+#include "render_queue.h"
+#include "transform_node.h"
 
 #include "../static_scene/scene.h"
 #include "../static_scene/light.h"
@@ -22,6 +28,7 @@ namespace CS248 {
 namespace DynamicScene {
 
 // Forward declarations
+class Mesh;
 class Scene;
 class Selection;
 class XFormWidget;
@@ -44,7 +51,8 @@ public:
 class SceneObject {
  public:
   SceneObject()
-      : scene(NULL), isVisible(true), isPickable(true) {}
+      : scene(NULL), scale(1, 1, 1), isVisible(true), isPickable(true),
+        hasBounds(false), boundsVersion(0) {}
 
   /**
    * Renders the object in OpenGL, assuming that the camera and projection
@@ -54,12 +62,34 @@ class SceneObject {
 
   virtual void draw_pretty() { draw(); }
 
+  /**
+   * Queues the object's draws instead of drawing them right away. Returns
+   * false if the object can't be queued; it is then drawn with draw().
+   */
+  virtual bool enqueue(RenderQueue &queue) { return false; }
+
   /**
    * Given a transformation matrix from local to space to world space, returns
    * a bounding box of the object in world space. Note that this doesn't have
    * to be the smallest possible bbox, in case that's difficult to compute.
    */
   virtual BBox get_bbox() = 0;
+
+  /**
+   * The object's triangles for occlusion culling, three floats per vertex
+   * and three indices per triangle, in the space get_bbox() is in. Returns
+   * false if the object hides nothing behind it.
+   */
+  virtual bool get_occluder(const float **positions, const uint32_t **indices,
+                            size_t *num_indices) {
+    return false;
+  }
+
+  /**
+   * The bounds from get_bbox(), taken once, moved by the world transform.
+   * Only recomputed after the transform has changed.
+   */
+  const BBox &world_bbox();
   
   /**
    * Converts this object to an immutable, raytracer-friendly form. Passes in a
@@ -84,11 +114,23 @@ class SceneObject {
    */
   Scene *scene;
 
-  /* World-space position, rotation, scale */
+  /* Position, rotation, scale relative to the parent transform */
   Vector3D position;
   Vector3D rotation;
   Vector3D scale;
 
+  /**
+   * The object's node in the transform hierarchy. Brought in line with
+   * position, rotation and scale by sync_transform().
+   */
+  TransformNode transform;
+
+  /**
+   * Passes position, rotation and scale on to the transform node, which
+   * only recomputes its matrices if they changed.
+   */
+  void sync_transform() { transform.set_local(position, rotation, scale); }
+
   /**
    * Is this object drawn in the scene?
    */
@@ -98,6 +140,13 @@ class SceneObject {
    * Is this object pickable right now?
    */
   bool isPickable;
+
+ private:
+  // get_bbox() and the transform version world_bbox() last saw
+  bool hasBounds;
+  BBox objectBounds;
+  BBox worldBounds;
+  uint32_t boundsVersion;
 };
 
 // A Selection stores information about any object or widget that is
@@ -168,6 +217,12 @@ class Scene {
    */
   void render_in_opengl();
 
+  /**
+   * Fills the FrameData uniform block from the camera and lights and binds
+   * it for all programs. Called once per frame by render_in_opengl().
+   */
+  void upload_frame_data();
+
   /**
    * Gets a bounding box for the entire scene in world space coordinates.
    * May not be the tightest possible.
@@ -205,6 +260,60 @@ class Scene {
   std::vector<StaticScene::SphereLight *> sphere_lights;
 
   Camera *camera;
+
+  // buffer behind the FrameData uniform block, 0 until first used
+  GLuint frame_data_buffer;
+
+  // the camera's world to clip matrix, column-major, as of the last
+  // upload_frame_data(); programs without uniform blocks get it as a
+  // plain uniform
+  float view_projection[16];
+
+  // sorted draws of the frame
+  RenderQueue render_queue;
+
+  /**
+   * Has the clusters of mesh culled once every object of the frame has been
+   * queued, before the queue is drawn.
+   */
+  void queue_cluster_culling(Mesh *mesh);
+
+  /**
+   * Objects tested against the view frustum in the last frame, those of
+   * them that were skipped as off screen, and those skipped as hidden
+   * behind occluders.
+   */
+  struct CullingStats {
+    size_t tested;
+    size_t culled;
+    size_t occluded;
+    size_t occluder_triangles;  ///< rasterized into the occlusion buffer
+    double occlusion_seconds;   ///< picking, rasterizing and testing
+    MeshClusters::Stats clusters;  ///< triangles of the queued meshes
+    double cluster_seconds;
+  };
+  CullingStats culling;
+
+ private:
+  /**
+   * Rasterizes the biggest objects in view into the occlusion buffer and
+   * clears cull_visible for the objects hidden behind them.
+   */
+  void cull_occluded();
+
+  /**
+   * Culls the clusters of the meshes queued for it, all meshes at once.
+   */
+  void cull_clusters();
+
+  // per-frame scratch for culling
+  std::vector<SceneObject *> cull_objects;
+  BoxBatch cull_boxes;
+  std::vector<uint8_t> cull_visible;
+  std::vector<std::pair<double, size_t> > occluder_ranks;
+  OcclusionBuffer occlusion;
+  std::vector<Mesh *> cluster_meshes;
+  std::vector<MeshClusters::Stats> cluster_stats;
 };
 
 // Mapping between integer and 8-bit RGB values (used for picking)
@@ -0,0 +1,145 @@
+#include "transform_node.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+namespace CS248 {
+namespace DynamicScene {
+
+size_t TransformNode::updates = 0;
+
+namespace {
+
+void multiply3x3(const float a[3][3], const float b[3][3], float out[3][3]) {
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 3; j++) {
+      out[i][j] = a[i][0] * b[0][j] + a[i][1] * b[1][j] + a[i][2] * b[2][j];
+    }
+  }
+}
+
+// out = a * b for column-major affine 4x4 matrices
+void multiply_affine(const float *a, const float *b, float *out) {
+  for (int j = 0; j < 4; j++) {
+    for (int i = 0; i < 3; i++) {
+      out[j * 4 + i] = a[i] * b[j * 4] + a[4 + i] * b[j * 4 + 1] +
+                       a[8 + i] * b[j * 4 + 2] + (j == 3 ? a[12 + i] : 0.f);
+    }
+    out[j * 4 + 3] = j == 3 ? 1.f : 0.f;
+  }
+}
+
+void cross(const float *a, const float *b, float *out) {
+  out[0] = a[1] * b[2] - a[2] * b[1];
+  out[1] = a[2] * b[0] - a[0] * b[2];
+  out[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+}  // namespace
+
+TransformNode::TransformNode()
+    : parentNode(nullptr), scale(1, 1, 1), dirty(false), worldVersion(0) {
+  for (int i = 0; i < 16; i++) local[i] = worldMatrix[i] = i % 5 == 0;
+  for (int i = 0; i < 9; i++) worldNormal[i] = i % 4 == 0;
+}
+
+TransformNode::~TransformNode() {
+  set_parent(nullptr);
+  for (TransformNode *child : children) {
+    child->parentNode = nullptr;
+    child->mark_dirty();
+  }
+}
+
+void TransformNode::set_parent(TransformNode *parent) {
+  if (parent == parentNode) return;
+  if (parentNode) {
+    vector<TransformNode *> &siblings = parentNode->children;
+    siblings.erase(find(siblings.begin(), siblings.end(), this));
+  }
+  parentNode = parent;
+  if (parent) parent->children.push_back(this);
+  mark_dirty();
+}
+
+void TransformNode::set_local(const Vector3D &position,
+                              const Vector3D &rotation,
+                              const Vector3D &scale) {
+  if (position == this->position && rotation == this->rotation &&
+      scale == this->scale) {
+    return;
+  }
+  this->position = position;
+  this->rotation = rotation;
+  this->scale = scale;
+
+  float deg2Rad = M_PI / 180.0;
+  float cx = cos(rotation.x * deg2Rad), sx = sin(rotation.x * deg2Rad);
+  float cy = cos(rotation.y * deg2Rad), sy = sin(rotation.y * deg2Rad);
+  float cz = cos(rotation.z * deg2Rad), sz = sin(rotation.z * deg2Rad);
+  const float rx[3][3] = {{1, 0, 0}, {0, cx, -sx}, {0, sx, cx}};
+  const float ry[3][3] = {{cy, 0, sy}, {0, 1, 0}, {-sy, 0, cy}};
+  const float rz[3][3] = {{cz, -sz, 0}, {sz, cz, 0}, {0, 0, 1}};
+  float rxy[3][3], r[3][3];
+  multiply3x3(rx, ry, rxy);
+  multiply3x3(rxy, rz, r);
+
+  for (int j = 0; j < 3; j++) {
+    for (int i = 0; i < 3; i++) local[j * 4 + i] = r[i][j] * scale[j];
+    local[j * 4 + 3] = 0;
+    local[12 + j] = position[j];
+  }
+  local[15] = 1;
+  mark_dirty();
+}
+
+const float *TransformNode::world() {
+  if (dirty) update();
+  return worldMatrix;
+}
+
+const float *TransformNode::world_normal() {
+  if (dirty) update();
+  return worldNormal;
+}
+
+uint32_t TransformNode::version() {
+  if (dirty) update();
+  return worldVersion;
+}
+
+void TransformNode::mark_dirty() {
+  // Below a dirty node everything is dirty already.
+  if (dirty) return;
+  dirty = true;
+  for (TransformNode *child : children) child->mark_dirty();
+}
+
+void TransformNode::update() {
+  if (parentNode) {
+    multiply_affine(parentNode->world(), local, worldMatrix);
+  } else {
+    copy(local, local + 16, worldMatrix);
+  }
+
+  // For an affine transform, the inverse transpose of the upper 3x3 has
+  // the cross products of its columns as columns, over its determinant.
+  const float *a0 = worldMatrix, *a1 = worldMatrix + 4, *a2 = worldMatrix + 8;
+  cross(a1, a2, worldNormal);
+  cross(a2, a0, worldNormal + 3);
+  cross(a0, a1, worldNormal + 6);
+  float det = a0[0] * worldNormal[0] + a0[1] * worldNormal[1] +
+              a0[2] * worldNormal[2];
+  if (det != 0) {
+    for (int i = 0; i < 9; i++) worldNormal[i] /= det;
+  }
+
+  dirty = false;
+  worldVersion++;
+  updates++;
+}
+
+}  // namespace DynamicScene
+}  // namespace CS248
@@ -0,0 +1,83 @@
+#ifndef CS248_DYNAMICSCENE_TRANSFORM_NODE_H
+#define CS248_DYNAMICSCENE_TRANSFORM_NODE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "CS248/vector3D.h"
+
+namespace CS248 {
+namespace DynamicScene {
+
+/**
+ * A node of the transform hierarchy. Its local transform is
+ * T * RX * RY * RZ * S from a position, rotation (in degrees) and scale, and
+ * its world transform is its parent's world transform times that.
+ *
+ * Matrices are kept in single precision, column-major as OpenGL takes them,
+ * and only recomputed when the node or one of its ancestors has changed:
+ * changing a node marks it and everything below it dirty, and a dirty world
+ * matrix is rebuilt the next time it is asked for.
+ */
+class TransformNode {
+ public:
+  TransformNode();
+  ~TransformNode();
+
+  TransformNode(const TransformNode &) = delete;
+  TransformNode &operator=(const TransformNode &) = delete;
+
+  /**
+   * Attaches the node below parent, or makes it a root if parent is null.
+   */
+  void set_parent(TransformNode *parent);
+  TransformNode *parent() const { return parentNode; }
+
+  /**
+   * Sets the local transform. Does nothing, and dirties nothing, if it is
+   * the same as before.
+   */
+  void set_local(const Vector3D &position, const Vector3D &rotation,
+                 const Vector3D &scale);
+
+  /**
+   * The object-to-world matrix, 4x4.
+   */
+  const float *world();
+
+  /**
+   * The inverse transpose of the upper 3x3 of world(), for normals.
+   */
+  const float *world_normal();
+
+  /**
+   * Changes whenever world() does.
+   */
+  uint32_t version();
+
+  /**
+   * World matrices rebuilt so far, by all nodes.
+   */
+  static size_t updates;
+
+ private:
+  void mark_dirty();
+  void update();
+
+  TransformNode *parentNode;
+  std::vector<TransformNode *> children;
+
+  Vector3D position, rotation, scale;
+  float local[16];
+  float worldMatrix[16];
+  float worldNormal[9];
+
+  bool dirty;
+  uint32_t worldVersion;
+};
+
+}  // namespace DynamicScene
+}  // namespace CS248
+
+#endif  // CS248_DYNAMICSCENE_TRANSFORM_NODE_H
@@ -0,0 +1,227 @@
+#include "vertex_format.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+using namespace std;
+
+namespace CS248 {
+namespace DynamicScene {
+
+bool VertexFormat::quantize_positions = true;
+
+namespace {
+
+float sign_not_zero(float v) { return v >= 0 ? 1.0f : -1.0f; }
+
+int16_t to_snorm16(float v) {
+  return (int16_t)lround(min(1.0f, max(-1.0f, v)) * 32767.0f);
+}
+
+uint8_t to_unorm8(float v) {
+  return (uint8_t)lround(min(1.0f, max(0.0f, v)) * 255.0f);
+}
+
+// Whether each vertex's bitangent, summed like its tangent over the
+// triangles using it, points along cross(normal, tangent).
+vector<bool> bitangent_signs(const MeshBuffers& buffers) {
+  size_t n = buffers.num_vertices;
+  vector<bool> signs(n, true);
+  if (!buffers.texcoords) return signs;
+
+  vector<Vector3Df> bitangents(n, Vector3Df{0, 0, 0});
+  const Vector3Df* p = buffers.positions;
+  const Vector2Df* uv = buffers.texcoords;
+  const uint32_t* indices = buffers.indices;
+  for (size_t i = 0; i + 3 <= buffers.num_indices; i += 3) {
+    uint32_t a = indices[i], b = indices[i + 1], c = indices[i + 2];
+    float e1[3] = {p[b].x - p[a].x, p[b].y - p[a].y, p[b].z - p[a].z};
+    float e2[3] = {p[c].x - p[a].x, p[c].y - p[a].y, p[c].z - p[a].z};
+    float du1 = uv[b].x - uv[a].x, dv1 = uv[b].y - uv[a].y;
+    float du2 = uv[c].x - uv[a].x, dv2 = uv[c].y - uv[a].y;
+    float r = 1.0f / (du1 * dv2 - dv1 * du2);
+    float bitangent[3];
+    for (int k = 0; k < 3; ++k) bitangent[k] = (e2[k] * du1 - e1[k] * du2) * r;
+    if (!isfinite(bitangent[0]) || !isfinite(bitangent[1]) ||
+        !isfinite(bitangent[2]))
+      continue;
+    for (uint32_t v : {a, b, c}) {
+      bitangents[v].x += bitangent[0];
+      bitangents[v].y += bitangent[1];
+      bitangents[v].z += bitangent[2];
+    }
+  }
+
+  for (size_t v = 0; v < n; ++v) {
+    const Vector3Df& nv = buffers.normals[v];
+    const Vector3Df& t = buffers.tangents[v];
+    const Vector3Df& b = bitangents[v];
+    float cross[3] = {nv.y * t.z - nv.z * t.y, nv.z * t.x - nv.x * t.z,
+                      nv.x * t.y - nv.y * t.x};
+    signs[v] = cross[0] * b.x + cross[1] * b.y + cross[2] * b.z >= 0;
+  }
+  return signs;
+}
+
+}  // namespace
+
+VertexFormat::Layout VertexFormat::layout() {
+  Layout layout;
+  layout.quantized_positions = quantize_positions;
+  layout.position = 0;
+  layout.normal = quantize_positions ? 4 * sizeof(uint16_t) : 4 * sizeof(float);
+  layout.tangent = layout.normal + 2 * sizeof(int16_t);
+  layout.texcoord = layout.tangent + 2 * sizeof(int16_t);
+  layout.diffuse_color = layout.texcoord + 2 * sizeof(uint16_t);
+  layout.stride = layout.diffuse_color + 4 * sizeof(uint8_t);
+  return layout;
+}
+
+void VertexFormat::pack(const MeshBuffers& buffers, void* out) {
+  Layout layout = VertexFormat::layout();
+  vector<bool> signs = bitangent_signs(buffers);
+
+  // positions map the bounds to 0..65535 on each axis; flat axes to 0
+  float lo[3] = {buffers.bbox_min.x, buffers.bbox_min.y, buffers.bbox_min.z};
+  float hi[3] = {buffers.bbox_max.x, buffers.bbox_max.y, buffers.bbox_max.z};
+  float scale[3];
+  for (int k = 0; k < 3; ++k) {
+    scale[k] = hi[k] > lo[k] ? 65535.0f / (hi[k] - lo[k]) : 0.0f;
+  }
+
+  for (size_t i = 0; i < buffers.num_vertices; ++i) {
+    uint8_t* vertex = (uint8_t*)out + i * layout.stride;
+    const Vector3Df& p = buffers.positions[i];
+    float position[3] = {p.x, p.y, p.z};
+    if (layout.quantized_positions) {
+      uint16_t q[4];
+      for (int k = 0; k < 3; ++k) {
+        float v = (position[k] - lo[k]) * scale[k];
+        q[k] = (uint16_t)lround(min(65535.0f, max(0.0f, v)));
+      }
+      q[3] = signs[i] ? 65535 : 0;
+      memcpy(vertex + layout.position, q, sizeof(q));
+    } else {
+      float f[4] = {p.x, p.y, p.z, signs[i] ? 1.0f : 0.0f};
+      memcpy(vertex + layout.position, f, sizeof(f));
+    }
+
+    int16_t normal[2], tangent[2];
+    encode_octahedral(buffers.normals[i], normal);
+    encode_octahedral(buffers.tangents[i], tangent);
+    memcpy(vertex + layout.normal, normal, sizeof(normal));
+    memcpy(vertex + layout.tangent, tangent, sizeof(tangent));
+
+    uint16_t texcoord[2] = {0, 0};
+    if (buffers.texcoords) {
+      texcoord[0] = to_half(buffers.texcoords[i].x);
+      texcoord[1] = to_half(buffers.texcoords[i].y);
+    }
+    memcpy(vertex + layout.texcoord, texcoord, sizeof(texcoord));
+
+    const Vector3Df& c = buffers.diffuse_colors[i];
+    uint8_t color[4] = {to_unorm8(c.x), to_unorm8(c.y), to_unorm8(c.z), 255};
+    memcpy(vertex + layout.diffuse_color, color, sizeof(color));
+  }
+}
+
+void VertexFormat::position_transform(const MeshBuffers& buffers,
+                                      const float* obj2world, float* out) {
+  if (!quantize_positions) {
+    copy(obj2world, obj2world + 16, out);
+    return;
+  }
+
+  // obj2world * translate(bbox_min) * scale(bbox_max - bbox_min), which
+  // maps the shader's 0..1 positions back into the bounds
+  float lo[3] = {buffers.bbox_min.x, buffers.bbox_min.y, buffers.bbox_min.z};
+  float hi[3] = {buffers.bbox_max.x, buffers.bbox_max.y, buffers.bbox_max.z};
+  for (int r = 0; r < 4; ++r) {
+    out[12 + r] = obj2world[12 + r];
+    for (int c = 0; c < 3; ++c) {
+      float extent = hi[c] > lo[c] ? hi[c] - lo[c] : 0.0f;
+      out[4 * c + r] = obj2world[4 * c + r] * extent;
+      out[12 + r] += obj2world[4 * c + r] * lo[c];
+    }
+  }
+}
+
+void VertexFormat::encode_octahedral(const Vector3Df& v, int16_t out[2]) {
+  float l1 = fabs(v.x) + fabs(v.y) + fabs(v.z);
+  if (!(l1 > 0) || !isfinite(l1)) {
+    out[0] = out[1] = 0;
+    return;
+  }
+
+  // project onto the octahedron, folding the lower half over the upper
+  float x = v.x / l1, y = v.y / l1;
+  if (v.z < 0) {
+    float folded_x = (1 - fabs(y)) * sign_not_zero(x);
+    float folded_y = (1 - fabs(x)) * sign_not_zero(y);
+    x = folded_x;
+    y = folded_y;
+  }
+  out[0] = to_snorm16(x);
+  out[1] = to_snorm16(y);
+}
+
+Vector3Df VertexFormat::decode_octahedral(const int16_t e[2]) {
+  float x = max(e[0] / 32767.0f, -1.0f), y = max(e[1] / 32767.0f, -1.0f);
+  float z = 1 - fabs(x) - fabs(y);
+  if (z < 0) {
+    float unfolded_x = (1 - fabs(y)) * sign_not_zero(x);
+    float unfolded_y = (1 - fabs(x)) * sign_not_zero(y);
+    x = unfolded_x;
+    y = unfolded_y;
+  }
+  float length = sqrt(x * x + y * y + z * z);
+  return Vector3Df{x / length, y / length, z / length};
+}
+
+uint16_t VertexFormat::to_half(float f) {
+  uint32_t bits;
+  memcpy(&bits, &f, sizeof(bits));
+  uint16_t sign = (bits >> 16) & 0x8000;
+  int exponent = (int)((bits >> 23) & 0xff) - 127 + 15;
+  uint32_t mantissa = bits & 0x7fffff;
+
+  if (((bits >> 23) & 0xff) == 0xff) {  // infinity or NaN
+    return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+  }
+  if (exponent >= 31) return sign | 0x7c00;
+  if (exponent < -10) return sign;
+
+  // keep the top 10 bits of the mantissa, which for subnormal halves is
+  // shifted right past its implicit leading 1, and round to nearest even
+  int shift = 13;
+  if (exponent <= 0) {
+    mantissa |= 0x800000;
+    shift = 14 - exponent;
+    exponent = 0;
+  }
+  uint32_t half = ((uint32_t)exponent << 10) | (mantissa >> shift);
+  uint32_t rest = mantissa & ((1u << shift) - 1), halfway = 1u << (shift - 1);
+  if (rest > halfway || (rest == halfway && (half & 1))) half++;
+  return sign | (uint16_t)half;
+}
+
+float VertexFormat::from_half(uint16_t h) {
+  uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+  uint32_t exponent = (h >> 10) & 0x1f;
+  uint32_t mantissa = h & 0x3ff;
+  if (exponent == 0) {
+    float f = ldexp((float)mantissa, -24);
+    return sign ? -f : f;
+  }
+  uint32_t bits = exponent == 31
+                      ? sign | 0x7f800000 | (mantissa << 13)
+                      : sign | ((exponent + 112) << 23) | (mantissa << 13);
+  float f;
+  memcpy(&f, &bits, sizeof(f));
+  return f;
+}
+
+}  // namespace DynamicScene
+}  // namespace CS248
@@ -0,0 +1,82 @@
+#ifndef CS248_DYNAMICSCENE_VERTEX_FORMAT_H
+#define CS248_DYNAMICSCENE_VERTEX_FORMAT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mesh_buffers.h"
+
+namespace CS248 {
+namespace DynamicScene {
+
+/**
+ * The compact, interleaved layout the geometry arena stores vertices in,
+ * 24 bytes each instead of the 56 of the float streams:
+ *
+ *  - position: 16-bit unorm within the mesh's bounds, or float, plus the
+ *    bitangent sign as w (1 if the bitangent is cross(normal, tangent), 0 if
+ *    it is the opposite);
+ *  - normal and tangent: octahedral, two snorm16 each;
+ *  - texcoord: two half floats;
+ *  - diffuse color: RGBA8.
+ *
+ * The vertex shader decodes normals and tangents. Quantized positions are
+ * mapped back to object space by folding the mesh's bounds into the
+ * obj2world matrix it is drawn with (see position_transform()), so the
+ * shader reads them as they are.
+ */
+class VertexFormat {
+ public:
+  /**
+   * Whether positions are stored as 16 bits within the mesh bounds rather
+   * than as floats. All meshes share one layout, so this must be set before
+   * any mesh is loaded.
+   */
+  static bool quantize_positions;
+
+  /**
+   * Byte offsets of each attribute within a vertex, and the vertex size.
+   */
+  struct Layout {
+    bool quantized_positions;  ///< unorm16 rather than float
+    size_t stride;
+    size_t position;
+    size_t normal;
+    size_t tangent;
+    size_t texcoord;
+    size_t diffuse_color;
+  };
+
+  static Layout layout();
+
+  /**
+   * Writes num_vertices vertices of layout() to out. Meshes without
+   * texcoords get zero texcoords and arbitrary tangents.
+   */
+  static void pack(const MeshBuffers& buffers, void* out);
+
+  /**
+   * The matrix that moves a mesh's stored positions to world space: obj2world
+   * after undoing the quantization, both column-major.
+   */
+  static void position_transform(const MeshBuffers& buffers,
+                                 const float* obj2world, float* out);
+
+  /**
+   * Octahedral encoding of a direction, which needn't be unit length, and
+   * its unit-length decoding.
+   */
+  static void encode_octahedral(const Vector3Df& v, int16_t out[2]);
+  static Vector3Df decode_octahedral(const int16_t e[2]);
+
+  /**
+   * IEEE half floats, rounded to nearest.
+   */
+  static uint16_t to_half(float f);
+  static float from_half(uint16_t h);
+};
+
+}  // namespace DynamicScene
+}  // namespace CS248
+
+#endif  // CS248_DYNAMICSCENE_VERTEX_FORMAT_H
@@ -0,0 +1,110 @@
+#include "frustum.h"
+
+#include <cmath>
+
+#if (defined(__SSE2__) || defined(_M_X64)) && !defined(CS248_NO_SIMD)
+#define CS248_FRUSTUM_SSE2
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+namespace CS248 {
+
+namespace {
+
+// floats per group of four boxes: four each of cx, cy, cz, ex, ey, ez
+const size_t kGroupFloats = 24;
+
+void set_plane(float plane[4], const Vector3D& n, const Vector3D& p) {
+  plane[0] = n.x;
+  plane[1] = n.y;
+  plane[2] = n.z;
+  plane[3] = -dot(n, p);
+}
+
+}  // namespace
+
+void BoxBatch::push(const BBox& box) {
+  size_t lane = count % 4;
+  if (lane == 0) data.resize(data.size() + kGroupFloats, 0.0f);
+  float* group = &data[data.size() - kGroupFloats];
+  Vector3D center = (box.min + box.max) * 0.5;
+  Vector3D half = (box.max - box.min) * 0.5;
+  for (int axis = 0; axis < 3; ++axis) {
+    group[axis * 4 + lane] = center[axis];
+    group[(3 + axis) * 4 + lane] = half[axis];
+  }
+  count++;
+}
+
+Frustum Frustum::from_camera(const Camera& camera) {
+  Vector3D eye = camera.position();
+  Vector3D forward = (camera.view_point() - eye).unit();
+  Vector3D right = cross(forward, camera.up_dir()).unit();
+  Vector3D up = cross(right, forward);
+  double tan_y = tan(camera.v_fov() * M_PI / 360.0);
+  double tan_x = tan_y * camera.aspect_ratio();
+
+  // A side plane holds the eye and an edge of the image, which lies along
+  // forward +- right * tan_x (or up * tan_y).
+  Frustum frustum;
+  set_plane(frustum.planes[0], forward, eye + forward * camera.near_clip());
+  set_plane(frustum.planes[1], -forward, eye + forward * camera.far_clip());
+  set_plane(frustum.planes[2], forward * tan_x + right, eye);
+  set_plane(frustum.planes[3], forward * tan_x - right, eye);
+  set_plane(frustum.planes[4], forward * tan_y + up, eye);
+  set_plane(frustum.planes[5], forward * tan_y - up, eye);
+  return frustum;
+}
+
+void Frustum::cull(const BoxBatch& boxes, uint8_t* visible) const {
+  // A box is outside a plane if even its corner furthest along the normal,
+  // at distance n.c + |n|.e + d, is behind it.
+  size_t num_groups = boxes.data.size() / kGroupFloats;
+  for (size_t g = 0; g < num_groups; ++g) {
+    const float* group = &boxes.data[g * kGroupFloats];
+    int outside = 0;  // bit i set if box i of the group is outside
+#ifdef CS248_FRUSTUM_SSE2
+    __m128 cx = _mm_loadu_ps(group + 0), cy = _mm_loadu_ps(group + 4),
+           cz = _mm_loadu_ps(group + 8), ex = _mm_loadu_ps(group + 12),
+           ey = _mm_loadu_ps(group + 16), ez = _mm_loadu_ps(group + 20);
+    __m128 out = _mm_setzero_ps();
+    for (int i = 0; i < 6; ++i) {
+      const float* p = planes[i];
+      __m128 dist = _mm_add_ps(
+          _mm_add_ps(_mm_mul_ps(cx, _mm_set1_ps(p[0])),
+                     _mm_mul_ps(cy, _mm_set1_ps(p[1]))),
+          _mm_add_ps(_mm_mul_ps(cz, _mm_set1_ps(p[2])), _mm_set1_ps(p[3])));
+      __m128 reach = _mm_add_ps(
+          _mm_add_ps(_mm_mul_ps(ex, _mm_set1_ps(fabsf(p[0]))),
+                     _mm_mul_ps(ey, _mm_set1_ps(fabsf(p[1])))),
+          _mm_mul_ps(ez, _mm_set1_ps(fabsf(p[2]))));
+      out = _mm_or_ps(out, _mm_cmplt_ps(_mm_add_ps(dist, reach),
+                                        _mm_setzero_ps()));
+    }
+    outside = _mm_movemask_ps(out);
+#else
+    for (int lane = 0; lane < 4; ++lane) {
+      for (int i = 0; i < 6; ++i) {
+        const float* p = planes[i];
+        float dist = group[lane] * p[0] + group[4 + lane] * p[1] +
+                     group[8 + lane] * p[2] + p[3];
+        float reach = group[12 + lane] * fabsf(p[0]) +
+                      group[16 + lane] * fabsf(p[1]) +
+                      group[20 + lane] * fabsf(p[2]);
+        if (dist + reach < 0) {
+          outside |= 1 << lane;
+          break;
+        }
+      }
+    }
+#endif
+
+    for (size_t lane = 0; lane < 4 && g * 4 + lane < boxes.count; ++lane) {
+      visible[g * 4 + lane] = (outside >> lane) & 1 ? 0 : 1;
+    }
+  }
+}
+
+}  // namespace CS248
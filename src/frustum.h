@@ -0,0 +1,68 @@
+#ifndef CS248_FRUSTUM_H
+#define CS248_FRUSTUM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "bbox.h"
+#include "camera.h"
+
+namespace CS248 {
+
+/**
+ * Axis-aligned boxes as centers and half extents, stored four at a time
+ * (x, y and z of four centers, then of four half extents) so that they can
+ * be tested against a frustum in one pass.
+ */
+class BoxBatch {
+ public:
+  BoxBatch() : count(0) {}
+
+  void clear() {
+    data.clear();
+    count = 0;
+  }
+
+  /**
+   * Appends a box; it must not be empty.
+   */
+  void push(const BBox& box);
+
+  size_t size() const { return count; }
+
+ private:
+  friend class Frustum;
+
+  std::vector<float> data;  ///< 24 floats per group of four boxes
+  size_t count;
+};
+
+/**
+ * The six planes bounding what a camera sees.
+ */
+class Frustum {
+ public:
+  /**
+   * The frustum of a perspective camera, as set up by Camera::view_matrix()
+   * and Camera::projection_matrix().
+   */
+  static Frustum from_camera(const Camera& camera);
+
+  /**
+   * Sets visible[i] to 1 if box i of boxes may be inside the frustum and
+   * to 0 if it is entirely outside. Boxes straddling a corner of the
+   * frustum may be kept even though they are outside.
+   */
+  void cull(const BoxBatch& boxes, uint8_t* visible) const;
+
+  /**
+   * Plane normals point inwards; a point p is on the inside of a plane
+   * when n.p + d >= 0.
+   */
+  float planes[6][4];
+};
+
+}  // namespace CS248
+
+#endif  // CS248_FRUSTUM_H
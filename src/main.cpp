@@ -5,6 +5,16 @@
 #include "CS248/tinyexr.h"
 
 #include "application.h"
+#include "benchmark.h"
+#include "dynamic_scene/mesh_batch.h"
+#include "dynamic_scene/mesh_cache.h"
+#include "dynamic_scene/mesh_clusters.h"
+#include "dynamic_scene/mesh_optimizer.h"
+#include "dynamic_scene/mesh_simplifier.h"
+#include "dynamic_scene/mesh_store.h"
+#include "dynamic_scene/vertex_format.h"
+#include "occlusion_buffer.h"
+#include "texture_registry.h"
 
 #include <iostream>
 
@@ -22,7 +32,23 @@ using namespace CS248;
 void usage(const char* binaryName) {
   printf("Usage: %s [options] <scenefile>\n", binaryName);
   printf("Program Options:\n");
-  printf("  -h               Print this help message\n");
+  printf("  -h                        Print this help message\n");
+  printf("  -b <objfiles>             Benchmark OBJ loading on the given files and exit\n");
+  printf("  -t <pngfiles>             Benchmark texture compression on the given files and exit\n");
+  printf("  -m <objfiles>             Report vertex cache efficiency before and after mesh optimization and exit\n");
+  printf("  --no-mesh-cache           Don't read or write mesh cache files\n");
+  printf("  --rebuild-mesh-cache      Ignore existing mesh cache files and rewrite them\n");
+  printf("  --no-mesh-optimization    Keep triangles and vertices in file order\n");
+  printf("  --no-lod                  Draw every mesh at full detail\n");
+  printf("  --no-cluster-culling      Draw whole meshes instead of culling their triangle clusters\n");
+  printf("  --float-positions         Store vertex positions as floats instead of 16 bits within the mesh bounds\n");
+  printf("  --no-texture-compression  Upload textures uncompressed\n");
+  printf("  --no-texture-cache        Don't read or write texture cache files\n");
+  printf("  --rebuild-texture-cache   Ignore existing texture cache files and rewrite them\n");
+  printf("  --mip-filter <filter>     Build texture mip chains with none, box or kaiser (default)\n");
+  printf("  --no-batching             Draw every mesh on its own instead of merging compatible ones\n");
+  printf("  --no-instancing           Draw copies of a mesh as separate meshes instead of instances\n");
+  printf("  --no-occlusion-culling    Draw objects even if they are hidden behind others\n");
   printf("\n");
 }
 
@@ -32,12 +58,69 @@ int main(int argc, char** argv) {
     return 1;
   }
 
-  string sceneFilePath = argv[1];
+  string sceneFilePath;
+  for (int i = 1; i < argc; ++i) {
+    string arg = argv[i];
+    if (arg == "-h") {
+      usage(argv[0]);
+      return 0;
+    } else if (arg == "-b") {
+      return Benchmark::obj_load(vector<string>(argv + i + 1, argv + argc));
+    } else if (arg == "--no-mesh-cache") {
+      DynamicScene::MeshCache::mode = DynamicScene::MeshCache::BYPASS;
+    } else if (arg == "-t") {
+      return Benchmark::texture_encode(vector<string>(argv + i + 1, argv + argc));
+    } else if (arg == "-m") {
+      return Benchmark::mesh_optimize(vector<string>(argv + i + 1, argv + argc));
+    } else if (arg == "--rebuild-mesh-cache") {
+      DynamicScene::MeshCache::mode = DynamicScene::MeshCache::REBUILD;
+    } else if (arg == "--no-mesh-optimization") {
+      DynamicScene::MeshOptimizer::enabled = false;
+    } else if (arg == "--no-lod") {
+      DynamicScene::MeshSimplifier::enabled = false;
+    } else if (arg == "--no-cluster-culling") {
+      DynamicScene::MeshClusters::enabled = false;
+    } else if (arg == "--float-positions") {
+      DynamicScene::VertexFormat::quantize_positions = false;
+    } else if (arg == "--no-texture-compression") {
+      TextureRegistry::compression = false;
+    } else if (arg == "--no-texture-cache") {
+      TextureCache::mode = TextureCache::BYPASS;
+    } else if (arg == "--rebuild-texture-cache") {
+      TextureCache::mode = TextureCache::REBUILD;
+    } else if (arg == "--no-batching") {
+      DynamicScene::MeshBatch::enabled = false;
+    } else if (arg == "--no-instancing") {
+      DynamicScene::MeshInstances::enabled = false;
+    } else if (arg == "--no-occlusion-culling") {
+      OcclusionBuffer::enabled = false;
+    } else if (arg == "--mip-filter" && i + 1 < argc) {
+      string filter = argv[++i];
+      if (filter == "none") {
+        TextureRegistry::mip_filter = MIP_NONE;
+      } else if (filter == "box") {
+        TextureRegistry::mip_filter = MIP_BOX;
+      } else if (filter == "kaiser") {
+        TextureRegistry::mip_filter = MIP_KAISER;
+      } else {
+        usage(argv[0]);
+        return 1;
+      }
+    } else {
+      sceneFilePath = arg;
+    }
+  }
+  if (sceneFilePath.empty()) {
+    usage(argv[0]);
+    return 1;
+  }
+
   msg("Input scene file: " << sceneFilePath);
 
   // parse scene
   Collada::SceneInfo* sceneInfo = new Collada::SceneInfo();
-  if (Collada::ColladaParser::load(sceneFilePath.c_str(), sceneInfo) < 0) {
+  if (Collada::ColladaParser::load(sceneFilePath.c_str(), sceneInfo,
+                                   &DynamicScene::MeshStore::shared()) < 0) {
     msg("Error: parsing failed!");
     delete sceneInfo;
     exit(0);
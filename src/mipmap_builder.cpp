@@ -0,0 +1,248 @@
+#include "mipmap_builder.h"
+
+#include "thread_pool.h"
+
+#include "CS248/misc.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if (defined(__SSE2__) || defined(_M_X64)) && !defined(CS248_NO_SIMD)
+#define CS248_MIPMAP_BUILDER_SSE
+#include <xmmintrin.h>
+#endif
+
+using namespace std;
+
+namespace CS248 {
+
+namespace {
+
+// Kaiser-windowed sinc as in most texture tools: three lobes either side,
+// measured in pixels of the smaller level.
+const float kKaiserWidth = 3.0f;
+const float kKaiserAlpha = 4.0f;
+
+const int kLinearToSrgbEntries = 4096;
+
+struct Tap {
+  unsigned index;  ///< source pixel along the axis
+  float weight;
+};
+
+// Taps of every destination pixel along one axis; pixel x uses
+// taps[begin[x]] to taps[begin[x + 1] - 1].
+struct Axis {
+  vector<size_t> begin;
+  vector<Tap> taps;
+};
+
+float bessel_i0(float x) {
+  float sum = 1, term = 1, half = x / 2;
+  for (int k = 1; term > sum * 1e-8f; ++k) {
+    term *= (half / k) * (half / k);
+    sum += term;
+  }
+  return sum;
+}
+
+float filter_support(MipFilter filter) {
+  return filter == MIP_BOX ? 0.5f : kKaiserWidth;
+}
+
+float filter_weight(MipFilter filter, float t) {
+  t = fabs(t);
+  if (filter == MIP_BOX) return t < 0.5f ? 1.0f : (t == 0.5f ? 0.5f : 0.0f);
+  if (t >= kKaiserWidth) return 0;
+  float sinc = t < 1e-6f ? 1.0f : sin((float)PI * t) / ((float)PI * t);
+  float r = t / kKaiserWidth;
+  return sinc * bessel_i0(kKaiserAlpha * sqrt(1 - r * r)) /
+         bessel_i0(kKaiserAlpha);
+}
+
+Axis make_axis(unsigned src, unsigned dst, MipFilter filter) {
+  Axis axis;
+  float scale = (float)src / dst;
+  float radius = filter_support(filter) * scale;
+  for (unsigned x = 0; x < dst; ++x) {
+    axis.begin.push_back(axis.taps.size());
+    float center = (x + 0.5f) * scale;
+    int lo = (int)floor(center - radius), hi = (int)ceil(center + radius);
+    float sum = 0;
+    for (int i = lo; i <= hi; ++i) {
+      float weight = filter_weight(filter, (i + 0.5f - center) / scale);
+      if (weight == 0) continue;
+      Tap tap = {(unsigned)min(max(i, 0), (int)src - 1), weight};
+      axis.taps.push_back(tap);
+      sum += weight;
+    }
+    for (size_t t = axis.begin.back(); t < axis.taps.size(); ++t) {
+      axis.taps[t].weight /= sum;
+    }
+  }
+  axis.begin.push_back(axis.taps.size());
+  return axis;
+}
+
+// acc += weight * pixel, for the four channels of a pixel
+inline void accumulate(float acc[4], const float* pixel, float weight) {
+#ifdef CS248_MIPMAP_BUILDER_SSE
+  _mm_storeu_ps(acc, _mm_add_ps(_mm_loadu_ps(acc),
+                                _mm_mul_ps(_mm_set1_ps(weight),
+                                           _mm_loadu_ps(pixel))));
+#else
+  for (int c = 0; c < 4; ++c) acc[c] += weight * pixel[c];
+#endif
+}
+
+// Filters every row of src (width src_width) down to width dst_width.
+void resample_rows(const vector<float>& src, unsigned src_width,
+                   unsigned rows, const Axis& axis, unsigned dst_width,
+                   vector<float>& dst, size_t max_threads) {
+  dst.assign((size_t)dst_width * rows * 4, 0.0f);
+  ThreadPool::shared().parallel_for(rows, [&](size_t y) {
+    const float* in = &src[y * src_width * 4];
+    float* out = &dst[y * dst_width * 4];
+    for (unsigned x = 0; x < dst_width; ++x, out += 4) {
+      for (size_t t = axis.begin[x]; t < axis.begin[x + 1]; ++t) {
+        accumulate(out, in + axis.taps[t].index * 4, axis.taps[t].weight);
+      }
+    }
+  }, max_threads);
+}
+
+// Filters the columns of src (width pixels wide) down to dst_height rows.
+void resample_columns(const vector<float>& src, unsigned width,
+                      const Axis& axis, unsigned dst_height,
+                      vector<float>& dst, size_t max_threads) {
+  dst.assign((size_t)width * dst_height * 4, 0.0f);
+  ThreadPool::shared().parallel_for(dst_height, [&](size_t y) {
+    float* out = &dst[y * width * 4];
+    for (size_t t = axis.begin[y]; t < axis.begin[y + 1]; ++t) {
+      const float* in = &src[(size_t)axis.taps[t].index * width * 4];
+      for (unsigned x = 0; x < width; ++x) {
+        accumulate(out + x * 4, in + x * 4, axis.taps[t].weight);
+      }
+    }
+  }, max_threads);
+}
+
+struct SrgbTables {
+  float to_linear[256];
+  unsigned char from_linear[kLinearToSrgbEntries];
+
+  SrgbTables() {
+    for (int i = 0; i < 256; ++i) {
+      float s = i / 255.0f;
+      to_linear[i] = s <= 0.04045f ? s / 12.92f
+                                   : pow((s + 0.055f) / 1.055f, 2.4f);
+    }
+    for (int i = 0; i < kLinearToSrgbEntries; ++i) {
+      float l = (float)i / (kLinearToSrgbEntries - 1);
+      float s = l <= 0.0031308f ? l * 12.92f
+                                : 1.055f * pow(l, 1 / 2.4f) - 0.055f;
+      from_linear[i] = (unsigned char)(s * 255 + 0.5f);
+    }
+  }
+};
+
+const SrgbTables& srgb_tables() {
+  static SrgbTables tables;
+  return tables;
+}
+
+inline unsigned char to_unorm8(float v) {
+  return (unsigned char)(min(max(v, 0.0f), 1.0f) * 255 + 0.5f);
+}
+
+void to_float(const unsigned char* rgba, unsigned width, unsigned height,
+              MipContent content, vector<float>& out, size_t max_threads) {
+  const SrgbTables& srgb = srgb_tables();
+  out.resize((size_t)width * height * 4);
+  ThreadPool::shared().parallel_for(height, [&](size_t y) {
+    for (size_t i = y * width; i < (y + 1) * width; ++i) {
+      for (int c = 0; c < 3; ++c) {
+        unsigned char v = rgba[4 * i + c];
+        switch (content) {
+          case MIP_SRGB: out[4 * i + c] = srgb.to_linear[v]; break;
+          case MIP_NORMAL: out[4 * i + c] = v / 255.0f * 2 - 1; break;
+          default: out[4 * i + c] = v / 255.0f; break;
+        }
+      }
+      out[4 * i + 3] = rgba[4 * i + 3] / 255.0f;
+    }
+  }, max_threads);
+}
+
+// Quantizes a level to RGBA8; normals are renormalized first, in place, so
+// that the next level is filtered from unit vectors too.
+void to_rgba8(vector<float>& level, unsigned width, unsigned height,
+              MipContent content, vector<unsigned char>& out,
+              size_t max_threads) {
+  const SrgbTables& srgb = srgb_tables();
+  out.resize((size_t)width * height * 4);
+  ThreadPool::shared().parallel_for(height, [&](size_t y) {
+    for (size_t i = y * width; i < (y + 1) * width; ++i) {
+      float* p = &level[4 * i];
+      if (content == MIP_NORMAL) {
+        float length = sqrt(p[0] * p[0] + p[1] * p[1] + p[2] * p[2]);
+        if (length > 0) {
+          for (int c = 0; c < 3; ++c) p[c] /= length;
+        }
+        for (int c = 0; c < 3; ++c) {
+          out[4 * i + c] = to_unorm8(p[c] * 0.5f + 0.5f);
+        }
+      } else if (content == MIP_SRGB) {
+        for (int c = 0; c < 3; ++c) {
+          float l = min(max(p[c], 0.0f), 1.0f);
+          int entry = (int)(l * (kLinearToSrgbEntries - 1) + 0.5f);
+          out[4 * i + c] = srgb.from_linear[entry];
+        }
+      } else {
+        for (int c = 0; c < 3; ++c) out[4 * i + c] = to_unorm8(p[c]);
+      }
+      out[4 * i + 3] = to_unorm8(p[3]);
+    }
+  }, max_threads);
+}
+
+}  // namespace
+
+unsigned MipmapBuilder::num_levels(unsigned width, unsigned height) {
+  unsigned levels = 1;
+  for (unsigned size = max(width, height); size > 1; size /= 2) levels++;
+  return levels;
+}
+
+unsigned MipmapBuilder::level_size(unsigned size, unsigned level) {
+  return max(1u, size >> level);
+}
+
+void MipmapBuilder::build(const unsigned char* rgba, unsigned width,
+                          unsigned height, MipFilter filter, MipContent content,
+                          vector<vector<unsigned char> >& levels,
+                          size_t max_threads) {
+  levels.clear();
+  if (filter == MIP_NONE) return;
+
+  unsigned n = num_levels(width, height);
+  levels.resize(n - 1);
+
+  vector<float> current, rows, next;
+  to_float(rgba, width, height, content, current, max_threads);
+  for (unsigned level = 1; level < n; ++level) {
+    unsigned w = level_size(width, level - 1);
+    unsigned h = level_size(height, level - 1);
+    unsigned next_w = level_size(width, level);
+    unsigned next_h = level_size(height, level);
+
+    resample_rows(current, w, h, make_axis(w, next_w, filter), next_w, rows,
+                  max_threads);
+    resample_columns(rows, next_w, make_axis(h, next_h, filter), next_h, next,
+                     max_threads);
+    to_rgba8(next, next_w, next_h, content, levels[level - 1], max_threads);
+    current.swap(next);
+  }
+}
+
+}  // namespace CS248
@@ -0,0 +1,61 @@
+#ifndef CS248_MIPMAP_BUILDER_H
+#define CS248_MIPMAP_BUILDER_H
+
+#include <stddef.h>
+#include <vector>
+
+namespace CS248 {
+
+/**
+ * Filter used to build each mip level from the one above it.
+ */
+enum MipFilter {
+  MIP_NONE,   ///< no mip chain, only the full-size image
+  MIP_BOX,    ///< 2x2 average
+  MIP_KAISER  ///< Kaiser-windowed sinc, sharper and with less aliasing
+};
+
+/**
+ * How the channels of an image are filtered.
+ */
+enum MipContent {
+  MIP_SRGB,    ///< sRGB color with linear alpha; filtered in linear space
+  MIP_LINEAR,  ///< data, filtered as stored
+  MIP_NORMAL   ///< tangent-space normals in RGB; renormalized per level
+};
+
+/**
+ * Builds mip chains of RGBA8 images on the CPU.
+ *
+ * Each level is filtered from the previous one in floating point, then
+ * quantized on its own, so rounding doesn't accumulate down the chain. Rows
+ * are spread over the shared ThreadPool; the filter taps use SSE on all four
+ * channels at once where available.
+ */
+class MipmapBuilder {
+ public:
+  /**
+   * Number of levels in a full chain, down to 1x1.
+   */
+  static unsigned num_levels(unsigned width, unsigned height);
+
+  /**
+   * Size of a level: the size of the one above it halved, rounded down,
+   * and at least 1.
+   */
+  static unsigned level_size(unsigned size, unsigned level);
+
+  /**
+   * Builds levels 1 and up of the chain of an image; levels[i] holds level
+   * i + 1 as RGBA8. Builds nothing for MIP_NONE. At most max_threads threads
+   * are used; zero means the whole pool.
+   */
+  static void build(const unsigned char* rgba, unsigned width, unsigned height,
+                    MipFilter filter, MipContent content,
+                    std::vector<std::vector<unsigned char> >& levels,
+                    size_t max_threads = 0);
+};
+
+}  // namespace CS248
+
+#endif  // CS248_MIPMAP_BUILDER_H
@@ -0,0 +1,249 @@
+#include "occlusion_buffer.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "thread_pool.h"
+
+#if (defined(__SSE2__) || defined(_M_X64)) && !defined(CS248_NO_SIMD)
+#define CS248_OCCLUSION_SSE2
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+namespace CS248 {
+
+bool OcclusionBuffer::enabled = true;
+
+namespace {
+
+// rows each thread pool task rasterizes
+const int kBandRows = 16;
+
+int level_width(int level) { return max(OcclusionBuffer::kWidth >> level, 1); }
+
+int level_height(int level) {
+  return max(OcclusionBuffer::kHeight >> level, 1);
+}
+
+void set_row(float row[4], const Vector3D& n, const Vector3D& eye) {
+  row[0] = n.x;
+  row[1] = n.y;
+  row[2] = n.z;
+  row[3] = -dot(n, eye);
+}
+
+}  // namespace
+
+OcclusionBuffer::OcclusionBuffer() : near_clip(0), queued_triangles(0) {
+  for (int level = 0;; ++level) {
+    levels.push_back(vector<float>(level_width(level) * level_height(level)));
+    if (level_width(level) == 1 && level_height(level) == 1) break;
+  }
+}
+
+void OcclusionBuffer::begin(const Camera& camera) {
+  // Clip x and y reach +-w at the edges of the image, which lie along
+  // forward +- right * tan_x (or up * tan_y); see Frustum::from_camera.
+  Vector3D eye = camera.position();
+  Vector3D forward = (camera.view_point() - eye).unit();
+  Vector3D right = cross(forward, camera.up_dir()).unit();
+  Vector3D up = cross(right, forward);
+  double tan_y = tan(camera.v_fov() * M_PI / 360.0);
+  double tan_x = tan_y * camera.aspect_ratio();
+  set_row(clip_rows[0], right / tan_x, eye);
+  set_row(clip_rows[1], up / tan_y, eye);
+  set_row(clip_rows[2], forward, eye);
+  near_clip = camera.near_clip();
+
+  queued_triangles = 0;
+  screen_triangles.clear();
+  fill(levels[0].begin(), levels[0].end(), 0.0f);
+}
+
+bool OcclusionBuffer::add_occluder(const float* positions,
+                                   const uint32_t* indices, size_t num_indices,
+                                   const float* obj2world) {
+  size_t num_triangles = num_indices / 3;
+  if (queued_triangles + num_triangles > kMaxTriangles) return false;
+  queued_triangles += num_triangles;
+
+  // object space straight to clip x, y and w
+  float m[3][4];
+  for (int r = 0; r < 3; ++r) {
+    for (int c = 0; c < 4; ++c) {
+      m[r][c] = clip_rows[r][0] * obj2world[c * 4] +
+                clip_rows[r][1] * obj2world[c * 4 + 1] +
+                clip_rows[r][2] * obj2world[c * 4 + 2] +
+                (c == 3 ? clip_rows[r][3] : 0.0f);
+    }
+  }
+
+  for (size_t t = 0; t < num_triangles; ++t) {
+    float corners[9];
+    bool in_front = true;
+    for (int v = 0; v < 3 && in_front; ++v) {
+      const float* p = positions + indices[t * 3 + v] * 3;
+      float clip[3];
+      for (int r = 0; r < 3; ++r) {
+        clip[r] = m[r][0] * p[0] + m[r][1] * p[1] + m[r][2] * p[2] + m[r][3];
+      }
+      in_front = clip[2] >= near_clip;
+      float inv_w = 1.0f / clip[2];
+      corners[v * 3] = (clip[0] * inv_w * 0.5f + 0.5f) * kWidth;
+      corners[v * 3 + 1] = (clip[1] * inv_w * 0.5f + 0.5f) * kHeight;
+      corners[v * 3 + 2] = inv_w;
+    }
+    if (!in_front) continue;
+
+    float min_x = min(corners[0], min(corners[3], corners[6]));
+    float max_x = max(corners[0], max(corners[3], corners[6]));
+    float min_y = min(corners[1], min(corners[4], corners[7]));
+    float max_y = max(corners[1], max(corners[4], corners[7]));
+    if (max_x < 0 || min_x > kWidth || max_y < 0 || min_y > kHeight) continue;
+    screen_triangles.insert(screen_triangles.end(), corners, corners + 9);
+  }
+  return true;
+}
+
+void OcclusionBuffer::rasterize() {
+  // Bands of rows share no pixels, so they need no locking.
+  ThreadPool::shared().parallel_for(kHeight / kBandRows, [this](size_t band) {
+    rasterize_rows(band * kBandRows, (band + 1) * kBandRows);
+  });
+
+  for (size_t level = 1; level < levels.size(); ++level) {
+    const vector<float>& src = levels[level - 1];
+    int src_width = level_width(level - 1), src_height = level_height(level - 1);
+    int width = level_width(level), height = level_height(level);
+    for (int y = 0; y < height; ++y) {
+      int y0 = 2 * y, y1 = min(2 * y + 1, src_height - 1);
+      for (int x = 0; x < width; ++x) {
+        int x0 = 2 * x, x1 = min(2 * x + 1, src_width - 1);
+        levels[level][y * width + x] =
+            min(min(src[y0 * src_width + x0], src[y0 * src_width + x1]),
+                min(src[y1 * src_width + x0], src[y1 * src_width + x1]));
+      }
+    }
+  }
+}
+
+void OcclusionBuffer::rasterize_rows(int first_row, int end_row) {
+  float* depth = levels[0].data();
+  for (size_t t = 0; t < screen_triangles.size(); t += 9) {
+    const float* c = &screen_triangles[t];
+    float x0 = c[0], y0 = c[1], z0 = c[2];
+    float x1 = c[3], y1 = c[4], z1 = c[5];
+    float x2 = c[6], y2 = c[7], z2 = c[8];
+    float area = (x1 - x0) * (y2 - y0) - (x2 - x0) * (y1 - y0);
+    if (area == 0) continue;
+    if (area < 0) {
+      swap(x1, x2);
+      swap(y1, y2);
+      swap(z1, z2);
+      area = -area;
+    }
+
+    // pixels whose centers lie within the triangle's bounds
+    int min_x = max(0, (int)ceil(min(x0, min(x1, x2)) - 0.5f));
+    int max_x = min(kWidth - 1, (int)floor(max(x0, max(x1, x2)) - 0.5f));
+    int min_y = max(first_row, (int)ceil(min(y0, min(y1, y2)) - 0.5f));
+    int max_y = min(end_row - 1, (int)floor(max(y0, max(y1, y2)) - 0.5f));
+    if (min_x > max_x || min_y > max_y) continue;
+
+    // Edge i is a * x + b * y + e, non-negative inside; it is also the
+    // weight of the corner opposite it, times area.
+    float a[3] = {y1 - y2, y2 - y0, y0 - y1};
+    float b[3] = {x2 - x1, x0 - x2, x1 - x0};
+    float e[3] = {-(a[0] * x1 + b[0] * y1), -(a[1] * x2 + b[1] * y2),
+                  -(a[2] * x0 + b[2] * y0)};
+    float dz_dx = (z0 * a[0] + z1 * a[1] + z2 * a[2]) / area;
+    float dz_dy = (z0 * b[0] + z1 * b[1] + z2 * b[2]) / area;
+    float dz = (z0 * e[0] + z1 * e[1] + z2 * e[2]) / area;
+
+#ifdef CS248_OCCLUSION_SSE2
+    int first_x = min_x & ~3;  // rows are a multiple of four pixels wide
+#endif
+    for (int y = min_y; y <= max_y; ++y) {
+      float py = y + 0.5f;
+      float* row = depth + y * kWidth;
+#ifdef CS248_OCCLUSION_SSE2
+      __m128 offsets = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+      __m128 zero = _mm_setzero_ps();
+      for (int x = first_x; x <= max_x; x += 4) {
+        __m128 px = _mm_add_ps(_mm_set1_ps((float)x), offsets);
+        __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        for (int i = 0; i < 3; ++i) {
+          __m128 edge = _mm_add_ps(_mm_mul_ps(px, _mm_set1_ps(a[i])),
+                                   _mm_set1_ps(b[i] * py + e[i]));
+          inside = _mm_and_ps(inside, _mm_cmpge_ps(edge, zero));
+        }
+        __m128 z = _mm_add_ps(_mm_mul_ps(px, _mm_set1_ps(dz_dx)),
+                              _mm_set1_ps(dz_dy * py + dz));
+        __m128 old_z = _mm_loadu_ps(row + x);
+        __m128 new_z = _mm_max_ps(old_z, z);
+        _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, new_z),
+                                         _mm_andnot_ps(inside, old_z)));
+      }
+#else
+      for (int x = min_x; x <= max_x; ++x) {
+        float px = x + 0.5f;
+        if (a[0] * px + b[0] * py + e[0] < 0 ||
+            a[1] * px + b[1] * py + e[1] < 0 ||
+            a[2] * px + b[2] * py + e[2] < 0) {
+          continue;
+        }
+        row[x] = max(row[x], dz_dx * px + dz_dy * py + dz);
+      }
+#endif
+    }
+  }
+}
+
+bool OcclusionBuffer::visible(const BBox& box) const {
+  float min_x = kWidth, max_x = 0, min_y = kHeight, max_y = 0;
+  float nearest = 0;  // largest 1/w of the corners
+  for (int i = 0; i < 8; ++i) {
+    float p[3] = {(float)(i & 1 ? box.max.x : box.min.x),
+                  (float)(i & 2 ? box.max.y : box.min.y),
+                  (float)(i & 4 ? box.max.z : box.min.z)};
+    float clip[3];
+    for (int r = 0; r < 3; ++r) {
+      clip[r] = clip_rows[r][0] * p[0] + clip_rows[r][1] * p[1] +
+                clip_rows[r][2] * p[2] + clip_rows[r][3];
+    }
+    if (clip[2] < near_clip) return true;
+    float inv_w = 1.0f / clip[2];
+    float x = (clip[0] * inv_w * 0.5f + 0.5f) * kWidth;
+    float y = (clip[1] * inv_w * 0.5f + 0.5f) * kHeight;
+    min_x = min(min_x, x);
+    max_x = max(max_x, x);
+    min_y = min(min_y, y);
+    max_y = max(max_y, y);
+    nearest = max(nearest, inv_w);
+  }
+
+  // every pixel the box's screen rectangle touches
+  int x0 = max(0, (int)floor(min_x)), x1 = min(kWidth - 1, (int)floor(max_x));
+  int y0 = max(0, (int)floor(min_y)), y1 = min(kHeight - 1, (int)floor(max_y));
+  if (x0 > x1 || y0 > y1) return true;
+
+  // the finest level where the rectangle spans at most 4x4 texels
+  size_t level = 0;
+  while (level + 1 < levels.size() &&
+         ((x1 >> level) - (x0 >> level) >= 4 ||
+          (y1 >> level) - (y0 >> level) >= 4)) {
+    level++;
+  }
+  const vector<float>& texels = levels[level];
+  int width = level_width(level);
+  for (int y = y0 >> level; y <= y1 >> level; ++y) {
+    for (int x = x0 >> level; x <= x1 >> level; ++x) {
+      if (texels[y * width + x] <= nearest) return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace CS248
@@ -0,0 +1,87 @@
+#ifndef CS248_OCCLUSION_BUFFER_H
+#define CS248_OCCLUSION_BUFFER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "bbox.h"
+#include "camera.h"
+
+namespace CS248 {
+
+/**
+ * A coarse software depth buffer of the biggest occluders in view, against
+ * which the bounds of other objects are tested so that objects hidden behind
+ * them need not be drawn. Runs on the CPU only: occluder triangles are
+ * rasterized in horizontal bands on the thread pool, four pixels at a time,
+ * and the result is reduced into a hierarchical-Z pyramid.
+ *
+ * Depth is stored as 1/w, which is linear in screen space; larger is nearer
+ * and 0 is infinitely far. Triangles crossing the near plane are left out,
+ * so that the buffer never hides more than the occluders do.
+ */
+class OcclusionBuffer {
+ public:
+  static const int kWidth = 256;
+  static const int kHeight = 128;
+
+  /**
+   * Most occluder triangles rasterized per frame.
+   */
+  static const size_t kMaxTriangles = 1 << 16;
+
+  /**
+   * Whether the scene culls occluded objects at all.
+   */
+  static bool enabled;
+
+  OcclusionBuffer();
+
+  /**
+   * Clears the buffer for the view of a perspective camera, as set up by
+   * Camera::view_matrix() and Camera::projection_matrix().
+   */
+  void begin(const Camera& camera);
+
+  /**
+   * Queues the triangles of an occluder: num_indices indices, three per
+   * triangle, into positions of three floats, moved to world space by a
+   * column-major 4x4 matrix. Queues nothing and returns false if they would
+   * exceed kMaxTriangles.
+   */
+  bool add_occluder(const float* positions, const uint32_t* indices,
+                    size_t num_indices, const float* obj2world);
+
+  /**
+   * Rasterizes the queued triangles and builds the pyramid.
+   */
+  void rasterize();
+
+  /**
+   * Whether any part of a world-space box may be in front of the
+   * occluders. Boxes reaching behind the near plane are always visible.
+   */
+  bool visible(const BBox& box) const;
+
+  /**
+   * Triangles queued since begin(), after those entirely off screen or
+   * crossing the near plane were dropped.
+   */
+  size_t triangles() const { return screen_triangles.size() / 9; }
+
+ private:
+  void rasterize_rows(int first_row, int end_row);
+
+  float clip_rows[3][4];  ///< world to clip x, y and w
+  float near_clip;
+  size_t queued_triangles;  ///< before dropping, for the budget
+  std::vector<float> screen_triangles;  ///< x, y, 1/w of each corner
+  std::vector<std::vector<float> > levels;  ///< levels[0] is the buffer;
+                                            ///< each next one holds the
+                                            ///< minimum of 2x2 texels
+};
+
+}  // namespace CS248
+
+#endif  // CS248_OCCLUSION_BUFFER_H
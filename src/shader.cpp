@@ -1,4 +1,6 @@
 #include "shader.h"
+#include "uniform_blocks.h"
+
 #include <fstream>
 #include <string>
 
@@ -6,9 +8,54 @@ using namespace CS248::StaticScene;
 
 namespace CS248 {
 
+namespace {
+
+// names of the well-known uniforms and attributes, in enum order
+const char* const kUniformNames[NUM_SHADER_UNIFORMS] = {
+  "obj2world",
+  "obj2worldNorm",
+  "view_projection",
+  "camera_position",
+  "useTextureMapping",
+  "useNormalMapping",
+  "useEnvironmentMapping",
+  "useBlending",
+  "useDisneyBRDF",
+  "diffuseTextureSampler",
+  "normalTextureSampler",
+  "environmentTextureSampler",
+  "blendTextureSampler",
+  "stub1TextureSampler",
+  "stub2TextureSampler",
+  "stub3TextureSampler",
+  "num_directional_lights",
+  "directional_light_vectors",
+  "num_point_lights",
+  "point_light_positions",
+};
+
+const char* const kAttributeNames[NUM_SHADER_ATTRIBUTES] = {
+  "vtx_position",
+  "vtx_diffuse_color",
+  "vtx_normal",
+  "vtx_texcoord",
+  "vtx_tangent",
+  "vtx_draw_id",
+};
+
+// glGetActiveUniform reports arrays as "name[0]"
+std::string baseName(const char* name) {
+  std::string base = name;
+  size_t bracket = base.find('[');
+  return bracket == std::string::npos ? base : base.substr(0, bracket);
+}
+
+}  // namespace
+
 Shader::Shader(std::string vertex_shader_filename, std::string fragment_shader_filename, std::string vertex_shader_content_prefix, std::string fragment_shader_content_prefix)
 {
     _printErrors = true;
+    for (int i = 0; i < NUM_SHADER_ATTRIBUTES; ++i) _attributeLocations[i] = -1;
 	_vertexShaderFilename = vertex_shader_filename;
 	_fragmentShaderFilename = fragment_shader_filename;
 
@@ -28,6 +75,21 @@ Shader::~Shader()
 {
 }
 
+const Shader& Shader::shared(const std::string& vertex_shader_filename, const std::string& fragment_shader_filename, const std::string& vertex_shader_content_prefix, const std::string& fragment_shader_content_prefix)
+{
+    // Meshes with the same shaders draw with the same program, so that
+    // their draws can be sorted together and merged.
+    static std::map<std::string, Shader> programs;
+    std::string key = vertex_shader_filename + '\n' + fragment_shader_filename + '\n' +
+                      vertex_shader_content_prefix + '\n' + fragment_shader_content_prefix;
+    std::map<std::string, Shader>::iterator it = programs.find(key);
+    if (it == programs.end()) {
+        it = programs.insert(std::make_pair(key, Shader(vertex_shader_filename, fragment_shader_filename,
+                                                        vertex_shader_content_prefix, fragment_shader_content_prefix))).first;
+    }
+    return it->second;
+}
+
 bool Shader::read(std::string filename, std::string& contents) {
   contents = "";
   std::ifstream file;
@@ -165,8 +227,77 @@ bool Shader::link()
         return false;
     }
 
+    // Uniform blocks shared by all programs sit at fixed binding points.
+    if (uniform_blocks_supported()) {
+        GLuint block = glGetUniformBlockIndex( _programID, "FrameData" );
+        if (block != GL_INVALID_INDEX) glUniformBlockBinding( _programID, block, FRAME_DATA_BINDING );
+        block = glGetUniformBlockIndex( _programID, "ObjectData" );
+        if (block != GL_INVALID_INDEX) glUniformBlockBinding( _programID, block, OBJECT_DATA_BINDING );
+        block = glGetUniformBlockIndex( _programID, "ObjectDataArray" );
+        if (block != GL_INVALID_INDEX) glUniformBlockBinding( _programID, block, OBJECT_DATA_BINDING );
+    }
+
+    // Look up every active uniform and attribute now, so that drawing never
+    // has to query a location by name.
+    _activeUniforms.clear();
+    for (int i = 0; i < NUM_SHADER_UNIFORMS; ++i) _uniformLocations[i].clear();
+    for (int i = 0; i < NUM_SHADER_ATTRIBUTES; ++i) _attributeLocations[i] = -1;
+
+    GLint count = 0, maxLength = 0;
+    glGetProgramiv( _programID, GL_ACTIVE_UNIFORMS, &count );
+    glGetProgramiv( _programID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength );
+    std::vector<GLchar> name(maxLength + 1);
+    for (GLint i = 0; i < count; ++i) {
+        GLint size = 0;
+        GLenum type;
+        glGetActiveUniform( _programID, i, (GLsizei)name.size(), NULL, &size, &type, name.data() );
+        std::string base = baseName(name.data());
+        GLint location = glGetUniformLocation( _programID, base.c_str() );
+        if (location < 0) continue;  // uniform block members
+        _activeUniforms[base] = location;
+
+        for (int u = 0; u < NUM_SHADER_UNIFORMS; ++u) {
+            if (base != kUniformNames[u]) continue;
+            // element locations of an array need not be consecutive
+            std::vector<GLint>& locations = _uniformLocations[u];
+            locations.push_back(location);
+            for (GLint j = 1; j < size; ++j) {
+                std::string element = base + "[" + std::to_string(j) + "]";
+                locations.push_back(glGetUniformLocation( _programID, element.c_str() ));
+            }
+        }
+    }
+
+    // Samplers read fixed texture units, which is program state and so only
+    // needs setting once.
+    glUseProgram( _programID );
+    for (int u = UNIFORM_DIFFUSE_TEXTURE; u <= UNIFORM_STUB3_TEXTURE; ++u) {
+        GLint location = uniformLocation((ShaderUniform)u);
+        if (location >= 0) glUniform1i( location, u - UNIFORM_DIFFUSE_TEXTURE );
+    }
+    glUseProgram( 0 );
+
+    glGetProgramiv( _programID, GL_ACTIVE_ATTRIBUTES, &count );
+    glGetProgramiv( _programID, GL_ACTIVE_ATTRIBUTE_MAX_LENGTH, &maxLength );
+    name.resize(maxLength + 1);
+    for (GLint i = 0; i < count; ++i) {
+        GLint size = 0;
+        GLenum type;
+        glGetActiveAttrib( _programID, i, (GLsizei)name.size(), NULL, &size, &type, name.data() );
+        for (int a = 0; a < NUM_SHADER_ATTRIBUTES; ++a) {
+            if (baseName(name.data()) == kAttributeNames[a]) {
+                _attributeLocations[a] = glGetAttribLocation( _programID, name.data() );
+            }
+        }
+    }
+
     return true;
 }
 
+GLint Shader::uniformLocation(const std::string& name) const {
+    std::map<std::string, GLint>::const_iterator it = _activeUniforms.find(name);
+    return it == _activeUniforms.end() ? -1 : it->second;
+}
+
 
 }  // namespace CS248
@@ -6,8 +6,53 @@ using CS248::StaticScene::Scene;
 
 #include "GL/glew.h"
 
+#include <map>
+#include <string>
+#include <vector>
+
 namespace CS248 {
 
+/**
+ * Uniforms the renderer sets on every draw. Their locations are looked up
+ * once, when the program is linked; see Shader::uniformLocation.
+ */
+enum ShaderUniform {
+  UNIFORM_OBJ2WORLD,
+  UNIFORM_OBJ2WORLD_NORM,
+  UNIFORM_VIEW_PROJECTION,
+  UNIFORM_CAMERA_POSITION,
+  UNIFORM_USE_TEXTURE_MAPPING,
+  UNIFORM_USE_NORMAL_MAPPING,
+  UNIFORM_USE_ENVIRONMENT_MAPPING,
+  UNIFORM_USE_BLENDING,
+  UNIFORM_USE_DISNEY_BRDF,
+  UNIFORM_DIFFUSE_TEXTURE,  ///< samplers, in texture unit order
+  UNIFORM_NORMAL_TEXTURE,
+  UNIFORM_ENVIRONMENT_TEXTURE,
+  UNIFORM_BLEND_TEXTURE,
+  UNIFORM_STUB1_TEXTURE,
+  UNIFORM_STUB2_TEXTURE,
+  UNIFORM_STUB3_TEXTURE,
+  UNIFORM_NUM_DIRECTIONAL_LIGHTS,
+  UNIFORM_DIRECTIONAL_LIGHT_VECTORS,
+  UNIFORM_NUM_POINT_LIGHTS,
+  UNIFORM_POINT_LIGHT_POSITIONS,
+  NUM_SHADER_UNIFORMS
+};
+
+/**
+ * Vertex attributes of a mesh, looked up once at link time.
+ */
+enum ShaderAttribute {
+  ATTRIBUTE_POSITION,
+  ATTRIBUTE_DIFFUSE_COLOR,
+  ATTRIBUTE_NORMAL,
+  ATTRIBUTE_TEXCOORD,
+  ATTRIBUTE_TANGENT,
+  ATTRIBUTE_DRAW_ID,  ///< per instance: which ObjectData a multi-draw uses
+  NUM_SHADER_ATTRIBUTES
+};
+
 
 /**
  * A shader
@@ -27,10 +72,49 @@ class Shader {
    */
   ~Shader();
 
+  /**
+   * A program for the given files and prefixes, compiled and linked the
+   * first time it is asked for and shared by everything drawn with it.
+   */
+  static const Shader& shared(const std::string& vertex_shader_filename,
+                              const std::string& fragment_shader_filename,
+                              const std::string& vertex_shader_content_prefix = "",
+                              const std::string& fragment_shader_content_prefix = "");
+
   bool read(std::string filename, std::string& contents);
   bool compileAndAttachShader( GLuint& shaderID, GLenum shaderType, const char* shaderTypeStr, std::string filename, std::string &contents, std::string prefix = "" );
   bool link();
 
+  /**
+   * Location of a well-known uniform, or of element index of a uniform
+   * array; -1 if the program doesn't use it.
+   */
+  GLint uniformLocation(ShaderUniform uniform, size_t index = 0) const {
+    const std::vector<GLint>& locations = _uniformLocations[uniform];
+    return index < locations.size() ? locations[index] : -1;
+  }
+
+  /**
+   * Number of elements of a well-known uniform the program uses: 1 for a
+   * plain uniform, the array size for an array, 0 if it is unused.
+   */
+  size_t uniformSize(ShaderUniform uniform) const {
+    return _uniformLocations[uniform].size();
+  }
+
+  /**
+   * Location of any active uniform by name (arrays by their name without
+   * "[0]"); -1 if the program doesn't use it. Doesn't query GL.
+   */
+  GLint uniformLocation(const std::string& name) const;
+
+  /**
+   * Location of a well-known attribute; -1 if the program doesn't use it.
+   */
+  GLint attributeLocation(ShaderAttribute attribute) const {
+    return _attributeLocations[attribute];
+  }
+
     // contents/filenames for the shaders
     std::string _vertexShaderFilename;
     std::string _vertexShaderString;
@@ -47,6 +131,11 @@ class Shader {
     GLuint _fragmentShaderID;
     GLuint _programID;
 
+    // locations of the active uniforms and attributes, filled in by link()
+    std::map<std::string, GLint> _activeUniforms;
+    std::vector<GLint> _uniformLocations[NUM_SHADER_UNIFORMS];
+    GLint _attributeLocations[NUM_SHADER_ATTRIBUTES];
+
     // where we keep track of the textures and where they are bound
     int _firstAvailableTextureUnit;
     //std::vector<BoundTexture> _boundTextures;
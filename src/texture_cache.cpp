@@ -0,0 +1,113 @@
+#include "texture_cache.h"
+
+#include <cstring>
+#include <fstream>
+
+using namespace std;
+
+namespace CS248 {
+
+TextureCache::Mode TextureCache::mode = TextureCache::READ_WRITE;
+
+namespace {
+
+// Bump whenever the file layout, the encoder's or the mip filters' output
+// changes.
+const uint32_t kVersion = 2;
+const char kMagic[8] = {'C', 'S', '2', '4', '8', 'T', 'E', 'X'};
+
+struct FileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t format;
+  TextureCache::Key key;
+  uint32_t width;
+  uint32_t height;
+  uint32_t num_levels;
+  uint32_t reserved;
+  uint64_t data_size;  ///< bytes of texture data right after the header
+};
+
+bool same_key(const TextureCache::Key& a, const TextureCache::Key& b) {
+  return a.source == b.source && a.format == b.format &&
+         a.mip_filter == b.mip_filter && a.mip_content == b.mip_content;
+}
+
+const char* format_name(TextureFormat format) {
+  switch (format) {
+    case TEXTURE_BC1: return "bc1";
+    case TEXTURE_BC3: return "bc3";
+    case TEXTURE_BC5: return "bc5";
+    default: return "rgba8";
+  }
+}
+
+}  // namespace
+
+bool TextureCache::make_key(const string& source_filename,
+                            const vector<unsigned char>& contents,
+                            TextureFormat format, MipFilter mip_filter,
+                            MipContent mip_content, Key& key) {
+  key.format = format;
+  key.mip_filter = (uint16_t)mip_filter;
+  key.mip_content = (uint16_t)mip_content;
+  return CacheFile::make_source(source_filename, contents.data(),
+                                contents.size(), key.source);
+}
+
+string TextureCache::cache_filename(const string& source_filename,
+                                    TextureFormat format) {
+  return source_filename + "." + format_name(format) + ".texcache";
+}
+
+bool TextureCache::load(const string& filename, const Key& key,
+                        TextureImage& image) {
+  ifstream in(filename, ios::in | ios::binary);
+  if (!in.is_open()) return false;
+
+  FileHeader header;
+  if (!in.read((char*)&header, sizeof(header))) return false;
+  if (memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 ||
+      header.version != kVersion || header.format != key.format ||
+      !same_key(header.key, key)) {
+    return false;
+  }
+  TextureImage cached;
+  cached.width = header.width;
+  cached.height = header.height;
+  cached.num_levels = header.num_levels;
+  cached.format = (TextureFormat)header.format;
+  if (header.num_levels < 1 ||
+      header.num_levels > MipmapBuilder::num_levels(header.width,
+                                                    header.height) ||
+      header.data_size != cached.level_offset(header.num_levels)) {
+    return false;
+  }
+
+  cached.pixels.resize(header.data_size);
+  if (!in.read((char*)cached.pixels.data(), cached.pixels.size())) return false;
+
+  swap(image, cached);
+  return true;
+}
+
+bool TextureCache::store(const string& filename, const Key& key,
+                         const TextureImage& image) {
+  FileHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.format = image.format;
+  header.key = key;
+  header.width = image.width;
+  header.height = image.height;
+  header.num_levels = image.num_levels;
+  header.data_size = image.pixels.size();
+
+  return CacheFile::write(filename, [&](ostream& out) {
+    out.write((const char*)&header, sizeof(header));
+    out.write((const char*)image.pixels.data(), image.pixels.size());
+  });
+}
+
+}  // namespace CS248
@@ -0,0 +1,102 @@
+#ifndef CS248_TEXTURE_CACHE_H
+#define CS248_TEXTURE_CACHE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "block_compressor.h"
+#include "cache_file.h"
+#include "mipmap_builder.h"
+
+namespace CS248 {
+
+/**
+ * An image file decoded (and possibly mipmapped and block-compressed) for
+ * upload.
+ */
+struct TextureImage {
+  std::vector<unsigned char> pixels;  ///< all levels, largest first
+  unsigned width, height;             ///< of level 0
+  unsigned num_levels;
+  TextureFormat format;
+  unsigned error;  ///< lodepng error code, 0 on success
+
+  TextureImage()
+      : width(0), height(0), num_levels(1), format(TEXTURE_RGBA8), error(0) {}
+
+  unsigned level_width(unsigned level) const {
+    return MipmapBuilder::level_size(width, level);
+  }
+  unsigned level_height(unsigned level) const {
+    return MipmapBuilder::level_size(height, level);
+  }
+  size_t level_bytes(unsigned level) const {
+    return BlockCompressor::encoded_size(format, level_width(level),
+                                         level_height(level));
+  }
+  size_t level_offset(unsigned level) const {
+    size_t offset = 0;
+    for (unsigned i = 0; i < level; ++i) offset += level_bytes(i);
+    return offset;
+  }
+};
+
+/**
+ * On-disk cache of processed textures, so that warm starts skip PNG decoding,
+ * mip chain building and block compression. A cache file holds a versioned
+ * header followed by the texture data exactly as it is uploaded, and is
+ * written next to its source image, one per format.
+ */
+class TextureCache {
+ public:
+  enum Mode {
+    READ_WRITE,  ///< use valid cache files, write missing or stale ones
+    BYPASS,      ///< neither read nor write cache files
+    REBUILD      ///< ignore existing cache files and rewrite them
+  };
+
+  static Mode mode;
+
+  /**
+   * Everything a cache file was built from. A file is only used if all
+   * fields match.
+   */
+  struct Key {
+    CacheFile::Source source;
+    uint32_t format;       ///< TextureFormat of the cached data
+    uint16_t mip_filter;   ///< MipFilter the chain was built with
+    uint16_t mip_content;  ///< MipContent it was filtered as
+  };
+
+  /**
+   * Fills in key for a source image whose contents have already been read.
+   */
+  static bool make_key(const std::string& source_filename,
+                       const std::vector<unsigned char>& contents,
+                       TextureFormat format, MipFilter mip_filter,
+                       MipContent mip_content, Key& key);
+
+  /**
+   * Where the cache file for a source and format lives.
+   */
+  static std::string cache_filename(const std::string& source_filename,
+                                    TextureFormat format);
+
+  /**
+   * Reads a cache file. Fails if it is missing, truncated, from another
+   * version, or was built from different inputs.
+   */
+  static bool load(const std::string& filename, const Key& key,
+                   TextureImage& image);
+
+  /**
+   * Writes a cache file; the file is replaced atomically.
+   */
+  static bool store(const std::string& filename, const Key& key,
+                    const TextureImage& image);
+};
+
+}  // namespace CS248
+
+#endif  // CS248_TEXTURE_CACHE_H
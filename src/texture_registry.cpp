@@ -0,0 +1,358 @@
+#include "texture_registry.h"
+
+#include "thread_pool.h"
+
+#include "CS248/lodepng.h"
+#include "CS248/timer.h"
+
+#include <chrono>
+#include <climits>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+
+using namespace std;
+
+namespace CS248 {
+
+bool TextureRegistry::compression = true;
+MipFilter TextureRegistry::mip_filter = MIP_KAISER;
+
+namespace {
+
+// lodepng's error code for a file that can't be read
+const unsigned kFileError = 78;
+
+// Resolves ., .. and symlinks so that different spellings of a path share one
+// registry entry. Falls back to the path as given.
+string canonical_path(const string& filename) {
+#ifdef _WIN32
+  char resolved[_MAX_PATH];
+  if (_fullpath(resolved, filename.c_str(), _MAX_PATH)) return resolved;
+#else
+  char resolved[PATH_MAX];
+  if (realpath(filename.c_str(), resolved)) return resolved;
+#endif
+  return filename;
+}
+
+string image_key(const string& path, TextureFormat format,
+                 MipContent content) {
+  ostringstream key;
+  key << path << '|' << format << '|' << content;
+  return key.str();
+}
+
+string texture_key(const string& path, TextureFormat format,
+                   MipContent content, const TextureSampler& sampler) {
+  ostringstream key;
+  key << image_key(path, format, content) << '|' << sampler.wrap_s << ','
+      << sampler.wrap_t << ',' << sampler.min_filter << ','
+      << sampler.mag_filter;
+  return key.str();
+}
+
+bool gl_supports(TextureFormat format) {
+  switch (format) {
+    case TEXTURE_BC1:
+    case TEXTURE_BC3:
+      return GLEW_EXT_texture_compression_s3tc;
+    case TEXTURE_BC5:
+      return GLEW_ARB_texture_compression_rgtc || GLEW_VERSION_3_0;
+    default:
+      return true;
+  }
+}
+
+GLenum gl_internal_format(TextureFormat format) {
+  switch (format) {
+    case TEXTURE_BC1: return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+    case TEXTURE_BC3: return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    case TEXTURE_BC5: return GL_COMPRESSED_RG_RGTC2;
+    default: return GL_RGB;
+  }
+}
+
+}  // namespace
+
+Texture::~Texture() {
+  if (id) glDeleteTextures(1, &id);
+}
+
+TextureRegistry::TextureRegistry() {
+  counters.hits = 0;
+  counters.misses = 0;
+  counters.decodes = 0;
+  counters.pending = 0;
+  counters.bytes_saved = 0;
+  counters.cache_loads = 0;
+  counters.vram_bytes = 0;
+  counters.rgba8_bytes = 0;
+  counters.encoded_pixels = 0;
+  counters.encode_seconds = 0;
+  counters.mip_pixels = 0;
+  counters.mip_seconds = 0;
+}
+
+TextureRegistry& TextureRegistry::shared() {
+  static TextureRegistry registry;
+  return registry;
+}
+
+TextureFormat TextureRegistry::format_for(TextureUsage usage) {
+  if (!compression) return TEXTURE_RGBA8;
+  switch (usage) {
+    case TEXTURE_COLOR: return TEXTURE_BC1;
+    case TEXTURE_ALPHA: return TEXTURE_BC3;
+    case TEXTURE_NORMAL: return TEXTURE_BC5;
+    default: return TEXTURE_RGBA8;
+  }
+}
+
+MipContent TextureRegistry::content_for(TextureUsage usage) {
+  switch (usage) {
+    case TEXTURE_COLOR:
+    case TEXTURE_ALPHA: return MIP_SRGB;
+    case TEXTURE_NORMAL: return MIP_NORMAL;
+    default: return MIP_LINEAR;
+  }
+}
+
+shared_ptr<const TextureImage> TextureRegistry::load_image(
+    const string& filename, TextureFormat format, MipContent content) {
+  shared_ptr<TextureImage> image = make_shared<TextureImage>();
+
+  vector<unsigned char> png;
+  lodepng::load_file(png, filename);
+  if (png.empty()) {
+    image->error = kFileError;
+    return image;
+  }
+
+  TextureCache::Key key;
+  string cache_filename;
+  bool use_cache = (format != TEXTURE_RGBA8 || mip_filter != MIP_NONE) &&
+                   TextureCache::mode != TextureCache::BYPASS &&
+                   TextureCache::make_key(filename, png, format, mip_filter,
+                                          content, key);
+  if (use_cache) {
+    cache_filename = TextureCache::cache_filename(filename, format);
+    if (TextureCache::mode == TextureCache::READ_WRITE &&
+        TextureCache::load(cache_filename, key, *image)) {
+      lock_guard<std::mutex> lock(mutex);
+      counters.cache_loads++;
+      return image;
+    }
+  }
+
+  vector<unsigned char> rgba;
+  image->error = lodepng::decode(rgba, image->width, image->height, png);
+  if (image->error) return image;
+  if (format == TEXTURE_RGBA8 && mip_filter == MIP_NONE) {
+    image->pixels.swap(rgba);
+    return image;
+  }
+
+  Timer mip_timer;
+  mip_timer.start();
+  vector<vector<unsigned char> > levels;
+  MipmapBuilder::build(rgba.data(), image->width, image->height, mip_filter,
+                       content, levels);
+  mip_timer.stop();
+  levels.insert(levels.begin(), vector<unsigned char>());
+  levels[0].swap(rgba);
+  image->num_levels = (unsigned)levels.size();
+  image->format = format;
+
+  // Encoding to RGBA8 only copies the pixels.
+  Timer encode_timer;
+  encode_timer.start();
+  image->pixels.resize(image->level_offset(image->num_levels));
+  size_t pixels = 0;
+  for (unsigned level = 0; level < image->num_levels; ++level) {
+    unsigned w = image->level_width(level), h = image->level_height(level);
+    BlockCompressor::encode(format, levels[level].data(), w, h,
+                            &image->pixels[image->level_offset(level)]);
+    pixels += (size_t)w * h;
+  }
+  encode_timer.stop();
+  {
+    lock_guard<std::mutex> lock(mutex);
+    if (image->num_levels > 1) {
+      counters.mip_pixels += pixels - (size_t)image->width * image->height;
+      counters.mip_seconds += mip_timer.duration();
+    }
+    if (format != TEXTURE_RGBA8) {
+      counters.encoded_pixels += pixels;
+      counters.encode_seconds += encode_timer.duration();
+    }
+  }
+
+  if (use_cache && !TextureCache::store(cache_filename, key, *image)) {
+    cerr << "Warning: could not write texture cache " << cache_filename
+         << endl;
+  }
+  return image;
+}
+
+TextureRegistry::PendingImage TextureRegistry::find_or_decode(
+    const string& path, const string& filename, TextureFormat format,
+    MipContent content) {
+  string key = image_key(path, format, content);
+  map<string, PendingImage>::iterator it = images.find(key);
+  if (it != images.end()) return it->second;
+
+  PendingImage image =
+      ThreadPool::shared().enqueue([this, filename, format, content]() {
+        return load_image(filename, format, content);
+      }).share();
+  images[key] = image;
+  counters.decodes++;
+  return image;
+}
+
+void TextureRegistry::request(const string& filename, TextureUsage usage) {
+  string path = canonical_path(filename);
+  lock_guard<std::mutex> lock(mutex);
+  find_or_decode(path, filename, format_for(usage), content_for(usage));
+}
+
+shared_ptr<Texture> TextureRegistry::acquire(const string& filename,
+                                             TextureUsage usage,
+                                             const TextureSampler& sampler) {
+  // Fall back to RGBA8 on a GL without the format; whatever the loader
+  // already requested in that format goes unused.
+  TextureFormat format = format_for(usage);
+  if (!gl_supports(format)) format = TEXTURE_RGBA8;
+  MipContent content = content_for(usage);
+
+  string path = canonical_path(filename);
+  string key = texture_key(path, format, content, sampler);
+
+  lock_guard<std::mutex> lock(mutex);
+  map<string, weak_ptr<Texture> >::iterator it = textures.find(key);
+  if (it != textures.end()) {
+    shared_ptr<Texture> texture = it->second.lock();
+    if (texture) {
+      counters.hits++;
+      if (texture->ready) {
+        counters.bytes_saved += (size_t)texture->width * texture->height * 4;
+      } else {
+        texture->shares++;
+      }
+      return texture;
+    }
+  }
+
+  PendingUpload upload;
+  upload.image = find_or_decode(path, filename, format, content);
+  upload.filename = filename;
+  upload.image_key = image_key(path, format, content);
+
+  // a flat normal for normal maps, white for everything else
+  unsigned char color[4] = {255, 255, 255, 255};
+  if (usage == TEXTURE_NORMAL) color[0] = color[1] = 128;
+
+  shared_ptr<Texture> texture(new Texture());
+  glGenTextures(1, &texture->id);
+  glBindTexture(GL_TEXTURE_2D, texture->id);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE,
+               color);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, sampler.wrap_s);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, sampler.wrap_t);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, sampler.min_filter);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, sampler.mag_filter);
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  upload.texture = texture;
+  textures[key] = texture;
+  pending.push_back(upload);
+  counters.misses++;
+  return texture;
+}
+
+size_t TextureRegistry::upload_pending(size_t budget_bytes) {
+  // Pick the uploads for this frame, and forget textures nobody uses anymore.
+  vector<PendingUpload> uploads;
+  {
+    lock_guard<std::mutex> lock(mutex);
+    size_t bytes = 0;
+    size_t kept = 0;
+    for (size_t i = 0; i < pending.size(); ++i) {
+      if (pending[i].texture.expired()) continue;
+      bool take = false;
+      if ((uploads.empty() || bytes < budget_bytes) &&
+          pending[i].image.wait_for(chrono::seconds(0)) == future_status::ready) {
+        size_t size = pending[i].image.get()->pixels.size();
+        if (uploads.empty() || bytes + size <= budget_bytes) {
+          bytes += size;
+          take = true;
+        }
+      }
+      if (take) {
+        uploads.push_back(pending[i]);
+      } else {
+        pending[kept++] = pending[i];
+      }
+    }
+    pending.resize(kept);
+  }
+
+  for (size_t i = 0; i < uploads.size(); ++i) {
+    shared_ptr<Texture> texture = uploads[i].texture.lock();
+    const TextureImage& image = *uploads[i].image.get();
+    if (image.error) {
+      cerr << "Texture loading error = " << uploads[i].filename << endl;
+      texture->error = image.error;
+    } else {
+      glBindTexture(GL_TEXTURE_2D, texture->id);
+      for (unsigned level = 0; level < image.num_levels; ++level) {
+        GLsizei w = image.level_width(level), h = image.level_height(level);
+        const unsigned char* data = &image.pixels[image.level_offset(level)];
+        if (image.format == TEXTURE_RGBA8) {
+          glTexImage2D(GL_TEXTURE_2D, level, GL_RGB, w, h, 0, GL_RGBA,
+                       GL_UNSIGNED_BYTE, data);
+        } else {
+          glCompressedTexImage2D(GL_TEXTURE_2D, level,
+                                 gl_internal_format(image.format), w, h, 0,
+                                 (GLsizei)image.level_bytes(level), data);
+        }
+      }
+      // With a single level, the mipmapped min filter still samples level 0.
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL,
+                      image.num_levels - 1);
+      texture->width = image.width;
+      texture->height = image.height;
+      texture->num_levels = image.num_levels;
+      texture->format = image.format;
+      texture->ready = true;
+    }
+
+    lock_guard<std::mutex> lock(mutex);
+    if (texture->ready) {
+      size_t rgba8_bytes = 0;
+      for (unsigned level = 0; level < image.num_levels; ++level) {
+        rgba8_bytes += (size_t)image.level_width(level) *
+                       image.level_height(level) * 4;
+      }
+      counters.bytes_saved += texture->shares * rgba8_bytes;
+      counters.vram_bytes += image.pixels.size();
+      counters.rgba8_bytes += rgba8_bytes;
+    }
+    texture->shares = 0;
+    // the pixels live in VRAM now
+    images.erase(uploads[i].image_key);
+  }
+  if (!uploads.empty()) glBindTexture(GL_TEXTURE_2D, 0);
+  return uploads.size();
+}
+
+TextureRegistry::Stats TextureRegistry::stats() const {
+  lock_guard<std::mutex> lock(mutex);
+  Stats stats = counters;
+  stats.pending = pending.size();
+  return stats;
+}
+
+}  // namespace CS248
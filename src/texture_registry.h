@@ -0,0 +1,167 @@
+#ifndef CS248_TEXTURE_REGISTRY_H
+#define CS248_TEXTURE_REGISTRY_H
+
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "GL/glew.h"
+
+#include "texture_cache.h"
+
+namespace CS248 {
+
+/**
+ * Sampler state a texture is created with. Textures with the same image but
+ * different samplers are separate GL objects.
+ */
+struct TextureSampler {
+  GLint wrap_s, wrap_t;
+  GLint min_filter, mag_filter;
+
+  TextureSampler()
+      : wrap_s(GL_REPEAT), wrap_t(GL_REPEAT),
+        min_filter(GL_LINEAR_MIPMAP_LINEAR), mag_filter(GL_LINEAR) {}
+};
+
+/**
+ * What a texture holds, which decides how it is mipmapped and compressed.
+ */
+enum TextureUsage {
+  TEXTURE_COLOR,   ///< opaque sRGB color (diffuse, environment): BC1
+  TEXTURE_ALPHA,   ///< sRGB color with alpha (blend maps): BC3
+  TEXTURE_NORMAL,  ///< tangent-space normals: BC5, the shader rebuilds z
+  TEXTURE_DATA     ///< anything else: filtered as stored, uncompressed
+};
+
+/**
+ * A GL texture shared by every mesh that uses the same image and sampler.
+ * It holds a 1x1 placeholder until its image has been decoded and uploaded;
+ * the id stays the same. The GL object is deleted when the last reference
+ * goes away.
+ */
+class Texture {
+ public:
+  ~Texture();
+
+  GLuint id;
+  unsigned width, height;
+  unsigned num_levels;
+  TextureFormat format;
+  bool ready;      ///< false while the placeholder is shown
+  unsigned error;  ///< decode error, the placeholder stays if nonzero
+
+ private:
+  friend class TextureRegistry;
+  Texture()
+      : id(0), width(1), height(1), num_levels(1), format(TEXTURE_RGBA8),
+        ready(false), error(0), shares(0) {}
+
+  size_t shares;  ///< registry hits while the image was still pending
+};
+
+/**
+ * Process-wide registry of textures, keyed by canonical file path, format and
+ * sampler settings, so that an image referenced by many meshes is decoded once
+ * and lives in VRAM once.
+ *
+ * Images are decoded, mipmapped and block-compressed according to their usage
+ * on the shared ThreadPool; the results go through the TextureCache.
+ * acquire() returns at once with a placeholder; upload_pending(), called once
+ * per frame, uploads the images that have finished decoding. request() may
+ * be called from any thread (the scene loader starts decodes while it parses
+ * meshes); everything else must be called on the GL thread.
+ */
+class TextureRegistry {
+ public:
+  struct Stats {
+    size_t hits;        ///< acquire() calls served by an existing texture
+    size_t misses;      ///< acquire() calls that created a texture
+    size_t decodes;     ///< images decoded or being decoded
+    size_t pending;     ///< textures still showing their placeholder
+    size_t bytes_saved; ///< decoded bytes not decoded or uploaded again
+    size_t cache_loads; ///< images read from the TextureCache
+    size_t vram_bytes;  ///< texture data uploaded
+    size_t rgba8_bytes; ///< what the same textures take uncompressed
+    size_t encoded_pixels;  ///< pixels block-compressed
+    double encode_seconds;  ///< time spent compressing them
+    size_t mip_pixels;      ///< pixels of the mip levels built
+    double mip_seconds;     ///< time spent building them
+  };
+
+  /**
+   * Whether textures are block-compressed (where the GL supports the
+   * format). Set before the first request.
+   */
+  static bool compression;
+
+  /**
+   * Filter mip chains are built with; MIP_NONE uploads only the full-size
+   * image. Set before the first request.
+   */
+  static MipFilter mip_filter;
+
+  static TextureRegistry& shared();
+
+  /**
+   * Starts decoding an image in the background, unless it is already
+   * decoding or decoded.
+   */
+  void request(const std::string& filename, TextureUsage usage = TEXTURE_COLOR);
+
+  /**
+   * Returns the texture for a file, usage and sampler, creating it (filled
+   * with a placeholder that suits the usage) and requesting its image on
+   * first use.
+   */
+  std::shared_ptr<Texture> acquire(const std::string& filename,
+                                   TextureUsage usage = TEXTURE_COLOR,
+                                   const TextureSampler& sampler = TextureSampler());
+
+  /**
+   * Uploads decoded images into their textures, oldest first, until about
+   * budget_bytes have been uploaded. At least one image is uploaded if one is
+   * ready, however large. Returns the number of textures uploaded.
+   */
+  size_t upload_pending(size_t budget_bytes);
+
+  Stats stats() const;
+
+ private:
+  TextureRegistry();
+
+  typedef std::shared_future<std::shared_ptr<const TextureImage> > PendingImage;
+
+  struct PendingUpload {
+    std::weak_ptr<Texture> texture;
+    PendingImage image;
+    std::string filename;
+    std::string image_key;  ///< in images
+  };
+
+  static TextureFormat format_for(TextureUsage usage);
+  static MipContent content_for(TextureUsage usage);
+
+  // Reads, decodes, mipmaps and compresses an image; runs on the thread pool.
+  std::shared_ptr<const TextureImage> load_image(const std::string& filename,
+                                                 TextureFormat format,
+                                                 MipContent content);
+
+  // Expects mutex to be held.
+  PendingImage find_or_decode(const std::string& path,
+                              const std::string& filename,
+                              TextureFormat format, MipContent content);
+
+  mutable std::mutex mutex;
+  std::map<std::string, PendingImage> images;  ///< by path, format and content
+  std::map<std::string, std::weak_ptr<Texture> > textures;  ///< by path and sampler
+  std::vector<PendingUpload> pending;  ///< in acquire() order
+  Stats counters;
+};
+
+}  // namespace CS248
+
+#endif  // CS248_TEXTURE_REGISTRY_H
@@ -0,0 +1,99 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+
+using namespace std;
+
+namespace CS248 {
+
+ThreadPool::ThreadPool(size_t num_threads) : stopping(false) {
+  if (num_threads == 0) {
+    num_threads = max(1u, thread::hardware_concurrency());
+  }
+  for (size_t i = 0; i < num_threads; ++i) {
+    workers.push_back(thread(&ThreadPool::worker_loop, this));
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  cv.notify_all();
+  for (thread& worker : workers) worker.join();
+}
+
+ThreadPool& ThreadPool::shared() {
+  static ThreadPool pool;
+  return pool;
+}
+
+void ThreadPool::push(function<void()> task) {
+  {
+    lock_guard<std::mutex> lock(mutex);
+    tasks.push(std::move(task));
+  }
+  cv.notify_one();
+}
+
+void ThreadPool::worker_loop() {
+  while (true) {
+    function<void()> task;
+    {
+      unique_lock<std::mutex> lock(mutex);
+      cv.wait(lock, [this]() { return stopping || !tasks.empty(); });
+      if (tasks.empty()) return;
+      task = std::move(tasks.front());
+      tasks.pop();
+    }
+    task();
+  }
+}
+
+void ThreadPool::parallel_for(size_t count, const function<void(size_t)>& body,
+                              size_t max_threads) {
+  if (count == 0) return;
+
+  size_t helpers = min(count, size() + 1) - 1;
+  if (max_threads) helpers = min(helpers, max_threads - 1);
+  if (helpers == 0) {
+    for (size_t i = 0; i < count; ++i) body(i);
+    return;
+  }
+
+  // Indices are handed out through a shared counter. The caller takes part
+  // too and only waits for indices that were actually claimed, so a nested
+  // call from a busy pool can't deadlock: helpers that start late find no
+  // work left and return straight away.
+  struct State {
+    atomic<size_t> next;
+    size_t done;
+    std::mutex mutex;
+    condition_variable cv;
+  };
+  shared_ptr<State> state = make_shared<State>();
+  state->next = 0;
+  state->done = 0;
+
+  auto run = [state, count, &body]() {
+    size_t finished = 0;
+    for (size_t i; (i = state->next++) < count; ++finished) body(i);
+    if (finished) {
+      lock_guard<std::mutex> lock(state->mutex);
+      state->done += finished;
+      if (state->done == count) state->cv.notify_all();
+    }
+  };
+
+  // body stays alive until every claimed index is finished, and late helpers
+  // never touch it, so capturing it by reference is safe.
+  for (size_t i = 0; i < helpers; ++i) push(run);
+  run();
+
+  unique_lock<std::mutex> lock(state->mutex);
+  state->cv.wait(lock, [&]() { return state->done == count; });
+}
+
+}  // namespace CS248
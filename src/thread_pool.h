@@ -0,0 +1,78 @@
+#ifndef CS248_THREAD_POOL_H
+#define CS248_THREAD_POOL_H
+
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+namespace CS248 {
+
+/**
+ * Fixed-size pool of worker threads.
+ * Tasks are run in FIFO order. enqueue() hands back a future for the task's
+ * result; parallel_for() splits an index range across the workers and the
+ * calling thread, and is safe to call from inside a task.
+ */
+class ThreadPool {
+ public:
+  /**
+   * Starts num_threads workers. Zero means one per hardware thread.
+   */
+  explicit ThreadPool(size_t num_threads = 0);
+
+  /**
+   * Finishes every queued task, then joins the workers.
+   */
+  ~ThreadPool();
+
+  /**
+   * Process-wide pool, created on first use.
+   */
+  static ThreadPool& shared();
+
+  /**
+   * Number of worker threads.
+   */
+  size_t size() const { return workers.size(); }
+
+  /**
+   * Queues f to run on a worker and returns a future for its result.
+   * Exceptions thrown by f are rethrown from future::get().
+   */
+  template <typename F>
+  std::future<typename std::result_of<F()>::type> enqueue(F f) {
+    typedef typename std::result_of<F()>::type R;
+    std::shared_ptr<std::packaged_task<R()> > task =
+        std::make_shared<std::packaged_task<R()> >(f);
+    std::future<R> result = task->get_future();
+    push([task]() { (*task)(); });
+    return result;
+  }
+
+  /**
+   * Calls body(i) for every i in [0, count) and returns when all calls are
+   * done. At most max_threads threads (the caller included) run the body at
+   * once; zero means no limit beyond the pool size. body must not throw.
+   */
+  void parallel_for(size_t count, const std::function<void(size_t)>& body,
+                    size_t max_threads = 0);
+
+ private:
+  void push(std::function<void()> task);
+  void worker_loop();
+
+  std::vector<std::thread> workers;
+  std::queue<std::function<void()> > tasks;
+  std::mutex mutex;
+  std::condition_variable cv;
+  bool stopping;
+};
+
+}  // namespace CS248
+
+#endif  // CS248_THREAD_POOL_H
@@ -0,0 +1,111 @@
+#ifndef CS248_UNIFORM_BLOCKS_H
+#define CS248_UNIFORM_BLOCKS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "GL/glew.h"
+
+namespace CS248 {
+
+/**
+ * Most directional and most point lights a scene can have; MAX_NUM_LIGHTS in
+ * the shaders.
+ */
+const int kMaxLights = 64;
+
+/**
+ * Most draws one multi-draw call can make, each with its own ObjectData;
+ * MAX_DRAWS in the shaders. The array of them must fit the 16 KB every
+ * implementation allows a uniform block.
+ */
+const int kMaxDrawsPerCall = 64;
+
+/**
+ * Binding points of the uniform blocks shared by all programs.
+ */
+enum UniformBlockBinding {
+  FRAME_DATA_BINDING = 0,
+  OBJECT_DATA_BINDING = 1
+};
+
+/**
+ * The FrameData uniform block, laid out as std140: what is the same for
+ * every mesh in a frame. Filled once per frame by the scene.
+ */
+struct FrameData {
+  float camera_position[3];
+  int32_t num_directional_lights;
+  int32_t num_point_lights;
+  int32_t padding[3];
+  float directional_light_vectors[kMaxLights][4];  ///< vec3, padded by std140
+  float point_light_positions[kMaxLights][4];
+  float view_projection[16];  ///< world to clip space, column-major
+};
+
+/**
+ * The ObjectData uniform block, laid out as std140: the transforms and
+ * material flags of one mesh. Each mesh keeps its own buffer and rewrites it
+ * only when something changes.
+ */
+struct ObjectData {
+  float obj2world[16];       ///< stored positions to world space, with
+                             ///< VertexFormat's quantization undone
+  float obj2world_norm[12];  ///< mat3, as three vec4 columns
+  int32_t use_texture_mapping;
+  int32_t use_normal_mapping;
+  int32_t use_environment_mapping;
+  int32_t use_blending;
+  int32_t use_disney_brdf;
+  int32_t padding[3];
+};
+
+static_assert(offsetof(FrameData, num_point_lights) == 16 &&
+              offsetof(FrameData, directional_light_vectors) == 32 &&
+              offsetof(FrameData, point_light_positions) ==
+                  32 + 16 * kMaxLights &&
+              offsetof(FrameData, view_projection) == 32 + 32 * kMaxLights,
+              "FrameData must match its std140 layout");
+static_assert(offsetof(ObjectData, obj2world_norm) == 64 &&
+              offsetof(ObjectData, use_texture_mapping) == 112 &&
+              sizeof(ObjectData) % 16 == 0,
+              "ObjectData must match its std140 layout");
+static_assert(kMaxDrawsPerCall * sizeof(ObjectData) <= 16384,
+              "ObjectDataArray must fit the smallest uniform block size");
+
+/**
+ * Whether the GL has uniform blocks. Without them the shaders fall back to
+ * plain uniforms, which are set for every mesh.
+ */
+inline bool uniform_blocks_supported() {
+  return GLEW_ARB_uniform_buffer_object;
+}
+
+/**
+ * Prepended to shaders so that they read the uniform blocks.
+ */
+const char* const kUniformBlocksShaderPrefix =
+    "#extension GL_ARB_uniform_buffer_object : require\n"
+    "#define USE_UNIFORM_BLOCKS\n";
+
+/**
+ * Whether the GL can draw many meshes with one glMultiDrawElementsIndirect,
+ * or a single command with glDrawElementsInstancedBaseVertexBaseInstance.
+ * Each draw then finds its ObjectData in an array indexed by a per-instance
+ * draw ID attribute, which baseInstance sets per command.
+ */
+inline bool multi_draw_supported() {
+  return uniform_blocks_supported() && GLEW_ARB_draw_indirect &&
+         GLEW_ARB_multi_draw_indirect && GLEW_ARB_base_instance &&
+         GLEW_ARB_instanced_arrays;
+}
+
+/**
+ * Prepended, after kUniformBlocksShaderPrefix, to shaders drawn with
+ * multi-draw calls.
+ */
+const char* const kMultiDrawShaderPrefix = "#define USE_MULTI_DRAW\n";
+
+}  // namespace CS248
+
+#endif  // CS248_UNIFORM_BLOCKS_H
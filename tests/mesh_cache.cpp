@@ -0,0 +1,96 @@
+#include "dynamic_scene/mesh_buffers.h"
+#include "dynamic_scene/mesh_cache.h"
+#include "test_harness.h"
+
+#include <stdio.h>
+#include <string.h>
+
+using namespace CS248;
+using namespace CS248::DynamicScene;
+
+// Checks that a mesh loaded from its cache file has exactly the same vertex
+// and index streams as one built from the OBJ.
+
+static const char* kCacheFile = "mesh_cache_test.meshcache";
+
+static bool same_stream(const char* name, const void* a, const void* b,
+                        size_t bytes) {
+  if ((a == NULL) != (b == NULL) || (bytes && memcmp(a, b, bytes) != 0)) {
+    fprintf(stderr, "  %s differ\n", name);
+    return false;
+  }
+  return true;
+}
+
+static bool test_file(const Test::ObjFile& obj, std::string& summary) {
+  MeshBuffers uncached;
+  MeshBuffers::build(obj.polymesh, uncached);
+
+  MeshCache::Key key;
+  if (!MeshCache::make_key(obj.filename, obj.data, key)) {
+    fprintf(stderr, "Error: could not stat %s\n", obj.filename);
+    return false;
+  }
+  key.inputs_hash = CacheFile::hash(obj.filename, strlen(obj.filename));
+
+  if (!MeshCache::store(kCacheFile, key, uncached)) {
+    fprintf(stderr, "Error: could not write %s\n", kCacheFile);
+    return false;
+  }
+
+  MeshBuffers cached;
+  if (!MeshCache::load(kCacheFile, key, cached)) {
+    fprintf(stderr, "Error: could not load %s\n", kCacheFile);
+    return false;
+  }
+
+  size_t n = uncached.num_vertices;
+  bool ok = cached.num_vertices == n &&
+            cached.num_indices == uncached.num_indices &&
+            cached.num_lods == uncached.num_lods &&
+            cached.num_lod_indices == uncached.num_lod_indices &&
+            cached.num_clusters == uncached.num_clusters;
+  if (!ok) fprintf(stderr, "  vertex or index counts differ\n");
+  if (ok) {
+    ok &= same_stream("positions", uncached.positions, cached.positions,
+                      n * sizeof(Vector3Df));
+    ok &= same_stream("normals", uncached.normals, cached.normals,
+                      n * sizeof(Vector3Df));
+    ok &= same_stream("texcoords", uncached.texcoords, cached.texcoords,
+                      uncached.texcoords ? n * sizeof(Vector2Df) : 0);
+    ok &= same_stream("tangents", uncached.tangents, cached.tangents,
+                      n * sizeof(Vector3Df));
+    ok &= same_stream("diffuse colors", uncached.diffuse_colors,
+                      cached.diffuse_colors, n * sizeof(Vector3Df));
+    ok &= same_stream("indices", uncached.indices, cached.indices,
+                      uncached.num_indices * sizeof(uint32_t));
+    ok &= same_stream("levels of detail", uncached.lods, cached.lods,
+                      sizeof(uncached.lods));
+    ok &= same_stream("lod indices", uncached.lod_indices, cached.lod_indices,
+                      uncached.num_lod_indices * sizeof(uint32_t));
+    ok &= same_stream("clusters", uncached.clusters, cached.clusters,
+                      uncached.num_clusters * sizeof(MeshBuffers::Cluster));
+    ok &= same_stream("bounds", &uncached.bbox_min, &cached.bbox_min,
+                      sizeof(Vector3Df));
+    ok &= same_stream("bounds", &uncached.bbox_max, &cached.bbox_max,
+                      sizeof(Vector3Df));
+  }
+
+  // a changed source must not hit the old file
+  MeshCache::Key stale = key;
+  stale.source.hash ^= 1;
+  MeshBuffers rejected;
+  if (MeshCache::load(kCacheFile, stale, rejected)) {
+    fprintf(stderr, "  stale cache file was accepted\n");
+    ok = false;
+  }
+
+  remove(kCacheFile);
+  summary = Test::format("%zu vertices, %zu indices", n,
+                         uncached.num_indices);
+  return ok;
+}
+
+int main(int argc, char* argv[]) {
+  return Test::run_obj_files(argc, argv, test_file);
+}
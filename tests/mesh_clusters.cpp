@@ -0,0 +1,170 @@
+#include "camera.h"
+#include "dynamic_scene/mesh_buffers.h"
+#include "dynamic_scene/mesh_clusters.h"
+#include "test_harness.h"
+
+#include <math.h>
+#include <stdio.h>
+
+#include <vector>
+
+using namespace CS248;
+using namespace CS248::DynamicScene;
+
+// Checks that a mesh's clusters cover its triangles in order, that their
+// bounds hold their vertices and normals, and that what culling rejects from
+// a few views around the mesh is really outside the view or facing away.
+
+static Vector3Df normal(const MeshBuffers& buffers, const uint32_t* tri) {
+  const Vector3Df &a = buffers.positions[tri[0]],
+                  &b = buffers.positions[tri[1]],
+                  &c = buffers.positions[tri[2]];
+  Vector3Df u = {b.x - a.x, b.y - a.y, b.z - a.z};
+  Vector3Df v = {c.x - a.x, c.y - a.y, c.z - a.z};
+  Vector3Df n = {u.y * v.z - u.z * v.y, u.z * v.x - u.x * v.z,
+                 u.x * v.y - u.y * v.x};
+  float length = sqrtf(n.x * n.x + n.y * n.y + n.z * n.z);
+  if (length > 0) {
+    n.x /= length;
+    n.y /= length;
+    n.z /= length;
+  }
+  return n;
+}
+
+static bool check_bounds(const MeshBuffers& buffers, float size) {
+  uint32_t next = 0;
+  float eps = size * 1e-5f;
+  for (size_t c = 0; c < buffers.num_clusters; ++c) {
+    const MeshBuffers::Cluster& cluster = buffers.clusters[c];
+    if (cluster.first_index != next || cluster.num_indices == 0 ||
+        cluster.num_indices % 3 != 0 ||
+        cluster.num_indices > MeshClusters::kMaxTriangles * 3) {
+      fprintf(stderr, "  cluster %zu: %u indices from %u\n", c,
+              cluster.num_indices, cluster.first_index);
+      return false;
+    }
+    next += cluster.num_indices;
+
+    const Vector3Df &lo = cluster.bbox_min, &hi = cluster.bbox_max;
+    float center[3] = {(lo.x + hi.x) / 2, (lo.y + hi.y) / 2,
+                       (lo.z + hi.z) / 2};
+    for (uint32_t i = 0; i < cluster.num_indices; ++i) {
+      const uint32_t* tri =
+          &buffers.indices[cluster.first_index + i / 3 * 3];
+      const Vector3Df& p = buffers.positions[tri[i % 3]];
+      float dx = p.x - center[0], dy = p.y - center[1], dz = p.z - center[2];
+      if (p.x < lo.x || p.y < lo.y || p.z < lo.z || p.x > hi.x ||
+          p.y > hi.y || p.z > hi.z ||
+          sqrtf(dx * dx + dy * dy + dz * dz) > cluster.radius + eps) {
+        fprintf(stderr, "  cluster %zu: vertex %u out of bounds\n", c,
+                tri[i % 3]);
+        return false;
+      }
+      if (i % 3 != 0 || cluster.cone_cutoff <= 0) continue;
+      Vector3Df n = normal(buffers, tri);
+      if (n.x == 0 && n.y == 0 && n.z == 0) continue;
+      const Vector3Df& axis = cluster.cone_axis;
+      if (n.x * axis.x + n.y * axis.y + n.z * axis.z <
+          cluster.cone_cutoff - 1e-4f) {
+        fprintf(stderr, "  cluster %zu: triangle %u outside the cone\n", c,
+                i / 3);
+        return false;
+      }
+    }
+  }
+  if (next != buffers.num_indices) {
+    fprintf(stderr, "  clusters cover %u of %zu indices\n", next,
+            buffers.num_indices);
+    return false;
+  }
+  return true;
+}
+
+// Whether cull() had a reason to reject a cluster: all of its vertices
+// behind one frustum plane, or all of its triangles facing away.
+static bool rejection_holds(const MeshBuffers& buffers,
+                            const MeshClusters::View& view,
+                            const MeshBuffers::Cluster& cluster,
+                            uint8_t result, float size) {
+  float eps = size * 1e-4f;
+  const uint32_t* begin = buffers.indices + cluster.first_index;
+  const uint32_t* end = begin + cluster.num_indices;
+  if (result == MeshClusters::OUTSIDE) {
+    for (int k = 0; k < 6; ++k) {
+      const float* plane = view.planes[k];
+      bool behind = true;
+      for (const uint32_t* i = begin; behind && i != end; ++i) {
+        const Vector3Df& p = buffers.positions[*i];
+        behind = plane[0] * p.x + plane[1] * p.y + plane[2] * p.z + plane[3] <
+                 eps;
+      }
+      if (behind) return true;
+    }
+    return false;
+  }
+  if (result == MeshClusters::BACKFACING) {
+    for (const uint32_t* tri = begin; tri != end; tri += 3) {
+      Vector3Df n = normal(buffers, tri);
+      const Vector3Df& p = buffers.positions[tri[0]];
+      if (n.x * (p.x - view.eye[0]) + n.y * (p.y - view.eye[1]) +
+              n.z * (p.z - view.eye[2]) < -eps) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+static bool test_file(const Test::ObjFile& obj, std::string& summary) {
+  MeshBuffers buffers;
+  MeshBuffers::build(obj.polymesh, buffers);
+
+  const Vector3Df &lo = buffers.bbox_min, &hi = buffers.bbox_max;
+  Vector3D center((lo.x + hi.x) / 2, (lo.y + hi.y) / 2, (lo.z + hi.z) / 2);
+  float size = (Vector3D(hi.x, hi.y, hi.z) - center).norm();
+  bool ok = buffers.num_clusters > 0 && check_bounds(buffers, size);
+
+  // Look at the mesh from all around, close enough that parts of it are
+  // out of view.
+  Collada::CameraInfo info;
+  info.hFov = 50;
+  info.vFov = 35;
+  info.nClip = 0.01f * size;
+  info.fClip = 100 * size;
+  Camera camera;
+  camera.configure(info, 800, 600);
+  float identity[16] = {1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1};
+  ClusterBatch batch;
+  batch.assign(buffers.clusters, buffers.num_clusters);
+  std::vector<uint8_t> results(buffers.num_clusters);
+  size_t tested = 0, rejected = 0;
+  for (int view_index = 0; ok && view_index < 8; ++view_index) {
+    camera.place(center, 0.8 * view_index, 0.3 + 0.3 * (view_index % 3),
+                 1.5 * size, 0, 1000 * size);
+    MeshClusters::View view = MeshClusters::make_view(
+        camera, identity, buffers.bbox_min, buffers.bbox_max, true);
+    MeshClusters::cull(view, batch, 0, batch.size(), results.data());
+    for (size_t c = 0; ok && c < buffers.num_clusters; ++c) {
+      const MeshBuffers::Cluster& cluster = buffers.clusters[c];
+      tested += cluster.num_indices / 3;
+      if (results[c] != MeshClusters::VISIBLE) {
+        rejected += cluster.num_indices / 3;
+      }
+      if (!rejection_holds(buffers, view, cluster, results[c], size)) {
+        fprintf(stderr, "  view %d: cluster %zu wrongly rejected (%d)\n",
+                view_index, c, results[c]);
+        ok = false;
+      }
+    }
+  }
+
+  summary = Test::format("%zu triangles in %zu clusters, %.0f%% culled",
+                         buffers.num_indices / 3, buffers.num_clusters,
+                         tested ? 100.0 * rejected / tested : 0.0);
+  return ok;
+}
+
+int main(int argc, char* argv[]) {
+  return Test::run_obj_files(argc, argv, test_file);
+}
@@ -0,0 +1,97 @@
+#include "dynamic_scene/mesh_buffers.h"
+#include "dynamic_scene/mesh_optimizer.h"
+#include "test_harness.h"
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <array>
+#include <vector>
+
+using namespace CS248;
+using namespace CS248::DynamicScene;
+
+// Checks that optimizing a mesh keeps every triangle, with its winding, and
+// never makes the vertex cache less effective.
+
+typedef std::array<Vector3Df, 3> Triangle;
+
+// The triangles by their positions, each starting at its smallest corner so
+// that rotating the corners doesn't matter, in sorted order.
+static std::vector<Triangle> triangles(const MeshBuffers& buffers) {
+  std::vector<Triangle> result;
+  for (size_t i = 0; i + 3 <= buffers.num_indices; i += 3) {
+    Triangle t;
+    for (int j = 0; j < 3; ++j) t[j] = buffers.positions[buffers.indices[i + j]];
+    auto less = [](const Vector3Df& a, const Vector3Df& b) {
+      return a.x < b.x || (a.x == b.x && (a.y < b.y || (a.y == b.y && a.z < b.z)));
+    };
+    std::rotate(t.begin(), std::min_element(t.begin(), t.end(), less), t.end());
+    result.push_back(t);
+  }
+  std::sort(result.begin(), result.end(),
+            [](const Triangle& a, const Triangle& b) {
+              for (int j = 0; j < 3; ++j) {
+                if (a[j].x != b[j].x) return a[j].x < b[j].x;
+                if (a[j].y != b[j].y) return a[j].y < b[j].y;
+                if (a[j].z != b[j].z) return a[j].z < b[j].z;
+              }
+              return false;
+            });
+  return result;
+}
+
+static bool same(const Vector3Df& a, const Vector3Df& b) {
+  return a.x == b.x && a.y == b.y && a.z == b.z;
+}
+
+static bool test_file(const Test::ObjFile& obj, std::string& summary) {
+  MeshOptimizer::enabled = false;
+  MeshBuffers original;
+  MeshBuffers::build(obj.polymesh, original);
+  MeshOptimizer::enabled = true;
+  MeshBuffers optimized;
+  MeshBuffers::build(obj.polymesh, optimized);
+
+  bool ok = optimized.num_vertices == original.num_vertices &&
+            optimized.num_indices == original.num_indices;
+  if (!ok) fprintf(stderr, "  vertex or index counts differ\n");
+
+  if (ok) {
+    std::vector<Triangle> a = triangles(original), b = triangles(optimized);
+    for (size_t i = 0; i < a.size() && ok; ++i) {
+      ok = same(a[i][0], b[i][0]) && same(a[i][1], b[i][1]) &&
+           same(a[i][2], b[i][2]);
+    }
+    if (!ok) fprintf(stderr, "  triangles differ\n");
+  }
+
+  // vertices come in the order the triangles first use them
+  uint32_t next = 0;
+  for (size_t i = 0; i < optimized.num_indices && ok; ++i) {
+    if (optimized.indices[i] > next) {
+      fprintf(stderr, "  vertex %u used before vertex %u\n",
+              optimized.indices[i], next);
+      ok = false;
+    } else if (optimized.indices[i] == next) {
+      next++;
+    }
+  }
+
+  MeshOptimizer::CacheStats before = MeshOptimizer::analyze(
+      original.indices, original.num_indices, original.num_vertices);
+  MeshOptimizer::CacheStats after = MeshOptimizer::analyze(
+      optimized.indices, optimized.num_indices, optimized.num_vertices);
+  if (after.acmr > before.acmr) {
+    fprintf(stderr, "  ACMR went from %.3f to %.3f\n", before.acmr,
+            after.acmr);
+    ok = false;
+  }
+
+  summary = Test::format("ACMR %.3f -> %.3f", before.acmr, after.acmr);
+  return ok;
+}
+
+int main(int argc, char* argv[]) {
+  return Test::run_obj_files(argc, argv, test_file);
+}
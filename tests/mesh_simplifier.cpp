@@ -0,0 +1,57 @@
+#include "dynamic_scene/mesh_buffers.h"
+#include "dynamic_scene/mesh_simplifier.h"
+#include "test_harness.h"
+
+#include <math.h>
+#include <stdio.h>
+
+#include <vector>
+
+using namespace CS248;
+using namespace CS248::DynamicScene;
+
+// Checks that each level of detail of a mesh has fewer triangles than the
+// one before, only uses the mesh's vertices, and claims a bounded error.
+
+static bool test_file(const Test::ObjFile& obj, std::string& summary) {
+  MeshBuffers buffers;
+  MeshBuffers::build(obj.polymesh, buffers);
+
+  bool ok = buffers.num_lods <= MeshBuffers::kMaxLods;
+  size_t previous = buffers.num_indices;
+  float previous_error = 0;
+  for (size_t l = 0; ok && l < buffers.num_lods; ++l) {
+    const MeshBuffers::Lod& lod = buffers.lods[l];
+    if (lod.num_indices % 3 != 0 || lod.num_indices >= previous ||
+        lod.num_indices < MeshSimplifier::kMinTriangles * 3 ||
+        lod.first_index + lod.num_indices > buffers.num_lod_indices ||
+        lod.error < previous_error || !(lod.error <= 0.1f + 1e-4f)) {
+      fprintf(stderr, "  level %zu: %u indices from %u, error %g\n", l,
+              lod.num_indices, lod.first_index, lod.error);
+      ok = false;
+      break;
+    }
+    for (uint32_t i = 0; i < lod.num_indices; ++i) {
+      const uint32_t* tri = &buffers.lod_indices[lod.first_index + i / 3 * 3];
+      if (tri[i % 3] >= buffers.num_vertices || tri[0] == tri[1] ||
+          tri[1] == tri[2] || tri[2] == tri[0]) {
+        fprintf(stderr, "  level %zu: bad triangle %u\n", l, i / 3);
+        ok = false;
+        break;
+      }
+    }
+    previous = lod.num_indices;
+    previous_error = lod.error;
+  }
+
+  summary = Test::format("%zu triangles;", buffers.num_indices / 3);
+  for (size_t l = 0; l < buffers.num_lods; ++l) {
+    summary += Test::format(" %u at %.2g%%", buffers.lods[l].num_indices / 3,
+                            buffers.lods[l].error * 100);
+  }
+  return ok;
+}
+
+int main(int argc, char* argv[]) {
+  return Test::run_obj_files(argc, argv, test_file);
+}
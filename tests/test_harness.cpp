@@ -0,0 +1,68 @@
+#include "test_harness.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+
+#include "collada/obj_parser.h"
+
+namespace CS248 {
+namespace Test {
+
+int run_files(int argc, char* argv[], const char* kind, const FileTest& test,
+              int failures) {
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s <%s>\n", argv[0], kind);
+    return 1;
+  }
+
+  for (int i = 1; i < argc; ++i) {
+    std::string summary;
+    if (!report(test(argv[i], summary), argv[i], summary)) failures++;
+  }
+  return failures ? 1 : 0;
+}
+
+int run_obj_files(int argc, char* argv[], const ObjTest& test,
+                  int failures) {
+  return run_files(argc, argv, "objfiles", [&](const char* filename,
+                                                std::string& summary) {
+    ObjFile obj;
+    obj.filename = filename;
+    if (!Collada::ObjParser::read_file(filename, obj.data) ||
+        !Collada::ObjParser::parse(obj.data.data(),
+                                   obj.data.data() + obj.data.size(),
+                                   obj.polymesh)) {
+      fprintf(stderr, "Error: could not load %s\n", filename);
+      return false;
+    }
+    return test(obj, summary);
+  }, failures);
+}
+
+bool report(bool ok, const char* name, const std::string& summary) {
+  if (summary.empty()) {
+    printf("%s %s\n", ok ? "PASS" : "FAIL", name);
+  } else {
+    printf("%s %s (%s)\n", ok ? "PASS" : "FAIL", name, summary.c_str());
+  }
+  return ok;
+}
+
+std::string format(const char* format, ...) {
+  va_list args;
+  va_start(args, format);
+  char buffer[256];
+  int length = vsnprintf(buffer, sizeof(buffer), format, args);
+  va_end(args);
+  if (length < 0) return std::string();
+  if ((size_t)length < sizeof(buffer)) return std::string(buffer, length);
+
+  std::string result(length, '\0');
+  va_start(args, format);
+  vsnprintf(&result[0], length + 1, format, args);
+  va_end(args);
+  return result;
+}
+
+}  // namespace Test
+}  // namespace CS248
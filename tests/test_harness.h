@@ -0,0 +1,48 @@
+#ifndef CS248_TESTS_TEST_HARNESS_H
+#define CS248_TESTS_TEST_HARNESS_H
+
+#include <functional>
+#include <string>
+
+#include "collada/polymesh_info.h"
+
+namespace CS248 {
+namespace Test {
+
+// What every test does with the files named on its command line: runs its
+// checks on each of them and prints one PASS or FAIL line per file. Checks
+// explain failures on stderr and describe what they tested in a summary,
+// which goes in parentheses after the file name.
+
+// An OBJ file, read and parsed.
+struct ObjFile {
+  const char* filename;
+  std::string data;                ///< contents of the file
+  Collada::PolymeshInfo polymesh;  ///< parsed from data
+};
+
+typedef std::function<bool(const char* filename, std::string& summary)>
+    FileTest;
+typedef std::function<bool(const ObjFile& obj, std::string& summary)> ObjTest;
+
+// Runs test on every file in argv and returns main's exit status, which is
+// nonzero without files or if any test failed. kind names the files in the
+// usage message; failures counts checks that failed before.
+int run_files(int argc, char* argv[], const char* kind, const FileTest& test,
+              int failures = 0);
+
+// The same for OBJ files. Files that can't be read or parsed fail.
+int run_obj_files(int argc, char* argv[], const ObjTest& test,
+                  int failures = 0);
+
+// Prints the PASS or FAIL line for name and returns ok.
+bool report(bool ok, const char* name, const std::string& summary = "");
+
+// printf into a string, for summaries.
+std::string format(const char* format, ...)
+    __attribute__((format(printf, 1, 2)));
+
+}  // namespace Test
+}  // namespace CS248
+
+#endif  // CS248_TESTS_TEST_HARNESS_H
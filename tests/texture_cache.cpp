@@ -0,0 +1,196 @@
+#include "CS248/lodepng.h"
+
+#include "block_compressor.h"
+#include "mipmap_builder.h"
+#include "texture_cache.h"
+#include "test_harness.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace CS248;
+
+// Checks that block compression is deterministic across thread counts, stays
+// within an error bound, that box-filtered mip levels are 2x2 averages and
+// normal map levels hold unit normals, and that a compressed, mipmapped
+// texture read back from its cache file is byte-identical.
+
+static const char* kCacheFile = "texture_cache_test.texcache";
+
+static const TextureFormat kFormats[] = {TEXTURE_BC1, TEXTURE_BC3, TEXTURE_BC5};
+static const char* kFormatNames[] = {"BC1", "BC3", "BC5"};
+static const int kChannels[] = {3, 4, 2};
+static const double kMinPsnr[] = {25, 25, 30};  // dB, over stored channels
+
+static double psnr(const std::vector<unsigned char>& a,
+                   const std::vector<unsigned char>& b, int channels) {
+  double squared_error = 0;
+  size_t n = a.size() / 4;
+  for (size_t i = 0; i < n; ++i) {
+    for (int c = 0; c < channels; ++c) {
+      double d = (double)a[4 * i + c] - b[4 * i + c];
+      squared_error += d * d;
+    }
+  }
+  double mse = squared_error / ((double)n * channels);
+  return mse > 0 ? 10 * log10(255.0 * 255.0 / mse) : 99;
+}
+
+static bool test_mipmaps(const char* filename,
+                         const std::vector<unsigned char>& png,
+                         const std::vector<unsigned char>& rgba,
+                         unsigned width, unsigned height) {
+  bool ok = true;
+  std::vector<std::vector<unsigned char> > levels;
+  MipmapBuilder::build(rgba.data(), width, height, MIP_BOX, MIP_LINEAR, levels);
+  if (levels.size() + 1 != MipmapBuilder::num_levels(width, height)) {
+    fprintf(stderr, "  mipmaps: %zu levels\n", levels.size() + 1);
+    return false;
+  }
+  if (width % 2 == 0 && height % 2 == 0) {
+    unsigned w = width / 2;
+    for (size_t i = 0; i < levels[0].size(); ++i) {
+      size_t x = i / 4 % w, y = i / 4 / w, c = i % 4;
+      int sum = 0;
+      for (size_t dy = 0; dy < 2; ++dy) {
+        for (size_t dx = 0; dx < 2; ++dx) {
+          sum += rgba[((2 * y + dy) * width + 2 * x + dx) * 4 + c];
+        }
+      }
+      if (abs(levels[0][i] - sum / 4.0) > 1) {
+        fprintf(stderr, "  mipmaps: box level 1 is not a 2x2 average\n");
+        ok = false;
+        break;
+      }
+    }
+  }
+
+  // every level of a normal map holds unit normals, up to quantization
+  MipmapBuilder::build(rgba.data(), width, height, MIP_KAISER, MIP_NORMAL,
+                       levels);
+  for (size_t l = 0; l < levels.size() && ok; ++l) {
+    for (size_t i = 0; i < levels[l].size(); i += 4) {
+      double length_squared = 0;
+      for (int c = 0; c < 3; ++c) {
+        double n = levels[l][i + c] / 255.0 * 2 - 1;
+        length_squared += n * n;
+      }
+      if (fabs(sqrt(length_squared) - 1) > 0.02) {
+        fprintf(stderr, "  mipmaps: level %zu holds a normal of length %.3f\n",
+                l + 1, sqrt(length_squared));
+        ok = false;
+        break;
+      }
+    }
+  }
+
+  // the whole chain, block-compressed, through the cache
+  TextureImage image;
+  image.width = width;
+  image.height = height;
+  image.num_levels = (unsigned)levels.size() + 1;
+  image.format = TEXTURE_BC5;
+  image.pixels.resize(image.level_offset(image.num_levels));
+  for (unsigned level = 0; level < image.num_levels; ++level) {
+    BlockCompressor::encode(image.format,
+                            level ? levels[level - 1].data() : rgba.data(),
+                            image.level_width(level), image.level_height(level),
+                            &image.pixels[image.level_offset(level)]);
+  }
+  TextureCache::Key key;
+  TextureImage cached;
+  if (!TextureCache::make_key(filename, png, image.format, MIP_KAISER,
+                              MIP_NORMAL, key) ||
+      !TextureCache::store(kCacheFile, key, image) ||
+      !TextureCache::load(kCacheFile, key, cached) ||
+      cached.pixels != image.pixels || cached.num_levels != image.num_levels) {
+    fprintf(stderr, "  mipmaps: cached chain differs\n");
+    ok = false;
+  }
+  TextureCache::Key box = key;
+  box.mip_filter = MIP_BOX;
+  if (TextureCache::load(kCacheFile, box, cached)) {
+    fprintf(stderr, "  mipmaps: chain built with another filter was accepted\n");
+    ok = false;
+  }
+  remove(kCacheFile);
+  return ok;
+}
+
+static bool test_file(const char* filename, std::string& summary) {
+  std::vector<unsigned char> png, rgba;
+  unsigned width, height;
+  lodepng::load_file(png, filename);
+  if (png.empty() || lodepng::decode(rgba, width, height, png)) {
+    fprintf(stderr, "Error: could not decode %s\n", filename);
+    return false;
+  }
+
+  bool ok = true;
+  for (int f = 0; f < 3; ++f) {
+    TextureFormat format = kFormats[f];
+    TextureImage image;
+    image.width = width;
+    image.height = height;
+    image.format = format;
+    image.pixels.resize(BlockCompressor::encoded_size(format, width, height));
+    BlockCompressor::encode(format, rgba.data(), width, height,
+                            image.pixels.data());
+
+    std::vector<unsigned char> serial(image.pixels.size());
+    BlockCompressor::encode(format, rgba.data(), width, height, serial.data(),
+                            1);
+    if (serial != image.pixels) {
+      fprintf(stderr, "  %s: serial and parallel encodes differ\n",
+              kFormatNames[f]);
+      ok = false;
+    }
+
+    std::vector<unsigned char> decoded(rgba.size());
+    BlockCompressor::decode(format, image.pixels.data(), width, height,
+                            decoded.data());
+    double error = psnr(rgba, decoded, kChannels[f]);
+    if (error < kMinPsnr[f]) {
+      fprintf(stderr, "  %s: PSNR %.2f dB is below %.0f dB\n",
+              kFormatNames[f], error, kMinPsnr[f]);
+      ok = false;
+    }
+
+    TextureCache::Key key;
+    if (!TextureCache::make_key(filename, png, format, MIP_NONE, MIP_LINEAR,
+                                key) ||
+        !TextureCache::store(kCacheFile, key, image)) {
+      fprintf(stderr, "Error: could not write %s\n", kCacheFile);
+      return false;
+    }
+    TextureImage cached;
+    if (!TextureCache::load(kCacheFile, key, cached) ||
+        cached.pixels != image.pixels || cached.width != width ||
+        cached.height != height || cached.format != format) {
+      fprintf(stderr, "  %s: cached texture differs\n", kFormatNames[f]);
+      ok = false;
+    }
+
+    // a changed source must not hit the old file
+    TextureCache::Key stale = key;
+    stale.source.hash ^= 1;
+    TextureImage rejected;
+    if (TextureCache::load(kCacheFile, stale, rejected)) {
+      fprintf(stderr, "  %s: stale cache file was accepted\n",
+              kFormatNames[f]);
+      ok = false;
+    }
+    remove(kCacheFile);
+  }
+
+  if (!test_mipmaps(filename, png, rgba, width, height)) ok = false;
+
+  summary = Test::format("%ux%u", width, height);
+  return ok;
+}
+
+int main(int argc, char* argv[]) {
+  return Test::run_files(argc, argv, "pngfiles", test_file);
+}
@@ -0,0 +1,101 @@
+#include "dynamic_scene/mesh_buffers.h"
+#include "dynamic_scene/vertex_format.h"
+#include "test_harness.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+using namespace CS248;
+using namespace CS248::DynamicScene;
+
+// Checks that packing a mesh into the compact vertex format loses no more
+// than its quantization allows, and that half floats round-trip.
+
+static bool test_halves() {
+  for (uint32_t h = 0; h < 0x10000; ++h) {
+    bool nan = (h & 0x7c00) == 0x7c00 && (h & 0x3ff);
+    if (nan) continue;
+    if (VertexFormat::to_half(VertexFormat::from_half(h)) != h) {
+      fprintf(stderr, "  half %04x does not round-trip\n", h);
+      return false;
+    }
+  }
+  bool ok = VertexFormat::to_half(1.0f) == 0x3c00 &&
+            VertexFormat::to_half(-2.0f) == 0xc000 &&
+            VertexFormat::to_half(65504.0f) == 0x7bff &&
+            VertexFormat::to_half(1e6f) == 0x7c00 &&
+            VertexFormat::to_half(1e-9f) == 0;
+  return Test::report(ok, "half floats");
+}
+
+static bool test_file(const Test::ObjFile& obj, std::string& summary) {
+  MeshBuffers buffers;
+  MeshBuffers::build(obj.polymesh, buffers);
+
+  VertexFormat::Layout layout = VertexFormat::layout();
+  std::vector<uint8_t> packed(buffers.num_vertices * layout.stride);
+  VertexFormat::pack(buffers, packed.data());
+
+  float lo[3] = {buffers.bbox_min.x, buffers.bbox_min.y, buffers.bbox_min.z};
+  float hi[3] = {buffers.bbox_max.x, buffers.bbox_max.y, buffers.bbox_max.z};
+  float max_position = 0, max_normal = 0, max_texcoord = 0, max_color = 0;
+  float position_bound = 0;
+  for (int k = 0; k < 3; ++k) {
+    position_bound = std::max(position_bound, (hi[k] - lo[k]) / 65535.0f);
+  }
+
+  for (size_t i = 0; i < buffers.num_vertices; ++i) {
+    const uint8_t* vertex = &packed[i * layout.stride];
+
+    uint16_t q[4];
+    memcpy(q, vertex + layout.position, sizeof(q));
+    const float* p = &buffers.positions[i].x;
+    for (int k = 0; k < 3; ++k) {
+      float position = lo[k] + q[k] / 65535.0f * (hi[k] - lo[k]);
+      max_position = std::max(max_position, fabsf(position - p[k]));
+    }
+
+    int16_t e[2];
+    memcpy(e, vertex + layout.normal, sizeof(e));
+    Vector3Df n = VertexFormat::decode_octahedral(e);
+    const Vector3Df& m = buffers.normals[i];
+    float length = sqrtf(m.x * m.x + m.y * m.y + m.z * m.z);
+    if (length > 0) {
+      float cosine = (n.x * m.x + n.y * m.y + n.z * m.z) / length;
+      max_normal = std::max(max_normal, acosf(std::min(1.0f, cosine)));
+    }
+
+    if (buffers.texcoords) {
+      uint16_t uv[2];
+      memcpy(uv, vertex + layout.texcoord, sizeof(uv));
+      const float* t = &buffers.texcoords[i].x;
+      for (int k = 0; k < 2; ++k) {
+        float error = fabsf(VertexFormat::from_half(uv[k]) - t[k]);
+        max_texcoord = std::max(max_texcoord, error / std::max(fabsf(t[k]), 1.0f));
+      }
+    }
+
+    const uint8_t* color = vertex + layout.diffuse_color;
+    const float* c = &buffers.diffuse_colors[i].x;
+    for (int k = 0; k < 3; ++k) {
+      max_color = std::max(max_color, fabsf(color[k] / 255.0f - c[k]));
+    }
+  }
+
+  bool ok = max_position <= position_bound && max_normal < 1e-3f &&
+            max_texcoord <= 1.0f / 2048 && max_color <= 0.5f / 255 + 1e-6f;
+  summary = Test::format("%zu bytes per vertex; errors: position %g, "
+                         "normal %g rad, texcoord %g, color %g",
+                         layout.stride, max_position, max_normal,
+                         max_texcoord, max_color);
+  return ok;
+}
+
+int main(int argc, char* argv[]) {
+  int failures = test_halves() ? 0 : 1;
+  return Test::run_obj_files(argc, argv, test_file, failures);
+}